@@ -0,0 +1,170 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_ACK_H__
+#define __MESH_ACK_H__
+
+#include "mdf_common.h"
+#include "mwifi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Result of a command on a node, the one byte payload of a
+ *        MESH_PROTO_ACK frame. The correlation id of the command is carried
+ *        in the `custom` field of mwifi_data_type_t, both for the command
+ *        and for its acknowledgement.
+ */
+typedef enum {
+    MESH_ACK_OK = 0,        /**< Command executed */
+    MESH_ACK_FAILED,        /**< Command failed on the node */
+    MESH_ACK_UNSUPPORTED,   /**< Command unknown to the node */
+    MESH_ACK_INVALID,       /**< Command malformed or out of range */
+    MESH_ACK_UNREACHABLE,   /**< Set by the root, the command could not be sent */
+} mesh_ack_result_t;
+
+/**
+ * @brief  Initialize the table of commands awaiting acknowledgements, called once at startup
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t mesh_ack_init();
+
+/**
+ * @brief  Start collecting acknowledgements, called when the device becomes root
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_ack_start();
+
+/**
+ * @brief  Stop collecting acknowledgements, called when the device loses the root role.
+ *         Commands still awaiting acknowledgements are dropped without a completion message.
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_ack_stop();
+
+/**
+ * @brief  Start collecting the acknowledgements of a command, called before it is sent
+ *
+ * @param  id         correlation id of the command, not 0
+ * @param  addrs_list destinations of the command, MWIFI_ADDR_ANY is expanded to the
+ *                    nodes of the routing table but the root, MWIFI_ADDR_ROOT to the root
+ * @param  addrs_num  number of destinations
+ *
+ * @note   Once every node has answered, or CONFIG_MESH_ACK_TIMEOUT_MS after this call,
+ *         a single completion message is published on the ack topic:
+ *         {"id":7,"succeeded":["30aea4000002"],"failed":[{"addr":"30aea4000003","result":2}],"timeout":["30aea4000004"]}
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_INVALID_STATE, not running or the id is already tracked
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t mesh_ack_track(uint32_t id, const uint8_t *addrs_list, size_t addrs_num);
+
+/**
+ * @brief  Record the result of a command on a node
+ *
+ * @param  addr   address of the node, a node that was not a destination is added
+ * @param  id     correlation id of the command
+ * @param  result result on the node
+ *
+ * @note   Results of commands that are no longer tracked, late or repeated
+ *         acknowledgements, are dropped
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mesh_ack_complete(const uint8_t *addr, uint32_t id, mesh_ack_result_t result);
+
+/**
+ * @brief  Complete a command at once, every node that has not answered gets the result
+ *
+ * @param  id     correlation id of the command
+ * @param  result result of the missing nodes, e.g. MESH_ACK_UNREACHABLE when the send failed
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND
+ */
+mdf_err_t mesh_ack_cancel(uint32_t id, mesh_ack_result_t result);
+
+/**
+ * @brief  Complete a command that was not sent to any node, e.g. to a group
+ *         unknown to the root. The completion message has no nodes and the
+ *         result of the command as a whole:
+ *         {"id":7,"result":4,"succeeded":[],"failed":[],"timeout":[]}
+ *
+ * @param  id     correlation id of the command, not 0
+ * @param  result MESH_ACK_INVALID or MESH_ACK_UNREACHABLE
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_INVALID_STATE, MQTT is not connected
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_ack_reject(uint32_t id, mesh_ack_result_t result);
+
+/**
+ * @brief  Record a MESH_PROTO_ACK frame received by the root
+ *
+ * @param  addr address of the node
+ * @param  id   the `custom` field of the frame
+ * @param  data pointer of the frame
+ * @param  size length of the frame
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mesh_ack_handle(const uint8_t *addr, uint32_t id, const uint8_t *data, size_t size);
+
+/**
+ * @brief  Acknowledge a command to the root, called by the node that executed it
+ *
+ * @param  id     the `custom` field of the command, nothing is sent if it is 0
+ * @param  result result of the command
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_ack_send(uint32_t id, mesh_ack_result_t result);
+
+/**
+ * @brief  Get the number of commands awaiting acknowledgements
+ *
+ * @return Number of commands
+ */
+uint32_t mesh_ack_get_pending_num();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_ACK_H__ */
@@ -0,0 +1,456 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_ack.h"
+#include "mesh_proto.h"
+#include "mesh_mqtt_handle.h"
+#include "mesh_static.h"
+
+#define MESH_ACK_PENDING        (0xff)  /**< Result of a node that has not answered yet */
+#define MESH_ACK_NODE_JSON_LEN  (48)    /**< Upper bound of one node in the completion message */
+
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint8_t result;             /**< mesh_ack_result_t, MESH_ACK_PENDING until the node answers */
+} mesh_ack_node_t;
+
+typedef struct {
+    uint32_t id;                /**< 0 marks a free entry */
+    TickType_t deadline;
+    size_t node_num;
+    size_t pending_num;
+    mesh_ack_node_t *nodes;
+} mesh_ack_command_t;
+
+static struct mesh_ack {
+    SemaphoreHandle_t lock;
+    mesh_ack_command_t commands[CONFIG_MESH_ACK_COMMAND_MAX_NUM];
+    bool running;
+    TaskHandle_t task;
+} g_mesh_ack;
+
+MESH_STATIC_MUTEX_DEFINE(ack);
+MESH_STATIC_TASK_DEFINE(ack, 3 * 1024);
+
+static const char *TAG = "mesh_ack";
+
+/**
+ * @brief Find a command, or a free entry with id 0, must be called with the lock held
+ */
+static mesh_ack_command_t *mesh_ack_find(uint32_t id)
+{
+    for (int i = 0; i < CONFIG_MESH_ACK_COMMAND_MAX_NUM; ++i) {
+        if (g_mesh_ack.commands[i].id == id) {
+            return g_mesh_ack.commands + i;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Take a command out of the table so it is published outside the lock
+ */
+static void mesh_ack_detach(mesh_ack_command_t *command, mesh_ack_command_t *detached)
+{
+    *detached = *command;
+    memset(command, 0, sizeof(mesh_ack_command_t));
+}
+
+static bool mesh_ack_append(const mesh_ack_node_t *node, int set, char *buffer, size_t buffer_size, int *size)
+{
+    int node_set = (node->result == MESH_ACK_OK) ? 0 : (node->result == MESH_ACK_PENDING) ? 2 : 1;
+
+    if (node_set != set) {
+        return false;
+    }
+
+    if (set == 1) {
+        *size += snprintf(buffer + *size, buffer_size - *size, "{\"addr\":\"%02x%02x%02x%02x%02x%02x\",\"result\":%d},",
+                          MAC2STR(node->addr), node->result);
+    } else {
+        *size += snprintf(buffer + *size, buffer_size - *size, "\"%02x%02x%02x%02x%02x%02x\",", MAC2STR(node->addr));
+    }
+
+    return true;
+}
+
+/**
+ * @brief Publish the completion message of a command and free it
+ */
+static void mesh_ack_publish(mesh_ack_command_t *command)
+{
+    static const char *const sets[] = {"succeeded", "failed", "timeout"};
+    size_t buffer_size = 64 + command->node_num * MESH_ACK_NODE_JSON_LEN;
+    char *buffer = MDF_MALLOC(buffer_size);
+    int size = 0;
+
+    MDF_ERROR_GOTO(buffer == NULL, EXIT, "Allocate mem failed");
+    MDF_ERROR_GOTO(!mesh_mqtt_is_connect(), EXIT, "MQTT is not connected, drop the completion of command %u", command->id);
+
+    size = snprintf(buffer, buffer_size, "{\"id\":%u", command->id);
+
+    for (int i = 0; i < sizeof(sets) / sizeof(sets[0]); ++i) {
+        bool empty = true;
+        size += snprintf(buffer + size, buffer_size - size, ",\"%s\":[", sets[i]);
+
+        for (int j = 0; j < command->node_num; ++j) {
+            empty &= !mesh_ack_append(command->nodes + j, i, buffer, buffer_size, &size);
+        }
+
+        /**< Overwrite the trailing comma */
+        size -= empty ? 0 : 1;
+        size += snprintf(buffer + size, buffer_size - size, "]");
+    }
+
+    size += snprintf(buffer + size, buffer_size - size, "}");
+
+    MDF_LOGI("Command %u completed, nodes: %d, missing: %d", command->id, command->node_num, command->pending_num);
+
+    mdf_err_t ret = mesh_mqtt_write_ack(buffer, size);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_mqtt_write_ack", mdf_err_to_name(ret));
+
+EXIT:
+    MDF_FREE(buffer);
+    MDF_FREE(command->nodes);
+}
+
+static void mesh_ack_task(void *arg)
+{
+    mesh_ack_command_t expired = {0};
+
+    MDF_LOGI("Mesh ack task is running");
+
+    while (g_mesh_ack.running) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+        for (bool found = true; found && g_mesh_ack.running;) {
+            TickType_t now = xTaskGetTickCount();
+            found = false;
+
+            xSemaphoreTake(g_mesh_ack.lock, portMAX_DELAY);
+
+            for (int i = 0; i < CONFIG_MESH_ACK_COMMAND_MAX_NUM && !found; ++i) {
+                mesh_ack_command_t *command = g_mesh_ack.commands + i;
+
+                if (command->id && (int32_t)(now - command->deadline) >= 0) {
+                    mesh_ack_detach(command, &expired);
+                    found = true;
+                }
+            }
+
+            xSemaphoreGive(g_mesh_ack.lock);
+
+            if (found) {
+                mesh_ack_publish(&expired);
+            }
+        }
+    }
+
+    xSemaphoreTake(g_mesh_ack.lock, portMAX_DELAY);
+
+    for (int i = 0; i < CONFIG_MESH_ACK_COMMAND_MAX_NUM; ++i) {
+        MDF_FREE(g_mesh_ack.commands[i].nodes);
+        g_mesh_ack.commands[i].id = 0;
+    }
+
+    xSemaphoreGive(g_mesh_ack.lock);
+
+    MDF_LOGW("Mesh ack task is exit");
+
+    g_mesh_ack.task = NULL;
+    MESH_STATIC_TASK_EXIT();
+}
+
+mdf_err_t mesh_ack_init()
+{
+    MDF_ERROR_CHECK(g_mesh_ack.lock != NULL, MDF_ERR_INVALID_STATE, "Mesh ack is already initialized");
+
+    g_mesh_ack.lock = MESH_STATIC_MUTEX_CREATE(ack);
+    MDF_ERROR_CHECK(g_mesh_ack.lock == NULL, MDF_ERR_NO_MEM, "Create mutex failed");
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_ack_start()
+{
+    MDF_ERROR_CHECK(g_mesh_ack.lock == NULL, MDF_ERR_INVALID_STATE, "Mesh ack is not initialized");
+    MDF_ERROR_CHECK(g_mesh_ack.running || g_mesh_ack.task, MDF_ERR_INVALID_STATE, "Mesh ack is already running");
+
+    g_mesh_ack.running = true;
+    MESH_STATIC_TASK_CREATE(ack, mesh_ack_task, "mesh_ack",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY - 1, &g_mesh_ack.task);
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_ack_stop()
+{
+    MDF_ERROR_CHECK(!g_mesh_ack.running, MDF_ERR_INVALID_STATE, "Mesh ack has not been started");
+
+    g_mesh_ack.running = false;
+
+    if (g_mesh_ack.task) {
+        xTaskNotifyGive(g_mesh_ack.task);
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Destinations of a command, one entry per node
+ */
+static mesh_ack_node_t *mesh_ack_expand(const uint8_t *addrs_list, size_t addrs_num, size_t *node_num)
+{
+    uint8_t addr_any[] = MWIFI_ADDR_ANY;
+    uint8_t addr_root[] = MWIFI_ADDR_ROOT;
+    uint8_t self[MWIFI_ADDR_LEN] = {0};
+    mesh_addr_t *route_table = NULL;
+    int route_num = 0;
+    size_t max_num = addrs_num;
+
+    esp_wifi_get_mac(ESP_IF_WIFI_STA, self);
+
+    for (int i = 0; i < addrs_num && route_table == NULL; ++i) {
+        if (!memcmp(addrs_list + i * MWIFI_ADDR_LEN, addr_any, MWIFI_ADDR_LEN)) {
+            route_num = esp_mesh_get_routing_table_size();
+            route_table = MDF_CALLOC(route_num ? route_num : 1, sizeof(mesh_addr_t));
+            MDF_ERROR_CHECK(route_table == NULL, NULL, "Allocate mem failed");
+            esp_mesh_get_routing_table(route_table, route_num * sizeof(mesh_addr_t), &route_num);
+            max_num += route_num;
+        }
+    }
+
+    mesh_ack_node_t *nodes = MDF_MALLOC((max_num ? max_num : 1) * sizeof(mesh_ack_node_t));
+    *node_num = 0;
+
+    for (int i = 0; nodes && i < addrs_num + route_num; ++i) {
+        const uint8_t *addr = (i < addrs_num) ? addrs_list + i * MWIFI_ADDR_LEN : route_table[i - addrs_num].addr;
+        int j = 0;
+
+        if (!memcmp(addr, addr_any, MWIFI_ADDR_LEN) || (i >= addrs_num && !memcmp(addr, self, MWIFI_ADDR_LEN))) {
+            continue;
+        }
+
+        addr = memcmp(addr, addr_root, MWIFI_ADDR_LEN) ? addr : self;
+
+        for (j = 0; j < *node_num && memcmp(nodes[j].addr, addr, MWIFI_ADDR_LEN); ++j);
+
+        if (j == *node_num) {
+            memcpy(nodes[j].addr, addr, MWIFI_ADDR_LEN);
+            nodes[j].result = MESH_ACK_PENDING;
+            (*node_num)++;
+        }
+    }
+
+    MDF_FREE(route_table);
+
+    return nodes;
+}
+
+mdf_err_t mesh_ack_track(uint32_t id, const uint8_t *addrs_list, size_t addrs_num)
+{
+    MDF_PARAM_CHECK(id);
+    MDF_PARAM_CHECK(addrs_list);
+    MDF_PARAM_CHECK(addrs_num);
+    MDF_ERROR_CHECK(!g_mesh_ack.running, MDF_ERR_INVALID_STATE, "Mesh ack has not been started");
+
+    mdf_err_t ret = MDF_OK;
+    mesh_ack_command_t evicted = {0};
+    size_t node_num = 0;
+    mesh_ack_node_t *nodes = mesh_ack_expand(addrs_list, addrs_num, &node_num);
+    MDF_ERROR_CHECK(nodes == NULL, MDF_ERR_NO_MEM, "Allocate mem failed");
+
+    xSemaphoreTake(g_mesh_ack.lock, portMAX_DELAY);
+
+    mesh_ack_command_t *command = mesh_ack_find(id);
+
+    if (command != NULL) {
+        MDF_LOGW("Command %u is already awaiting acknowledgements", id);
+        ret = MDF_ERR_INVALID_STATE;
+        goto EXIT;
+    }
+
+    command = mesh_ack_find(0);
+
+    if (command == NULL) {
+        /**< Every command has the same timeout, the oldest expires first */
+        command = g_mesh_ack.commands;
+
+        for (int i = 1; i < CONFIG_MESH_ACK_COMMAND_MAX_NUM; ++i) {
+            if ((int32_t)(g_mesh_ack.commands[i].deadline - command->deadline) < 0) {
+                command = g_mesh_ack.commands + i;
+            }
+        }
+
+        MDF_LOGW("Too many commands awaiting acknowledgements, complete command %u early", command->id);
+        mesh_ack_detach(command, &evicted);
+    }
+
+    command->id          = id;
+    command->deadline    = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_MESH_ACK_TIMEOUT_MS);
+    command->node_num    = node_num;
+    command->pending_num = node_num;
+    command->nodes       = nodes;
+    nodes = NULL;
+
+EXIT:
+    xSemaphoreGive(g_mesh_ack.lock);
+
+    MDF_FREE(nodes);
+
+    if (evicted.id) {
+        mesh_ack_publish(&evicted);
+    }
+
+    return ret;
+}
+
+mdf_err_t mesh_ack_complete(const uint8_t *addr, uint32_t id, mesh_ack_result_t result)
+{
+    MDF_PARAM_CHECK(addr);
+    MDF_PARAM_CHECK(result != MESH_ACK_PENDING);
+
+    mesh_ack_command_t completed = {0};
+    mesh_ack_node_t *node = NULL;
+
+    if (id == 0 || g_mesh_ack.lock == NULL) {
+        return MDF_OK;
+    }
+
+    xSemaphoreTake(g_mesh_ack.lock, portMAX_DELAY);
+
+    mesh_ack_command_t *command = mesh_ack_find(id);
+
+    if (command == NULL) {
+        MDF_LOGD("Command %u is no longer tracked, drop the result of " MACSTR, id, MAC2STR(addr));
+        goto EXIT;
+    }
+
+    for (int i = 0; i < command->node_num && node == NULL; ++i) {
+        node = memcmp(command->nodes[i].addr, addr, MWIFI_ADDR_LEN) ? NULL : command->nodes + i;
+    }
+
+    /**< A node that joined after a broadcast was expanded */
+    if (node == NULL) {
+        mesh_ack_node_t *nodes = MDF_REALLOC(command->nodes, (command->node_num + 1) * sizeof(mesh_ack_node_t));
+        MDF_ERROR_GOTO(nodes == NULL, EXIT, "Allocate mem failed");
+
+        command->nodes = nodes;
+        node = nodes + command->node_num++;
+        memcpy(node->addr, addr, MWIFI_ADDR_LEN);
+        node->result = MESH_ACK_PENDING;
+        command->pending_num++;
+    }
+
+    if (node->result == MESH_ACK_PENDING) {
+        node->result = result;
+        command->pending_num--;
+    }
+
+    if (command->pending_num == 0) {
+        mesh_ack_detach(command, &completed);
+    }
+
+EXIT:
+    xSemaphoreGive(g_mesh_ack.lock);
+
+    if (completed.id) {
+        mesh_ack_publish(&completed);
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_ack_cancel(uint32_t id, mesh_ack_result_t result)
+{
+    MDF_PARAM_CHECK(result != MESH_ACK_PENDING);
+    MDF_ERROR_CHECK(g_mesh_ack.lock == NULL, MDF_ERR_NOT_FOUND, "Mesh ack is not initialized");
+
+    mesh_ack_command_t cancelled = {0};
+
+    xSemaphoreTake(g_mesh_ack.lock, portMAX_DELAY);
+
+    mesh_ack_command_t *command = id ? mesh_ack_find(id) : NULL;
+
+    for (int i = 0; command && i < command->node_num; ++i) {
+        if (command->nodes[i].result == MESH_ACK_PENDING) {
+            command->nodes[i].result = result;
+            command->pending_num--;
+        }
+    }
+
+    if (command) {
+        mesh_ack_detach(command, &cancelled);
+    }
+
+    xSemaphoreGive(g_mesh_ack.lock);
+
+    MDF_ERROR_CHECK(cancelled.id == 0, MDF_ERR_NOT_FOUND, "Command %u is not tracked", id);
+    mesh_ack_publish(&cancelled);
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_ack_reject(uint32_t id, mesh_ack_result_t result)
+{
+    MDF_PARAM_CHECK(id);
+    MDF_PARAM_CHECK(result != MESH_ACK_OK && result != MESH_ACK_PENDING);
+    MDF_ERROR_CHECK(!mesh_mqtt_is_connect(), MDF_ERR_INVALID_STATE, "MQTT is not connected, drop the rejection of command %u", id);
+
+    char buffer[96];
+    int size = snprintf(buffer, sizeof(buffer), "{\"id\":%u,\"result\":%d,\"succeeded\":[],\"failed\":[],\"timeout\":[]}",
+                        id, result);
+
+    MDF_LOGI("Command %u rejected, result: %d", id, result);
+
+    return mesh_mqtt_write_ack(buffer, size);
+}
+
+mdf_err_t mesh_ack_handle(const uint8_t *addr, uint32_t id, const uint8_t *data, size_t size)
+{
+    MDF_PARAM_CHECK(addr);
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(size != 1 || data[0] >= MESH_ACK_UNREACHABLE, MDF_ERR_INVALID_ARG,
+                    "Invalid acknowledgement from " MACSTR ", size: %d", MAC2STR(addr), size);
+
+    return mesh_ack_complete(addr, id, data[0]);
+}
+
+mdf_err_t mesh_ack_send(uint32_t id, mesh_ack_result_t result)
+{
+    mdf_err_t ret = MDF_OK;
+    uint8_t payload = result;
+    mwifi_data_type_t data_type = {.protocol = MESH_PROTO_ACK, .custom = id};
+
+    if (id == 0) {
+        return MDF_OK;
+    }
+
+    ret = mwifi_write(NULL, &data_type, &payload, sizeof(payload), true);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> mwifi_write", mdf_err_to_name(ret));
+
+    return MDF_OK;
+}
+
+uint32_t mesh_ack_get_pending_num()
+{
+    uint32_t num = 0;
+
+    for (int i = 0; i < CONFIG_MESH_ACK_COMMAND_MAX_NUM; ++i) {
+        num += g_mesh_ack.commands[i].id ? 1 : 0;
+    }
+
+    return num;
+}
@@ -0,0 +1,158 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_AGGREGATE_H__
+#define __MESH_AGGREGATE_H__
+
+#include "mdf_common.h"
+#include "mwifi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MESH_AGGREGATE_VERSION (2)
+
+/**
+ * @brief Header of a batch sent with protocol MESH_PROTO_AGGREGATE, followed by
+ *        record_num x {uint8_t addr[6], uint16_t size, uint32_t seq, data}
+ *
+ * @note  Every record keeps the address of the node that produced it, its
+ *        sequence number and its payload unchanged, including the "ts" sample
+ *        time. Version 1 records have no seq, they are still accepted.
+ */
+typedef struct {
+    uint8_t version;    /**< MESH_AGGREGATE_VERSION */
+    uint8_t record_num;
+} __attribute__((packed)) mesh_aggregate_header_t;
+
+/**
+ * @brief Called for every record of a batch
+ *
+ * @param  addr address of the node that produced the record
+ * @param  seq  sequence number given by that node, MESH_SEQ_NONE if unknown
+ * @param  data pointer of the record, not null-terminated
+ * @param  size length of the record
+ * @param  arg  argument passed to mesh_aggregate_foreach
+ */
+typedef void (*mesh_aggregate_record_cb_t)(const uint8_t *addr, uint32_t seq, const char *data, size_t size, void *arg);
+
+/**
+ * @brief  Start the task that forwards batches, called once at startup
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t mesh_aggregate_start();
+
+/**
+ * @brief  Send a reading of this node towards the root
+ *
+ * @param  data pointer of the reading
+ * @param  size length of the reading
+ *
+ * @note   Without CONFIG_MESH_AGGREGATE_ENABLE, or on the root, this is a plain
+ *         mwifi_write() to the root with the sequence number in `custom`
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_aggregate_write(const char *data, size_t size);
+
+/**
+ * @brief  Send a reading produced by another device towards the root, under
+ *         the address of that device
+ *
+ * @param  addr address of the device, e.g. a leaf sensor node
+ * @param  seq  sequence number given by the device
+ * @param  data pointer of the reading
+ * @param  size length of the reading
+ *
+ * @note   Without CONFIG_MESH_AGGREGATE_ENABLE, or on the root, the reading is
+ *         sent as a batch of one record
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_NO_MEM
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_aggregate_inject(const uint8_t *addr, uint32_t seq, const char *data, size_t size);
+
+/**
+ * @brief  Merge a batch received from a child into the batch of this node
+ *
+ * @param  data pointer of the batch
+ * @param  size length of the batch
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mesh_aggregate_handle(const uint8_t *data, size_t size);
+
+/**
+ * @brief  Remember the station MAC of the parent, from the MESH_PROTO_PARENT
+ *         frame it sends to every child that connects to it
+ *
+ * @param  src_addr station MAC of the parent
+ * @param  data     softAP MAC of the parent, compared with the BSSID this node
+ *                  is connected to before a batch is sent to src_addr
+ * @param  size     length of data, MWIFI_ADDR_LEN
+ *
+ * @note   Until its parent announced itself, a node sends its batches to the root
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_aggregate_handle_parent(const uint8_t *src_addr, const uint8_t *data, size_t size);
+
+/**
+ * @brief  Split a batch into its records, used by the root
+ *
+ * @param  data pointer of the batch
+ * @param  size length of the batch
+ * @param  cb   called for every record
+ * @param  arg  passed to cb
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG, the batch is truncated, cb has been called for the valid records
+ */
+mdf_err_t mesh_aggregate_foreach(const uint8_t *data, size_t size, mesh_aggregate_record_cb_t cb, void *arg);
+
+/**
+ * @brief  Get the number of records this node has put into batches
+ *
+ * @return Number of records, own readings and the ones of the subtree
+ */
+uint32_t mesh_aggregate_get_record_num();
+
+/**
+ * @brief  Get the number of batches this node has sent
+ *
+ * @return Number of frames, compare with mesh_aggregate_get_record_num()
+ */
+uint32_t mesh_aggregate_get_frame_num();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_AGGREGATE_H__ */
@@ -0,0 +1,444 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_aggregate.h"
+#include "mesh_metrics.h"
+#include "mesh_proto.h"
+#include "mesh_seq.h"
+#include "mesh_static.h"
+
+#include "esp_event.h"
+
+#define MESH_AGGREGATE_RECORD_HEADER_SIZE    (MWIFI_ADDR_LEN + 2 + 4)
+#define MESH_AGGREGATE_V1_RECORD_HEADER_SIZE (MWIFI_ADDR_LEN + 2)
+
+#define MESH_AGGREGATE_CHILD_QUEUE_LEN       (4)
+
+static struct mesh_aggregate {
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t send_lock;  /**< Held while `spare` is on its way to the parent */
+    QueueHandle_t child_queue;    /**< Children to announce the station MAC to */
+    TaskHandle_t task;
+    uint8_t *batch;    /**< Batch being collected, MWIFI_PAYLOAD_LEN bytes */
+    uint8_t *spare;    /**< Batch being sent, swapped with `batch` by a flush */
+    size_t batch_size;
+    uint32_t record_num;
+    uint32_t frame_num;
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint8_t softap_addr[MWIFI_ADDR_LEN];
+    uint8_t parent_bssid[MWIFI_ADDR_LEN]; /**< Parent that announced `parent_addr` */
+    uint8_t parent_addr[MWIFI_ADDR_LEN];
+} g_mesh_aggregate;
+
+MESH_STATIC_MUTEX_DEFINE(aggregate);
+#ifdef CONFIG_MESH_AGGREGATE_ENABLE
+MESH_STATIC_MUTEX_DEFINE(aggregate_send);
+MESH_STATIC_QUEUE_DEFINE(aggregate_child, MESH_AGGREGATE_CHILD_QUEUE_LEN, MWIFI_ADDR_LEN);
+MESH_STATIC_TASK_DEFINE(aggregate, 3 * 1024);
+MESH_STATIC_BUFFER_DEFINE(aggregate, MWIFI_PAYLOAD_LEN);
+MESH_STATIC_BUFFER_DEFINE(aggregate_spare, MWIFI_PAYLOAD_LEN);
+#endif /**< CONFIG_MESH_AGGREGATE_ENABLE */
+
+static const char *TAG = "mesh_aggregate";
+
+/**
+ * @brief Write a record at `record`, returns its size
+ */
+static size_t mesh_aggregate_put_record(uint8_t *record, const uint8_t *addr, uint32_t seq, const char *data, size_t size)
+{
+    memcpy(record, addr, MWIFI_ADDR_LEN);
+    record[MWIFI_ADDR_LEN] = size & 0xff;
+    record[MWIFI_ADDR_LEN + 1] = size >> 8;
+
+    for (int i = 0; i < 4; ++i) {
+        record[MWIFI_ADDR_LEN + 2 + i] = seq >> (i * 8);
+    }
+
+    memcpy(record + MESH_AGGREGATE_RECORD_HEADER_SIZE, data, size);
+
+    return MESH_AGGREGATE_RECORD_HEADER_SIZE + size;
+}
+
+#ifdef CONFIG_MESH_AGGREGATE_ENABLE
+/**
+ * @brief Look up the station MAC of the parent, ESP-MESH addresses nodes by
+ *        their station MAC but a child only knows the BSSID of its parent.
+ *
+ * @note  The softAP MAC is not derived from the station MAC the same way on
+ *        every chip and MAC configuration, so the parent announces it.
+ */
+static bool mesh_aggregate_get_parent(uint8_t *parent_addr)
+{
+    mesh_addr_t parent = {0};
+    bool found = false;
+
+    if (esp_mesh_get_parent_bssid(&parent) != ESP_OK) {
+        return false;
+    }
+
+    xSemaphoreTake(g_mesh_aggregate.lock, portMAX_DELAY);
+
+    if (!memcmp(parent.addr, g_mesh_aggregate.parent_bssid, MWIFI_ADDR_LEN)) {
+        memcpy(parent_addr, g_mesh_aggregate.parent_addr, MWIFI_ADDR_LEN);
+        found = true;
+    }
+
+    xSemaphoreGive(g_mesh_aggregate.lock);
+
+    return found;
+}
+
+/**
+ * @brief Send a batch to the parent, or to the root from the second layer or
+ *        while the parent has not announced itself yet.
+ */
+static mdf_err_t mesh_aggregate_send(const uint8_t *batch, size_t size)
+{
+    mdf_err_t ret = MDF_OK;
+    uint8_t parent_addr[MWIFI_ADDR_LEN] = {0};
+    mwifi_data_type_t data_type = {.protocol = MESH_PROTO_AGGREGATE};
+
+    if (esp_mesh_is_root() || esp_mesh_get_layer() <= 2 || !mesh_aggregate_get_parent(parent_addr)) {
+        ret = mwifi_write(NULL, &data_type, batch, size, true);
+    } else {
+        ret = mwifi_write(parent_addr, &data_type, batch, size, true);
+    }
+
+    if (ret != MDF_OK) {
+        mesh_metrics_inc(MESH_METRICS_MESH_TX_ERROR);
+        return ret;
+    }
+
+    g_mesh_aggregate.frame_num++;
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Send the current batch. It is swapped with the spare one under the
+ *        lock and sent without it, so that records keep coming in meanwhile.
+ *
+ * @note  Must be called without the lock held
+ */
+static void mesh_aggregate_flush()
+{
+    xSemaphoreTake(g_mesh_aggregate.send_lock, portMAX_DELAY);
+    xSemaphoreTake(g_mesh_aggregate.lock, portMAX_DELAY);
+
+    uint8_t *batch = g_mesh_aggregate.batch;
+    size_t batch_size = g_mesh_aggregate.batch_size;
+    uint8_t record_num = ((mesh_aggregate_header_t *)batch)->record_num;
+
+    g_mesh_aggregate.batch = g_mesh_aggregate.spare;
+    g_mesh_aggregate.spare = batch;
+    ((mesh_aggregate_header_t *)g_mesh_aggregate.batch)->record_num = 0;
+    g_mesh_aggregate.batch_size = sizeof(mesh_aggregate_header_t);
+
+    xSemaphoreGive(g_mesh_aggregate.lock);
+
+    if (record_num > 0) {
+        mdf_err_t ret = mesh_aggregate_send(batch, batch_size);
+
+        if (ret != MDF_OK) {
+            MDF_LOGW("<%s> Drop batch of %d records", mdf_err_to_name(ret), record_num);
+        }
+    }
+
+    xSemaphoreGive(g_mesh_aggregate.send_lock);
+}
+
+/**
+ * @brief Append a record, flushing the batch first if the record does not fit
+ */
+static mdf_err_t mesh_aggregate_append(const uint8_t *addr, uint32_t seq, const char *data, size_t size)
+{
+    mesh_aggregate_header_t *header = NULL;
+    bool first = false;
+
+    if (sizeof(mesh_aggregate_header_t) + MESH_AGGREGATE_RECORD_HEADER_SIZE + size > MWIFI_PAYLOAD_LEN) {
+        return MDF_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(g_mesh_aggregate.lock, portMAX_DELAY);
+
+    /**< Another task may fill the new batch while this one sends the full one */
+    for (header = (mesh_aggregate_header_t *)g_mesh_aggregate.batch;
+            g_mesh_aggregate.batch_size + MESH_AGGREGATE_RECORD_HEADER_SIZE + size > MWIFI_PAYLOAD_LEN
+            || header->record_num == UINT8_MAX;
+            header = (mesh_aggregate_header_t *)g_mesh_aggregate.batch) {
+        xSemaphoreGive(g_mesh_aggregate.lock);
+        mesh_aggregate_flush();
+        xSemaphoreTake(g_mesh_aggregate.lock, portMAX_DELAY);
+    }
+
+    g_mesh_aggregate.batch_size += mesh_aggregate_put_record(g_mesh_aggregate.batch + g_mesh_aggregate.batch_size,
+                                   addr, seq, data, size);
+    g_mesh_aggregate.record_num++;
+    first = header->record_num++ == 0;
+
+    xSemaphoreGive(g_mesh_aggregate.lock);
+
+    /**< The window starts with the first record of a batch */
+    if (first) {
+        xTaskNotifyGive(g_mesh_aggregate.task);
+    }
+
+    return MDF_OK;
+}
+
+static void mesh_aggregate_record_cb(const uint8_t *addr, uint32_t seq, const char *data, size_t size, void *arg)
+{
+    mdf_err_t ret = mesh_aggregate_append(addr, seq, data, size);
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> Drop record of " MACSTR, mdf_err_to_name(ret), MAC2STR(addr));
+    }
+}
+
+static void mesh_aggregate_child_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    mesh_event_child_connected_t *child = (mesh_event_child_connected_t *)event_data;
+
+    if (xQueueSend(g_mesh_aggregate.child_queue, child->mac, 0) != pdTRUE) {
+        MDF_LOGW("Child queue is full, " MACSTR " sends to the root", MAC2STR(child->mac));
+        return;
+    }
+
+    xTaskNotifyGive(g_mesh_aggregate.task);
+}
+
+/**
+ * @brief Tell the children that connected since the last call the station MAC
+ *        of this node, so that they can send their batches to it
+ */
+static void mesh_aggregate_announce()
+{
+    uint8_t child_addr[MWIFI_ADDR_LEN] = {0};
+    mwifi_data_type_t data_type = {.protocol = MESH_PROTO_PARENT};
+
+    while (xQueueReceive(g_mesh_aggregate.child_queue, child_addr, 0) == pdTRUE) {
+        if (esp_mesh_is_root()) {
+            continue;
+        }
+
+        mdf_err_t ret = mwifi_write(child_addr, &data_type, g_mesh_aggregate.softap_addr, MWIFI_ADDR_LEN, true);
+
+        if (ret != MDF_OK) {
+            mesh_metrics_inc(MESH_METRICS_MESH_TX_ERROR);
+            MDF_LOGW("<%s> Announce to " MACSTR, mdf_err_to_name(ret), MAC2STR(child_addr));
+        }
+    }
+}
+
+static void mesh_aggregate_task(void *arg)
+{
+    MDF_LOGI("Mesh aggregate task is running");
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        mesh_aggregate_announce();
+
+        xSemaphoreTake(g_mesh_aggregate.lock, portMAX_DELAY);
+        bool empty = ((mesh_aggregate_header_t *)g_mesh_aggregate.batch)->record_num == 0;
+        xSemaphoreGive(g_mesh_aggregate.lock);
+
+        /**< Woken up by a child that connected */
+        if (empty) {
+            continue;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_MESH_AGGREGATE_WINDOW_MS));
+
+        /**< A batch flushed early because it was full restarted the window */
+        ulTaskNotifyTake(pdTRUE, 0);
+
+        if (mwifi_is_connected()) {
+            mesh_aggregate_flush();
+        }
+
+        mesh_aggregate_announce();
+    }
+
+    MESH_STATIC_TASK_EXIT();
+}
+#endif /**< CONFIG_MESH_AGGREGATE_ENABLE */
+
+mdf_err_t mesh_aggregate_start()
+{
+    MDF_ERROR_CHECK(g_mesh_aggregate.lock != NULL, MDF_ERR_INVALID_STATE, "Mesh aggregate is already running");
+
+    MDF_ERROR_ASSERT(esp_read_mac(g_mesh_aggregate.addr, ESP_MAC_WIFI_STA));
+    g_mesh_aggregate.lock = MESH_STATIC_MUTEX_CREATE(aggregate);
+    MDF_ERROR_CHECK(g_mesh_aggregate.lock == NULL, MDF_ERR_NO_MEM, "Create mutex failed");
+
+#ifdef CONFIG_MESH_AGGREGATE_ENABLE
+    MDF_ERROR_ASSERT(esp_read_mac(g_mesh_aggregate.softap_addr, ESP_MAC_WIFI_SOFTAP));
+    g_mesh_aggregate.send_lock = MESH_STATIC_MUTEX_CREATE(aggregate_send);
+    MDF_ERROR_CHECK(g_mesh_aggregate.send_lock == NULL, MDF_ERR_NO_MEM, "Create mutex failed");
+    g_mesh_aggregate.child_queue = MESH_STATIC_QUEUE_CREATE(aggregate_child, MESH_AGGREGATE_CHILD_QUEUE_LEN, MWIFI_ADDR_LEN);
+    MDF_ERROR_CHECK(g_mesh_aggregate.child_queue == NULL, MDF_ERR_NO_MEM, "Create queue failed");
+
+    g_mesh_aggregate.batch = MESH_STATIC_MALLOC(aggregate, MWIFI_PAYLOAD_LEN);
+    g_mesh_aggregate.spare = MESH_STATIC_MALLOC(aggregate_spare, MWIFI_PAYLOAD_LEN);
+    MDF_ERROR_CHECK(g_mesh_aggregate.batch == NULL || g_mesh_aggregate.spare == NULL,
+                    MDF_ERR_NO_MEM, "Allocate mem failed");
+
+    ((mesh_aggregate_header_t *)g_mesh_aggregate.batch)->version = MESH_AGGREGATE_VERSION;
+    ((mesh_aggregate_header_t *)g_mesh_aggregate.spare)->version = MESH_AGGREGATE_VERSION;
+    g_mesh_aggregate.batch_size = sizeof(mesh_aggregate_header_t);
+
+    MESH_STATIC_TASK_CREATE(aggregate, mesh_aggregate_task, "mesh_aggregate",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, &g_mesh_aggregate.task);
+
+    mdf_err_t ret = esp_event_handler_register(MESH_EVENT, MESH_EVENT_CHILD_CONNECTED,
+                    mesh_aggregate_child_event_handler, NULL);
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_event_handler_register", mdf_err_to_name(ret));
+
+    MDF_LOGI("Aggregation window: %dms", CONFIG_MESH_AGGREGATE_WINDOW_MS);
+#endif /**< CONFIG_MESH_AGGREGATE_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_aggregate_write(const char *data, size_t size)
+{
+    MDF_PARAM_CHECK(data);
+
+    mwifi_data_type_t data_type = {.custom = mesh_seq_next()};
+
+#ifdef CONFIG_MESH_AGGREGATE_ENABLE
+    if (g_mesh_aggregate.batch != NULL && !esp_mesh_is_root()
+            && mesh_aggregate_append(g_mesh_aggregate.addr, data_type.custom, data, size) == MDF_OK) {
+        return MDF_OK;
+    }
+#endif /**< CONFIG_MESH_AGGREGATE_ENABLE */
+
+    mdf_err_t ret = mwifi_write(NULL, &data_type, data, size, true);
+
+    if (ret != MDF_OK) {
+        mesh_metrics_inc(MESH_METRICS_MESH_TX_ERROR);
+    }
+
+    return ret;
+}
+
+mdf_err_t mesh_aggregate_inject(const uint8_t *addr, uint32_t seq, const char *data, size_t size)
+{
+    MDF_PARAM_CHECK(addr);
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(sizeof(mesh_aggregate_header_t) + MESH_AGGREGATE_RECORD_HEADER_SIZE + size > MWIFI_PAYLOAD_LEN,
+                    MDF_ERR_INVALID_ARG, "Record is too long, size: %d", size);
+
+#ifdef CONFIG_MESH_AGGREGATE_ENABLE
+    if (g_mesh_aggregate.batch != NULL && !esp_mesh_is_root()) {
+        return mesh_aggregate_append(addr, seq, data, size);
+    }
+#endif /**< CONFIG_MESH_AGGREGATE_ENABLE */
+
+    /**< A batch of one record, the root takes the address from the record */
+    size_t batch_size = sizeof(mesh_aggregate_header_t) + MESH_AGGREGATE_RECORD_HEADER_SIZE + size;
+    uint8_t *batch = MDF_MALLOC(batch_size);
+    MDF_ERROR_CHECK(batch == NULL, MDF_ERR_NO_MEM, "Allocate mem failed");
+
+    mesh_aggregate_header_t header = {.version = MESH_AGGREGATE_VERSION, .record_num = 1};
+    mwifi_data_type_t data_type = {.protocol = MESH_PROTO_AGGREGATE};
+
+    memcpy(batch, &header, sizeof(header));
+    mesh_aggregate_put_record(batch + sizeof(header), addr, seq, data, size);
+
+    mdf_err_t ret = mwifi_write(NULL, &data_type, batch, batch_size, true);
+
+    if (ret != MDF_OK) {
+        mesh_metrics_inc(MESH_METRICS_MESH_TX_ERROR);
+    }
+
+    MDF_FREE(batch);
+
+    return ret;
+}
+
+mdf_err_t mesh_aggregate_handle(const uint8_t *data, size_t size)
+{
+#ifdef CONFIG_MESH_AGGREGATE_ENABLE
+    MDF_ERROR_CHECK(g_mesh_aggregate.batch == NULL, MDF_ERR_INVALID_STATE, "Mesh aggregate is not running");
+
+    return mesh_aggregate_foreach(data, size, mesh_aggregate_record_cb, NULL);
+#else
+    return MDF_ERR_NOT_SUPPORTED;
+#endif /**< CONFIG_MESH_AGGREGATE_ENABLE */
+}
+
+mdf_err_t mesh_aggregate_handle_parent(const uint8_t *src_addr, const uint8_t *data, size_t size)
+{
+    MDF_PARAM_CHECK(src_addr);
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(size != MWIFI_ADDR_LEN, MDF_ERR_INVALID_ARG, "Invalid announce, size: %d", size);
+    MDF_ERROR_CHECK(g_mesh_aggregate.lock == NULL, MDF_ERR_INVALID_STATE, "Mesh aggregate is not running");
+
+    xSemaphoreTake(g_mesh_aggregate.lock, portMAX_DELAY);
+    memcpy(g_mesh_aggregate.parent_bssid, data, MWIFI_ADDR_LEN);
+    memcpy(g_mesh_aggregate.parent_addr, src_addr, MWIFI_ADDR_LEN);
+    xSemaphoreGive(g_mesh_aggregate.lock);
+
+    MDF_LOGD("Parent " MACSTR " is " MACSTR, MAC2STR(data), MAC2STR(src_addr));
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_aggregate_foreach(const uint8_t *data, size_t size, mesh_aggregate_record_cb_t cb, void *arg)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_PARAM_CHECK(cb);
+    MDF_ERROR_CHECK(size < sizeof(mesh_aggregate_header_t), MDF_ERR_INVALID_ARG, "Batch is too short, size: %d", size);
+
+    mesh_aggregate_header_t header = {0};
+    size_t offset = sizeof(mesh_aggregate_header_t);
+
+    memcpy(&header, data, sizeof(mesh_aggregate_header_t));
+    MDF_ERROR_CHECK(header.version != MESH_AGGREGATE_VERSION && header.version != 1, MDF_ERR_INVALID_ARG,
+                    "Unsupported batch version: %d", header.version);
+
+    /**< Batches of relays that have not been upgraded yet carry no sequence numbers */
+    size_t header_size = header.version == 1 ? MESH_AGGREGATE_V1_RECORD_HEADER_SIZE : MESH_AGGREGATE_RECORD_HEADER_SIZE;
+
+    for (int i = 0; i < header.record_num; ++i) {
+        MDF_ERROR_CHECK(offset + header_size > size, MDF_ERR_INVALID_ARG, "Record is truncated");
+
+        const uint8_t *record = data + offset;
+        size_t record_size = record[MWIFI_ADDR_LEN] | record[MWIFI_ADDR_LEN + 1] << 8;
+        uint32_t seq = MESH_SEQ_NONE;
+        offset += header_size;
+
+        MDF_ERROR_CHECK(offset + record_size > size, MDF_ERR_INVALID_ARG, "Record is truncated");
+
+        for (int j = 0; j < 4 && header.version != 1; ++j) {
+            seq |= (uint32_t)record[MWIFI_ADDR_LEN + 2 + j] << (j * 8);
+        }
+
+        cb(record, seq, (const char *)data + offset, record_size, arg);
+        offset += record_size;
+    }
+
+    return MDF_OK;
+}
+
+uint32_t mesh_aggregate_get_record_num()
+{
+    return g_mesh_aggregate.record_num;
+}
+
+uint32_t mesh_aggregate_get_frame_num()
+{
+    return g_mesh_aggregate.frame_num;
+}
@@ -0,0 +1,125 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_COMMAND_H__
+#define __MESH_COMMAND_H__
+
+#include "mdf_common.h"
+#include "mesh_ack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Opcodes of the commands every node understands, applications add
+ *        their own from MESH_COMMAND_USER on
+ */
+typedef enum {
+    MESH_COMMAND_RESTART    = 0x01, /**< No argument */
+    MESH_COMMAND_RELAY_SET  = 0x02, /**< uint8_t state, 0 off, 1 on */
+    MESH_COMMAND_CONFIG_SET = 0x03, /**< JSON object, the same as a node_config_update() */
+    MESH_COMMAND_SAMPLE_NOW = 0x04, /**< No argument */
+    MESH_COMMAND_BURST      = 0x05, /**< uint16_t interval_s, uint16_t duration_s, 0 ends the burst */
+    MESH_COMMAND_LOG_LEVEL  = 0x06, /**< uint8_t esp_log_level_t, then the module name, "*" for every module */
+    MESH_COMMAND_USER       = 0x80,
+} mesh_command_opcode_t;
+
+/**
+ * @brief Header of a command in a MESH_PROTO_COMMAND frame. A frame holds one
+ *        or more commands, each followed by exactly `size` bytes of arguments.
+ *        Integers are little endian.
+ */
+typedef struct {
+    uint8_t opcode;   /**< mesh_command_opcode_t */
+    uint16_t size;    /**< Length of the arguments */
+} __attribute__((packed)) mesh_command_header_t;
+
+/**
+ * @brief  Handler of a command
+ *
+ * @param  args pointer of the arguments inside the received frame, valid until the
+ *              handler returns and not null-terminated
+ * @param  size length of the arguments, within the bounds it was registered with
+ *
+ * @return result reported to the root
+ */
+typedef mesh_ack_result_t (*mesh_command_handler_t)(const uint8_t *args, size_t size);
+
+/**
+ * @brief Entry of the command table
+ */
+typedef struct {
+    uint8_t opcode;
+    uint16_t min_size;                /**< Shorter arguments are rejected with MESH_ACK_INVALID */
+    uint16_t max_size;                /**< Longer arguments are rejected with MESH_ACK_INVALID */
+    mesh_command_handler_t handler;
+} mesh_command_t;
+
+/**
+ * @brief  Register the handler of an opcode, replacing any previous one
+ *
+ * @param  command entry of the command table, copied
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_NO_MEM, CONFIG_MESH_COMMAND_MAX_NUM commands are registered
+ */
+mdf_err_t mesh_command_register(const mesh_command_t *command);
+
+/**
+ * @brief  Execute one command
+ *
+ * @param  opcode opcode of the command
+ * @param  args   pointer of the arguments
+ * @param  size   length of the arguments
+ *
+ * @return result of the handler, MESH_ACK_UNSUPPORTED for an unknown opcode
+ */
+mesh_ack_result_t mesh_command_execute(uint8_t opcode, const uint8_t *args, size_t size);
+
+/**
+ * @brief  Execute the commands of a MESH_PROTO_COMMAND frame in order
+ *
+ * @param  data pointer of the frame
+ * @param  size length of the frame
+ *
+ * @note   Execution stops at the first command that does not succeed, a
+ *         truncated frame is rejected before any command is executed
+ *
+ * @return MESH_ACK_OK, or the result of the first command that did not succeed
+ */
+mesh_ack_result_t mesh_command_dispatch(const uint8_t *data, size_t size);
+
+/**
+ * @brief  Append a command to a frame
+ *
+ * @param  buffer      frame being built
+ * @param  buffer_size size of the buffer
+ * @param  offset      length of the frame so far
+ * @param  opcode      opcode of the command
+ * @param  args        pointer of the arguments, may be NULL if size is 0
+ * @param  size        length of the arguments
+ *
+ * @return Length of the frame with the command, 0 if the buffer is too small
+ */
+size_t mesh_command_encode(uint8_t *buffer, size_t buffer_size, size_t offset,
+                           uint8_t opcode, const void *args, size_t size);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_COMMAND_H__ */
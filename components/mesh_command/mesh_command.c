@@ -0,0 +1,132 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_command.h"
+
+static struct mesh_command {
+    size_t num;
+    mesh_command_t table[CONFIG_MESH_COMMAND_MAX_NUM];
+} g_mesh_command;
+
+static const char *TAG = "mesh_command";
+
+static const mesh_command_t *mesh_command_find(uint8_t opcode)
+{
+    for (size_t i = 0; i < g_mesh_command.num; ++i) {
+        if (g_mesh_command.table[i].opcode == opcode) {
+            return g_mesh_command.table + i;
+        }
+    }
+
+    return NULL;
+}
+
+mdf_err_t mesh_command_register(const mesh_command_t *command)
+{
+    MDF_PARAM_CHECK(command);
+    MDF_PARAM_CHECK(command->handler);
+    MDF_PARAM_CHECK(command->min_size <= command->max_size);
+
+    mesh_command_t *entry = (mesh_command_t *)mesh_command_find(command->opcode);
+
+    if (entry == NULL) {
+        MDF_ERROR_CHECK(g_mesh_command.num == CONFIG_MESH_COMMAND_MAX_NUM, MDF_ERR_NO_MEM,
+                        "Too many commands, opcode: 0x%02x", command->opcode);
+        entry = g_mesh_command.table + g_mesh_command.num++;
+    }
+
+    *entry = *command;
+
+    return MDF_OK;
+}
+
+mesh_ack_result_t mesh_command_execute(uint8_t opcode, const uint8_t *args, size_t size)
+{
+    const mesh_command_t *command = mesh_command_find(opcode);
+
+    if (command == NULL) {
+        MDF_LOGW("Unsupported command, opcode: 0x%02x", opcode);
+        return MESH_ACK_UNSUPPORTED;
+    }
+
+    if (size < command->min_size || size > command->max_size) {
+        MDF_LOGW("Invalid arguments of command 0x%02x, size: %d", opcode, size);
+        return MESH_ACK_INVALID;
+    }
+
+    MDF_LOGD("Execute command 0x%02x, size: %d", opcode, size);
+
+    return command->handler(args, size);
+}
+
+/**
+ * @brief Length of the command at the start of data, 0 if it is truncated
+ */
+static size_t mesh_command_next(const uint8_t *data, size_t size, mesh_command_header_t *header)
+{
+    if (size < sizeof(mesh_command_header_t)) {
+        return 0;
+    }
+
+    header->opcode = data[0];
+    header->size = data[1] | data[2] << 8;
+
+    return (size - sizeof(mesh_command_header_t) < header->size) ? 0 : sizeof(mesh_command_header_t) + header->size;
+}
+
+mesh_ack_result_t mesh_command_dispatch(const uint8_t *data, size_t size)
+{
+    mesh_command_header_t header;
+    size_t command_size = 0;
+
+    if (data == NULL || size == 0) {
+        return MESH_ACK_INVALID;
+    }
+
+    /**< Validate the framing first, nothing runs if the frame is truncated */
+    for (size_t offset = 0; offset < size; offset += command_size) {
+        command_size = mesh_command_next(data + offset, size - offset, &header);
+        MDF_ERROR_CHECK(command_size == 0, MESH_ACK_INVALID, "Command frame is truncated, size: %d", size);
+    }
+
+    for (size_t offset = 0; offset < size; offset += command_size) {
+        command_size = mesh_command_next(data + offset, size - offset, &header);
+        mesh_ack_result_t result = mesh_command_execute(header.opcode, data + offset + sizeof(mesh_command_header_t), header.size);
+
+        if (result != MESH_ACK_OK) {
+            return result;
+        }
+    }
+
+    return MESH_ACK_OK;
+}
+
+size_t mesh_command_encode(uint8_t *buffer, size_t buffer_size, size_t offset,
+                           uint8_t opcode, const void *args, size_t size)
+{
+    if (buffer == NULL || (size && args == NULL) || size > UINT16_MAX || offset > buffer_size
+            || buffer_size - offset < sizeof(mesh_command_header_t) + size) {
+        return 0;
+    }
+
+    buffer[offset] = opcode;
+    buffer[offset + 1] = size & 0xff;
+    buffer[offset + 2] = size >> 8;
+
+    if (size) {
+        memcpy(buffer + offset + sizeof(mesh_command_header_t), args, size);
+    }
+
+    return offset + sizeof(mesh_command_header_t) + size;
+}
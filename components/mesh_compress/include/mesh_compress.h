@@ -0,0 +1,142 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_COMPRESS_H__
+#define __MESH_COMPRESS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief LZ77 codec with a static dictionary of our telemetry keys.
+ *
+ *        Stream format:
+ *          <dictionary version>
+ *          { <flags> <item> x 8 } ...
+ *
+ *        Bit n of flags (LSB first) describes item n: 0 is a literal byte,
+ *        1 a little endian 16 bit match, (offset - 1) << 6 | (length - 3).
+ *        Offsets reach back into the dictionary, which precedes the data.
+ *        The stream ends with the input, a trailing group may be partial.
+ *
+ * @note  The code has no platform dependencies and is shared with the host
+ *        tools in tools/mesh_compress.
+ */
+#define MESH_COMPRESS_DICT_VERSION (1)
+
+#define MESH_COMPRESS_RING_SIZE    (1024)
+#define MESH_COMPRESS_HASH_SIZE    (256)
+#define MESH_COMPRESS_MIN_MATCH    (3)
+#define MESH_COMPRESS_MAX_MATCH    (66)
+#define MESH_COMPRESS_MAX_OFFSET   (MESH_COMPRESS_RING_SIZE - MESH_COMPRESS_MAX_MATCH)
+
+/**
+ * @brief Upper bound of the compressed size of `size` bytes
+ */
+#define MESH_COMPRESS_BOUND(size)  (1 + (size) + ((size) + 7) / 8)
+
+/**
+ * @brief Receives compressed output, returns false to abort
+ */
+typedef bool (*mesh_compress_write_cb_t)(const uint8_t *data, size_t size, void *arg);
+
+/**
+ * @brief Compressor state, about 1.6 KB regardless of the message size
+ */
+typedef struct {
+    uint8_t ring[MESH_COMPRESS_RING_SIZE];  /**< History, dictionary included, and lookahead */
+    uint16_t head[MESH_COMPRESS_HASH_SIZE]; /**< Latest position of every 3 byte hash */
+    uint32_t pos;                           /**< Position of the next byte to encode */
+    uint32_t in_pos;                        /**< Position of the next input byte */
+    uint8_t group[1 + 8 * 2];               /**< Flags and items not written yet */
+    uint8_t group_len;
+    uint8_t group_items;
+    bool failed;
+    mesh_compress_write_cb_t write_cb;
+    void *arg;
+} mesh_compress_t;
+
+/**
+ * @brief  Start a compressed stream
+ *
+ * @param  ctx      compressor state
+ * @param  write_cb called with the compressed output as it becomes available
+ * @param  arg      passed to write_cb
+ *
+ * @return
+ *     - true
+ *     - false, write_cb failed
+ */
+bool mesh_compress_init(mesh_compress_t *ctx, mesh_compress_write_cb_t write_cb, void *arg);
+
+/**
+ * @brief  Feed input, can be called any number of times
+ *
+ * @param  ctx  compressor state
+ * @param  data pointer of the input
+ * @param  size length of the input
+ *
+ * @return
+ *     - true
+ *     - false, write_cb failed
+ */
+bool mesh_compress_update(mesh_compress_t *ctx, const void *data, size_t size);
+
+/**
+ * @brief  Encode the remaining input and flush the output
+ *
+ * @param  ctx compressor state
+ *
+ * @return
+ *     - true
+ *     - false, write_cb failed
+ */
+bool mesh_compress_finish(mesh_compress_t *ctx);
+
+/**
+ * @brief  Compress a buffer in one call
+ *
+ * @param  ctx      compressor state, used as scratch memory
+ * @param  src      pointer of the input
+ * @param  src_size length of the input
+ * @param  dst      pointer of the output, MESH_COMPRESS_BOUND(src_size) is always enough
+ * @param  dst_size length of the output buffer
+ *
+ * @return Length of the compressed data, 0 if dst is too small
+ */
+size_t mesh_compress_buffer(mesh_compress_t *ctx, const void *src, size_t src_size, void *dst, size_t dst_size);
+
+/**
+ * @brief  Decompress a stream produced by the compressor
+ *
+ * @param  src      pointer of the compressed data
+ * @param  src_size length of the compressed data
+ * @param  dst      pointer of the output
+ * @param  dst_size length of the output buffer
+ *
+ * @return Length of the decompressed data, -1 if the stream is corrupt,
+ *         uses another dictionary version or does not fit into dst
+ */
+int mesh_decompress_buffer(const void *src, size_t src_size, void *dst, size_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_COMPRESS_H__ */
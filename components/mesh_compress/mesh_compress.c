@@ -0,0 +1,233 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include "mesh_compress.h"
+
+#define MESH_COMPRESS_RING_MASK (MESH_COMPRESS_RING_SIZE - 1)
+
+/**
+ * @brief Dictionary version 1, fragments of the messages the root publishes.
+ *        Fragments used most often are placed last so they get the shortest
+ *        offsets. Changing the content requires a new MESH_COMPRESS_DICT_VERSION.
+ */
+static const char g_mesh_compress_dict[] =
+    "\"string\"\"bytes\""
+    "\"up\":\"heap\":[\"cnt\":[\"g\":{\"mqtt_q\":\"inflight\":\"task\":[[\""
+    "{\"type\":\"heartbeat\", \"self\": \"\", \"parent\":\"\",\"layer\":"
+    "\"version\":\"0.0.1\",\"Temp\":\"\",\"Humi\":\"\",\"sensor_light\":\"\",\"ts\":17"
+    "{\"addr\":\"\",\"type\":\"json\",\"data\":{";
+
+#define MESH_COMPRESS_DICT_SIZE (sizeof(g_mesh_compress_dict) - 1)
+
+_Static_assert(MESH_COMPRESS_DICT_SIZE <= MESH_COMPRESS_MAX_OFFSET, "Dictionary does not fit into the window");
+_Static_assert((MESH_COMPRESS_RING_SIZE & MESH_COMPRESS_RING_MASK) == 0, "Ring size must be a power of two");
+
+static inline uint8_t mesh_compress_hash(const uint8_t *ring, uint32_t pos)
+{
+    uint32_t value = ring[pos & MESH_COMPRESS_RING_MASK]
+                     | ring[(pos + 1) & MESH_COMPRESS_RING_MASK] << 8
+                     | ring[(pos + 2) & MESH_COMPRESS_RING_MASK] << 16;
+
+    return (value * 2654435761U) >> 24;
+}
+
+static bool mesh_compress_flush(mesh_compress_t *ctx)
+{
+    if (ctx->group_items && !ctx->failed) {
+        ctx->failed = !ctx->write_cb(ctx->group, ctx->group_len, ctx->arg);
+    }
+
+    ctx->group[0]    = 0;
+    ctx->group_len   = 1;
+    ctx->group_items = 0;
+
+    return !ctx->failed;
+}
+
+/**
+ * @brief Encode one literal or match at ctx->pos. All bytes up to ctx->in_pos
+ *        are in the ring, at most MESH_COMPRESS_MAX_MATCH of them not encoded.
+ */
+static void mesh_compress_step(mesh_compress_t *ctx)
+{
+    uint32_t avail = ctx->in_pos - ctx->pos;
+    uint32_t length = 0;
+    uint16_t offset = 0;
+
+    if (avail >= MESH_COMPRESS_MIN_MATCH) {
+        uint8_t hash = mesh_compress_hash(ctx->ring, ctx->pos);
+        offset = (uint16_t)ctx->pos - ctx->head[hash];
+        ctx->head[hash] = (uint16_t)ctx->pos;
+
+        /**< The candidate is only a hint, every byte is compared */
+        if (offset > 0 && offset <= MESH_COMPRESS_MAX_OFFSET && offset <= ctx->pos) {
+            uint32_t max = avail < MESH_COMPRESS_MAX_MATCH ? avail : MESH_COMPRESS_MAX_MATCH;
+
+            while (length < max && ctx->ring[(ctx->pos - offset + length) & MESH_COMPRESS_RING_MASK]
+                    == ctx->ring[(ctx->pos + length) & MESH_COMPRESS_RING_MASK]) {
+                length++;
+            }
+        }
+    }
+
+    if (length >= MESH_COMPRESS_MIN_MATCH) {
+        uint16_t item = (offset - 1) << 6 | (length - MESH_COMPRESS_MIN_MATCH);
+
+        ctx->group[0] |= 1 << ctx->group_items;
+        ctx->group[ctx->group_len++] = item & 0xff;
+        ctx->group[ctx->group_len++] = item >> 8;
+
+        for (uint32_t i = 1; i < length && ctx->pos + i + MESH_COMPRESS_MIN_MATCH <= ctx->in_pos; ++i) {
+            ctx->head[mesh_compress_hash(ctx->ring, ctx->pos + i)] = (uint16_t)(ctx->pos + i);
+        }
+
+        ctx->pos += length;
+    } else {
+        ctx->group[ctx->group_len++] = ctx->ring[ctx->pos & MESH_COMPRESS_RING_MASK];
+        ctx->pos++;
+    }
+
+    if (++ctx->group_items == 8) {
+        mesh_compress_flush(ctx);
+    }
+}
+
+bool mesh_compress_init(mesh_compress_t *ctx, mesh_compress_write_cb_t write_cb, void *arg)
+{
+    const uint8_t version = MESH_COMPRESS_DICT_VERSION;
+
+    memset(ctx->head, 0, sizeof(ctx->head));
+    memcpy(ctx->ring, g_mesh_compress_dict, MESH_COMPRESS_DICT_SIZE);
+
+    for (uint32_t i = 0; i + MESH_COMPRESS_MIN_MATCH <= MESH_COMPRESS_DICT_SIZE; ++i) {
+        ctx->head[mesh_compress_hash(ctx->ring, i)] = i;
+    }
+
+    ctx->pos      = MESH_COMPRESS_DICT_SIZE;
+    ctx->in_pos   = MESH_COMPRESS_DICT_SIZE;
+    ctx->write_cb = write_cb;
+    ctx->arg      = arg;
+    ctx->failed   = !write_cb(&version, sizeof(version), arg);
+
+    return mesh_compress_flush(ctx);
+}
+
+bool mesh_compress_update(mesh_compress_t *ctx, const void *data, size_t size)
+{
+    const uint8_t *src = data;
+
+    for (size_t i = 0; i < size && !ctx->failed; ++i) {
+        /**< Keep the history the next match can refer to */
+        while (ctx->in_pos - ctx->pos >= MESH_COMPRESS_MAX_MATCH) {
+            mesh_compress_step(ctx);
+        }
+
+        ctx->ring[ctx->in_pos++ & MESH_COMPRESS_RING_MASK] = src[i];
+    }
+
+    return !ctx->failed;
+}
+
+bool mesh_compress_finish(mesh_compress_t *ctx)
+{
+    while (ctx->pos < ctx->in_pos && !ctx->failed) {
+        mesh_compress_step(ctx);
+    }
+
+    return mesh_compress_flush(ctx);
+}
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t len;
+} mesh_compress_buffer_t;
+
+static bool mesh_compress_buffer_write(const uint8_t *data, size_t size, void *arg)
+{
+    mesh_compress_buffer_t *buffer = arg;
+
+    if (buffer->size - buffer->len < size) {
+        return false;
+    }
+
+    memcpy(buffer->data + buffer->len, data, size);
+    buffer->len += size;
+    return true;
+}
+
+size_t mesh_compress_buffer(mesh_compress_t *ctx, const void *src, size_t src_size, void *dst, size_t dst_size)
+{
+    mesh_compress_buffer_t buffer = {
+        .data = dst,
+        .size = dst_size,
+    };
+
+    if (!mesh_compress_init(ctx, mesh_compress_buffer_write, &buffer)
+            || !mesh_compress_update(ctx, src, src_size)
+            || !mesh_compress_finish(ctx)) {
+        return 0;
+    }
+
+    return buffer.len;
+}
+
+int mesh_decompress_buffer(const void *src, size_t src_size, void *dst, size_t dst_size)
+{
+    const uint8_t *in = src;
+    uint8_t *out = dst;
+    size_t in_pos = 1;
+    size_t out_len = 0;
+
+    if (src_size < 1 || in[0] != MESH_COMPRESS_DICT_VERSION) {
+        return -1;
+    }
+
+    while (in_pos < src_size) {
+        uint8_t flags = in[in_pos++];
+
+        for (int i = 0; i < 8 && in_pos < src_size; ++i) {
+            if (!(flags & (1 << i))) {
+                if (out_len >= dst_size) {
+                    return -1;
+                }
+
+                out[out_len++] = in[in_pos++];
+                continue;
+            }
+
+            if (src_size - in_pos < 2) {
+                return -1;
+            }
+
+            uint16_t item = in[in_pos] | in[in_pos + 1] << 8;
+            size_t offset = (item >> 6) + 1;
+            size_t length = (item & 0x3f) + MESH_COMPRESS_MIN_MATCH;
+            in_pos += 2;
+
+            if (offset > out_len + MESH_COMPRESS_DICT_SIZE || dst_size - out_len < length) {
+                return -1;
+            }
+
+            /**< Byte by byte, a match may overlap its own output */
+            for (size_t j = 0; j < length; ++j, ++out_len) {
+                out[out_len] = out_len >= offset ? out[out_len - offset]
+                               : (uint8_t)g_mesh_compress_dict[MESH_COMPRESS_DICT_SIZE + out_len - offset];
+            }
+        }
+    }
+
+    return out_len;
+}
@@ -0,0 +1,168 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef __MESH_DLOG_H__
+#define __MESH_DLOG_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MESH_DLOG_RECORD_MAX_SIZE (256)  /**< Arguments that do not fit are left out and the record is marked */
+#define MESH_DLOG_MODULE_MAX_LEN  (16)   /**< Including the terminating null */
+
+/**
+ * @brief Record layout, little endian words. Records are padded to a multiple
+ *        of 4 bytes and the console sink frames each one as MESH_DLOG_SYNC,
+ *        the record and the low byte of the sum of its bytes.
+ *
+ *        header  size | (level | flags) << 16 | MESH_DLOG_MAGIC << 24
+ *        format  address of the mesh_dlog_format_t of the call site
+ *        module  address of the module name, the TAG of the call site
+ *        time    ms since boot
+ *        args    32-bit words, 64-bit integers and doubles as two words,
+ *                strings as a length byte and the characters
+ */
+#define MESH_DLOG_MAGIC           (0xa5)
+#define MESH_DLOG_SYNC            "\xd1\x06"
+#define MESH_DLOG_FLAG_TRUNCATED  (0x80)
+
+/**
+ * @brief Constant part of a call site, stays in flash. The host decoder reads
+ *        it from the ELF at the address recorded in place of the text.
+ */
+typedef struct {
+    const char *format;
+    const char *func;
+    uint16_t line;
+    uint8_t level;           /**< esp_log_level_t */
+} mesh_dlog_format_t;
+
+/**
+ * @brief Callback used to deliver a batch of records
+ *
+ * @param  data {"dlog":"<base64 of the records>","lost":<dropped records>}
+ * @param  size length of data
+ */
+typedef mdf_err_t (*mesh_dlog_sink_cb_t)(const char *data, size_t size);
+
+/**
+ * @brief Incremented on every level change, call sites cache their level
+ *        until it moves
+ */
+extern volatile uint32_t g_mesh_dlog_generation;
+
+#ifdef CONFIG_MESH_DLOG_ENABLE
+
+#define MESH_DLOG(level, format, ...) do { \
+        static const mesh_dlog_format_t _dlog_format = {format, __func__, __LINE__, level}; \
+        static uint32_t _dlog_generation = 0; \
+        static bool _dlog_enabled = false; \
+        if (_dlog_generation != g_mesh_dlog_generation) { \
+            _dlog_enabled = mesh_dlog_level_get(TAG) >= level; \
+            _dlog_generation = g_mesh_dlog_generation; \
+        } \
+        if (_dlog_enabled) { \
+            mesh_dlog_write(&_dlog_format, TAG, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define MESH_DLOGE(format, ...) MESH_DLOG(ESP_LOG_ERROR, format, ##__VA_ARGS__)
+#define MESH_DLOGW(format, ...) MESH_DLOG(ESP_LOG_WARN, format, ##__VA_ARGS__)
+#define MESH_DLOGI(format, ...) MESH_DLOG(ESP_LOG_INFO, format, ##__VA_ARGS__)
+#define MESH_DLOGD(format, ...) MESH_DLOG(ESP_LOG_DEBUG, format, ##__VA_ARGS__)
+#define MESH_DLOGV(format, ...) MESH_DLOG(ESP_LOG_VERBOSE, format, ##__VA_ARGS__)
+
+#else
+
+#define MESH_DLOGE(format, ...) MDF_LOGE(format, ##__VA_ARGS__)
+#define MESH_DLOGW(format, ...) MDF_LOGW(format, ##__VA_ARGS__)
+#define MESH_DLOGI(format, ...) MDF_LOGI(format, ##__VA_ARGS__)
+#define MESH_DLOGD(format, ...) MDF_LOGD(format, ##__VA_ARGS__)
+#define MESH_DLOGV(format, ...) MDF_LOGV(format, ##__VA_ARGS__)
+
+#endif /**< CONFIG_MESH_DLOG_ENABLE */
+
+/**
+ * @brief  Record a message, use the MESH_DLOGx() macros
+ *
+ * @param  format call site
+ * @param  module module name
+ *
+ * @note   Never blocks and can be called from any task. The record is
+ *         dropped if the ring buffer is full.
+ */
+void mesh_dlog_write(const mesh_dlog_format_t *format, const char *module, ...);
+
+/**
+ * @brief  Take the oldest record out of the ring buffer
+ *
+ * @param  buffer pointer of the output buffer, MESH_DLOG_RECORD_MAX_SIZE is always enough
+ * @param  size   length of the output buffer
+ *
+ * @note   Records are taken by one task only, the sink task once started
+ *
+ * @return Length of the record, 0 if there is none
+ */
+size_t mesh_dlog_read(uint8_t *buffer, size_t size);
+
+/**
+ * @brief  Set the level of a module, for MESH_DLOGx() and the text log alike
+ *
+ * @param  module module name, "*" sets the default and resets every module
+ * @param  level  records above the level are not kept
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_NO_MEM, CONFIG_MESH_DLOG_MODULE_MAX_NUM modules have their own level
+ */
+mdf_err_t mesh_dlog_level_set(const char *module, esp_log_level_t level);
+
+/**
+ * @brief  Get the level of a module
+ *
+ * @param  module module name
+ *
+ * @return level of the module, the default if it has none of its own
+ */
+esp_log_level_t mesh_dlog_level_get(const char *module);
+
+/**
+ * @brief  Start the task that drains the ring buffer at low priority
+ *
+ * @param  cb callback used to deliver the records in batches, NULL to write
+ *            them to the console as they come
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_dlog_start(mesh_dlog_sink_cb_t cb);
+
+/**
+ * @brief  Get the number of records dropped because the ring buffer was full
+ *
+ * @return Total since boot
+ */
+uint32_t mesh_dlog_get_lost_num();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_DLOG_H__ */
@@ -0,0 +1,441 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdarg.h>
+#include <sys/param.h>
+#include "mesh_dlog.h"
+#include "mesh_static.h"
+#include "mbedtls/base64.h"
+
+volatile uint32_t g_mesh_dlog_generation = 1;
+
+static struct mesh_dlog {
+    portMUX_TYPE lock;
+    uint8_t default_level;
+    size_t module_num;
+    struct {
+        char name[MESH_DLOG_MODULE_MAX_LEN];
+        uint8_t level;
+    } modules[CONFIG_MESH_DLOG_MODULE_MAX_NUM];
+#ifdef CONFIG_MESH_DLOG_ENABLE
+    uint32_t head;           /**< Bytes reserved by writers, free running */
+    uint32_t tail;           /**< Bytes taken by the reader, free running */
+    uint32_t lost;
+    mesh_dlog_sink_cb_t sink_cb;
+    TaskHandle_t task;
+    uint8_t buffer[CONFIG_MESH_DLOG_BUFFER_SIZE] __attribute__((aligned(4)));
+#endif /**< CONFIG_MESH_DLOG_ENABLE */
+} g_mesh_dlog = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+    .default_level = CONFIG_LOG_DEFAULT_LEVEL,
+};
+
+static const char *TAG = "mesh_dlog";
+
+#ifdef CONFIG_MESH_DLOG_ENABLE
+
+_Static_assert((CONFIG_MESH_DLOG_BUFFER_SIZE & (CONFIG_MESH_DLOG_BUFFER_SIZE - 1)) == 0,
+               "CONFIG_MESH_DLOG_BUFFER_SIZE must be a power of two");
+
+#define MESH_DLOG_HEADER_SIZE (16)
+#define MESH_DLOG_BATCH_SIZE  (768)  /**< Records per sink call, 1024 bytes in base64 */
+#define MESH_DLOG_REPORT_SIZE (32 + (MESH_DLOG_BATCH_SIZE + 2) / 3 * 4 + 1)
+
+MESH_STATIC_TASK_DEFINE(dlog, 4 * 1024);
+MESH_STATIC_BUFFER_DEFINE(dlog_batch, MESH_DLOG_BATCH_SIZE);
+MESH_STATIC_BUFFER_DEFINE(dlog_report, MESH_DLOG_REPORT_SIZE);
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    bool truncated;
+} mesh_dlog_record_t;
+
+static bool mesh_dlog_put(mesh_dlog_record_t *record, const void *data, size_t size)
+{
+    if (record->truncated || record->len + size > MESH_DLOG_RECORD_MAX_SIZE) {
+        record->truncated = true;
+        return false;
+    }
+
+    memcpy(record->data + record->len, data, size);
+    record->len += size;
+    return true;
+}
+
+static void mesh_dlog_put_string(mesh_dlog_record_t *record, const char *str, int precision)
+{
+    size_t room = MESH_DLOG_RECORD_MAX_SIZE - record->len;
+    size_t max_len = CONFIG_MESH_DLOG_STRING_MAX_LEN;
+    bool cut = false;
+    uint8_t len = 0;
+
+    /**< The precision bounds strings that are not null-terminated, e.g. "%.*s" of a payload */
+    if (precision >= 0) {
+        max_len = MIN(max_len, (size_t)precision);
+    }
+
+    /**< A string longer than the space left is cut to it and the record marked */
+    if (room > 0 && max_len > room - 1) {
+        cut = str && strnlen(str, max_len) > room - 1;
+        max_len = room - 1;
+    }
+
+    len = str ? strnlen(str, max_len) : 0;
+
+    if (mesh_dlog_put(record, &len, 1) && len) {
+        mesh_dlog_put(record, str, len);
+    }
+
+    record->truncated |= cut;
+}
+
+/**
+ * @brief Copy the arguments the way printf() would consume them. Only the
+ *        conversion specifiers are scanned, nothing is formatted.
+ */
+static void mesh_dlog_put_args(mesh_dlog_record_t *record, const char *format, va_list args)
+{
+    for (const char *p = format; *p; ++p) {
+        int precision = -1;
+        int wide = 0;
+
+        if (*p != '%' || *++p == '%') {
+            continue;
+        }
+
+        while (*p && strchr("-+ #0", *p)) {
+            p++;
+        }
+
+        if (*p == '*') {
+            int width = va_arg(args, int);
+            mesh_dlog_put(record, &width, sizeof(width));
+            p++;
+        }
+
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+
+        if (*p == '.') {
+            if (*++p == '*') {
+                precision = va_arg(args, int);
+                mesh_dlog_put(record, &precision, sizeof(precision));
+                p++;
+            }
+
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+
+        /**< wide is 1 for long and size_t, 2 for 64-bit integers */
+        for (; *p && strchr("hlLjzt", *p); ++p) {
+            wide += (*p == 'h') ? 0 : (*p == 'j') ? 2 : 1;
+        }
+
+        switch (*p) {
+            case 's':
+                mesh_dlog_put_string(record, va_arg(args, const char *), precision);
+                break;
+
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                double value = va_arg(args, double);
+                mesh_dlog_put(record, &value, sizeof(value));
+                break;
+            }
+
+            case 'p': {
+                uint32_t value = (uint32_t)(uintptr_t)va_arg(args, void *);
+                mesh_dlog_put(record, &value, sizeof(value));
+                break;
+            }
+
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                if (wide >= 2) {
+                    long long value = va_arg(args, long long);
+                    mesh_dlog_put(record, &value, sizeof(value));
+                } else {
+                    uint32_t value = wide ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                    mesh_dlog_put(record, &value, sizeof(value));
+                }
+
+                break;
+
+            default:
+                /**< Unknown conversion, the arguments after it cannot be located */
+                record->truncated = true;
+                return;
+        }
+    }
+}
+
+/**
+ * @brief Copy into the ring at a free running offset, wrapping at its end
+ */
+static void mesh_dlog_ring_copy(uint32_t offset, const uint8_t *data, size_t size)
+{
+    size_t pos = offset & (CONFIG_MESH_DLOG_BUFFER_SIZE - 1);
+    size_t first = MIN(size, CONFIG_MESH_DLOG_BUFFER_SIZE - pos);
+
+    memcpy(g_mesh_dlog.buffer + pos, data, first);
+    memcpy(g_mesh_dlog.buffer, data + first, size - first);
+}
+
+void mesh_dlog_write(const mesh_dlog_format_t *format, const char *module, ...)
+{
+    uint8_t data[MESH_DLOG_RECORD_MAX_SIZE] __attribute__((aligned(4)));
+    mesh_dlog_record_t record = {.data = data, .len = MESH_DLOG_HEADER_SIZE};
+    uint32_t *words = (uint32_t *)data;
+    va_list args;
+
+    words[1] = (uint32_t)(uintptr_t)format;
+    words[2] = (uint32_t)(uintptr_t)module;
+    words[3] = esp_log_timestamp();
+
+    va_start(args, module);
+    mesh_dlog_put_args(&record, format->format, args);
+    va_end(args);
+
+    uint32_t size = (record.len + 3) & ~3;
+    memset(data + record.len, 0, size - record.len);
+    uint32_t header = size | (format->level | (record.truncated ? MESH_DLOG_FLAG_TRUNCATED : 0)) << 16
+                      | MESH_DLOG_MAGIC << 24;
+
+    /**
+     * @brief Reserve the space with a compare and swap on the head, writers
+     *        never wait for each other or for the reader. Chips without an
+     *        atomic instruction, the S2 among them, get the builtin from the
+     *        IDF, which masks interrupts for the few instructions it takes.
+     */
+    uint32_t head = __atomic_load_n(&g_mesh_dlog.head, __ATOMIC_RELAXED);
+
+    do {
+        if (head + size - __atomic_load_n(&g_mesh_dlog.tail, __ATOMIC_ACQUIRE) > CONFIG_MESH_DLOG_BUFFER_SIZE) {
+            __atomic_fetch_add(&g_mesh_dlog.lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&g_mesh_dlog.head, &head, head + size, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    /**< The header is written last, a zero header tells the reader the record is not complete yet */
+    mesh_dlog_ring_copy(head + 4, data + 4, size - 4);
+    __atomic_store_n((uint32_t *)(g_mesh_dlog.buffer + (head & (CONFIG_MESH_DLOG_BUFFER_SIZE - 1))),
+                     header, __ATOMIC_RELEASE);
+}
+
+size_t mesh_dlog_read(uint8_t *buffer, size_t size)
+{
+    uint32_t tail = g_mesh_dlog.tail;
+    size_t pos = tail & (CONFIG_MESH_DLOG_BUFFER_SIZE - 1);
+    uint32_t header = __atomic_load_n((uint32_t *)(g_mesh_dlog.buffer + pos), __ATOMIC_ACQUIRE);
+    size_t record_size = header & 0xffff;
+
+    if (header == 0 || record_size > size) {
+        return 0;
+    }
+
+    /**< Free space is kept zeroed, so the header of a record being written reads as 0 */
+    size_t first = MIN(record_size, CONFIG_MESH_DLOG_BUFFER_SIZE - pos);
+    memcpy(buffer, g_mesh_dlog.buffer + pos, first);
+    memcpy(buffer + first, g_mesh_dlog.buffer, record_size - first);
+    memset(g_mesh_dlog.buffer + pos, 0, first);
+    memset(g_mesh_dlog.buffer, 0, record_size - first);
+
+    __atomic_store_n(&g_mesh_dlog.tail, tail + record_size, __ATOMIC_RELEASE);
+
+    return record_size;
+}
+
+static void mesh_dlog_console_write(const uint8_t *record, size_t size)
+{
+    uint8_t sum = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        sum += record[i];
+    }
+
+    fwrite(MESH_DLOG_SYNC, 1, sizeof(MESH_DLOG_SYNC) - 1, stdout);
+    fwrite(record, 1, size, stdout);
+    fwrite(&sum, 1, 1, stdout);
+}
+
+/**
+ * @brief Deliver a batch as {"dlog":"<base64>","lost":<n>}, report is
+ *        MESH_DLOG_REPORT_SIZE bytes, room for the base64 of a full batch
+ */
+static mdf_err_t mesh_dlog_sink_flush(char *report, const uint8_t *batch, size_t size)
+{
+    size_t len = strlen("{\"dlog\":\"");
+    size_t olen = 0;
+
+    memcpy(report, "{\"dlog\":\"", len);
+    mbedtls_base64_encode((uint8_t *)report + len, MESH_DLOG_REPORT_SIZE - len, &olen, batch, size);
+    len += olen;
+    len += snprintf(report + len, MESH_DLOG_REPORT_SIZE - len, "\",\"lost\":%u}", mesh_dlog_get_lost_num());
+
+    return g_mesh_dlog.sink_cb(report, len);
+}
+
+static void mesh_dlog_task(void *arg)
+{
+    mdf_err_t ret = MDF_OK;
+    uint8_t *batch = MESH_STATIC_MALLOC(dlog_batch, MESH_DLOG_BATCH_SIZE);
+    char *report = MESH_STATIC_MALLOC(dlog_report, MESH_DLOG_REPORT_SIZE);
+    uint8_t record[MESH_DLOG_RECORD_MAX_SIZE];
+    size_t batch_size = 0;
+    TickType_t flush_tick = xTaskGetTickCount();
+
+    MDF_ERROR_GOTO(!batch || !report, EXIT, "Allocate mem failed");
+
+    for (;;) {
+        size_t size = mesh_dlog_read(record, sizeof(record));
+
+        if (!g_mesh_dlog.sink_cb) {
+            if (size) {
+                mesh_dlog_console_write(record, size);
+            } else {
+                fflush(stdout);
+                vTaskDelay(pdMS_TO_TICKS(50));
+            }
+
+            continue;
+        }
+
+        if (size && batch_size + size <= MESH_DLOG_BATCH_SIZE) {
+            memcpy(batch + batch_size, record, size);
+            batch_size += size;
+            continue;
+        }
+
+        /**< The batch is full, or the buffer is empty and the interval has passed */
+        if (batch_size && (size || xTaskGetTickCount() - flush_tick >= pdMS_TO_TICKS(CONFIG_MESH_DLOG_FLUSH_MS))) {
+            ret = mesh_dlog_sink_flush(report, batch, batch_size);
+
+            if (ret != MDF_OK) {
+                MDF_LOGD("<%s> Deliver records", mdf_err_to_name(ret));
+            }
+
+            batch_size = 0;
+            flush_tick = xTaskGetTickCount();
+        }
+
+        if (size) {
+            memcpy(batch, record, size);
+            batch_size = size;
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+
+EXIT:
+    MESH_STATIC_FREE(dlog_report, report);
+    MESH_STATIC_FREE(dlog_batch, batch);
+    g_mesh_dlog.task = NULL;
+    MESH_STATIC_TASK_EXIT();
+}
+
+#else
+
+void mesh_dlog_write(const mesh_dlog_format_t *format, const char *module, ...)
+{
+}
+
+size_t mesh_dlog_read(uint8_t *buffer, size_t size)
+{
+    return 0;
+}
+
+#endif /**< CONFIG_MESH_DLOG_ENABLE */
+
+mdf_err_t mesh_dlog_level_set(const char *module, esp_log_level_t level)
+{
+    MDF_PARAM_CHECK(module);
+    MDF_PARAM_CHECK(strlen(module) < MESH_DLOG_MODULE_MAX_LEN);
+    MDF_PARAM_CHECK(level <= ESP_LOG_VERBOSE);
+
+    mdf_err_t ret = MDF_OK;
+    size_t i = 0;
+
+    portENTER_CRITICAL(&g_mesh_dlog.lock);
+
+    if (!strcmp(module, "*")) {
+        g_mesh_dlog.default_level = level;
+        g_mesh_dlog.module_num = 0;
+    } else {
+        for (i = 0; i < g_mesh_dlog.module_num && strcmp(g_mesh_dlog.modules[i].name, module); ++i) {
+        }
+
+        if (i == CONFIG_MESH_DLOG_MODULE_MAX_NUM) {
+            ret = MDF_ERR_NO_MEM;
+        } else {
+            strcpy(g_mesh_dlog.modules[i].name, module);
+            g_mesh_dlog.modules[i].level = level;
+            g_mesh_dlog.module_num = MAX(g_mesh_dlog.module_num, i + 1);
+        }
+    }
+
+    g_mesh_dlog_generation++;
+    portEXIT_CRITICAL(&g_mesh_dlog.lock);
+
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Too many modules, %s keeps the default level", module);
+
+    /**< Text logs of the module follow the same level */
+    esp_log_level_set(module, level);
+
+    return MDF_OK;
+}
+
+esp_log_level_t mesh_dlog_level_get(const char *module)
+{
+    esp_log_level_t level = ESP_LOG_NONE;
+
+    portENTER_CRITICAL(&g_mesh_dlog.lock);
+    level = g_mesh_dlog.default_level;
+
+    for (size_t i = 0; i < g_mesh_dlog.module_num; ++i) {
+        if (!strcmp(g_mesh_dlog.modules[i].name, module)) {
+            level = g_mesh_dlog.modules[i].level;
+            break;
+        }
+    }
+
+    portEXIT_CRITICAL(&g_mesh_dlog.lock);
+
+    return level;
+}
+
+mdf_err_t mesh_dlog_start(mesh_dlog_sink_cb_t cb)
+{
+#ifdef CONFIG_MESH_DLOG_ENABLE
+    MDF_ERROR_CHECK(g_mesh_dlog.task != NULL, MDF_ERR_INVALID_STATE, "Deferred log task is already running");
+
+    g_mesh_dlog.sink_cb = cb;
+    MESH_STATIC_TASK_CREATE(dlog, mesh_dlog_task, "mesh_dlog", NULL, tskIDLE_PRIORITY + 1, &g_mesh_dlog.task);
+    MDF_LOGI("Deferred log is written to the %s", cb ? "sink" : "console");
+#endif /**< CONFIG_MESH_DLOG_ENABLE */
+
+    return MDF_OK;
+}
+
+uint32_t mesh_dlog_get_lost_num()
+{
+#ifdef CONFIG_MESH_DLOG_ENABLE
+    return __atomic_load_n(&g_mesh_dlog.lost, __ATOMIC_RELAXED);
+#else
+    return 0;
+#endif /**< CONFIG_MESH_DLOG_ENABLE */
+}
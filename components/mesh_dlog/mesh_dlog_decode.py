@@ -0,0 +1,267 @@
+#!/usr/bin/env python
+#
+# Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Turns the records of a CONFIG_MESH_DLOG_ENABLE build back into text:
+
+    mesh_dlog_decode.py smart_agriculture.elf console.bin
+    mosquitto_sub -v -t 'mesh/+/diag' | mesh_dlog_decode.py --mqtt smart_agriculture.elf -
+
+The console input is a raw capture of the serial port, text output between
+the records is passed through. The MQTT input is the "topic payload" lines
+of mosquitto_sub -v, the records of every node are prefixed with its address.
+The ELF must be the one of the firmware that wrote the records.
+"""
+
+import argparse
+import base64
+import json
+import re
+import struct
+import sys
+
+MESH_DLOG_MAGIC = 0xa5
+MESH_DLOG_SYNC = b'\xd1\x06'
+MESH_DLOG_FLAG_TRUNCATED = 0x80
+MESH_DLOG_HEADER_SIZE = 16
+MESH_DLOG_RECORD_MAX_SIZE = 256
+
+LEVELS = ' EWIDV'
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?([hlLjzt]*)([a-zA-Z%])')
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+
+class Elf(object):
+    """
+    Reads constant data of a 32-bit little endian ELF by address
+    """
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+
+        if self.data[:6] != b'\x7fELF\x01\x01':
+            raise ValueError('%s is not a 32-bit little endian ELF' % path)
+
+        shoff, = struct.unpack_from('<I', self.data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', self.data, 0x2e)
+        self.sections = []
+
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = struct.unpack_from('<IIIIII', self.data, shoff + i * shentsize)
+
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size:
+                self.sections.append((addr, offset, size))
+
+    def read(self, addr, size):
+        for start, offset, length in self.sections:
+            if start <= addr and addr + size <= start + length:
+                return self.data[offset + addr - start:offset + addr - start + size]
+
+        raise KeyError('0x%08x is not in the ELF' % addr)
+
+    def string(self, addr):
+        for start, offset, length in self.sections:
+            if start <= addr < start + length:
+                end = self.data.index(b'\0', offset + addr - start)
+                return self.data[offset + addr - start:end].decode('utf-8', 'replace')
+
+        raise KeyError('0x%08x is not in the ELF' % addr)
+
+
+class Decoder(object):
+    def __init__(self, elf):
+        self.elf = elf
+        self.formats = {}
+
+    def call_site(self, addr):
+        if addr not in self.formats:
+            format_addr, func_addr, line, level = struct.unpack('<IIHB', self.elf.read(addr, 11))
+            self.formats[addr] = (self.elf.string(format_addr), self.elf.string(func_addr), line, level)
+
+        return self.formats[addr]
+
+    @staticmethod
+    def format_args(fmt, args):
+        """
+        printf() of the recorded arguments, mesh_dlog_put_args() in reverse
+        """
+        out = []
+        pos = 0
+        offset = 0
+
+        def take(size, code):
+            value = struct.unpack_from(code, args, offset)[0]
+            return value, offset + size
+
+        for match in CONVERSION.finditer(fmt):
+            flags, width, precision, length, conv = match.groups()
+            out.append(fmt[pos:match.start()])
+            pos = match.end()
+
+            if conv == '%':
+                out.append('%')
+                continue
+
+            if width == '*':
+                width, offset = take(4, '<i')
+                width = str(width)
+
+            if precision == '*':
+                precision, offset = take(4, '<i')
+                precision = str(precision) if precision >= 0 else None
+
+            wide = sum(0 if c == 'h' else 2 if c == 'j' else 1 for c in length)
+            spec = '%' + flags + (width or '') + ('.' + precision if precision is not None else '')
+
+            if conv == 's':
+                size = args[offset]
+                value = args[offset + 1:offset + 1 + size].decode('utf-8', 'replace')
+                offset += 1 + size
+                out.append((spec + 's') % value)
+            elif conv in 'fFeEgGaA':
+                value, offset = take(8, '<d')
+                out.append((spec + ('f' if conv in 'aA' else conv)) % value)
+            elif conv == 'p':
+                value, offset = take(4, '<I')
+                out.append('0x%x' % value)
+            elif conv in 'diuxXoc':
+                if wide >= 2:
+                    value, offset = take(8, '<q' if conv in 'di' else '<Q')
+                else:
+                    value, offset = take(4, '<i' if conv in 'di' else '<I')
+
+                out.append((spec + ('d' if conv in 'iu' else conv)) % value)
+            else:
+                break
+
+        out.append(fmt[pos:])
+        return ''.join(out)
+
+    def decode(self, record):
+        header, format_addr, module_addr, timestamp = struct.unpack_from('<IIII', record)
+        fmt, func, line, _ = self.call_site(format_addr)
+        level = (header >> 16) & 0x7
+
+        try:
+            text = self.format_args(fmt, record[MESH_DLOG_HEADER_SIZE:(header & 0xffff)])
+        except struct.error:
+            text = fmt + ' <arguments cut>'
+
+        if (header >> 16) & MESH_DLOG_FLAG_TRUNCATED:
+            text += ' <truncated>'
+
+        return '%s (%d) %s: [%s, %d]: %s' % (LEVELS[level], timestamp, self.elf.string(module_addr), func, line, text)
+
+    def records(self, data):
+        """
+        Records of a batch delivered over MQTT, back to back
+        """
+        while len(data) >= MESH_DLOG_HEADER_SIZE:
+            size = struct.unpack_from('<I', data)[0] & 0xffff
+
+            if size < MESH_DLOG_HEADER_SIZE or size > len(data):
+                break
+
+            yield self.decode(data[:size])
+            data = data[size:]
+
+
+def valid_record(data, start):
+    """
+    Length of the framed record at start, 0 if it is not one
+    """
+    if len(data) < start + len(MESH_DLOG_SYNC) + MESH_DLOG_HEADER_SIZE + 1:
+        return 0
+
+    header = struct.unpack_from('<I', data, start + len(MESH_DLOG_SYNC))[0]
+    size = header & 0xffff
+    end = start + len(MESH_DLOG_SYNC) + size
+
+    if header >> 24 != MESH_DLOG_MAGIC or size < MESH_DLOG_HEADER_SIZE or size > MESH_DLOG_RECORD_MAX_SIZE \
+            or size % 4 or end >= len(data):
+        return 0
+
+    if sum(bytearray(data[start + len(MESH_DLOG_SYNC):end])) & 0xff != bytearray(data[end:end + 1])[0]:
+        return 0
+
+    return size
+
+
+def decode_console(decoder, data, out):
+    pos = 0
+
+    while pos < len(data):
+        start = data.find(MESH_DLOG_SYNC, pos)
+
+        if start < 0:
+            out.write(data[pos:].decode('utf-8', 'replace'))
+            break
+
+        size = valid_record(data, start)
+        out.write(data[pos:start + (0 if size else 1)].decode('utf-8', 'replace'))
+
+        if size:
+            record = data[start + len(MESH_DLOG_SYNC):start + len(MESH_DLOG_SYNC) + size]
+            out.write(decoder.decode(record) + '\n')
+            pos = start + len(MESH_DLOG_SYNC) + size + 1
+        else:
+            pos = start + 1
+
+
+def decode_mqtt(decoder, lines, out):
+    for line in lines:
+        payload = line[line.find('{'):] if '{' in line else ''
+
+        try:
+            message = json.loads(payload)
+        except ValueError:
+            continue
+
+        batch = message.get('data', message) if isinstance(message.get('data'), dict) else message
+
+        if 'dlog' not in batch:
+            continue
+
+        prefix = message.get('addr', '')
+
+        for text in decoder.records(base64.b64decode(batch['dlog'])):
+            out.write('%s %s\n' % (prefix, text) if prefix else text + '\n')
+
+        if batch.get('lost'):
+            out.write('%s lost %d records so far\n' % (prefix or 'node', batch['lost']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode deferred log records')
+    parser.add_argument('--mqtt', action='store_true', help='input is mosquitto_sub -v output of the diag topic')
+    parser.add_argument('elf', help='ELF of the firmware')
+    parser.add_argument('input', nargs='?', default='-', help='capture to decode, - for stdin')
+    args = parser.parse_args()
+
+    decoder = Decoder(Elf(args.elf))
+
+    if args.mqtt:
+        lines = sys.stdin if args.input == '-' else open(args.input)
+        decode_mqtt(decoder, lines, sys.stdout)
+    else:
+        stream = sys.stdin.buffer if args.input == '-' else open(args.input, 'rb')
+        decode_console(decoder, stream.read(), sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,177 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_ESPNOW_H__
+#define __MESH_ESPNOW_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MESH_ESPNOW_VERSION  (1)
+#define MESH_ESPNOW_ADDR_LEN (6)
+
+/**
+ * @brief Fast path for leaf-only sensor nodes. Such a node never joins the
+ *        mesh: it wakes, sends one reading over ESP-NOW to a nearby mesh
+ *        node, the relay, and goes back to deep sleep. The relay hands the
+ *        reading to the normal uplink under the address of the leaf.
+ *
+ *        A leaf that knows no relay broadcasts MESH_ESPNOW_DISCOVER on each
+ *        channel, relays connected to a root answer with MESH_ESPNOW_OFFER.
+ *        Readings are then sent unicast, so ESP-NOW retries them at the MAC
+ *        layer and a failed send starts a new discovery.
+ */
+typedef enum {
+    MESH_ESPNOW_DISCOVER = 0, /**< Leaf looking for a relay, broadcast */
+    MESH_ESPNOW_OFFER,        /**< Relay answering a discovery */
+    MESH_ESPNOW_READING,      /**< Reading of a leaf */
+} mesh_espnow_type_t;
+
+typedef struct {
+    uint8_t version; /**< MESH_ESPNOW_VERSION */
+    uint8_t type;    /**< mesh_espnow_type_t */
+} __attribute__((packed)) mesh_espnow_header_t;
+
+typedef struct {
+    mesh_espnow_header_t header;
+    uint8_t layer;   /**< Mesh layer of the relay */
+} __attribute__((packed)) mesh_espnow_offer_t;
+
+/**
+ * @brief Sample of the DHT11 and light sensors, in the units of the sensor
+ */
+typedef struct {
+    int16_t temp;    /**< 0.1 C */
+    uint16_t humi;   /**< 0.1 %RH */
+    uint16_t light;  /**< Raw ADC value */
+} __attribute__((packed)) mesh_espnow_sample_t;
+
+/**
+ * @brief A reading, little-endian. wake_ms and energy_uj describe the previous
+ *        reading of the leaf, they are only known once it has been sent.
+ */
+typedef struct {
+    mesh_espnow_header_t header;
+    uint32_t seq;                /**< Sequence number, kept across deep sleep */
+    mesh_espnow_sample_t sample;
+    uint16_t wake_ms;            /**< Time from wake-up to the reading sent */
+    uint32_t energy_uj;          /**< Estimated energy of a wake-up and the sleep after it */
+} __attribute__((packed)) mesh_espnow_reading_t;
+
+/**
+ * @brief  Called by a transport for every frame received
+ *
+ * @param  src_addr address of the sender
+ * @param  data     pointer of the frame
+ * @param  size     length of the frame
+ * @param  rssi     signal strength of the frame, 0 if the transport does not know it
+ */
+typedef void (*mesh_espnow_recv_cb_t)(const uint8_t *src_addr, const uint8_t *data, size_t size, int rssi);
+
+/**
+ * @brief Connectionless link used by the fast path, mesh_espnow_transport_wifi
+ *        on the device. recv_cb is called from a task of the transport, it
+ *        may send.
+ */
+typedef struct {
+    mdf_err_t (*init)(mesh_espnow_recv_cb_t recv_cb);
+    mdf_err_t (*set_channel)(uint8_t channel);
+    mdf_err_t (*send)(const uint8_t *dest_addr, const void *data, size_t size); /**< Returns once the frame is acknowledged or lost */
+    void (*deinit)();
+} mesh_espnow_transport_t;
+
+/**
+ * @brief  Hands a reading of a leaf to the uplink, mesh_aggregate_inject() on the device
+ */
+typedef mdf_err_t (*mesh_espnow_inject_t)(const uint8_t *addr, uint32_t seq, const char *data, size_t size);
+
+extern const mesh_espnow_transport_t mesh_espnow_transport_wifi;
+
+/**
+ * @brief  Accept readings of leaf nodes, called once the mesh is started
+ *
+ * @param  transport link to the leaf nodes
+ * @param  inject    called with every reading formatted as the JSON a node sends
+ *
+ * @note   Without CONFIG_MESH_ESPNOW_RELAY this does nothing
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ *     - the error of transport->init
+ */
+mdf_err_t mesh_espnow_relay_start(const mesh_espnow_transport_t *transport, mesh_espnow_inject_t inject);
+
+/**
+ * @brief  Stop accepting readings of leaf nodes
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_espnow_relay_stop();
+
+/**
+ * @brief  Format a reading as the JSON a node sends to the root
+ *
+ * @param  reading reading of a leaf
+ * @param  ts      time the relay received it, 0 if the clock is not synchronized
+ * @param  buffer  output buffer
+ * @param  size    length of the buffer
+ *
+ * @return Length of the JSON, as snprintf()
+ */
+int mesh_espnow_reading_format(const mesh_espnow_reading_t *reading, int64_t ts, char *buffer, size_t size);
+
+/**
+ * @brief  Send a reading of this leaf, looking for a relay first if needed
+ *
+ * @param  transport link to the relays
+ * @param  sample    sample to send
+ *
+ * @note   The relay, its channel and the sequence number are kept in RTC
+ *         memory. Without CONFIG_MESH_ESPNOW_LEAF this returns MDF_ERR_NOT_SUPPORTED.
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND, no relay answered
+ *     - the error of transport->send
+ */
+mdf_err_t mesh_espnow_leaf_send(const mesh_espnow_transport_t *transport, const mesh_espnow_sample_t *sample);
+
+/**
+ * @brief  Account for the energy of this wake-up and enter deep sleep
+ *
+ * @param  sleep_ms time until the next reading
+ */
+void mesh_espnow_leaf_sleep(uint32_t sleep_ms);
+
+/**
+ * @brief  Time from wake-up to the last reading sent, for a metrics gauge or a log
+ */
+uint32_t mesh_espnow_get_wake_ms();
+
+/**
+ * @brief  Number of readings of leaf nodes handed to the uplink by this relay
+ */
+uint32_t mesh_espnow_get_relay_num();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_ESPNOW_H__ */
@@ -0,0 +1,320 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/param.h>
+
+#include "mesh_espnow.h"
+#include "mesh_time.h"
+#include "sensor_pipeline.h"
+#include "mwifi.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+#define MESH_ESPNOW_CHANNEL_MAX_NUM (13)
+#define MESH_ESPNOW_JSON_LEN        (192)
+
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+static const uint8_t g_mesh_espnow_broadcast[MESH_ESPNOW_ADDR_LEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+/**
+ * @brief State of a leaf that survives deep sleep, channel 0 means that no
+ *        relay is known
+ */
+static RTC_DATA_ATTR struct mesh_espnow_leaf {
+    uint8_t relay_addr[MESH_ESPNOW_ADDR_LEN];
+    uint8_t channel;
+    uint32_t seq;
+    uint16_t wake_ms;
+    uint32_t energy_uj;
+} g_mesh_espnow_leaf;
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+
+static struct mesh_espnow {
+    const mesh_espnow_transport_t *transport;
+    mesh_espnow_inject_t inject;
+    uint32_t relay_num;
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+    portMUX_TYPE lock;  /**< Guards the best offer, written from the transport task */
+    bool offered;
+    uint8_t offer_addr[MESH_ESPNOW_ADDR_LEN];
+    int offer_rssi;
+    uint8_t offer_layer;
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+} g_mesh_espnow = {
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+};
+
+static const char *TAG = "mesh_espnow";
+
+int mesh_espnow_reading_format(const mesh_espnow_reading_t *reading, int64_t ts, char *buffer, size_t size)
+{
+    char ts_field[32] = "";
+    char temp_str[SENSOR_Q16_STR_SIZE] = "";
+    char humi_str[SENSOR_Q16_STR_SIZE] = "";
+
+    if (ts > 0) {
+        snprintf(ts_field, sizeof(ts_field), ",\"ts\":%lld", (long long)ts);
+    }
+
+    /**< Formatted as dht11_task() does, without a soft-float division on the relay. The frame is
+         not authenticated, readings are clamped to the range of sensor_q16_from_ratio() */
+    sensor_q16_format(sensor_q16_from_ratio(MAX(reading->sample.temp, -INT16_MAX), 10), temp_str);
+    sensor_q16_format(sensor_q16_from_ratio(MIN(reading->sample.humi, INT16_MAX), 10), humi_str);
+
+    return snprintf(buffer, size, "{\"Temp\":\"%s\",\"Humi\":\"%s\",\"sensor_light\":\"%d\","
+                    "\"wake_ms\":%u,\"energy_uj\":%u%s}",
+                    temp_str, humi_str, reading->sample.light, reading->wake_ms, reading->energy_uj, ts_field);
+}
+
+#ifdef CONFIG_MESH_ESPNOW_RELAY
+static void mesh_espnow_relay_recv_cb(const uint8_t *src_addr, const uint8_t *data, size_t size, int rssi)
+{
+    mdf_err_t ret = MDF_OK;
+    mesh_espnow_header_t header = {0};
+
+    if (size < sizeof(header)) {
+        return;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (header.version != MESH_ESPNOW_VERSION) {
+        MDF_LOGD("Unsupported frame version: %d", header.version);
+        return;
+    }
+
+    if (header.type == MESH_ESPNOW_DISCOVER) {
+        /**< A relay that cannot reach the root would only lose the readings */
+        if (!mwifi_is_connected() || !mwifi_get_root_status()) {
+            return;
+        }
+
+        mesh_espnow_offer_t offer = {
+            .header = {MESH_ESPNOW_VERSION, MESH_ESPNOW_OFFER},
+            .layer = esp_mesh_get_layer(),
+        };
+
+        ret = g_mesh_espnow.transport->send(src_addr, &offer, sizeof(offer));
+
+        if (ret != MDF_OK) {
+            MDF_LOGD("<%s> Offer to " MACSTR, mdf_err_to_name(ret), MAC2STR(src_addr));
+        }
+    } else if (header.type == MESH_ESPNOW_READING && size >= sizeof(mesh_espnow_reading_t)) {
+        char buffer[MESH_ESPNOW_JSON_LEN];
+        mesh_espnow_reading_t reading = {0};
+
+        memcpy(&reading, data, sizeof(reading));
+
+        /**< The leaf has no clock, the reading is stamped on arrival */
+        int len = mesh_espnow_reading_format(&reading, mesh_time_now_ms(), buffer, sizeof(buffer));
+        ret = g_mesh_espnow.inject(src_addr, reading.seq, buffer, len);
+
+        if (ret != MDF_OK) {
+            MDF_LOGW("<%s> Drop reading of " MACSTR, mdf_err_to_name(ret), MAC2STR(src_addr));
+            return;
+        }
+
+        g_mesh_espnow.relay_num++;
+    }
+}
+#endif /**< CONFIG_MESH_ESPNOW_RELAY */
+
+mdf_err_t mesh_espnow_relay_start(const mesh_espnow_transport_t *transport, mesh_espnow_inject_t inject)
+{
+    MDF_PARAM_CHECK(transport);
+    MDF_PARAM_CHECK(inject);
+
+#ifdef CONFIG_MESH_ESPNOW_RELAY
+    MDF_ERROR_CHECK(g_mesh_espnow.transport, MDF_ERR_INVALID_STATE, "Mesh ESP-NOW relay is already running");
+
+    g_mesh_espnow.transport = transport;
+    g_mesh_espnow.inject = inject;
+
+    mdf_err_t ret = transport->init(mesh_espnow_relay_recv_cb);
+
+    if (ret != MDF_OK) {
+        g_mesh_espnow.transport = NULL;
+        MDF_LOGW("<%s> Start the transport", mdf_err_to_name(ret));
+        return ret;
+    }
+
+    MDF_LOGI("Accept readings of leaf nodes over ESP-NOW");
+#endif /**< CONFIG_MESH_ESPNOW_RELAY */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_espnow_relay_stop()
+{
+#ifdef CONFIG_MESH_ESPNOW_RELAY
+    MDF_ERROR_CHECK(!g_mesh_espnow.transport, MDF_ERR_INVALID_STATE, "Mesh ESP-NOW relay is not running");
+
+    g_mesh_espnow.transport->deinit();
+    g_mesh_espnow.transport = NULL;
+#endif /**< CONFIG_MESH_ESPNOW_RELAY */
+
+    return MDF_OK;
+}
+
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+/**
+ * @brief Keep the strongest offer, the one closest to the root on a tie
+ */
+static void mesh_espnow_leaf_recv_cb(const uint8_t *src_addr, const uint8_t *data, size_t size, int rssi)
+{
+    mesh_espnow_offer_t offer = {0};
+
+    if (size < sizeof(offer)) {
+        return;
+    }
+
+    memcpy(&offer, data, sizeof(offer));
+
+    if (offer.header.version != MESH_ESPNOW_VERSION || offer.header.type != MESH_ESPNOW_OFFER) {
+        return;
+    }
+
+    portENTER_CRITICAL(&g_mesh_espnow.lock);
+
+    if (!g_mesh_espnow.offered || rssi > g_mesh_espnow.offer_rssi
+            || (rssi == g_mesh_espnow.offer_rssi && offer.layer < g_mesh_espnow.offer_layer)) {
+        memcpy(g_mesh_espnow.offer_addr, src_addr, MESH_ESPNOW_ADDR_LEN);
+        g_mesh_espnow.offer_rssi = rssi;
+        g_mesh_espnow.offer_layer = offer.layer;
+        g_mesh_espnow.offered = true;
+    }
+
+    portEXIT_CRITICAL(&g_mesh_espnow.lock);
+}
+
+static mdf_err_t mesh_espnow_leaf_discover(const mesh_espnow_transport_t *transport)
+{
+    mesh_espnow_header_t discover = {MESH_ESPNOW_VERSION, MESH_ESPNOW_DISCOVER};
+    uint8_t first = CONFIG_MESH_ESPNOW_CHANNEL ? CONFIG_MESH_ESPNOW_CHANNEL : 1;
+    uint8_t last = CONFIG_MESH_ESPNOW_CHANNEL ? CONFIG_MESH_ESPNOW_CHANNEL : MESH_ESPNOW_CHANNEL_MAX_NUM;
+
+    for (uint8_t channel = first; channel <= last; ++channel) {
+        if (transport->set_channel(channel) != MDF_OK) {
+            continue;
+        }
+
+        portENTER_CRITICAL(&g_mesh_espnow.lock);
+        g_mesh_espnow.offered = false;
+        portEXIT_CRITICAL(&g_mesh_espnow.lock);
+
+        transport->send(g_mesh_espnow_broadcast, &discover, sizeof(discover));
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_MESH_ESPNOW_OFFER_WINDOW_MS));
+
+        portENTER_CRITICAL(&g_mesh_espnow.lock);
+
+        if (g_mesh_espnow.offered) {
+            memcpy(g_mesh_espnow_leaf.relay_addr, g_mesh_espnow.offer_addr, MESH_ESPNOW_ADDR_LEN);
+            g_mesh_espnow_leaf.channel = channel;
+        }
+
+        portEXIT_CRITICAL(&g_mesh_espnow.lock);
+
+        if (g_mesh_espnow_leaf.channel) {
+            MDF_LOGI("Relay " MACSTR " on channel %d, layer: %d, rssi: %d", MAC2STR(g_mesh_espnow_leaf.relay_addr),
+                     channel, g_mesh_espnow.offer_layer, g_mesh_espnow.offer_rssi);
+            return MDF_OK;
+        }
+    }
+
+    return MDF_ERR_NOT_FOUND;
+}
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+
+mdf_err_t mesh_espnow_leaf_send(const mesh_espnow_transport_t *transport, const mesh_espnow_sample_t *sample)
+{
+    MDF_PARAM_CHECK(transport);
+    MDF_PARAM_CHECK(sample);
+
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+    mdf_err_t ret = transport->init(mesh_espnow_leaf_recv_cb);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> Start the transport", mdf_err_to_name(ret));
+
+    /**< Random start after power-on, as mesh_seq_next(), 0 is MESH_SEQ_NONE */
+    if (!g_mesh_espnow_leaf.seq) {
+        g_mesh_espnow_leaf.seq = esp_random() | 1;
+    }
+
+    mesh_espnow_reading_t reading = {
+        .header = {MESH_ESPNOW_VERSION, MESH_ESPNOW_READING},
+        .seq = g_mesh_espnow_leaf.seq++,
+        .sample = *sample,
+        .wake_ms = g_mesh_espnow_leaf.wake_ms,
+        .energy_uj = g_mesh_espnow_leaf.energy_uj,
+    };
+
+    /**< A relay that stopped acknowledging is replaced once per wake-up */
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        ret = g_mesh_espnow_leaf.channel ? transport->set_channel(g_mesh_espnow_leaf.channel)
+              : mesh_espnow_leaf_discover(transport);
+
+        if (ret == MDF_ERR_NOT_FOUND) {
+            MDF_LOGW("No relay answered");
+            break;
+        }
+
+        if (ret == MDF_OK && (ret = transport->send(g_mesh_espnow_leaf.relay_addr, &reading, sizeof(reading))) == MDF_OK) {
+            break;
+        }
+
+        MDF_LOGW("<%s> Relay " MACSTR " is lost", mdf_err_to_name(ret), MAC2STR(g_mesh_espnow_leaf.relay_addr));
+        g_mesh_espnow_leaf.channel = 0;
+    }
+
+    int64_t wake_ms = esp_timer_get_time() / 1000;
+    g_mesh_espnow_leaf.wake_ms = wake_ms > UINT16_MAX ? UINT16_MAX : wake_ms;
+    transport->deinit();
+
+    return ret;
+#else
+    return MDF_ERR_NOT_SUPPORTED;
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+}
+
+void mesh_espnow_leaf_sleep(uint32_t sleep_ms)
+{
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+    /**< mA x mV x us and uA x mV x ms are both pJ */
+    uint64_t awake_us = esp_timer_get_time();
+    uint64_t energy_pj = (uint64_t)CONFIG_MESH_ESPNOW_ACTIVE_MA * CONFIG_MESH_ESPNOW_SUPPLY_MV * awake_us
+                         + (uint64_t)CONFIG_MESH_ESPNOW_SLEEP_UA * CONFIG_MESH_ESPNOW_SUPPLY_MV * sleep_ms;
+    g_mesh_espnow_leaf.energy_uj = energy_pj / 1000000;
+
+    MDF_LOGI("Awake: %lldms, sent after: %dms, next reading in %ums, energy per reading: %uuJ",
+             awake_us / 1000, g_mesh_espnow_leaf.wake_ms, sleep_ms, g_mesh_espnow_leaf.energy_uj);
+
+    esp_deep_sleep((uint64_t)sleep_ms * 1000);
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+}
+
+uint32_t mesh_espnow_get_wake_ms()
+{
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+    return g_mesh_espnow_leaf.wake_ms;
+#else
+    return 0;
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+}
+
+uint32_t mesh_espnow_get_relay_num()
+{
+    return g_mesh_espnow.relay_num;
+}
@@ -0,0 +1,175 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_espnow.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include "mesh_static.h"
+
+#define MESH_ESPNOW_RX_QUEUE_NUM       (8)
+#define MESH_ESPNOW_SEND_TIMEOUT_MS    (100)
+
+typedef struct {
+    uint8_t src_addr[MESH_ESPNOW_ADDR_LEN];
+    uint8_t size;                      /**< 0 stops the task */
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} mesh_espnow_rx_t;
+
+static struct mesh_espnow_transport {
+    mesh_espnow_recv_cb_t recv_cb;
+    QueueHandle_t rx_queue;
+    SemaphoreHandle_t sent;            /**< Given by the send callback */
+    bool send_ok;
+    TaskHandle_t task;
+} g_mesh_espnow_transport;
+
+MESH_STATIC_QUEUE_DEFINE(espnow_rx, MESH_ESPNOW_RX_QUEUE_NUM, sizeof(mesh_espnow_rx_t));
+MESH_STATIC_SEMAPHORE_DEFINE(espnow_sent);
+MESH_STATIC_TASK_DEFINE(espnow, 3 * 1024);
+MESH_STATIC_BUFFER_DEFINE(espnow_rx, sizeof(mesh_espnow_rx_t));
+
+static const char *TAG = "mesh_espnow_transport";
+
+/**
+ * @brief Runs in the Wi-Fi task, the frame is handed over and never waited for
+ */
+static void mesh_espnow_wifi_recv_cb(const uint8_t *mac_addr, const uint8_t *data, int data_len)
+{
+    mesh_espnow_rx_t rx = {.size = data_len};
+
+    if (data_len <= 0 || data_len > ESP_NOW_MAX_DATA_LEN) {
+        return;
+    }
+
+    memcpy(rx.src_addr, mac_addr, MESH_ESPNOW_ADDR_LEN);
+    memcpy(rx.data, data, data_len);
+
+    if (xQueueSend(g_mesh_espnow_transport.rx_queue, &rx, 0) != pdTRUE) {
+        MDF_LOGD("Receive queue is full, drop a frame of " MACSTR, MAC2STR(mac_addr));
+    }
+}
+
+static void mesh_espnow_wifi_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
+{
+    g_mesh_espnow_transport.send_ok = status == ESP_NOW_SEND_SUCCESS;
+    xSemaphoreGive(g_mesh_espnow_transport.sent);
+}
+
+static void mesh_espnow_wifi_task(void *arg)
+{
+    mesh_espnow_rx_t *rx = MESH_STATIC_MALLOC(espnow_rx, sizeof(mesh_espnow_rx_t));
+
+    while (rx && xQueueReceive(g_mesh_espnow_transport.rx_queue, rx, portMAX_DELAY) == pdTRUE && rx->size) {
+        /**< ESP-IDF 4.4 does not pass the RSSI of ESP-NOW frames */
+        g_mesh_espnow_transport.recv_cb(rx->src_addr, rx->data, rx->size, 0);
+    }
+
+    MESH_STATIC_FREE(espnow_rx, rx);
+    g_mesh_espnow_transport.task = NULL;
+    MESH_STATIC_TASK_EXIT();
+}
+
+static mdf_err_t mesh_espnow_wifi_init(mesh_espnow_recv_cb_t recv_cb)
+{
+    MDF_PARAM_CHECK(recv_cb);
+    MDF_ERROR_CHECK(g_mesh_espnow_transport.task, MDF_ERR_INVALID_STATE, "ESP-NOW transport is already running");
+
+    /**< Kept across init and deinit, a leaf runs them once per wake-up */
+    if (!g_mesh_espnow_transport.rx_queue) {
+        g_mesh_espnow_transport.rx_queue = MESH_STATIC_QUEUE_CREATE(espnow_rx, MESH_ESPNOW_RX_QUEUE_NUM,
+                                                                    sizeof(mesh_espnow_rx_t));
+        g_mesh_espnow_transport.sent = MESH_STATIC_BINARY_CREATE(espnow_sent);
+        MDF_ERROR_CHECK(!g_mesh_espnow_transport.rx_queue || !g_mesh_espnow_transport.sent,
+                        MDF_ERR_NO_MEM, "Create queue failed");
+    }
+
+    xQueueReset(g_mesh_espnow_transport.rx_queue);
+    g_mesh_espnow_transport.recv_cb = recv_cb;
+
+    mdf_err_t ret = esp_now_init();
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_now_init", mdf_err_to_name(ret));
+    esp_now_register_recv_cb(mesh_espnow_wifi_recv_cb);
+    esp_now_register_send_cb(mesh_espnow_wifi_send_cb);
+
+    MESH_STATIC_TASK_CREATE(espnow, mesh_espnow_wifi_task, "mesh_espnow",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, &g_mesh_espnow_transport.task);
+
+    return MDF_OK;
+}
+
+static mdf_err_t mesh_espnow_wifi_set_channel(uint8_t channel)
+{
+    return esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+}
+
+/**
+ * @brief Peers are added for the time of a send, the table of ESP-NOW only
+ *        holds 20 of them and a relay answers any number of leaves
+ */
+static mdf_err_t mesh_espnow_wifi_send(const uint8_t *dest_addr, const void *data, size_t size)
+{
+    mdf_err_t ret = MDF_OK;
+    bool added = false;
+
+    MDF_PARAM_CHECK(dest_addr);
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(size > ESP_NOW_MAX_DATA_LEN, MDF_ERR_INVALID_ARG, "Frame is too long, size: %d", size);
+
+    if (!esp_now_is_peer_exist(dest_addr)) {
+        esp_now_peer_info_t peer = {
+            .channel = 0, /**< Current channel */
+            .ifidx = WIFI_IF_STA,
+        };
+
+        memcpy(peer.peer_addr, dest_addr, MESH_ESPNOW_ADDR_LEN);
+        ret = esp_now_add_peer(&peer);
+        MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_now_add_peer", mdf_err_to_name(ret));
+        added = true;
+    }
+
+    xSemaphoreTake(g_mesh_espnow_transport.sent, 0);
+    ret = esp_now_send(dest_addr, data, size);
+
+    if (ret == ESP_OK) {
+        /**< The callback reports the MAC acknowledgement of a unicast frame */
+        ret = xSemaphoreTake(g_mesh_espnow_transport.sent, pdMS_TO_TICKS(MESH_ESPNOW_SEND_TIMEOUT_MS)) != pdTRUE
+              ? MDF_ERR_TIMEOUT : g_mesh_espnow_transport.send_ok ? MDF_OK : MDF_FAIL;
+    }
+
+    if (added) {
+        esp_now_del_peer(dest_addr);
+    }
+
+    return ret;
+}
+
+static void mesh_espnow_wifi_deinit()
+{
+    mesh_espnow_rx_t stop = {.size = 0};
+
+    esp_now_unregister_recv_cb();
+    esp_now_unregister_send_cb();
+    esp_now_deinit();
+
+    if (g_mesh_espnow_transport.task) {
+        xQueueSend(g_mesh_espnow_transport.rx_queue, &stop, portMAX_DELAY);
+    }
+}
+
+const mesh_espnow_transport_t mesh_espnow_transport_wifi = {
+    .init = mesh_espnow_wifi_init,
+    .set_channel = mesh_espnow_wifi_set_channel,
+    .send = mesh_espnow_wifi_send,
+    .deinit = mesh_espnow_wifi_deinit,
+};
@@ -0,0 +1,115 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_FAIRQ_H__
+#define __MESH_FAIRQ_H__
+
+#include "mdf_common.h"
+#include "mwifi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief  Handler of a scheduled message, runs in the task of the queue
+ *
+ * @param  src_addr  node the message was read from
+ * @param  data_type type of the message
+ * @param  data      pointer of the message, freed when the handler returns
+ * @param  size      length of the message
+ */
+typedef void (*mesh_fairq_handler_t)(const uint8_t *src_addr, const mwifi_data_type_t *data_type,
+                                     char *data, size_t size);
+
+/**
+ * @brief  Initialize the queue, the memory is only allocated once
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NO_MEM
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_fairq_init();
+
+/**
+ * @brief  Start the task that hands the queued messages to the handler,
+ *         called when the device becomes the root
+ *
+ * @param  handler handler of the messages
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_fairq_start(mesh_fairq_handler_t handler);
+
+/**
+ * @brief  Stop the task, messages still queued are dropped
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_fairq_stop();
+
+/**
+ * @brief  Take a token from the bucket of a node
+ *
+ * @param  addr node the message originates from
+ *
+ * @note   A node over its rate is counted in MESH_METRICS_UPLINK_THROTTLED
+ *         and in its next throttling report
+ *
+ * @return true if the message may be forwarded
+ */
+bool mesh_fairq_admit(const uint8_t *addr);
+
+/**
+ * @brief  Queue a message behind the earlier messages of its source node
+ *
+ * @param  src_addr  node the message was read from
+ * @param  data_type type of the message
+ * @param  data      pointer of the message, allocated with MDF_MALLOC. The queue
+ *                   takes ownership and frees it on every path, including errors.
+ * @param  size      length of the message
+ *
+ * @note   Without CONFIG_MESH_FAIRQ_ENABLE the handler runs in the caller.
+ *         A message dropped because the queue is full still returns MDF_OK,
+ *         it is counted in MESH_METRICS_MQTT_DROP and in the throttling report.
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_NO_MEM
+ *     - MDF_ERR_INVALID_STATE, the queue has not been started
+ */
+mdf_err_t mesh_fairq_push(const uint8_t *src_addr, const mwifi_data_type_t *data_type, char *data, size_t size);
+
+/**
+ * @brief  Number of queued messages, for a metrics gauge
+ */
+uint32_t mesh_fairq_get_queue_num();
+
+/**
+ * @brief  Number of nodes that had messages dropped since the last report, for a metrics gauge
+ */
+uint32_t mesh_fairq_get_throttled_num();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_FAIRQ_H__ */
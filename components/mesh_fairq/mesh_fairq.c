@@ -0,0 +1,445 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_fairq.h"
+#include "mesh_metrics.h"
+#include "mesh_mqtt_handle.h"
+#include "mesh_static.h"
+#include <sys/param.h>
+
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+
+#define MESH_FAIRQ_QUANTUM      (MWIFI_PAYLOAD_LEN)  /**< Bytes a node may send per round, at least one message */
+#define MESH_FAIRQ_TOKEN        (60 * 1000)          /**< A message, in units of the refill per ms */
+#define MESH_FAIRQ_REPORT_LEN   (48)
+
+typedef struct mesh_fairq_item {
+    struct mesh_fairq_item *next;
+    mwifi_data_type_t data_type;
+    size_t size;
+    char *data;
+} mesh_fairq_item_t;
+
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint32_t tokens;            /**< CONFIG_MESH_FAIRQ_RATE per ms, MESH_FAIRQ_TOKEN per message */
+    TickType_t refill;          /**< Tick of the last refill, also the last activity */
+    uint32_t throttled;         /**< Messages dropped since the last report */
+    uint32_t deficit;           /**< Bytes the node may still send in this round */
+    size_t queue_num;
+    mesh_fairq_item_t *head;
+    mesh_fairq_item_t *tail;
+} mesh_fairq_node_t;
+
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+
+static struct mesh_fairq {
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+    SemaphoreHandle_t lock;
+    size_t node_num;
+    mesh_fairq_node_t nodes[CONFIG_MESH_FAIRQ_NODE_MAX_NUM];
+    size_t queue_num;
+    size_t cursor;              /**< Node served in the current round */
+    bool granted;               /**< The node at the cursor got its quantum in this round */
+    uint32_t throttled_num;     /**< Nodes throttled in the last report interval */
+    TaskHandle_t task;
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+    mesh_fairq_handler_t handler;
+    bool running;
+} g_mesh_fairq;
+
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+MESH_STATIC_MUTEX_DEFINE(fairq);
+MESH_STATIC_TASK_DEFINE(fairq, 8 * 1024);
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+
+static const char *TAG = "mesh_fairq";
+
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+
+/**
+ * @brief Find or add the state of a node, must be called with the lock held
+ *
+ * @note  With the table full the least recently active node without queued
+ *        messages is replaced, NULL if every node has messages queued
+ */
+static mesh_fairq_node_t *mesh_fairq_node_get(const uint8_t *addr)
+{
+    mesh_fairq_node_t *idle = NULL;
+    TickType_t now = xTaskGetTickCount();
+
+    for (int i = 0; i < g_mesh_fairq.node_num; ++i) {
+        mesh_fairq_node_t *node = g_mesh_fairq.nodes + i;
+
+        if (!memcmp(node->addr, addr, MWIFI_ADDR_LEN)) {
+            return node;
+        }
+
+        if (node->queue_num == 0 && (idle == NULL || now - node->refill > now - idle->refill)) {
+            idle = node;
+        }
+    }
+
+    if (g_mesh_fairq.node_num < CONFIG_MESH_FAIRQ_NODE_MAX_NUM) {
+        idle = g_mesh_fairq.nodes + g_mesh_fairq.node_num++;
+    } else if (idle == NULL) {
+        return NULL;
+    }
+
+    memset(idle, 0, sizeof(mesh_fairq_node_t));
+    memcpy(idle->addr, addr, MWIFI_ADDR_LEN);
+    idle->tokens = CONFIG_MESH_FAIRQ_BURST * MESH_FAIRQ_TOKEN;
+    idle->refill = now;
+
+    return idle;
+}
+
+/**
+ * @brief Drop the oldest message of the node with the longest queue, must be
+ *        called with the lock held
+ */
+static void mesh_fairq_drop_longest()
+{
+    mesh_fairq_node_t *longest = g_mesh_fairq.nodes;
+
+    for (int i = 1; i < g_mesh_fairq.node_num; ++i) {
+        if (g_mesh_fairq.nodes[i].queue_num > longest->queue_num) {
+            longest = g_mesh_fairq.nodes + i;
+        }
+    }
+
+    mesh_fairq_item_t *item = longest->head;
+    longest->head = item->next;
+    longest->tail = longest->head ? longest->tail : NULL;
+    longest->queue_num--;
+    longest->throttled++;
+    g_mesh_fairq.queue_num--;
+
+    MDF_FREE(item->data);
+    MDF_FREE(item);
+    mesh_metrics_inc(MESH_METRICS_MQTT_DROP);
+}
+
+/**
+ * @brief Next message by deficit round robin, must be called with the lock held
+ *
+ * @note  Every node with queued messages gets MESH_FAIRQ_QUANTUM bytes per
+ *        round and keeps the cursor until its next message does not fit, so
+ *        a node gets the same share of the uplink whatever its message rate
+ */
+static mesh_fairq_item_t *mesh_fairq_dequeue(uint8_t *addr)
+{
+    while (g_mesh_fairq.queue_num > 0) {
+        mesh_fairq_node_t *node = g_mesh_fairq.nodes + g_mesh_fairq.cursor;
+
+        if (node->head != NULL && !g_mesh_fairq.granted) {
+            node->deficit += MESH_FAIRQ_QUANTUM;
+            g_mesh_fairq.granted = true;
+        }
+
+        if (node->head != NULL && node->head->size <= node->deficit) {
+            mesh_fairq_item_t *item = node->head;
+            node->head = item->next;
+            node->tail = node->head ? node->tail : NULL;
+            node->queue_num--;
+            node->deficit = node->head ? node->deficit - item->size : 0;
+            g_mesh_fairq.queue_num--;
+            memcpy(addr, node->addr, MWIFI_ADDR_LEN);
+            return item;
+        }
+
+        node->deficit = node->head ? node->deficit : 0;
+        g_mesh_fairq.cursor = (g_mesh_fairq.cursor + 1) % g_mesh_fairq.node_num;
+        g_mesh_fairq.granted = false;
+    }
+
+    return NULL;
+}
+
+static void mesh_fairq_report()
+{
+    char buffer[MESH_FAIRQ_REPORT_LEN];
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint32_t throttled_num = 0;
+
+    /**< One node at a time, the publishes must not hold up the root task */
+    for (int i = 0;; ++i) {
+        uint32_t throttled = 0;
+
+        xSemaphoreTake(g_mesh_fairq.lock, portMAX_DELAY);
+
+        for (; i < g_mesh_fairq.node_num; ++i) {
+            if (g_mesh_fairq.nodes[i].throttled) {
+                throttled = g_mesh_fairq.nodes[i].throttled;
+                g_mesh_fairq.nodes[i].throttled = 0;
+                memcpy(addr, g_mesh_fairq.nodes[i].addr, MWIFI_ADDR_LEN);
+                break;
+            }
+        }
+
+        xSemaphoreGive(g_mesh_fairq.lock);
+
+        if (!throttled) {
+            break;
+        }
+
+        throttled_num++;
+        MDF_LOGW("Node " MACSTR " is over its uplink share, %u messages dropped", MAC2STR(addr), throttled);
+
+        int size = snprintf(buffer, sizeof(buffer), "{\"throttled\":%u,\"window\":%d}",
+                            throttled, CONFIG_MESH_FAIRQ_REPORT_INTERVAL_S);
+        mdf_err_t ret = mesh_mqtt_write_diag(addr, buffer, size);
+
+        if (ret != MDF_OK) {
+            MDF_LOGD("<%s> mesh_mqtt_write_diag", mdf_err_to_name(ret));
+        }
+    }
+
+    g_mesh_fairq.throttled_num = throttled_num;
+}
+
+static void mesh_fairq_task(void *arg)
+{
+    uint8_t addr[MWIFI_ADDR_LEN];
+    TickType_t interval = pdMS_TO_TICKS(CONFIG_MESH_FAIRQ_REPORT_INTERVAL_S * 1000);
+    TickType_t report = xTaskGetTickCount();
+
+    MDF_LOGI("Mesh fairq task is running");
+
+    while (g_mesh_fairq.running) {
+        xSemaphoreTake(g_mesh_fairq.lock, portMAX_DELAY);
+        mesh_fairq_item_t *item = mesh_fairq_dequeue(addr);
+        xSemaphoreGive(g_mesh_fairq.lock);
+
+        if (item != NULL) {
+            g_mesh_fairq.handler(addr, &item->data_type, item->data, item->size);
+            MDF_FREE(item->data);
+            MDF_FREE(item);
+        }
+
+        TickType_t elapsed = xTaskGetTickCount() - report;
+
+        if (elapsed >= interval) {
+            report += elapsed;
+            mesh_fairq_report();
+        } else if (item == NULL) {
+            ulTaskNotifyTake(pdTRUE, interval - elapsed);
+        }
+    }
+
+    xSemaphoreTake(g_mesh_fairq.lock, portMAX_DELAY);
+
+    if (g_mesh_fairq.queue_num) {
+        MDF_LOGW("Drop %d queued messages", g_mesh_fairq.queue_num);
+    }
+
+    for (int i = 0; i < g_mesh_fairq.node_num; ++i) {
+        for (mesh_fairq_item_t *item = g_mesh_fairq.nodes[i].head, *next = NULL; item; item = next) {
+            next = item->next;
+            MDF_FREE(item->data);
+            MDF_FREE(item);
+        }
+    }
+
+    g_mesh_fairq.node_num = 0;
+    g_mesh_fairq.queue_num = 0;
+    xSemaphoreGive(g_mesh_fairq.lock);
+
+    MDF_LOGW("Mesh fairq task is exit");
+
+    g_mesh_fairq.task = NULL;
+    MESH_STATIC_TASK_EXIT();
+}
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+
+mdf_err_t mesh_fairq_init()
+{
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+    MDF_ERROR_CHECK(g_mesh_fairq.lock != NULL, MDF_ERR_INVALID_STATE, "Mesh fairq is already initialized");
+
+    g_mesh_fairq.lock = MESH_STATIC_MUTEX_CREATE(fairq);
+    MDF_ERROR_CHECK(g_mesh_fairq.lock == NULL, MDF_ERR_NO_MEM, "Create mutex failed");
+
+    MDF_LOGI("Uplink per node: %d messages/min, burst %d", CONFIG_MESH_FAIRQ_RATE, CONFIG_MESH_FAIRQ_BURST);
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_fairq_start(mesh_fairq_handler_t handler)
+{
+    MDF_PARAM_CHECK(handler);
+
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+    MDF_ERROR_CHECK(g_mesh_fairq.lock == NULL, MDF_ERR_INVALID_STATE, "Mesh fairq is not initialized");
+    MDF_ERROR_CHECK(g_mesh_fairq.running || g_mesh_fairq.task, MDF_ERR_INVALID_STATE, "Mesh fairq is already running");
+
+    xSemaphoreTake(g_mesh_fairq.lock, portMAX_DELAY);
+    g_mesh_fairq.cursor = 0;
+    g_mesh_fairq.granted = false;
+    g_mesh_fairq.throttled_num = 0;
+    xSemaphoreGive(g_mesh_fairq.lock);
+
+    g_mesh_fairq.handler = handler;
+    g_mesh_fairq.running = true;
+    MESH_STATIC_TASK_CREATE(fairq, mesh_fairq_task, "mesh_fairq",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, &g_mesh_fairq.task);
+#else
+    MDF_ERROR_CHECK(g_mesh_fairq.running, MDF_ERR_INVALID_STATE, "Mesh fairq is already running");
+
+    g_mesh_fairq.handler = handler;
+    g_mesh_fairq.running = true;
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_fairq_stop()
+{
+    MDF_ERROR_CHECK(!g_mesh_fairq.running, MDF_ERR_INVALID_STATE, "Mesh fairq has not been started");
+
+    g_mesh_fairq.running = false;
+
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+    if (g_mesh_fairq.task) {
+        xTaskNotifyGive(g_mesh_fairq.task);
+    }
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+
+    return MDF_OK;
+}
+
+bool mesh_fairq_admit(const uint8_t *addr)
+{
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+    bool admitted = true;
+
+    if (addr == NULL || g_mesh_fairq.lock == NULL) {
+        return true;
+    }
+
+    xSemaphoreTake(g_mesh_fairq.lock, portMAX_DELAY);
+    mesh_fairq_node_t *node = mesh_fairq_node_get(addr);
+
+    if (node != NULL) {
+        /**< 64 bits, a node quiet for days must not overflow the refill */
+        TickType_t now = xTaskGetTickCount();
+        uint64_t tokens = node->tokens + (uint64_t)(now - node->refill) * portTICK_PERIOD_MS * CONFIG_MESH_FAIRQ_RATE;
+        node->tokens = MIN(tokens, CONFIG_MESH_FAIRQ_BURST * MESH_FAIRQ_TOKEN);
+        node->refill = now;
+
+        if (node->tokens >= MESH_FAIRQ_TOKEN) {
+            node->tokens -= MESH_FAIRQ_TOKEN;
+        } else {
+            node->throttled++;
+            admitted = false;
+        }
+    }
+
+    xSemaphoreGive(g_mesh_fairq.lock);
+
+    if (!admitted) {
+        mesh_metrics_inc(MESH_METRICS_UPLINK_THROTTLED);
+    }
+
+    return admitted;
+#else
+    return true;
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+}
+
+mdf_err_t mesh_fairq_push(const uint8_t *src_addr, const mwifi_data_type_t *data_type, char *data, size_t size)
+{
+    if (!src_addr || !data_type || !data) {
+        MDF_FREE(data);
+        return MDF_ERR_INVALID_ARG;
+    }
+
+    if (!g_mesh_fairq.running) {
+        MDF_FREE(data);
+        MDF_LOGW("Mesh fairq has not been started");
+        return MDF_ERR_INVALID_STATE;
+    }
+
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+    mesh_fairq_item_t *item = MDF_MALLOC(sizeof(mesh_fairq_item_t));
+
+    if (item == NULL) {
+        MDF_FREE(data);
+        return MDF_ERR_NO_MEM;
+    }
+
+    item->next = NULL;
+    item->data_type = *data_type;
+    item->size = size;
+    item->data = data;
+
+    xSemaphoreTake(g_mesh_fairq.lock, portMAX_DELAY);
+    mesh_fairq_node_t *node = mesh_fairq_node_get(src_addr);
+
+    if (node != NULL) {
+        if (node->tail) {
+            node->tail->next = item;
+        } else {
+            node->head = item;
+        }
+
+        node->tail = item;
+        node->queue_num++;
+        g_mesh_fairq.queue_num++;
+
+        /**< After the append, a node with the longest queue loses its own oldest message */
+        if (g_mesh_fairq.queue_num > CONFIG_MESH_FAIRQ_QUEUE_MAX_NUM) {
+            mesh_fairq_drop_longest();
+        }
+    }
+
+    xSemaphoreGive(g_mesh_fairq.lock);
+
+    if (node == NULL) {
+        MDF_LOGW("Every tracked node has queued messages, drop message from " MACSTR, MAC2STR(src_addr));
+        mesh_metrics_inc(MESH_METRICS_MQTT_DROP);
+        MDF_FREE(item->data);
+        MDF_FREE(item);
+        return MDF_OK;
+    }
+
+    if (g_mesh_fairq.task) {
+        xTaskNotifyGive(g_mesh_fairq.task);
+    }
+#else
+    g_mesh_fairq.handler(src_addr, data_type, data, size);
+    MDF_FREE(data);
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+
+    return MDF_OK;
+}
+
+uint32_t mesh_fairq_get_queue_num()
+{
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+    return g_mesh_fairq.queue_num;
+#else
+    return 0;
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+}
+
+uint32_t mesh_fairq_get_throttled_num()
+{
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+    return g_mesh_fairq.throttled_num;
+#else
+    return 0;
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+}
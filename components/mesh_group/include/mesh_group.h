@@ -0,0 +1,115 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_GROUP_H__
+#define __MESH_GROUP_H__
+
+#include "mdf_common.h"
+#include "mwifi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MESH_GROUP_NAME_MAX_LEN   (16)  /**< Including the terminating null */
+#define MESH_GROUP_EXPAND_MAX_NUM (8)   /**< Groups a single command may address */
+
+/**
+ * @brief  Load the group table from NVS
+ *
+ * @note   NVS must have been initialized. Only the root uses the table,
+ *         the standby roots receive a copy with the root state snapshot.
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_group_init();
+
+/**
+ * @brief  Apply an incremental update of the group table and persist it
+ *
+ * @param  data pointer of a JSON object, e.g.
+ *              {"groups":[{"id":1,"name":"greenhouse1","add":["30aea4000002"],"remove":["30aea4000003"]},
+ *                         {"id":2,"set":["30aea4000004","30aea4000005"]},
+ *                         {"id":3,"delete":true}]}
+ * @param  size length of data
+ *
+ * @note   A group is created by the first update that names its id. The
+ *         update is validated as a whole, nothing is applied on an error.
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_NO_MEM, the table of groups or of nodes is full
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_group_update(const char *data, size_t size);
+
+/**
+ * @brief  Expand groups to the addresses of their members
+ *
+ * @param  ids        ids of the groups
+ * @param  id_num     number of ids, at most MESH_GROUP_EXPAND_MAX_NUM
+ * @param  addrs_list output, MDF_MALLOC'd list of addresses, free it with MDF_FREE
+ * @param  addrs_num  output, number of addresses, a node in several groups is listed once
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND, no known group or no members
+ *     - MDF_ERR_NO_MEM
+ *     - MDF_ERR_NOT_INIT
+ */
+mdf_err_t mesh_group_expand(const uint16_t *ids, size_t id_num, uint8_t **addrs_list, size_t *addrs_num);
+
+/**
+ * @brief  Serialize the group table for a standby root, only the nodes in
+ *         use and the groups that exist are written
+ *
+ * @param  buffer output buffer
+ * @param  size   length of the buffer
+ *
+ * @return Length of the table, 0 if it does not fit or the groups have not
+ *         been initialized
+ */
+size_t mesh_group_export(uint8_t *buffer, size_t size);
+
+/**
+ * @brief  Replace the group table with one written by mesh_group_export()
+ *         and persist it, NVS is not written if nothing changed
+ *
+ * @param  data pointer of the table
+ * @param  size length of the table
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG, malformed or built with other limits
+ *     - MDF_ERR_NO_MEM
+ *     - MDF_ERR_NOT_INIT
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_group_import(const uint8_t *data, size_t size);
+
+/**
+ * @brief  Get the number of groups
+ *
+ * @return Number of groups
+ */
+uint32_t mesh_group_get_num();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_GROUP_H__ */
@@ -0,0 +1,513 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mesh_group.h"
+#include "cJSON.h"
+#include "mlink.h"
+#include "nvs.h"
+#include "mesh_static.h"
+#include <ctype.h>
+
+#define MESH_GROUP_NAMESPACE      "mesh_group"
+#define MESH_GROUP_KEY            "table"
+#define MESH_GROUP_TABLE_VERSION  (1)
+#define MESH_GROUP_BITMAP_LEN     ((CONFIG_MESH_GROUP_NODE_MAX_NUM + 31) / 32)
+
+/**< mesh_group_export(): version, group_num, node_num (2), then the nodes in use and the groups */
+#define MESH_GROUP_EXPORT_HEADER_LEN (4)
+#define MESH_GROUP_EXPORT_NODE_LEN   (1 + MWIFI_ADDR_LEN)
+#define MESH_GROUP_EXPORT_ENTRY_LEN  (2 + MESH_GROUP_NAME_MAX_LEN + MESH_GROUP_BITMAP_LEN * 4)
+
+typedef struct {
+    uint16_t id;                              /**< 0 marks a free entry */
+    char name[MESH_GROUP_NAME_MAX_LEN];
+    uint32_t members[MESH_GROUP_BITMAP_LEN];  /**< Bit i is set if nodes[i] is a member */
+} mesh_group_entry_t;
+
+/**
+ * @brief The table as stored in NVS. A node slot is in use as long as its
+ *        bit is set in any group.
+ */
+typedef struct {
+    uint16_t version;
+    uint16_t group_max_num;                   /**< CONFIG_MESH_GROUP_MAX_NUM of the stored table */
+    uint16_t node_max_num;                    /**< CONFIG_MESH_GROUP_NODE_MAX_NUM of the stored table */
+    uint8_t nodes[CONFIG_MESH_GROUP_NODE_MAX_NUM][MWIFI_ADDR_LEN];
+    mesh_group_entry_t groups[CONFIG_MESH_GROUP_MAX_NUM];
+} mesh_group_table_t;
+
+static struct mesh_group {
+    SemaphoreHandle_t lock;
+    mesh_group_table_t table;
+} g_mesh_group;
+
+MESH_STATIC_MUTEX_DEFINE(group);
+
+static const char *TAG = "mesh_group";
+
+static void mesh_group_table_reset(mesh_group_table_t *table)
+{
+    memset(table, 0, sizeof(mesh_group_table_t));
+    table->version = MESH_GROUP_TABLE_VERSION;
+    table->group_max_num = CONFIG_MESH_GROUP_MAX_NUM;
+    table->node_max_num = CONFIG_MESH_GROUP_NODE_MAX_NUM;
+}
+
+static mdf_err_t mesh_group_load(mesh_group_table_t *table)
+{
+    nvs_handle_t handle = 0;
+    size_t size = sizeof(mesh_group_table_t);
+
+    mdf_err_t ret = nvs_open(MESH_GROUP_NAMESPACE, NVS_READONLY, &handle);
+
+    if (ret == ESP_OK) {
+        ret = nvs_get_blob(handle, MESH_GROUP_KEY, table, &size);
+        nvs_close(handle);
+    }
+
+    /**< Nothing stored yet, the namespace is only created by the first save */
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        mesh_group_table_reset(table);
+        return MDF_OK;
+    }
+
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> nvs_get_blob", mdf_err_to_name(ret));
+
+    /**< Bitmaps and indexes change meaning with the limits, start over */
+    if (size != sizeof(mesh_group_table_t) || table->version != MESH_GROUP_TABLE_VERSION
+            || table->group_max_num != CONFIG_MESH_GROUP_MAX_NUM || table->node_max_num != CONFIG_MESH_GROUP_NODE_MAX_NUM) {
+        MDF_LOGW("Stored table does not match the configuration, discard it");
+        return MDF_ERR_INVALID_SIZE;
+    }
+
+    return MDF_OK;
+}
+
+static mdf_err_t mesh_group_save(const mesh_group_table_t *table)
+{
+    nvs_handle_t handle = 0;
+
+    mdf_err_t ret = nvs_open(MESH_GROUP_NAMESPACE, NVS_READWRITE, &handle);
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> nvs_open", mdf_err_to_name(ret));
+
+    ret = nvs_set_blob(handle, MESH_GROUP_KEY, table, sizeof(mesh_group_table_t));
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> nvs_set_blob", mdf_err_to_name(ret));
+    ret = nvs_commit(handle);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> nvs_commit", mdf_err_to_name(ret));
+
+EXIT:
+    nvs_close(handle);
+    return ret;
+}
+
+static mesh_group_entry_t *mesh_group_find(mesh_group_table_t *table, uint16_t id)
+{
+    for (int i = 0; i < CONFIG_MESH_GROUP_MAX_NUM; ++i) {
+        if (table->groups[i].id == id) {
+            return table->groups + i;
+        }
+    }
+
+    return NULL;
+}
+
+static bool mesh_group_parse_mac(const cJSON *item, uint8_t *mac)
+{
+    if (!cJSON_IsString(item) || strlen(item->valuestring) != MWIFI_ADDR_LEN * 2) {
+        return false;
+    }
+
+    for (int i = 0; i < MWIFI_ADDR_LEN * 2; ++i) {
+        if (!isxdigit((int)item->valuestring[i])) {
+            return false;
+        }
+    }
+
+    mlink_mac_str2hex(item->valuestring, mac);
+    return true;
+}
+
+/**
+ * @brief Slot of a node, a free slot is taken if the node is not known yet
+ *
+ * @return Index of the slot, -1 if the table of nodes is full
+ */
+static int mesh_group_node_slot(mesh_group_table_t *table, const uint8_t *mac, bool add)
+{
+    uint32_t used[MESH_GROUP_BITMAP_LEN] = {0};
+    int free_slot = -1;
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_MAX_NUM; ++i) {
+        for (int j = 0; table->groups[i].id && j < MESH_GROUP_BITMAP_LEN; ++j) {
+            used[j] |= table->groups[i].members[j];
+        }
+    }
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_NODE_MAX_NUM; ++i) {
+        if (!(used[i / 32] & (1UL << (i % 32)))) {
+            free_slot = free_slot < 0 ? i : free_slot;
+        } else if (!memcmp(table->nodes[i], mac, MWIFI_ADDR_LEN)) {
+            return i;
+        }
+    }
+
+    if (add && free_slot >= 0) {
+        memcpy(table->nodes[free_slot], mac, MWIFI_ADDR_LEN);
+    }
+
+    return add ? free_slot : -1;
+}
+
+static mdf_err_t mesh_group_apply_members(mesh_group_table_t *table, mesh_group_entry_t *group,
+                                          const cJSON *list, bool add)
+{
+    const cJSON *item = NULL;
+    uint8_t mac[MWIFI_ADDR_LEN];
+
+    MDF_ERROR_CHECK(!cJSON_IsArray(list), MDF_ERR_INVALID_ARG, "Members should be array type");
+
+    cJSON_ArrayForEach(item, list) {
+        MDF_ERROR_CHECK(!mesh_group_parse_mac(item, mac), MDF_ERR_INVALID_ARG, "Invalid member address");
+
+        int slot = mesh_group_node_slot(table, mac, add);
+
+        if (add) {
+            MDF_ERROR_CHECK(slot < 0, MDF_ERR_NO_MEM, "Table of nodes is full");
+            group->members[slot / 32] |= 1UL << (slot % 32);
+        } else if (slot >= 0) {
+            group->members[slot / 32] &= ~(1UL << (slot % 32));
+        }
+    }
+
+    return MDF_OK;
+}
+
+static mdf_err_t mesh_group_apply(mesh_group_table_t *table, const cJSON *update)
+{
+    mdf_err_t ret = MDF_OK;
+    const cJSON *id = cJSON_GetObjectItem(update, "id");
+    const cJSON *name = cJSON_GetObjectItem(update, "name");
+    const cJSON *delete = cJSON_GetObjectItem(update, "delete");
+    const cJSON *set = cJSON_GetObjectItem(update, "set");
+    const cJSON *add = cJSON_GetObjectItem(update, "add");
+    const cJSON *remove = cJSON_GetObjectItem(update, "remove");
+
+    MDF_ERROR_CHECK(!cJSON_IsNumber(id) || id->valuedouble < 1 || id->valuedouble > UINT16_MAX,
+                    MDF_ERR_INVALID_ARG, "Group id should be a number in [1, 65535]");
+    MDF_ERROR_CHECK(name && (!cJSON_IsString(name) || strlen(name->valuestring) >= MESH_GROUP_NAME_MAX_LEN),
+                    MDF_ERR_INVALID_ARG, "Group name should be a string of at most %d characters", MESH_GROUP_NAME_MAX_LEN - 1);
+
+    mesh_group_entry_t *group = mesh_group_find(table, (uint16_t)id->valuedouble);
+
+    if (cJSON_IsTrue(delete)) {
+        if (group) {
+            memset(group, 0, sizeof(mesh_group_entry_t));
+        }
+
+        return MDF_OK;
+    }
+
+    if (group == NULL) {
+        group = mesh_group_find(table, 0);
+        MDF_ERROR_CHECK(group == NULL, MDF_ERR_NO_MEM, "Table of groups is full");
+        group->id = (uint16_t)id->valuedouble;
+    }
+
+    if (name) {
+        memset(group->name, 0, sizeof(group->name));
+        strcpy(group->name, name->valuestring);
+    }
+
+    /**< Members that leave free their slots before new ones take them */
+    if (set) {
+        memset(group->members, 0, sizeof(group->members));
+        ret = mesh_group_apply_members(table, group, set, true);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> Set members of group %d", mdf_err_to_name(ret), group->id);
+    }
+
+    if (remove) {
+        ret = mesh_group_apply_members(table, group, remove, false);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> Remove members of group %d", mdf_err_to_name(ret), group->id);
+    }
+
+    if (add) {
+        ret = mesh_group_apply_members(table, group, add, true);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> Add members to group %d", mdf_err_to_name(ret), group->id);
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_group_init()
+{
+    MDF_ERROR_CHECK(g_mesh_group.lock != NULL, MDF_ERR_INVALID_STATE, "Groups have already been initialized");
+
+    if (mesh_group_load(&g_mesh_group.table) != MDF_OK) {
+        mesh_group_table_reset(&g_mesh_group.table);
+    }
+
+    g_mesh_group.lock = MESH_STATIC_MUTEX_CREATE(group);
+    MDF_ERROR_CHECK(g_mesh_group.lock == NULL, MDF_FAIL, "Create mutex failed");
+
+    MDF_LOGI("Groups: %d", mesh_group_get_num());
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_group_update(const char *data, size_t size)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(g_mesh_group.lock == NULL, MDF_ERR_NOT_INIT, "Groups have not been initialized");
+
+    mdf_err_t ret = MDF_OK;
+    const cJSON *update = NULL;
+    mesh_group_table_t *table = NULL;
+    cJSON *obj = cJSON_ParseWithLength(data, size);
+    cJSON *groups = cJSON_GetObjectItem(obj, "groups");
+
+    if (!cJSON_IsArray(groups)) {
+        MDF_LOGW("groups should be array type");
+        cJSON_Delete(obj);
+        return MDF_ERR_INVALID_ARG;
+    }
+
+    table = MDF_MALLOC(sizeof(mesh_group_table_t));
+
+    if (table == NULL) {
+        MDF_LOGE("Allocate mem failed");
+        cJSON_Delete(obj);
+        return MDF_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(g_mesh_group.lock, portMAX_DELAY);
+    memcpy(table, &g_mesh_group.table, sizeof(mesh_group_table_t));
+
+    cJSON_ArrayForEach(update, groups) {
+        ret = mesh_group_apply(table, update);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_group_apply", mdf_err_to_name(ret));
+    }
+
+    if (memcmp(table, &g_mesh_group.table, sizeof(mesh_group_table_t))) {
+        ret = mesh_group_save(table);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_group_save", mdf_err_to_name(ret));
+        memcpy(&g_mesh_group.table, table, sizeof(mesh_group_table_t));
+    }
+
+EXIT:
+    xSemaphoreGive(g_mesh_group.lock);
+    MDF_FREE(table);
+    cJSON_Delete(obj);
+
+    if (ret == MDF_OK) {
+        MDF_LOGI("Groups updated, %d groups", mesh_group_get_num());
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Addresses of the nodes of a bitmap, must be called with the lock held
+ */
+static mdf_err_t mesh_group_collect(const uint32_t *members, uint8_t **addrs_list, size_t *addrs_num)
+{
+    size_t num = 0;
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_NODE_MAX_NUM; ++i) {
+        num += (members[i / 32] & (1UL << (i % 32))) ? 1 : 0;
+    }
+
+    *addrs_list = NULL;
+    *addrs_num = 0;
+    MDF_ERROR_CHECK(num == 0, MDF_ERR_NOT_FOUND, "No members");
+
+    *addrs_list = MDF_MALLOC(num * MWIFI_ADDR_LEN);
+    MDF_ERROR_CHECK(*addrs_list == NULL, MDF_ERR_NO_MEM, "Allocate mem failed");
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_NODE_MAX_NUM; ++i) {
+        if (members[i / 32] & (1UL << (i % 32))) {
+            memcpy(*addrs_list + (*addrs_num)++ * MWIFI_ADDR_LEN, g_mesh_group.table.nodes[i], MWIFI_ADDR_LEN);
+        }
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_group_expand(const uint16_t *ids, size_t id_num, uint8_t **addrs_list, size_t *addrs_num)
+{
+    MDF_PARAM_CHECK(ids);
+    MDF_PARAM_CHECK(addrs_list);
+    MDF_PARAM_CHECK(addrs_num);
+    MDF_ERROR_CHECK(id_num == 0 || id_num > MESH_GROUP_EXPAND_MAX_NUM, MDF_ERR_INVALID_ARG, "Invalid number of groups: %d", id_num);
+    MDF_ERROR_CHECK(g_mesh_group.lock == NULL, MDF_ERR_NOT_INIT, "Groups have not been initialized");
+
+    mdf_err_t ret = MDF_ERR_NOT_FOUND;
+    uint32_t members[MESH_GROUP_BITMAP_LEN] = {0};
+    bool found = false;
+
+    *addrs_list = NULL;
+    *addrs_num = 0;
+
+    xSemaphoreTake(g_mesh_group.lock, portMAX_DELAY);
+
+    for (size_t i = 0; i < id_num; ++i) {
+        const mesh_group_entry_t *group = ids[i] ? mesh_group_find(&g_mesh_group.table, ids[i]) : NULL;
+
+        if (group == NULL) {
+            MDF_LOGW("Unknown group: %d", ids[i]);
+            continue;
+        }
+
+        for (int j = 0; j < MESH_GROUP_BITMAP_LEN; ++j) {
+            members[j] |= group->members[j];
+        }
+
+        found = true;
+    }
+
+    if (found) {
+        ret = mesh_group_collect(members, addrs_list, addrs_num);
+    }
+
+    xSemaphoreGive(g_mesh_group.lock);
+
+    return ret;
+}
+
+size_t mesh_group_export(uint8_t *buffer, size_t size)
+{
+    MDF_ERROR_CHECK(buffer == NULL || g_mesh_group.lock == NULL, 0, "Groups have not been initialized");
+
+    const mesh_group_table_t *table = &g_mesh_group.table;
+    uint32_t used[MESH_GROUP_BITMAP_LEN] = {0};
+    size_t offset = MESH_GROUP_EXPORT_HEADER_LEN;
+    uint16_t node_num = 0;
+    uint8_t group_num = 0;
+
+    xSemaphoreTake(g_mesh_group.lock, portMAX_DELAY);
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_MAX_NUM; ++i) {
+        for (int j = 0; table->groups[i].id && j < MESH_GROUP_BITMAP_LEN; ++j) {
+            used[j] |= table->groups[i].members[j];
+        }
+
+        group_num += table->groups[i].id ? 1 : 0;
+    }
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_NODE_MAX_NUM; ++i) {
+        node_num += (used[i / 32] & (1UL << (i % 32))) ? 1 : 0;
+    }
+
+    if (size < offset + node_num * MESH_GROUP_EXPORT_NODE_LEN + group_num * MESH_GROUP_EXPORT_ENTRY_LEN) {
+        xSemaphoreGive(g_mesh_group.lock);
+        return 0;
+    }
+
+    buffer[0] = MESH_GROUP_TABLE_VERSION;
+    buffer[1] = group_num;
+    buffer[2] = node_num & 0xff;
+    buffer[3] = node_num >> 8;
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_NODE_MAX_NUM; ++i) {
+        if (used[i / 32] & (1UL << (i % 32))) {
+            buffer[offset] = i;
+            memcpy(buffer + offset + 1, table->nodes[i], MWIFI_ADDR_LEN);
+            offset += MESH_GROUP_EXPORT_NODE_LEN;
+        }
+    }
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_MAX_NUM; ++i) {
+        const mesh_group_entry_t *group = table->groups + i;
+
+        if (group->id) {
+            buffer[offset] = group->id & 0xff;
+            buffer[offset + 1] = group->id >> 8;
+            memcpy(buffer + offset + 2, group->name, MESH_GROUP_NAME_MAX_LEN);
+            memcpy(buffer + offset + 2 + MESH_GROUP_NAME_MAX_LEN, group->members, sizeof(group->members));
+            offset += MESH_GROUP_EXPORT_ENTRY_LEN;
+        }
+    }
+
+    xSemaphoreGive(g_mesh_group.lock);
+
+    return offset;
+}
+
+mdf_err_t mesh_group_import(const uint8_t *data, size_t size)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(g_mesh_group.lock == NULL, MDF_ERR_NOT_INIT, "Groups have not been initialized");
+    MDF_ERROR_CHECK(size < MESH_GROUP_EXPORT_HEADER_LEN || data[0] != MESH_GROUP_TABLE_VERSION,
+                    MDF_ERR_INVALID_ARG, "Invalid group table");
+
+    mdf_err_t ret = MDF_OK;
+    uint8_t group_num = data[1];
+    uint16_t node_num = data[2] | data[3] << 8;
+    size_t offset = MESH_GROUP_EXPORT_HEADER_LEN;
+
+    /**< Bitmaps only line up between nodes built with the same limits */
+    MDF_ERROR_CHECK(group_num > CONFIG_MESH_GROUP_MAX_NUM || node_num > CONFIG_MESH_GROUP_NODE_MAX_NUM
+                    || size != offset + node_num * MESH_GROUP_EXPORT_NODE_LEN + group_num * MESH_GROUP_EXPORT_ENTRY_LEN,
+                    MDF_ERR_INVALID_ARG, "Group table does not match the configuration, size: %d", size);
+
+    mesh_group_table_t *table = MDF_MALLOC(sizeof(mesh_group_table_t));
+    MDF_ERROR_CHECK(table == NULL, MDF_ERR_NO_MEM, "Allocate mem failed");
+    mesh_group_table_reset(table);
+
+    for (int i = 0; i < node_num; ++i, offset += MESH_GROUP_EXPORT_NODE_LEN) {
+        int slot = data[offset];
+        ret = slot < CONFIG_MESH_GROUP_NODE_MAX_NUM ? MDF_OK : MDF_ERR_INVALID_ARG;
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Invalid node slot: %d", slot);
+        memcpy(table->nodes[slot], data + offset + 1, MWIFI_ADDR_LEN);
+    }
+
+    for (int i = 0; i < group_num; ++i, offset += MESH_GROUP_EXPORT_ENTRY_LEN) {
+        mesh_group_entry_t *group = table->groups + i;
+
+        group->id = data[offset] | data[offset + 1] << 8;
+        ret = group->id ? MDF_OK : MDF_ERR_INVALID_ARG;
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Invalid group id");
+        memcpy(group->name, data + offset + 2, MESH_GROUP_NAME_MAX_LEN);
+        memcpy(group->members, data + offset + 2 + MESH_GROUP_NAME_MAX_LEN, sizeof(group->members));
+        group->name[MESH_GROUP_NAME_MAX_LEN - 1] = '\0';
+    }
+
+    xSemaphoreTake(g_mesh_group.lock, portMAX_DELAY);
+
+    if (memcmp(table, &g_mesh_group.table, sizeof(mesh_group_table_t))) {
+        ret = mesh_group_save(table);
+
+        if (ret == MDF_OK) {
+            memcpy(&g_mesh_group.table, table, sizeof(mesh_group_table_t));
+        }
+    }
+
+    xSemaphoreGive(g_mesh_group.lock);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_group_save", mdf_err_to_name(ret));
+
+EXIT:
+    MDF_FREE(table);
+    return ret;
+}
+
+uint32_t mesh_group_get_num()
+{
+    uint32_t num = 0;
+
+    for (int i = 0; i < CONFIG_MESH_GROUP_MAX_NUM; ++i) {
+        num += g_mesh_group.table.groups[i].id ? 1 : 0;
+    }
+
+    return num;
+}
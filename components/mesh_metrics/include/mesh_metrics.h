@@ -0,0 +1,115 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_METRICS_H__
+#define __MESH_METRICS_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MESH_METRICS_GAUGE_MAX_NUM CONFIG_MESH_METRICS_GAUGE_MAX_NUM
+
+/**
+ * @brief Event counters, reported as totals since boot
+ */
+typedef enum {
+    MESH_METRICS_MESH_TX_ERROR = 0, /**< mwifi_write/mwifi_root_write failed */
+    MESH_METRICS_MESH_RX_ERROR,     /**< mwifi_read/mwifi_root_read failed */
+    MESH_METRICS_MQTT_PUB_FAIL,     /**< esp_mqtt_client_publish failed */
+    MESH_METRICS_MQTT_DROP,         /**< Message dropped, e.g. receive queue or in-flight window full */
+    MESH_METRICS_MQTT_RETRANSMIT,   /**< QoS 1 message not acknowledged in time, esp-mqtt resends it */
+    MESH_METRICS_UPLINK_THROTTLED,  /**< Message of a node over its uplink rate dropped by the root */
+    MESH_METRICS_COUNTER_MAX,
+} mesh_metrics_counter_t;
+
+/**
+ * @brief Gauge sampled on every report, e.g. the depth of a queue
+ */
+typedef uint32_t (*mesh_metrics_gauge_cb_t)(void);
+
+/**
+ * @brief Callback used to deliver a report
+ *
+ * @param  data compact JSON report
+ * @param  size length of the report
+ */
+typedef mdf_err_t (*mesh_metrics_report_cb_t)(const char *data, size_t size);
+
+/**
+ * @brief  Increase an event counter, can be called from any task
+ *
+ * @param  counter counter to increase
+ */
+void mesh_metrics_inc(mesh_metrics_counter_t counter);
+
+/**
+ * @brief  Get the value of an event counter
+ *
+ * @param  counter counter to read
+ *
+ * @return Total since boot
+ */
+uint32_t mesh_metrics_get(mesh_metrics_counter_t counter);
+
+/**
+ * @brief  Register a gauge included in every report
+ *
+ * @param  name short name of the gauge, must stay valid
+ * @param  cb   callback returning the current value
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NO_MEM, MESH_METRICS_GAUGE_MAX_NUM gauges are registered
+ */
+mdf_err_t mesh_metrics_register_gauge(const char *name, mesh_metrics_gauge_cb_t cb);
+
+/**
+ * @brief  Format a report of the current heap, task and counter state
+ *
+ *         {"up":<uptime s>,
+ *          "heap":[<free>,<minimum free>,<largest free block>],
+ *          "cnt":[<mesh tx err>,<mesh rx err>,<publish fail>,<drop>,<retransmit>],
+ *          "g":{"<gauge>":<value>,...},
+ *          "task":[["<name>",<cpu % since last report>,<stack high water mark>],...]}
+ *
+ * @param  buffer pointer of the output buffer
+ * @param  size   length of the output buffer
+ *
+ * @note   Task entries that do not fit are left out
+ *
+ * @return Length of the report
+ */
+size_t mesh_metrics_format(char *buffer, size_t size);
+
+/**
+ * @brief  Start the task that periodically reports metrics
+ *
+ * @param  cb callback used to deliver the report
+ *
+ * @note   The cadence is `metrics_interval` of node_config, 0 disables reporting
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_metrics_start(mesh_metrics_report_cb_t cb);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_METRICS_H__ */
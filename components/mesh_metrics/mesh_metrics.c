@@ -0,0 +1,259 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdarg.h>
+#include "mesh_metrics.h"
+#include "node_config.h"
+#include "esp_heap_caps.h"
+#include "mesh_static.h"
+
+#define MESH_METRICS_TASK_MAX_NUM (32)
+#define MESH_METRICS_REPORT_SIZE  (1024)
+
+typedef struct {
+    UBaseType_t number;   /**< xTaskNumber, stable for the lifetime of the task */
+    uint32_t run_time;    /**< ulRunTimeCounter at the previous report */
+} mesh_metrics_task_t;
+
+static struct mesh_metrics {
+    portMUX_TYPE lock;
+    uint32_t counters[MESH_METRICS_COUNTER_MAX];
+    size_t gauge_num;
+    struct {
+        const char *name;
+        mesh_metrics_gauge_cb_t cb;
+    } gauges[MESH_METRICS_GAUGE_MAX_NUM];
+    mesh_metrics_task_t prev_tasks[MESH_METRICS_TASK_MAX_NUM];
+    size_t prev_task_num;
+    uint32_t prev_total_run_time;
+    mesh_metrics_report_cb_t report_cb;
+    TaskHandle_t task;
+} g_mesh_metrics = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+MESH_STATIC_TASK_DEFINE(metrics, 3 * 1024);
+MESH_STATIC_BUFFER_DEFINE(metrics_report, MESH_METRICS_REPORT_SIZE);
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+MESH_STATIC_BUFFER_DEFINE(metrics_tasks, MESH_METRICS_TASK_MAX_NUM * sizeof(TaskStatus_t));
+#endif
+
+static const char *TAG = "mesh_metrics";
+
+static bool mesh_metrics_append(char *buffer, size_t size, size_t *len, const char *fmt, ...)
+{
+    va_list args;
+
+    if (*len >= size) {
+        return false;
+    }
+
+    va_start(args, fmt);
+    int ret = vsnprintf(buffer + *len, size - *len, fmt, args);
+    va_end(args);
+
+    if (ret < 0 || ret >= size - *len) {
+        buffer[*len] = '\0';
+        return false;
+    }
+
+    *len += ret;
+    return true;
+}
+
+void mesh_metrics_inc(mesh_metrics_counter_t counter)
+{
+    if (counter >= MESH_METRICS_COUNTER_MAX) {
+        return;
+    }
+
+    portENTER_CRITICAL(&g_mesh_metrics.lock);
+    g_mesh_metrics.counters[counter]++;
+    portEXIT_CRITICAL(&g_mesh_metrics.lock);
+}
+
+uint32_t mesh_metrics_get(mesh_metrics_counter_t counter)
+{
+    return counter < MESH_METRICS_COUNTER_MAX ? g_mesh_metrics.counters[counter] : 0;
+}
+
+mdf_err_t mesh_metrics_register_gauge(const char *name, mesh_metrics_gauge_cb_t cb)
+{
+    MDF_PARAM_CHECK(name);
+    MDF_PARAM_CHECK(cb);
+
+    for (int i = 0; i < g_mesh_metrics.gauge_num; ++i) {
+        if (!strcmp(g_mesh_metrics.gauges[i].name, name)) {
+            g_mesh_metrics.gauges[i].cb = cb;
+            return MDF_OK;
+        }
+    }
+
+    MDF_ERROR_CHECK(g_mesh_metrics.gauge_num >= MESH_METRICS_GAUGE_MAX_NUM, MDF_ERR_NO_MEM, "Too many gauges");
+
+    g_mesh_metrics.gauges[g_mesh_metrics.gauge_num].name = name;
+    g_mesh_metrics.gauges[g_mesh_metrics.gauge_num].cb = cb;
+    g_mesh_metrics.gauge_num++;
+
+    return MDF_OK;
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static void mesh_metrics_format_tasks(char *buffer, size_t size, size_t *len)
+{
+    uint32_t total_run_time = 0;
+    UBaseType_t task_num = uxTaskGetNumberOfTasks();
+
+#ifdef CONFIG_MESH_STATIC_MEMORY
+    /**< With more tasks than the pool holds uxTaskGetSystemState() returns 0, the tasks are left out */
+    task_num = MESH_METRICS_TASK_MAX_NUM;
+    TaskStatus_t *tasks = MESH_STATIC_MALLOC(metrics_tasks, MESH_METRICS_TASK_MAX_NUM * sizeof(TaskStatus_t));
+#else
+    TaskStatus_t *tasks = MDF_MALLOC(task_num * sizeof(TaskStatus_t));
+#endif /**< CONFIG_MESH_STATIC_MEMORY */
+
+    if (tasks == NULL) {
+        return;
+    }
+
+    task_num = uxTaskGetSystemState(tasks, task_num, &total_run_time);
+    uint32_t elapsed = total_run_time - g_mesh_metrics.prev_total_run_time;
+    mesh_metrics_task_t *prev_tasks = g_mesh_metrics.prev_tasks;
+    size_t prev_task_num = g_mesh_metrics.prev_task_num;
+    mesh_metrics_task_t cur_tasks[MESH_METRICS_TASK_MAX_NUM];
+    size_t cur_task_num = 0;
+    bool first = true;
+
+    mesh_metrics_append(buffer, size, len, ",\"task\":[");
+
+    for (int i = 0; i < task_num; ++i) {
+        uint32_t run_time = tasks[i].ulRunTimeCounter;
+        char entry[48];
+
+        /**< CPU usage of the task since the previous report, in percent */
+        for (int j = 0; j < prev_task_num; ++j) {
+            if (prev_tasks[j].number == tasks[i].xTaskNumber) {
+                run_time -= prev_tasks[j].run_time;
+                break;
+            }
+        }
+
+        if (cur_task_num < MESH_METRICS_TASK_MAX_NUM) {
+            cur_tasks[cur_task_num].number = tasks[i].xTaskNumber;
+            cur_tasks[cur_task_num].run_time = tasks[i].ulRunTimeCounter;
+            cur_task_num++;
+        }
+
+        int entry_len = snprintf(entry, sizeof(entry), "%s[\"%.*s\",%u,%u]", first ? "" : ",",
+                                 configMAX_TASK_NAME_LEN, tasks[i].pcTaskName,
+                                 elapsed ? (unsigned)((uint64_t)run_time * 100 / elapsed) : 0,
+                                 (unsigned)tasks[i].usStackHighWaterMark);
+
+        /**< Keep room for closing the array and the object */
+        if (entry_len < 0 || *len + entry_len + 3 > size) {
+            continue;
+        }
+
+        mesh_metrics_append(buffer, size, len, "%s", entry);
+        first = false;
+    }
+
+    mesh_metrics_append(buffer, size, len, "]");
+
+    memcpy(g_mesh_metrics.prev_tasks, cur_tasks, cur_task_num * sizeof(mesh_metrics_task_t));
+    g_mesh_metrics.prev_task_num = cur_task_num;
+    g_mesh_metrics.prev_total_run_time = total_run_time;
+
+    MESH_STATIC_FREE(metrics_tasks, tasks);
+}
+#endif
+
+size_t mesh_metrics_format(char *buffer, size_t size)
+{
+    size_t len = 0;
+    uint32_t counters[MESH_METRICS_COUNTER_MAX];
+
+    portENTER_CRITICAL(&g_mesh_metrics.lock);
+    memcpy(counters, g_mesh_metrics.counters, sizeof(counters));
+    portEXIT_CRITICAL(&g_mesh_metrics.lock);
+
+    mesh_metrics_append(buffer, size, &len, "{\"up\":%lld,\"heap\":[%u,%u,%u],\"cnt\":[%u,%u,%u,%u,%u,%u]",
+                        esp_timer_get_time() / 1000000,
+                        heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+                        heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT),
+                        heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT),
+                        counters[MESH_METRICS_MESH_TX_ERROR], counters[MESH_METRICS_MESH_RX_ERROR],
+                        counters[MESH_METRICS_MQTT_PUB_FAIL], counters[MESH_METRICS_MQTT_DROP],
+                        counters[MESH_METRICS_MQTT_RETRANSMIT], counters[MESH_METRICS_UPLINK_THROTTLED]);
+
+    if (g_mesh_metrics.gauge_num > 0) {
+        mesh_metrics_append(buffer, size, &len, ",\"g\":{");
+
+        for (int i = 0; i < g_mesh_metrics.gauge_num; ++i) {
+            mesh_metrics_append(buffer, size, &len, "%s\"%s\":%u", i ? "," : "",
+                                g_mesh_metrics.gauges[i].name, g_mesh_metrics.gauges[i].cb());
+        }
+
+        mesh_metrics_append(buffer, size, &len, "}");
+    }
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    mesh_metrics_format_tasks(buffer, size, &len);
+#endif
+
+    mesh_metrics_append(buffer, size, &len, "}");
+
+    return len;
+}
+
+static void mesh_metrics_task(void *arg)
+{
+    mdf_err_t ret = MDF_OK;
+    char *report = MESH_STATIC_MALLOC(metrics_report, MESH_METRICS_REPORT_SIZE);
+    node_config_t config = {0};
+
+    MDF_LOGI("Metrics task is running");
+
+    for (;;) {
+        node_config_get(&config);
+
+        if (config.metrics_interval_s == 0) {
+            vTaskDelay(pdMS_TO_TICKS(10 * 1000));
+            continue;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(config.metrics_interval_s * 1000));
+
+        size_t size = mesh_metrics_format(report, MESH_METRICS_REPORT_SIZE);
+        MDF_LOGD("Metrics report, size: %d, data: %s", size, report);
+
+        ret = g_mesh_metrics.report_cb(report, size);
+        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> Report metrics", mdf_err_to_name(ret));
+    }
+
+    MESH_STATIC_FREE(metrics_report, report);
+    MESH_STATIC_TASK_EXIT();
+}
+
+mdf_err_t mesh_metrics_start(mesh_metrics_report_cb_t cb)
+{
+    MDF_PARAM_CHECK(cb);
+    MDF_ERROR_CHECK(g_mesh_metrics.task != NULL, MDF_ERR_INVALID_STATE, "Metrics task is already running");
+
+    g_mesh_metrics.report_cb = cb;
+    MESH_STATIC_TASK_CREATE(metrics, mesh_metrics_task, "mesh_metrics",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY - 1, &g_mesh_metrics.task);
+
+    return MDF_OK;
+}
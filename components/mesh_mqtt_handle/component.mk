@@ -2,3 +2,12 @@
 # "main" pseudo-component makefile.
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
+
+# Embedded files are relative to the component, the certificate directory to the project
+ifdef CONFIG_MESH_MQTT_TLS_CERT
+COMPONENT_EMBED_TXTFILES := ../../$(CONFIG_MESH_MQTT_TLS_CERT_DIR:"%"=%)/mqtt_ca.pem
+ifdef CONFIG_MESH_MQTT_TLS_CLIENT_CERT
+COMPONENT_EMBED_TXTFILES += ../../$(CONFIG_MESH_MQTT_TLS_CERT_DIR:"%"=%)/mqtt_client.crt
+COMPONENT_EMBED_TXTFILES += ../../$(CONFIG_MESH_MQTT_TLS_CERT_DIR:"%"=%)/mqtt_client.key
+endif
+endif
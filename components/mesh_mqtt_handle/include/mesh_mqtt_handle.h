@@ -30,7 +30,9 @@
 
 #define MDF_EVENT_CUSTOM_MQTT_CONNECTED (MDF_EVENT_CUSTOM_BASE + 1)
 #define MDF_EVENT_CUSTOM_MQTT_DISCONNECTED (MDF_EVENT_CUSTOM_BASE + 2)
-#define MESH_MQTT_TOPIC_MAX_LEN (32)
+#define MESH_MQTT_TOPIC_MAX_LEN (64)
+#define MESH_MQTT_COMPRESS_SUFFIX "/z" /**< Appended to the topic of compressed uplink messages */
+#define MESH_MQTT_BINARY_SUFFIX "/bin" /**< Appended to the topics of raw binary messages */
 
 typedef enum {
     MESH_MQTT_DATA_BYTES = 0,
@@ -44,8 +46,22 @@ typedef struct {
     uint8_t *addrs_list; /**< List of address */
     size_t size; /**< Length of data */
     char *data; /**< Pointer of data */
+    uint32_t id; /**< Correlation id of the command, 0 if no acknowledgement is wanted */
+    mesh_mqtt_publish_data_type_t type; /**< Type of the data, MESH_MQTT_DATA_BYTES is a binary command frame */
+    mdf_err_t addrs_err; /**< Why the groups could not be expanded, only set with an id, the command has no data and no address */
 } mesh_mqtt_data_t;
 
+/**
+ * @brief Header of a binary message, followed by exactly `size` bytes of data.
+ *        Uplink it carries the source node, downlink the destination node,
+ *        ff:ff:ff:ff:ff:ff for all nodes.
+ */
+typedef struct {
+    uint8_t addr[6]; /**< Node address */
+    uint8_t type;    /**< mesh_mqtt_publish_data_type_t of the data */
+    uint16_t size;   /**< Length of the data, little endian */
+} __attribute__((packed)) mesh_mqtt_bin_header_t;
+
 /**
  * @brief  Check if mqtt is connected
  *
@@ -65,6 +81,10 @@ mdf_err_t mesh_mqtt_update_topo();
 /**
  * @brief  mqtt subscribe special topic according device MAC address.
  *
+ * @note   with CONFIG_MESH_MQTT_BINARY the MESH_MQTT_BINARY_SUFFIX variants are subscribed too
+ * @note   called on every connection by the MQTT client itself; on a resumed persistent
+ *         session only the topics of this root are subscribed
+ *
  * @return
  *     - MDF_OK
  *     - MDF_FAIL
@@ -88,21 +108,144 @@ mdf_err_t mesh_mqtt_unsubscribe();
  * @param  size length of data
  * @param  type type of the data
  *
- * @note if type is MESH_MQTT_DATA_BYTES, the data will be encode as base64 string
+ * @note if type is MESH_MQTT_DATA_BYTES, the data will be encode as base64 string, with
+ *       CONFIG_MESH_MQTT_BINARY it is published raw behind a mesh_mqtt_bin_header_t and
+ *       MESH_MQTT_BINARY_SUFFIX is appended to the topic
  * @note if type is MESH_MQTT_DATA_STRING, the data will be treated as string
  * @note if type is MESH_MQTT_DATA_JSON, the data will be treated as json object
+ * @note publish topic: mesh/{root_mac}/toCloud, or mesh/{root_mac}/{node_mac}/telemetry
+ *       with CONFIG_MESH_MQTT_TOPIC_PER_NODE
+ * @note with CONFIG_MESH_MQTT_COMPRESS the payload is compressed by mesh_compress
+ *       and MESH_MQTT_COMPRESS_SUFFIX is appended to the topic
+ * @note with CONFIG_MESH_MQTT_RELIABLE_UPLINK the data is published with QoS 1 and this
+ *       blocks while the in-flight window is full
  *
  * @return
  *     - MDF_OK
  *     - MDF_FAIL
+ *     - MDF_ERR_TIMEOUT, the in-flight window stayed full
  */
 mdf_err_t mesh_mqtt_write(uint8_t *addr, const char *data, size_t size, mesh_mqtt_publish_data_type_t type);
 
+/**
+ * @brief  Build a binary message
+ *
+ * @param  buffer      output, holds the header and the data
+ * @param  buffer_size size of the buffer
+ * @param  addr        node address
+ * @param  type        type of the data
+ * @param  data        pointer of data
+ * @param  size        length of data
+ *
+ * @return Length of the message, 0 if it does not fit in the buffer
+ */
+size_t mesh_mqtt_bin_encode(uint8_t *buffer, size_t buffer_size, const uint8_t *addr,
+                            mesh_mqtt_publish_data_type_t type, const void *data, size_t size);
+
+/**
+ * @brief  Check a binary message and locate its data
+ *
+ * @param  payload      the message
+ * @param  payload_size length of the message
+ * @param  header       output, the header of the message
+ * @param  data         output, points into the payload
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_SIZE, the message is shorter or longer than the header says
+ *     - MDF_ERR_INVALID_ARG, unknown data type
+ */
+mdf_err_t mesh_mqtt_bin_decode(const uint8_t *payload, size_t payload_size,
+                               mesh_mqtt_bin_header_t *header, const uint8_t **data);
+
+/**
+ * @brief  mqtt publish a diagnostics report to the diag topic
+ *
+ * @param  addr node address
+ * @param  data pointer of the JSON report
+ * @param  size length of data
+ *
+ * @note   publish topic: mesh/{root_mac}/diag, payload is the same envelope as mesh_mqtt_write
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_mqtt_write_diag(uint8_t *addr, const char *data, size_t size);
+
+/**
+ * @brief  mqtt publish the rollup of a node to the rollup topic
+ *
+ * @param  addr node address
+ * @param  data pointer of the JSON rollup
+ * @param  size length of data
+ *
+ * @note   publish topic: mesh/{root_mac}/rollup, payload is the same envelope as mesh_mqtt_write
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_mqtt_write_rollup(uint8_t *addr, const char *data, size_t size);
+
+/**
+ * @brief  mqtt publish the completion message of a command to the ack topic
+ *
+ * @param  data pointer of the JSON completion message, see mesh_ack.h
+ * @param  size length of data
+ *
+ * @note   publish topic: mesh/{root_mac}/ack, payload is the same envelope as mesh_mqtt_write
+ *         with the address of the root
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_FAIL
+ */
+mdf_err_t mesh_mqtt_write_ack(const char *data, size_t size);
+
+/**
+ * @brief  Get the number of downlink requests waiting in the receive queue
+ *
+ * @return Number of requests
+ */
+uint32_t mesh_mqtt_get_queue_depth();
+
+/**
+ * @brief  Get the number of QoS 1 messages waiting for an acknowledgement
+ *
+ * @return Number of messages, always 0 without CONFIG_MESH_MQTT_RELIABLE_UPLINK
+ */
+uint32_t mesh_mqtt_get_inflight_num();
+
+/**
+ * @brief  Get the duration of the last connection to the broker, from the
+ *         connection attempt to the CONNACK
+ *
+ * @note   Includes DNS, TCP and, for mqtts://, the TLS handshake
+ *
+ * @return Milliseconds, 0 before the first connection
+ */
+uint32_t mesh_mqtt_get_connect_ms();
+
+/**
+ * @brief  Get the time from the last connection attempt until the broker
+ *         acknowledged all subscriptions
+ *
+ * @return Milliseconds, 0 before the first connection
+ */
+uint32_t mesh_mqtt_get_ready_ms();
+
 /**
  * @brief  receive data from special topic
  *
  * @param  request Request data
  *
+ * @note   a command on mesh/{root_mac}/toDevice is addressed by "addr", an array of
+ *         node addresses, or by "group", a group id or an array of group ids that is
+ *         expanded by mesh_group on the root
+ * @note   a command that carries "id", a number in [1, 4294967295], is acknowledged by
+ *         the addressed nodes and completed with a single message, see mesh_mqtt_write_ack
+ *
  * @return
  *     - MDF_OK
  *     - MDF_FAIL
@@ -112,7 +255,8 @@ mdf_err_t mesh_mqtt_read(mesh_mqtt_data_t **request, TickType_t wait_ticks);
 /**
 * @brief  start mqtt client
 *
-* @param  url mqtt connect url
+* @param  url mqtt connect url, mqtt:// or mqtts:// with the credentials of
+*              CONFIG_MESH_MQTT_TLS
 *
 * @return
 *     - MDF_OK
@@ -13,39 +13,284 @@
 // limitations under the License.
 
 #include "mesh_mqtt_handle.h"
+#include "mesh_metrics.h"
+#include "mesh_compress.h"
+#include "mesh_group.h"
+#include "mesh_static.h"
+#include "mesh_dlog.h"
 #include "cJSON.h"
 #include "esp_wifi.h"
 #include "mbedtls/base64.h"
 #include "mlink.h"
 #include "mwifi.h"
-
+#include "freertos/timers.h"
+#include <ctype.h>
+#include <sys/param.h>
+
+#ifdef CONFIG_MESH_MQTT_TLS_PSK
+#include "esp_tls.h"
+#endif /**< CONFIG_MESH_MQTT_TLS_PSK */
+
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+#define MESH_MQTT_PUBLISH_QOS         (1)
+#define MESH_MQTT_INFLIGHT_TABLE_SIZE (CONFIG_MESH_MQTT_INFLIGHT_WINDOW * 2)
+
+typedef enum {
+    MESH_MQTT_INFLIGHT_FREE = 0,
+    MESH_MQTT_INFLIGHT_WAIT_ACK, /**< Published, waiting for PUBACK */
+    MESH_MQTT_INFLIGHT_ACKED,    /**< PUBACK arrived before the publish call returned */
+    MESH_MQTT_INFLIGHT_DELETED,  /**< Expired from the outbox before the publish call returned */
+} mesh_mqtt_inflight_state_t;
+
+/**
+ * @brief QoS 1 message still in the esp-mqtt outbox. Only the metadata is
+ *        kept here, the slot is held until esp-mqtt reports the message
+ *        acknowledged or deleted, so the window bounds the outbox.
+ */
+typedef struct {
+    int msg_id;
+    uint8_t state;
+    uint16_t size;                /**< Length of the payload */
+    uint8_t addr[MWIFI_ADDR_LEN]; /**< Source node of the frame */
+    TickType_t timestamp;         /**< Tick of the publish or of the last resend by esp-mqtt */
+} mesh_mqtt_inflight_t;
+#else
+#define MESH_MQTT_PUBLISH_QOS         (0)
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+#define MESH_MQTT_SUBSCRIBE_QOS       (1) /**< The broker only queues QoS 1 for an offline session */
+#else
+#define MESH_MQTT_SUBSCRIBE_QOS       (0)
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
+
+#ifdef CONFIG_MESH_MQTT_TLS_CERT
+extern const char mqtt_ca_pem_start[] asm("_binary_mqtt_ca_pem_start");
+#ifdef CONFIG_MESH_MQTT_TLS_CLIENT_CERT
+extern const char mqtt_client_crt_start[] asm("_binary_mqtt_client_crt_start");
+extern const char mqtt_client_key_start[] asm("_binary_mqtt_client_key_start");
+#endif /**< CONFIG_MESH_MQTT_TLS_CLIENT_CERT */
+#endif /**< CONFIG_MESH_MQTT_TLS_CERT */
+
+#ifdef CONFIG_MESH_MQTT_TLS_PSK
+#define MESH_MQTT_PSK_KEY_LEN ((sizeof(CONFIG_MESH_MQTT_TLS_PSK_KEY) - 1) / 2)
+_Static_assert(sizeof(CONFIG_MESH_MQTT_TLS_PSK_KEY) % 2 == 1 && MESH_MQTT_PSK_KEY_LEN >= 16 && MESH_MQTT_PSK_KEY_LEN <= 32,
+               "CONFIG_MESH_MQTT_TLS_PSK_KEY must be 16 to 32 bytes in hex");
+
+static uint8_t g_mesh_mqtt_psk_key[MESH_MQTT_PSK_KEY_LEN];
+static const psk_hint_key_t g_mesh_mqtt_psk = {
+    .key = g_mesh_mqtt_psk_key,
+    .key_size = MESH_MQTT_PSK_KEY_LEN,
+    .hint = CONFIG_MESH_MQTT_TLS_PSK_IDENTITY,
+};
+#endif /**< CONFIG_MESH_MQTT_TLS_PSK */
+
+/**
+ * @note The queue and the locks are created by the first mesh_mqtt_start() and
+ *       never deleted, the metrics task and the publishers may still use them
+ *       while mesh_mqtt_stop() runs.
+ */
 static struct mesh_mqtt {
     xQueueHandle queue; /**< mqtt receive data queue */
     esp_mqtt_client_handle_t client; /**< mqtt client */
+    SemaphoreHandle_t client_lock;   /**< Held while the client is used outside of its own task */
     bool is_connected;
     uint8_t addr[MWIFI_ADDR_LEN];
-    char publish_topic[32];
-    char topo_topic[32];
-} g_mesh_mqtt;
+    char publish_topic[MESH_MQTT_TOPIC_MAX_LEN];
+    char topo_topic[MESH_MQTT_TOPIC_MAX_LEN];
+    char diag_topic[MESH_MQTT_TOPIC_MAX_LEN];
+    char rollup_topic[MESH_MQTT_TOPIC_MAX_LEN];
+    char ack_topic[MESH_MQTT_TOPIC_MAX_LEN];
+    char client_id[24];
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+    TimerHandle_t reconnect_timer;
+    uint32_t retry_num;          /**< Failed connection attempts since the last CONNACK */
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
+    int64_t disconnect_time;     /**< Time the connection was lost, us */
+    int64_t connect_start;       /**< Time of the last connection attempt, us */
+    uint32_t connect_ms;         /**< Connection attempt to CONNACK, TCP and TLS included */
+    uint32_t ready_ms;           /**< Connection attempt to the last SUBACK */
+    uint32_t connect_num;
+    bool session_present;        /**< The broker resumed the session of a previous root */
+    uint8_t subscribe_pending;   /**< SUBACKs outstanding before the root is ready */
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+    SemaphoreHandle_t window; /**< Free slots of the in-flight window */
+    portMUX_TYPE inflight_lock;
+    size_t inflight_num;
+    mesh_mqtt_inflight_t inflight[MESH_MQTT_INFLIGHT_TABLE_SIZE];
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+#ifdef CONFIG_MESH_MQTT_COMPRESS
+    SemaphoreHandle_t compress_lock;
+    mesh_compress_t compress;       /**< Shared compressor state, guarded by compress_lock */
+#endif /**< CONFIG_MESH_MQTT_COMPRESS */
+} g_mesh_mqtt = {
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+    .inflight_lock = portMUX_INITIALIZER_UNLOCKED,
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+};
+
+MESH_STATIC_QUEUE_DEFINE(mqtt, 3, sizeof(mesh_mqtt_data_t *));
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+MESH_STATIC_TIMER_DEFINE(mqtt_reconnect);
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+MESH_STATIC_SEMAPHORE_DEFINE(mqtt_window);
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+MESH_STATIC_MUTEX_DEFINE(mqtt_client);
+#ifdef CONFIG_MESH_MQTT_COMPRESS
+MESH_STATIC_MUTEX_DEFINE(mqtt_compress);
+#endif /**< CONFIG_MESH_MQTT_COMPRESS */
 
 static const char *TAG = "mesh_mqtt";
 
 static const char publish_topic_template[] = "mesh/%02x%02x%02x%02x%02x%02x/toCloud";
 static const char topo_topic_template[] = "mesh/%02x%02x%02x%02x%02x%02x/topo";
+static const char diag_topic_template[] = "mesh/%02x%02x%02x%02x%02x%02x/diag";
+static const char rollup_topic_template[] = "mesh/%02x%02x%02x%02x%02x%02x/rollup";
+static const char ack_topic_template[] = "mesh/%02x%02x%02x%02x%02x%02x/ack";
+#ifdef CONFIG_MESH_MQTT_TOPIC_PER_NODE
+static const char node_topic_template[] = "mesh/%02x%02x%02x%02x%02x%02x/%02x%02x%02x%02x%02x%02x/telemetry";
+#endif /**< CONFIG_MESH_MQTT_TOPIC_PER_NODE */
 static const char subscribe_topic_template[] = "mesh/%02x%02x%02x%02x%02x%02x/toDevice";
+#ifdef CONFIG_MESH_MQTT_BINARY
+static const char binary_subscribe_topic_template[] = "mesh/%02x%02x%02x%02x%02x%02x/toDevice" MESH_MQTT_BINARY_SUFFIX;
+#endif /**< CONFIG_MESH_MQTT_BINARY */
 static uint8_t mwifi_addr_any[] = MWIFI_ADDR_ANY;
 
+size_t mesh_mqtt_bin_encode(uint8_t *buffer, size_t buffer_size, const uint8_t *addr,
+                            mesh_mqtt_publish_data_type_t type, const void *data, size_t size)
+{
+    mesh_mqtt_bin_header_t header = {
+        .type = type,
+        .size = size,
+    };
+
+    if (size > UINT16_MAX || buffer_size < sizeof(header) + size) {
+        return 0;
+    }
+
+    memcpy(header.addr, addr, MWIFI_ADDR_LEN);
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), data, size);
+
+    return sizeof(header) + size;
+}
+
+mdf_err_t mesh_mqtt_bin_decode(const uint8_t *payload, size_t payload_size,
+                               mesh_mqtt_bin_header_t *header, const uint8_t **data)
+{
+    MDF_PARAM_CHECK(payload);
+    MDF_PARAM_CHECK(header);
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(payload_size < sizeof(mesh_mqtt_bin_header_t), MDF_ERR_INVALID_SIZE,
+                    "Binary message of %d bytes is shorter than its header", payload_size);
+
+    memcpy(header, payload, sizeof(mesh_mqtt_bin_header_t));
+    MDF_ERROR_CHECK(header->size != payload_size - sizeof(mesh_mqtt_bin_header_t), MDF_ERR_INVALID_SIZE,
+                    "Binary message of %d bytes announces %d bytes of data", payload_size, header->size);
+    MDF_ERROR_CHECK(header->type >= MESH_MQTT_DATA_TYPE_MAX, MDF_ERR_INVALID_ARG,
+                    "Unknow data type: %d", header->type);
+
+    *data = payload + sizeof(mesh_mqtt_bin_header_t);
+    return MDF_OK;
+}
+
+#ifdef CONFIG_MESH_MQTT_BINARY
+/**
+ * @brief Downlink binary message, sent to the node of the header unless the
+ *        topic already addresses all nodes
+ */
+static mesh_mqtt_data_t *mesh_mqtt_parse_binary(const uint8_t *mac, const char *payload, size_t payload_size)
+{
+    mesh_mqtt_bin_header_t header;
+    const uint8_t *data = NULL;
+
+    if (mesh_mqtt_bin_decode((const uint8_t *)payload, payload_size, &header, &data) != MDF_OK) {
+        return NULL;
+    }
+
+    mesh_mqtt_data_t *request = MDF_CALLOC(1, sizeof(mesh_mqtt_data_t));
+    MDF_ERROR_CHECK(request == NULL, NULL, "No memory");
+
+    request->addrs_num = 1;
+    request->addrs_list = MDF_MALLOC(MWIFI_ADDR_LEN);
+    request->size = header.size;
+    request->type = header.type;
+    request->data = MDF_MALLOC(header.size + 1);
+
+    if (request->addrs_list == NULL || request->data == NULL) {
+        MDF_LOGE("No memory");
+        MDF_FREE(request->addrs_list);
+        MDF_FREE(request->data);
+        MDF_FREE(request);
+        return NULL;
+    }
+
+    memcpy(request->addrs_list, memcmp(mac, mwifi_addr_any, MWIFI_ADDR_LEN) ? header.addr : mwifi_addr_any, MWIFI_ADDR_LEN);
+    memcpy(request->data, data, header.size);
+    request->data[header.size] = '\0';
+
+    return request;
+}
+#endif /**< CONFIG_MESH_MQTT_BINARY */
+
+/**
+ * @brief Destinations of a command addressed by "group", a group id or an
+ *        array of group ids
+ */
+static mdf_err_t mesh_mqtt_parse_group(const cJSON *group, mesh_mqtt_data_t *request)
+{
+    uint16_t ids[MESH_GROUP_EXPAND_MAX_NUM];
+    size_t id_num = 0;
+    const cJSON *item = NULL;
+
+    if (cJSON_IsNumber(group)) {
+        item = group;
+    } else if (cJSON_IsArray(group) && cJSON_GetArraySize(group) <= MESH_GROUP_EXPAND_MAX_NUM) {
+        item = group->child;
+    }
+
+    for (; item; item = (item == group) ? NULL : item->next) {
+        MDF_ERROR_CHECK(!cJSON_IsNumber(item) || item->valueint < 1 || item->valueint > UINT16_MAX,
+                        MDF_ERR_INVALID_ARG, "Group id should be a number in [1, 65535]");
+        ids[id_num++] = (uint16_t)item->valueint;
+    }
+
+    MDF_ERROR_CHECK(id_num == 0, MDF_ERR_INVALID_ARG, "group should be a number or an array of at most %d numbers",
+                    MESH_GROUP_EXPAND_MAX_NUM);
+
+    mdf_err_t ret = mesh_group_expand(ids, id_num, &request->addrs_list, &request->addrs_num);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> mesh_group_expand", mdf_err_to_name(ret));
+
+    return MDF_OK;
+}
+
 static mesh_mqtt_data_t *mesh_mqtt_parse_data(const char *topic, size_t topic_size, const char *payload, size_t payload_size)
 {
     uint8_t mac[MWIFI_ADDR_LEN];
+    char mac_str[MWIFI_ADDR_LEN * 2 + 1];
+
+    /**< mesh/{mac}/toDevice[/bin], the topic is not null-terminated and belongs to esp-mqtt */
+    const char *begin_pos = memchr(topic, '/', topic_size);
+    const char *end_pos = begin_pos ? memchr(begin_pos + 1, '/', topic + topic_size - begin_pos - 1) : NULL;
 
-    char *mac_str = strchr(topic, '/') + 1;
-    assert(mac_str != NULL + 1);
-    char *end_pos = strchr(mac_str, '/');
-    assert(end_pos != NULL);
-    *end_pos = '\0';
+    if (end_pos == NULL || end_pos - begin_pos - 1 != sizeof(mac_str) - 1) {
+        MDF_LOGW("Invalid topic: %.*s", (int)topic_size, topic);
+        return NULL;
+    }
+
+    memcpy(mac_str, begin_pos + 1, sizeof(mac_str) - 1);
+    mac_str[sizeof(mac_str) - 1] = '\0';
     mlink_mac_str2hex(mac_str, mac);
 
+#ifdef CONFIG_MESH_MQTT_BINARY
+    size_t suffix_len = strlen(MESH_MQTT_BINARY_SUFFIX);
+
+    if (topic_size > suffix_len && !memcmp(topic + topic_size - suffix_len, MESH_MQTT_BINARY_SUFFIX, suffix_len)) {
+        return mesh_mqtt_parse_binary(mac, payload, payload_size);
+    }
+#endif /**< CONFIG_MESH_MQTT_BINARY */
+
     char *str = MDF_MALLOC(payload_size + 1);
 
     if (str == NULL) {
@@ -74,6 +319,9 @@ static mesh_mqtt_data_t *mesh_mqtt_parse_data(const char *topic, size_t topic_si
         request->addrs_list = MDF_MALLOC(MWIFI_ADDR_LEN);
         memcpy(request->addrs_list, mwifi_addr_any, MWIFI_ADDR_LEN);
         request->addrs_num = 1;
+    } else if (cJSON_GetObjectItem(obj, "group") != NULL) {
+        /**< Answered by the root if the command has an id, see below */
+        request->addrs_err = mesh_mqtt_parse_group(cJSON_GetObjectItem(obj, "group"), request);
     } else {
         cJSON *addr = cJSON_GetObjectItem(obj, "addr");
 
@@ -107,6 +355,25 @@ static mesh_mqtt_data_t *mesh_mqtt_parse_data(const char *topic, size_t topic_si
         goto _exit;
     }
 
+    cJSON *id = cJSON_GetObjectItem(obj, "id");
+
+    if (id != NULL && (cJSON_IsNumber(id) != true || id->valuedouble < 1 || id->valuedouble > UINT32_MAX)) {
+        MDF_LOGW("id should be a number in [1, 4294967295]");
+        MDF_FREE(request->addrs_list);
+        MDF_FREE(request);
+        goto _exit;
+    }
+
+    request->id = id ? (uint32_t)id->valuedouble : 0;
+
+    if (request->addrs_err != MDF_OK) {
+        if (request->id == 0) {
+            MDF_FREE(request);
+        }
+
+        goto _exit;
+    }
+
     cJSON *data = cJSON_GetObjectItem(obj, "data");
 
     if (data == NULL) {
@@ -116,6 +383,8 @@ static mesh_mqtt_data_t *mesh_mqtt_parse_data(const char *topic, size_t topic_si
     }
 
     if (strcmp(type->valuestring, "bytes") == 0) {
+        request->type = MESH_MQTT_DATA_BYTES;
+
         if (cJSON_IsString(data) != true) {
             MDF_LOGW("Data should be string type");
             MDF_FREE(request->addrs_list);
@@ -123,12 +392,22 @@ static mesh_mqtt_data_t *mesh_mqtt_parse_data(const char *topic, size_t topic_si
             goto _exit;
         }
 
-        size_t dst_size = (strlen(data->valuestring) / 4 + 1) * 3;
-        request->data = MDF_MALLOC(dst_size);
+        /**< Base64 decodes 4 characters to at most 3 bytes */
+        size_t src_size = strlen(data->valuestring);
+        size_t dst_size = (src_size + 3) / 4 * 3;
+        request->data = MDF_MALLOC(dst_size + 1);
         assert(request->data != NULL);
-        int ret = mbedtls_base64_decode((uint8_t *)request->data, dst_size, &request->size, (uint8_t *)data->valuestring, strlen(data->valuestring));
-        assert(ret == 0);
+
+        if (mbedtls_base64_decode((uint8_t *)request->data, dst_size, &request->size, (uint8_t *)data->valuestring, src_size) != 0) {
+            MDF_LOGW("Invalid base64 data");
+            MDF_FREE(request->data);
+            MDF_FREE(request->addrs_list);
+            MDF_FREE(request);
+            goto _exit;
+        }
     } else if (strcmp(type->valuestring, "string") == 0) {
+        request->type = MESH_MQTT_DATA_STRING;
+
         if (cJSON_IsString(data) != true) {
             MDF_LOGW("Data should be string type");
             MDF_FREE(request->addrs_list);
@@ -137,10 +416,11 @@ static mesh_mqtt_data_t *mesh_mqtt_parse_data(const char *topic, size_t topic_si
         }
 
         request->size = strlen(data->valuestring);
-        request->data = MDF_MALLOC(request->size);
+        request->data = MDF_MALLOC(request->size + 1);
         assert(request->data != NULL);
         strcpy(request->data, data->valuestring);
     } else if (strcmp(type->valuestring, "json") == 0) {
+        request->type = MESH_MQTT_DATA_JSON;
         str = cJSON_PrintUnformatted(data);
 
         if (str == NULL) {
@@ -165,23 +445,310 @@ _exit:
     return request;
 }
 
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+/**
+ * @brief Count the resends of unacknowledged messages. esp-mqtt resends them
+ *        from the outbox every message_retransmit_timeout while connected and
+ *        has no event for it, so they are derived from the same timeout here.
+ */
+static void mesh_mqtt_inflight_sweep()
+{
+    TickType_t now = xTaskGetTickCount();
+    size_t retransmitted = 0;
+
+    portENTER_CRITICAL(&g_mesh_mqtt.inflight_lock);
+
+    for (int i = 0; i < MESH_MQTT_INFLIGHT_TABLE_SIZE; ++i) {
+        mesh_mqtt_inflight_t *item = g_mesh_mqtt.inflight + i;
+
+        if (item->state == MESH_MQTT_INFLIGHT_FREE
+                || now - item->timestamp < pdMS_TO_TICKS(CONFIG_MESH_MQTT_ACK_TIMEOUT_MS)) {
+            continue;
+        }
+
+        if (item->state != MESH_MQTT_INFLIGHT_WAIT_ACK) {
+            /**< Never claimed by mesh_mqtt_inflight_track() */
+            item->state = MESH_MQTT_INFLIGHT_FREE;
+            continue;
+        }
+
+        item->timestamp = now;
+
+        if (g_mesh_mqtt.is_connected) {
+            retransmitted++;
+        }
+    }
+
+    portEXIT_CRITICAL(&g_mesh_mqtt.inflight_lock);
+
+    for (int i = 0; i < retransmitted; ++i) {
+        mesh_metrics_inc(MESH_METRICS_MQTT_RETRANSMIT);
+    }
+}
+
+static void mesh_mqtt_inflight_track(int msg_id, const uint8_t *addr, size_t size)
+{
+    mesh_mqtt_inflight_t *free_item = NULL;
+    bool acked = false;
+    bool deleted = false;
+
+    portENTER_CRITICAL(&g_mesh_mqtt.inflight_lock);
+
+    for (int i = 0; i < MESH_MQTT_INFLIGHT_TABLE_SIZE; ++i) {
+        mesh_mqtt_inflight_t *item = g_mesh_mqtt.inflight + i;
+
+        if ((item->state == MESH_MQTT_INFLIGHT_ACKED || item->state == MESH_MQTT_INFLIGHT_DELETED)
+                && item->msg_id == msg_id) {
+            deleted = item->state == MESH_MQTT_INFLIGHT_DELETED;
+            item->state = MESH_MQTT_INFLIGHT_FREE;
+            acked = true;
+            break;
+        }
+
+        if (item->state == MESH_MQTT_INFLIGHT_FREE && free_item == NULL) {
+            free_item = item;
+        }
+    }
+
+    /**< The window guarantees a free slot, the table is twice its size */
+    if (!acked && free_item != NULL) {
+        free_item->msg_id      = msg_id;
+        free_item->state       = MESH_MQTT_INFLIGHT_WAIT_ACK;
+        free_item->size        = size;
+        free_item->timestamp   = xTaskGetTickCount();
+        memcpy(free_item->addr, addr, MWIFI_ADDR_LEN);
+        g_mesh_mqtt.inflight_num++;
+    }
+
+    portEXIT_CRITICAL(&g_mesh_mqtt.inflight_lock);
+
+    if (acked) {
+        xSemaphoreGive(g_mesh_mqtt.window);
+    }
+
+    if (deleted) {
+        mesh_metrics_inc(MESH_METRICS_MQTT_DROP);
+    }
+}
+
+static void mesh_mqtt_inflight_release(int msg_id, bool delivered)
+{
+    mesh_mqtt_inflight_t *free_item = NULL;
+    bool found = false;
+
+    portENTER_CRITICAL(&g_mesh_mqtt.inflight_lock);
+
+    for (int i = 0; i < MESH_MQTT_INFLIGHT_TABLE_SIZE; ++i) {
+        mesh_mqtt_inflight_t *item = g_mesh_mqtt.inflight + i;
+
+        if (item->state == MESH_MQTT_INFLIGHT_WAIT_ACK && item->msg_id == msg_id) {
+            item->state = MESH_MQTT_INFLIGHT_FREE;
+            g_mesh_mqtt.inflight_num--;
+            found = true;
+            break;
+        }
+
+        if (item->state == MESH_MQTT_INFLIGHT_FREE && free_item == NULL) {
+            free_item = item;
+        }
+    }
+
+    /**< Reported before mesh_mqtt_inflight_track() ran, let it release the slot */
+    if (!found && free_item != NULL) {
+        free_item->msg_id    = msg_id;
+        free_item->state     = delivered ? MESH_MQTT_INFLIGHT_ACKED : MESH_MQTT_INFLIGHT_DELETED;
+        free_item->timestamp = xTaskGetTickCount();
+    }
+
+    portEXIT_CRITICAL(&g_mesh_mqtt.inflight_lock);
+
+    if (found) {
+        xSemaphoreGive(g_mesh_mqtt.window);
+    }
+
+    if (found && !delivered) {
+        mesh_metrics_inc(MESH_METRICS_MQTT_DROP);
+    }
+}
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+
+/**
+ * @brief Publish an uplink message. In reliable mode this blocks while the
+ *        in-flight window is full, which stalls the caller's mesh read loop.
+ *        Without a connection no PUBACK can free a slot, so a full window
+ *        drops the message at once.
+ */
+static mdf_err_t mesh_mqtt_publish_payload(const char *topic, const char *payload, size_t size, const uint8_t *addr)
+{
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+    mesh_mqtt_inflight_sweep();
+
+    TickType_t wait_ticks = g_mesh_mqtt.is_connected ? pdMS_TO_TICKS(CONFIG_MESH_MQTT_ACK_TIMEOUT_MS) : 0;
+
+    if (xSemaphoreTake(g_mesh_mqtt.window, wait_ticks) != pdTRUE) {
+        mesh_mqtt_inflight_sweep();
+        mesh_metrics_inc(MESH_METRICS_MQTT_DROP);
+        MDF_LOGW("In-flight window is full, drop message from " MACSTR, MAC2STR(addr));
+        return MDF_ERR_TIMEOUT;
+    }
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+
+    /**< mesh_mqtt_stop() takes the lock before it destroys the client */
+    xSemaphoreTake(g_mesh_mqtt.client_lock, portMAX_DELAY);
+
+    /**< Stopped meanwhile, or woken up by mesh_mqtt_stop() */
+    if (g_mesh_mqtt.client == NULL) {
+        xSemaphoreGive(g_mesh_mqtt.client_lock);
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+        xSemaphoreGive(g_mesh_mqtt.window);
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+        return MDF_ERR_INVALID_STATE;
+    }
+
+    int msg_id = esp_mqtt_client_publish(g_mesh_mqtt.client, topic, payload, size, MESH_MQTT_PUBLISH_QOS, 0);
+
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+    /**< Tracked before mesh_mqtt_stop() can run, so that it releases the slot */
+    if (msg_id >= 0) {
+        mesh_mqtt_inflight_track(msg_id, addr, size);
+    }
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+
+    xSemaphoreGive(g_mesh_mqtt.client_lock);
+
+    if (msg_id < 0) {
+        mesh_metrics_inc(MESH_METRICS_MQTT_PUB_FAIL);
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+        xSemaphoreGive(g_mesh_mqtt.window);
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+        return MDF_FAIL;
+    }
+
+    return MDF_OK;
+}
+
+#ifdef CONFIG_MESH_MQTT_COMPRESS
+/**
+ * @brief Compress the payload and publish it on the topic with the
+ *        MESH_MQTT_COMPRESS_SUFFIX, the payload is sent as is if it does not shrink
+ */
+static mdf_err_t mesh_mqtt_publish(const char *topic, const char *payload, size_t size, const uint8_t *addr)
+{
+    mdf_err_t ret = MDF_OK;
+    char compressed_topic[MESH_MQTT_TOPIC_MAX_LEN];
+    size_t compressed_size = 0;
+    int64_t start_time = esp_timer_get_time();
+    uint8_t *compressed = size > 1 ? MDF_MALLOC(size) : NULL;
+
+    if (compressed == NULL) {
+        return mesh_mqtt_publish_payload(topic, payload, size, addr);
+    }
+
+    xSemaphoreTake(g_mesh_mqtt.compress_lock, portMAX_DELAY);
+    /**< Only worth it if the result is smaller than the payload */
+    compressed_size = mesh_compress_buffer(&g_mesh_mqtt.compress, payload, size, compressed, size - 1);
+    xSemaphoreGive(g_mesh_mqtt.compress_lock);
+
+    MDF_LOGD("Compress %d -> %d bytes in %lld us", size, compressed_size, esp_timer_get_time() - start_time);
+
+    if (compressed_size == 0) {
+        ret = mesh_mqtt_publish_payload(topic, payload, size, addr);
+    } else {
+        snprintf(compressed_topic, sizeof(compressed_topic), "%s" MESH_MQTT_COMPRESS_SUFFIX, topic);
+        ret = mesh_mqtt_publish_payload(compressed_topic, (char *)compressed, compressed_size, addr);
+    }
+
+    MDF_FREE(compressed);
+    return ret;
+}
+#else
+#define mesh_mqtt_publish mesh_mqtt_publish_payload
+#endif /**< CONFIG_MESH_MQTT_COMPRESS */
+
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+static void mesh_mqtt_reconnect_timer_cb(TimerHandle_t timer)
+{
+    xSemaphoreTake(g_mesh_mqtt.client_lock, portMAX_DELAY);
+
+    if (g_mesh_mqtt.client) {
+        esp_mqtt_client_reconnect(g_mesh_mqtt.client);
+    }
+
+    xSemaphoreGive(g_mesh_mqtt.client_lock);
+}
+
+/**
+ * @brief Exponential backoff with jitter in place of the fixed reconnect
+ *        timeout of esp-mqtt
+ */
+static void mesh_mqtt_schedule_reconnect()
+{
+    if (g_mesh_mqtt.reconnect_timer == NULL) {
+        return;
+    }
+
+    uint64_t backoff_ms = (uint64_t)CONFIG_MESH_MQTT_RECONNECT_MIN_MS << MIN(g_mesh_mqtt.retry_num, 16);
+    uint32_t delay_ms = MIN(backoff_ms, CONFIG_MESH_MQTT_RECONNECT_MAX_MS);
+    delay_ms = delay_ms / 2 + esp_random() % (delay_ms / 2 + 1);
+    g_mesh_mqtt.retry_num++;
+
+    MDF_LOGI("Reconnect in %u ms, attempt: %u", delay_ms, g_mesh_mqtt.retry_num);
+    xTimerChangePeriod(g_mesh_mqtt.reconnect_timer, pdMS_TO_TICKS(delay_ms), 0);
+}
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
+
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
     switch (event->event_id) {
+        case MQTT_EVENT_BEFORE_CONNECT:
+            MDF_LOGD("MQTT_EVENT_BEFORE_CONNECT");
+            g_mesh_mqtt.connect_start = esp_timer_get_time();
+            break;
+
         case MQTT_EVENT_CONNECTED:
-            MDF_LOGD("MQTT_EVENT_CONNECTED");
+            g_mesh_mqtt.connect_ms = (esp_timer_get_time() - g_mesh_mqtt.connect_start) / 1000;
+            g_mesh_mqtt.connect_num++;
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+            g_mesh_mqtt.retry_num = 0;
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
+            g_mesh_mqtt.session_present = event->session_present;
+            MDF_LOGI("MQTT_EVENT_CONNECTED, connection: %u, connect time: %u ms, session present: %d",
+                     g_mesh_mqtt.connect_num, g_mesh_mqtt.connect_ms, event->session_present);
+
+            /**< Subscribe from the MQTT task, without a round trip through the event loop */
+            if (mesh_mqtt_subscribe() != MDF_OK) {
+                MDF_LOGW("Subscribe failed");
+                g_mesh_mqtt.subscribe_pending = 0;
+            }
+
             g_mesh_mqtt.is_connected = true;
             mdf_event_loop_send(MDF_EVENT_CUSTOM_MQTT_CONNECTED, NULL);
             break;
 
         case MQTT_EVENT_DISCONNECTED:
             MDF_LOGD("MQTT_EVENT_DISCONNECTED");
+
+            if (g_mesh_mqtt.is_connected) {
+                g_mesh_mqtt.disconnect_time = esp_timer_get_time();
+            }
+
             g_mesh_mqtt.is_connected = false;
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+            mesh_mqtt_schedule_reconnect();
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
             mdf_event_loop_send(MDF_EVENT_CUSTOM_MQTT_DISCONNECTED, NULL);
             break;
 
         case MQTT_EVENT_SUBSCRIBED:
             MDF_LOGD("MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+
+            if (g_mesh_mqtt.subscribe_pending && --g_mesh_mqtt.subscribe_pending == 0) {
+                int64_t now = esp_timer_get_time();
+                g_mesh_mqtt.ready_ms = (now - g_mesh_mqtt.connect_start) / 1000;
+                MDF_LOGI("Ready %u ms after the connection attempt, %u ms offline", g_mesh_mqtt.ready_ms,
+                         g_mesh_mqtt.disconnect_time ? (uint32_t)((now - g_mesh_mqtt.disconnect_time) / 1000) : 0);
+            }
+
             break;
 
         case MQTT_EVENT_UNSUBSCRIBED:
@@ -190,11 +757,23 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 
         case MQTT_EVENT_PUBLISHED:
             MDF_LOGD("MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+            mesh_mqtt_inflight_release(event->msg_id, true);
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
             break;
 
+#ifdef CONFIG_MQTT_REPORT_DELETED_MESSAGES
+        case MQTT_EVENT_DELETED:
+            MDF_LOGD("MQTT_EVENT_DELETED, msg_id=%d", event->msg_id);
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+            mesh_mqtt_inflight_release(event->msg_id, false);
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+            break;
+#endif /**< CONFIG_MQTT_REPORT_DELETED_MESSAGES */
+
         case MQTT_EVENT_DATA: {
-            MDF_LOGD("MQTT_EVENT_DATA, topic: %.*s, data: %.*s",
-                     event->topic_len, event->topic, event->data_len, event->data);
+            MESH_DLOGD("MQTT_EVENT_DATA, topic: %.*s, data: %.*s",
+                       event->topic_len, event->topic, event->data_len, event->data);
 
             mesh_mqtt_data_t *item = mesh_mqtt_parse_data(event->topic, event->topic_len, event->data, event->data_len);
 
@@ -204,6 +783,7 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 
             if (xQueueSend(g_mesh_mqtt.queue, &item, 0) != pdPASS) {
                 MDF_LOGD("Send receive queue failed");
+                mesh_metrics_inc(MESH_METRICS_MQTT_DROP);
                 MDF_FREE(item->addrs_list);
                 MDF_FREE(item->data);
                 MDF_FREE(item);
@@ -234,18 +814,35 @@ mdf_err_t mesh_mqtt_subscribe()
     char topic_str[MESH_MQTT_TOPIC_MAX_LEN];
     char mac_any[] = MWIFI_ADDR_ANY;
     char mac_root[] = MWIFI_ADDR_ROOT;
+    const uint8_t *macs[] = {g_mesh_mqtt.addr, (uint8_t *)mac_any, (uint8_t *)mac_root};
+    const char *templates[] = {
+        subscribe_topic_template,
+#ifdef CONFIG_MESH_MQTT_BINARY
+        binary_subscribe_topic_template,
+#endif /**< CONFIG_MESH_MQTT_BINARY */
+    };
 
-    snprintf(topic_str, sizeof(topic_str), subscribe_topic_template, MAC2STR(g_mesh_mqtt.addr));
-    int msg_id = esp_mqtt_client_subscribe(g_mesh_mqtt.client, topic_str, 0);
-    MDF_ERROR_CHECK(msg_id < 0, MDF_FAIL, "Subscribe failed");
-
-    snprintf(topic_str, sizeof(topic_str), subscribe_topic_template, MAC2STR(mac_any));
-    msg_id = esp_mqtt_client_subscribe(g_mesh_mqtt.client, topic_str, 0);
-    MDF_ERROR_CHECK(msg_id < 0, MDF_FAIL, "Subscribe failed");
-
-    snprintf(topic_str, sizeof(topic_str), subscribe_topic_template, MAC2STR(mac_root));
-    msg_id = esp_mqtt_client_subscribe(g_mesh_mqtt.client, topic_str, 0);
-    MDF_ERROR_CHECK(msg_id < 0, MDF_FAIL, "Subscribe failed");
+    /**< Read once, mesh_mqtt_stop() clears it before it stops the task this runs in */
+    esp_mqtt_client_handle_t client = g_mesh_mqtt.client;
+    MDF_ERROR_CHECK(client == NULL, MDF_ERR_INVALID_STATE, "MQTT client has been stopped");
+
+    /**< A resumed session already holds the topics every root subscribes to */
+    size_t mac_num = g_mesh_mqtt.session_present ? 1 : sizeof(macs) / sizeof(macs[0]);
+    size_t template_num = sizeof(templates) / sizeof(templates[0]);
+
+    /**
+     * esp-mqtt has no call for several topics in one SUBSCRIBE, but it does not
+     * wait for the SUBACK either, so the subscriptions are on the wire together.
+     */
+    g_mesh_mqtt.subscribe_pending = mac_num * template_num;
+
+    for (size_t i = 0; i < template_num; ++i) {
+        for (size_t j = 0; j < mac_num; ++j) {
+            snprintf(topic_str, sizeof(topic_str), templates[i], MAC2STR(macs[j]));
+            int msg_id = esp_mqtt_client_subscribe(client, topic_str, MESH_MQTT_SUBSCRIBE_QOS);
+            MDF_ERROR_CHECK(msg_id < 0, MDF_FAIL, "Subscribe failed");
+        }
+    }
 
     return MDF_OK;
 }
@@ -253,6 +850,12 @@ mdf_err_t mesh_mqtt_subscribe()
 mdf_err_t mesh_mqtt_unsubscribe()
 {
     char topic_str[MESH_MQTT_TOPIC_MAX_LEN];
+
+#ifdef CONFIG_MESH_MQTT_BINARY
+    snprintf(topic_str, sizeof(topic_str), binary_subscribe_topic_template, MAC2STR(g_mesh_mqtt.addr));
+    esp_mqtt_client_unsubscribe(g_mesh_mqtt.client, topic_str);
+#endif /**< CONFIG_MESH_MQTT_BINARY */
+
     snprintf(topic_str, sizeof(topic_str), subscribe_topic_template, MAC2STR(g_mesh_mqtt.addr));
     int msg_id = esp_mqtt_client_unsubscribe(g_mesh_mqtt.client, topic_str);
 
@@ -288,15 +891,35 @@ mdf_err_t mesh_mqtt_update_topo()
     MDF_FREE(route_table);
     char *str = cJSON_PrintUnformatted(obj);
     MDF_ERROR_GOTO(str == NULL, _no_mem, "Print JSON failed");
-    esp_mqtt_client_publish(g_mesh_mqtt.client, g_mesh_mqtt.topo_topic, str, strlen(str), 0, 0);
+    ret = mesh_mqtt_publish(g_mesh_mqtt.topo_topic, str, strlen(str), g_mesh_mqtt.addr);
     MDF_FREE(str);
-    ret = MDF_OK;
 _no_mem:
     cJSON_Delete(obj);
     return ret;
 }
 
-mdf_err_t mesh_mqtt_write(uint8_t *addr, const char *data, size_t size, mesh_mqtt_publish_data_type_t type)
+#ifdef CONFIG_MESH_MQTT_BINARY
+static mdf_err_t mesh_mqtt_publish_binary(const char *topic, const uint8_t *addr, const char *data, size_t size)
+{
+    mdf_err_t ret = MDF_OK;
+    char binary_topic[MESH_MQTT_TOPIC_MAX_LEN];
+    size_t buffer_size = sizeof(mesh_mqtt_bin_header_t) + size;
+    uint8_t *buffer = MDF_MALLOC(buffer_size);
+    MDF_ERROR_CHECK(buffer == NULL, MDF_ERR_NO_MEM, "Allocate mem failed");
+
+    buffer_size = mesh_mqtt_bin_encode(buffer, buffer_size, addr, MESH_MQTT_DATA_BYTES, data, size);
+    MDF_ERROR_GOTO(buffer_size == 0, _exit, "Binary data of %d bytes is too long", size);
+
+    snprintf(binary_topic, sizeof(binary_topic), "%s" MESH_MQTT_BINARY_SUFFIX, topic);
+    ret = mesh_mqtt_publish(binary_topic, (char *)buffer, buffer_size, addr);
+
+_exit:
+    MDF_FREE(buffer);
+    return buffer_size ? ret : MDF_ERR_INVALID_SIZE;
+}
+#endif /**< CONFIG_MESH_MQTT_BINARY */
+
+static mdf_err_t mesh_mqtt_publish_data(const char *topic, uint8_t *addr, const char *data, size_t size, mesh_mqtt_publish_data_type_t type)
 {
     MDF_PARAM_CHECK(addr);
     MDF_PARAM_CHECK(data);
@@ -306,7 +929,12 @@ mdf_err_t mesh_mqtt_write(uint8_t *addr, const char *data, size_t size, mesh_mqt
     mdf_err_t ret = MDF_FAIL;
     char mac_str[13];
 
-    /* publish data topic: mesh/{root_mac}/toCloud */
+#ifdef CONFIG_MESH_MQTT_BINARY
+    if (type == MESH_MQTT_DATA_BYTES) {
+        return mesh_mqtt_publish_binary(topic, addr, data, size);
+    }
+#endif /**< CONFIG_MESH_MQTT_BINARY */
+
     mlink_mac_hex2str(addr, mac_str);
 
     cJSON *obj = cJSON_CreateObject();
@@ -359,15 +987,68 @@ mdf_err_t mesh_mqtt_write(uint8_t *addr, const char *data, size_t size, mesh_mqt
     char *payload = cJSON_PrintUnformatted(obj);
     MDF_ERROR_GOTO(payload == NULL, _no_mem, "Print JSON failed");
 
-    esp_mqtt_client_publish(g_mesh_mqtt.client, g_mesh_mqtt.publish_topic, payload, strlen(payload), 0, 0);
+    ret = mesh_mqtt_publish(topic, payload, strlen(payload), addr);
     MDF_FREE(payload);
-
-    ret = MDF_OK;
 _no_mem:
     cJSON_Delete(obj);
     return ret;
 }
 
+mdf_err_t mesh_mqtt_write(uint8_t *addr, const char *data, size_t size, mesh_mqtt_publish_data_type_t type)
+{
+#ifdef CONFIG_MESH_MQTT_TOPIC_PER_NODE
+    MDF_PARAM_CHECK(addr);
+
+    /* publish data topic: mesh/{root_mac}/{node_mac}/telemetry */
+    char topic[MESH_MQTT_TOPIC_MAX_LEN];
+    snprintf(topic, sizeof(topic), node_topic_template, MAC2STR(g_mesh_mqtt.addr), MAC2STR(addr));
+
+    return mesh_mqtt_publish_data(topic, addr, data, size, type);
+#else
+    return mesh_mqtt_publish_data(g_mesh_mqtt.publish_topic, addr, data, size, type);
+#endif /**< CONFIG_MESH_MQTT_TOPIC_PER_NODE */
+}
+
+mdf_err_t mesh_mqtt_write_diag(uint8_t *addr, const char *data, size_t size)
+{
+    return mesh_mqtt_publish_data(g_mesh_mqtt.diag_topic, addr, data, size, MESH_MQTT_DATA_JSON);
+}
+
+mdf_err_t mesh_mqtt_write_rollup(uint8_t *addr, const char *data, size_t size)
+{
+    return mesh_mqtt_publish_data(g_mesh_mqtt.rollup_topic, addr, data, size, MESH_MQTT_DATA_JSON);
+}
+
+mdf_err_t mesh_mqtt_write_ack(const char *data, size_t size)
+{
+    return mesh_mqtt_publish_data(g_mesh_mqtt.ack_topic, g_mesh_mqtt.addr, data, size, MESH_MQTT_DATA_JSON);
+}
+
+uint32_t mesh_mqtt_get_queue_depth()
+{
+    /**< Never deleted once created, see the note on g_mesh_mqtt */
+    return g_mesh_mqtt.queue ? uxQueueMessagesWaiting(g_mesh_mqtt.queue) : 0;
+}
+
+uint32_t mesh_mqtt_get_inflight_num()
+{
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+    return g_mesh_mqtt.inflight_num;
+#else
+    return 0;
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+}
+
+uint32_t mesh_mqtt_get_connect_ms()
+{
+    return g_mesh_mqtt.connect_ms;
+}
+
+uint32_t mesh_mqtt_get_ready_ms()
+{
+    return g_mesh_mqtt.ready_ms;
+}
+
 mdf_err_t mesh_mqtt_read(mesh_mqtt_data_t **request, TickType_t wait_ticks)
 {
     MDF_PARAM_CHECK(request);
@@ -380,6 +1061,22 @@ mdf_err_t mesh_mqtt_read(mesh_mqtt_data_t **request, TickType_t wait_ticks)
     return MDF_OK;
 }
 
+#ifdef CONFIG_MESH_MQTT_TLS_PSK
+static mdf_err_t mesh_mqtt_psk_load()
+{
+    const char *hex = CONFIG_MESH_MQTT_TLS_PSK_KEY;
+
+    for (int i = 0; i < MESH_MQTT_PSK_KEY_LEN; ++i) {
+        char byte[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+        MDF_ERROR_CHECK(!isxdigit((int)byte[0]) || !isxdigit((int)byte[1]), MDF_ERR_INVALID_ARG,
+                        "CONFIG_MESH_MQTT_TLS_PSK_KEY is not a hex string");
+        g_mesh_mqtt_psk_key[i] = strtoul(byte, NULL, 16);
+    }
+
+    return MDF_OK;
+}
+#endif /**< CONFIG_MESH_MQTT_TLS_PSK */
+
 mdf_err_t mesh_mqtt_start(char *url)
 {
     MDF_PARAM_CHECK(url);
@@ -388,13 +1085,86 @@ mdf_err_t mesh_mqtt_start(char *url)
     esp_mqtt_client_config_t mqtt_cfg = {
         .uri = url,
         .event_handle = mqtt_event_handler,
-        // .client_cert_pem = (const char *)client_cert_pem_start,
-        // .client_key_pem = (const char *)client_key_pem_start,
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+        .client_id = g_mesh_mqtt.client_id,
+        .disable_clean_session = true,
+        .disable_auto_reconnect = true,
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+        .message_retransmit_timeout = CONFIG_MESH_MQTT_ACK_TIMEOUT_MS,
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+#ifdef CONFIG_MESH_MQTT_TLS_CERT
+        .cert_pem = mqtt_ca_pem_start,
+#ifdef CONFIG_MESH_MQTT_TLS_CLIENT_CERT
+        .client_cert_pem = mqtt_client_crt_start,
+        .client_key_pem = mqtt_client_key_start,
+#endif /**< CONFIG_MESH_MQTT_TLS_CLIENT_CERT */
+#endif /**< CONFIG_MESH_MQTT_TLS_CERT */
+#ifdef CONFIG_MESH_MQTT_TLS_PSK
+        .psk_hint_key = &g_mesh_mqtt_psk,
+#endif /**< CONFIG_MESH_MQTT_TLS_PSK */
     };
+
+#ifdef CONFIG_MESH_MQTT_TLS_PSK
+    MDF_ERROR_CHECK(mesh_mqtt_psk_load() != MDF_OK, MDF_ERR_INVALID_ARG, "Invalid TLS pre-shared key");
+#endif /**< CONFIG_MESH_MQTT_TLS_PSK */
+
+#ifdef CONFIG_MESH_MQTT_TLS_NONE
+    if (strncmp(url, "mqtts://", strlen("mqtts://")) == 0) {
+        MDF_LOGW("No TLS credentials configured for %s", url);
+    }
+#else
+    if (strncmp(url, "mqtts://", strlen("mqtts://")) != 0) {
+        MDF_LOGW("TLS credentials are not used, %s is not a mqtts:// URL", url);
+    }
+#endif /**< CONFIG_MESH_MQTT_TLS_NONE */
+
     MDF_ERROR_ASSERT(esp_read_mac(g_mesh_mqtt.addr, ESP_MAC_WIFI_STA));
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+    mesh_addr_t mesh_id = {0};
+    MDF_ERROR_ASSERT(esp_mesh_get_id(&mesh_id));
+    snprintf(g_mesh_mqtt.client_id, sizeof(g_mesh_mqtt.client_id), "mesh_%02x%02x%02x%02x%02x%02x",
+             MAC2STR(mesh_id.addr));
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
     snprintf(g_mesh_mqtt.publish_topic, sizeof(g_mesh_mqtt.publish_topic), publish_topic_template, MAC2STR(g_mesh_mqtt.addr));
     snprintf(g_mesh_mqtt.topo_topic, sizeof(g_mesh_mqtt.topo_topic), topo_topic_template, MAC2STR(g_mesh_mqtt.addr));
-    g_mesh_mqtt.queue = xQueueCreate(3, sizeof(mesh_mqtt_data_t *));
+    snprintf(g_mesh_mqtt.diag_topic, sizeof(g_mesh_mqtt.diag_topic), diag_topic_template, MAC2STR(g_mesh_mqtt.addr));
+    snprintf(g_mesh_mqtt.rollup_topic, sizeof(g_mesh_mqtt.rollup_topic), rollup_topic_template, MAC2STR(g_mesh_mqtt.addr));
+    snprintf(g_mesh_mqtt.ack_topic, sizeof(g_mesh_mqtt.ack_topic), ack_topic_template, MAC2STR(g_mesh_mqtt.addr));
+
+    if (g_mesh_mqtt.queue == NULL) {
+        g_mesh_mqtt.queue = MESH_STATIC_QUEUE_CREATE(mqtt, 3, sizeof(mesh_mqtt_data_t *));
+    }
+
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+    /**< mesh_mqtt_stop() gave every slot back */
+    if (g_mesh_mqtt.window == NULL) {
+        g_mesh_mqtt.window = MESH_STATIC_COUNTING_CREATE(mqtt_window, CONFIG_MESH_MQTT_INFLIGHT_WINDOW,
+                                                         CONFIG_MESH_MQTT_INFLIGHT_WINDOW);
+    }
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
+    if (g_mesh_mqtt.client_lock == NULL) {
+        g_mesh_mqtt.client_lock = MESH_STATIC_MUTEX_CREATE(mqtt_client);
+    }
+
+#ifdef CONFIG_MESH_MQTT_COMPRESS
+    if (g_mesh_mqtt.compress_lock == NULL) {
+        g_mesh_mqtt.compress_lock = MESH_STATIC_MUTEX_CREATE(mqtt_compress);
+    }
+#endif /**< CONFIG_MESH_MQTT_COMPRESS */
+    g_mesh_mqtt.disconnect_time = 0;
+    g_mesh_mqtt.subscribe_pending = 0;
+
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+    g_mesh_mqtt.retry_num = 0;
+
+    /**< Kept across stop and start, a deleted timer is only released later by the timer task */
+    if (g_mesh_mqtt.reconnect_timer == NULL) {
+        g_mesh_mqtt.reconnect_timer = MESH_STATIC_TIMER_CREATE(mqtt_reconnect, "mqtt_reconnect", 1, pdFALSE,
+                                                               NULL, mesh_mqtt_reconnect_timer_cb);
+    }
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
+
     g_mesh_mqtt.client = esp_mqtt_client_init(&mqtt_cfg);
     MDF_ERROR_ASSERT(esp_mqtt_client_start(g_mesh_mqtt.client));
 
@@ -406,18 +1176,56 @@ mdf_err_t mesh_mqtt_stop()
     MDF_ERROR_CHECK(g_mesh_mqtt.client == NULL, MDF_ERR_INVALID_STATE, "MQTT client has not been started");
     mesh_mqtt_data_t *item;
 
-    if (uxQueueMessagesWaiting(g_mesh_mqtt.queue)) {
-        if (xQueueReceive(g_mesh_mqtt.queue, &item, 0)) {
-            MDF_FREE(item);
-        }
+#ifdef CONFIG_MESH_MQTT_PERSISTENT_SESSION
+    xTimerStop(g_mesh_mqtt.reconnect_timer, portMAX_DELAY);
+#endif /**< CONFIG_MESH_MQTT_PERSISTENT_SESSION */
+
+    /**
+     * Taken away from the publishers first, a publish in progress finishes
+     * before the client goes. The lock is not held across the stop, which
+     * waits for the MQTT task and its event handler.
+     */
+    xSemaphoreTake(g_mesh_mqtt.client_lock, portMAX_DELAY);
+    esp_mqtt_client_handle_t client = g_mesh_mqtt.client;
+    g_mesh_mqtt.client = NULL;
+    xSemaphoreGive(g_mesh_mqtt.client_lock);
+
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+
+    /**< The queue is kept for the next start, only the requests left in it are dropped */
+    while (xQueueReceive(g_mesh_mqtt.queue, &item, 0) == pdPASS) {
+        MDF_FREE(item->addrs_list);
+        MDF_FREE(item->data);
+        MDF_FREE(item);
     }
 
-    vQueueDelete(g_mesh_mqtt.queue);
-    g_mesh_mqtt.queue = NULL;
+#ifdef CONFIG_MESH_MQTT_RELIABLE_UPLINK
+    /**
+     * The outbox went with the client. Its slots are given back rather than
+     * the window deleted, publishers blocked on it wake up and see no client.
+     */
+    size_t released = 0;
 
-    esp_mqtt_client_stop(g_mesh_mqtt.client);
-    esp_mqtt_client_destroy(g_mesh_mqtt.client);
-    g_mesh_mqtt.client = NULL;
+    portENTER_CRITICAL(&g_mesh_mqtt.inflight_lock);
+
+    for (int i = 0; i < MESH_MQTT_INFLIGHT_TABLE_SIZE; ++i) {
+        released += g_mesh_mqtt.inflight[i].state == MESH_MQTT_INFLIGHT_WAIT_ACK;
+        g_mesh_mqtt.inflight[i].state = MESH_MQTT_INFLIGHT_FREE;
+    }
+
+    g_mesh_mqtt.inflight_num = 0;
+    portEXIT_CRITICAL(&g_mesh_mqtt.inflight_lock);
+
+    if (released) {
+        MDF_LOGW("Drop %d unacknowledged messages", released);
+    }
+
+    for (int i = 0; i < released; ++i) {
+        mesh_metrics_inc(MESH_METRICS_MQTT_DROP);
+        xSemaphoreGive(g_mesh_mqtt.window);
+    }
+#endif /**< CONFIG_MESH_MQTT_RELIABLE_UPLINK */
 
     return MDF_OK;
 }
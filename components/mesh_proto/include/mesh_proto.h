@@ -0,0 +1,57 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_PROTO_H__
+#define __MESH_PROTO_H__
+
+#include "mwifi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Application frame types exchanged over the mesh.
+ *
+ * @note The type is carried in the `protocol` field of mwifi_data_type_t,
+ *       so frames keep their payload untouched. MESH_PROTO_DATA (0) is the
+ *       default of a zeroed mwifi_data_type_t and is used by all plain
+ *       telemetry, so older firmware stays compatible. On the way to the
+ *       root, MESH_PROTO_DATA and MESH_PROTO_METRICS frames carry the
+ *       sequence number of the node in `custom`, see mesh_seq.h.
+ */
+typedef enum {
+    MESH_PROTO_DATA = 0,        /**< Application data, forwarded to the cloud as is */
+    MESH_PROTO_TIME_BEACON,     /**< Wall clock broadcast by the root, see mesh_time.h */
+    MESH_PROTO_CONFIG,          /**< JSON configuration update, see node_config.h */
+    MESH_PROTO_METRICS,         /**< Node metrics report, published on the diag topic */
+    MESH_PROTO_ROOT_STATE,      /**< Root state snapshot sent to standby roots, see root_standby.h */
+    MESH_PROTO_AGGREGATE,       /**< Readings of a subtree batched by a relay node, see mesh_aggregate.h */
+    MESH_PROTO_ACK,             /**< Result of a command sent back by a node, see mesh_ack.h */
+    MESH_PROTO_COMMAND,         /**< Binary commands for a node, see mesh_command.h */
+    MESH_PROTO_SHARD_STATE,     /**< Load of the root and share of leaf nodes to move, see mesh_shard.h */
+    MESH_PROTO_PARENT,          /**< SoftAP MAC of a parent, sent to a child that connects, see mesh_aggregate.h */
+} mesh_proto_type_t;
+
+/**
+ * @brief Heartbeat sent by every node, arguments are the node STA MAC, the
+ *        parent BSSID (MAC2STR) and the layer. The root publishes it as is.
+ */
+#define MESH_PROTO_HEARTBEAT_FORMAT "{\"type\":\"heartbeat\", \"self\": \"%02x%02x%02x%02x%02x%02x\", \"parent\":\"%02x%02x%02x%02x%02x%02x\",\"layer\":%d}"
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_PROTO_H__ */
@@ -0,0 +1,90 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_ROLLUP_H__
+#define __MESH_ROLLUP_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Channels folded into rollups, in the order they are published
+ */
+typedef enum {
+    MESH_ROLLUP_TEMP = 0,   /**< "Temp" */
+    MESH_ROLLUP_HUMI,       /**< "Humi" */
+    MESH_ROLLUP_LIGHT,      /**< "sensor_light" */
+    MESH_ROLLUP_CHANNEL_MAX,
+} mesh_rollup_channel_t;
+
+/**
+ * @brief  Initialize the accumulators, called once at startup
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t mesh_rollup_init();
+
+/**
+ * @brief  Start publishing rollups, called when the device becomes root
+ *
+ * @note   Every window is published as
+ *         {"window":60,"end":1700000040000,"Temp":{"min":20.1,"max":21.3,"mean":20.74,"count":12},...}
+ *         "end" is the wall clock boundary the window closed on, a multiple
+ *         of CONFIG_MESH_ROLLUP_WINDOW_S, and is left out while the clock is
+ *         not synchronized. "window" is the real length in seconds, shorter
+ *         for the first window and the one closed by mesh_rollup_stop().
+ *         Channels without readings are left out.
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_rollup_start();
+
+/**
+ * @brief  Stop publishing rollups, called when the device loses the root role
+ *
+ * @note   The open window is published before this returns, if MQTT is
+ *         still connected
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_rollup_stop();
+
+/**
+ * @brief  Fold a reading received by the root into the rollup of its node
+ *
+ * @param  addr address of the node
+ * @param  data pointer of the JSON reading, not null-terminated
+ * @param  size length of the reading
+ *
+ * @return
+ *     - true, the reading must also be forwarded raw
+ *     - false, the reading is only kept in the rollup
+ */
+bool mesh_rollup_handle(const uint8_t *addr, const char *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_ROLLUP_H__ */
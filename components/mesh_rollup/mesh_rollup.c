@@ -0,0 +1,393 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/param.h>
+#include "mesh_rollup.h"
+#include "mesh_mqtt_handle.h"
+#include "mesh_time.h"
+#include "mwifi.h"
+#include "mesh_static.h"
+
+#define MESH_ROLLUP_JSON_MAX_LEN (256)
+#define MESH_ROLLUP_EXIT_WAIT_MS (1000)  /**< How long stop and start wait for the task to exit */
+
+#ifdef CONFIG_MESH_ROLLUP_ENABLE
+
+typedef struct {
+    float min;
+    float max;
+    float sum;
+    uint32_t count;
+} mesh_rollup_acc_t;
+
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    mesh_rollup_acc_t acc[MESH_ROLLUP_CHANNEL_MAX];
+} mesh_rollup_node_t;
+
+static const struct {
+    const char *key;
+    bool raw;   /**< Readings with this channel are forwarded raw too */
+} g_mesh_rollup_channels[MESH_ROLLUP_CHANNEL_MAX] = {
+    [MESH_ROLLUP_TEMP] = {
+        .key = "Temp",
+#ifdef CONFIG_MESH_ROLLUP_RAW_TEMP
+        .raw = true,
+#endif /**< CONFIG_MESH_ROLLUP_RAW_TEMP */
+    },
+    [MESH_ROLLUP_HUMI] = {
+        .key = "Humi",
+#ifdef CONFIG_MESH_ROLLUP_RAW_HUMI
+        .raw = true,
+#endif /**< CONFIG_MESH_ROLLUP_RAW_HUMI */
+    },
+    [MESH_ROLLUP_LIGHT] = {
+        .key = "sensor_light",
+#ifdef CONFIG_MESH_ROLLUP_RAW_LIGHT
+        .raw = true,
+#endif /**< CONFIG_MESH_ROLLUP_RAW_LIGHT */
+    },
+};
+
+static struct mesh_rollup {
+    SemaphoreHandle_t lock;
+    size_t node_num;
+    mesh_rollup_node_t *nodes;    /**< Accumulators of the open window */
+    mesh_rollup_node_t *closed;   /**< Copy of the last window, published outside the lock */
+    bool running;
+    TaskHandle_t task;
+} g_mesh_rollup;
+
+MESH_STATIC_MUTEX_DEFINE(rollup);
+MESH_STATIC_TASK_DEFINE(rollup, 3 * 1024);
+MESH_STATIC_BUFFER_DEFINE(rollup_json, MESH_ROLLUP_JSON_MAX_LEN);
+MESH_STATIC_BUFFER_DEFINE(rollup_nodes, CONFIG_MESH_ROLLUP_NODE_MAX_NUM * sizeof(mesh_rollup_node_t));
+MESH_STATIC_BUFFER_DEFINE(rollup_closed, CONFIG_MESH_ROLLUP_NODE_MAX_NUM * sizeof(mesh_rollup_node_t));
+
+static const char *TAG = "mesh_rollup";
+
+/**
+ * @brief Parse the value of "key":"12.5" or "key":12.5 without copying the reading
+ */
+static bool mesh_rollup_parse(const char *data, size_t size, const char *key, float *value)
+{
+    char pattern[20];
+    int pattern_len = snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = memmem(data, size, pattern, pattern_len);
+    const char *end = data + size;
+    float integer = 0, fraction = 0, scale = 1;
+    bool negative = false, digits = false;
+
+    if (p == NULL) {
+        return false;
+    }
+
+    for (p += pattern_len; p < end && (*p == ' ' || *p == '"'); ++p);
+
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, digits = true) {
+        integer = integer * 10 + (*p - '0');
+    }
+
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, digits = true) {
+            scale /= 10;
+            fraction += (*p - '0') * scale;
+        }
+    }
+
+    *value = negative ? -(integer + fraction) : integer + fraction;
+
+    return digits;
+}
+
+/**
+ * @brief Find or add the accumulators of a node, must be called with the lock held
+ */
+static mesh_rollup_node_t *mesh_rollup_node_get(const uint8_t *addr)
+{
+    for (size_t i = 0; i < g_mesh_rollup.node_num; ++i) {
+        if (!memcmp(g_mesh_rollup.nodes[i].addr, addr, MWIFI_ADDR_LEN)) {
+            return g_mesh_rollup.nodes + i;
+        }
+    }
+
+    if (g_mesh_rollup.node_num == CONFIG_MESH_ROLLUP_NODE_MAX_NUM) {
+        return NULL;
+    }
+
+    mesh_rollup_node_t *node = g_mesh_rollup.nodes + g_mesh_rollup.node_num++;
+    memset(node, 0, sizeof(mesh_rollup_node_t));
+    memcpy(node->addr, addr, MWIFI_ADDR_LEN);
+
+    return node;
+}
+
+static void mesh_rollup_publish(mesh_rollup_node_t *node, uint32_t window_s, int64_t end_ms, char *buffer)
+{
+    mdf_err_t ret = MDF_OK;
+    int size = snprintf(buffer, MESH_ROLLUP_JSON_MAX_LEN, "{\"window\":%u", window_s);
+
+    if (end_ms > 0) {
+        size += snprintf(buffer + size, MESH_ROLLUP_JSON_MAX_LEN - size, ",\"end\":%lld", (long long)end_ms);
+    }
+
+    for (int i = 0; i < MESH_ROLLUP_CHANNEL_MAX; ++i) {
+        const mesh_rollup_acc_t *acc = node->acc + i;
+
+        if (acc->count == 0) {
+            continue;
+        }
+
+        size += snprintf(buffer + size, MESH_ROLLUP_JSON_MAX_LEN - size,
+                         ",\"%s\":{\"min\":%.2f,\"max\":%.2f,\"mean\":%.2f,\"count\":%u}",
+                         g_mesh_rollup_channels[i].key, acc->min, acc->max, acc->sum / acc->count, acc->count);
+    }
+
+    size += snprintf(buffer + size, MESH_ROLLUP_JSON_MAX_LEN - size, "}");
+
+    if (size >= MESH_ROLLUP_JSON_MAX_LEN) {
+        MDF_LOGW("Rollup of " MACSTR " is truncated", MAC2STR(node->addr));
+        return;
+    }
+
+    ret = mesh_mqtt_write_rollup(node->addr, buffer, size);
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> mesh_mqtt_write_rollup", mdf_err_to_name(ret));
+    }
+}
+
+/**
+ * @brief Close the open window and publish it
+ */
+static void mesh_rollup_close(uint32_t window_s, int64_t end_ms, char *buffer)
+{
+    /**< Swap the window out so the root task is never blocked by the publishes */
+    xSemaphoreTake(g_mesh_rollup.lock, portMAX_DELAY);
+    size_t node_num = g_mesh_rollup.node_num;
+    mesh_rollup_node_t *closed = g_mesh_rollup.nodes;
+    g_mesh_rollup.nodes = g_mesh_rollup.closed;
+    g_mesh_rollup.closed = closed;
+    g_mesh_rollup.node_num = 0;
+    xSemaphoreGive(g_mesh_rollup.lock);
+
+    if (node_num == 0) {
+        return;
+    }
+
+    if (!mesh_mqtt_is_connect()) {
+        MDF_LOGW("MQTT is not connected, drop the rollups of %d nodes", node_num);
+        return;
+    }
+
+    for (size_t i = 0; i < node_num; ++i) {
+        mesh_rollup_publish(closed + i, window_s, end_ms, buffer);
+    }
+}
+
+/**
+ * @brief Windows end on multiples of the window on the wall clock, e.g. on
+ *        every minute, so rollups of different roots line up. Until the
+ *        clock is synchronized, a window is as long as configured from the
+ *        start of the task. The window open when the root role is lost is
+ *        published as is, with its real length.
+ */
+static void mesh_rollup_task(void *arg)
+{
+    char *buffer = MESH_STATIC_MALLOC(rollup_json, MESH_ROLLUP_JSON_MAX_LEN);
+    const int64_t window_ms = CONFIG_MESH_ROLLUP_WINDOW_S * 1000LL;
+    TickType_t start = xTaskGetTickCount();
+    int64_t start_ms = mesh_time_now_ms();
+
+    MDF_LOGI("Mesh rollup task is running");
+
+    while (buffer != NULL) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        int64_t now_ms = mesh_time_now_ms();
+        int64_t end_ms = 0;
+        TickType_t wait = 0;
+
+        /**< The clock got synchronized during this window */
+        if (now_ms > 0 && start_ms == 0) {
+            start_ms = now_ms;
+        }
+
+        if (now_ms > 0) {
+            end_ms = (start_ms / window_ms + 1) * window_ms;
+            wait = now_ms < end_ms ? pdMS_TO_TICKS(end_ms - now_ms) : 0;
+        } else if (elapsed < pdMS_TO_TICKS(window_ms)) {
+            wait = pdMS_TO_TICKS(window_ms) - elapsed;
+        }
+
+        if (g_mesh_rollup.running && wait > 0) {
+            ulTaskNotifyTake(pdTRUE, wait);
+            continue;
+        }
+
+        /**< Stopped before the boundary, the window ends now */
+        if (wait > 0) {
+            end_ms = now_ms;
+        }
+
+        mesh_rollup_close((elapsed + pdMS_TO_TICKS(500)) / pdMS_TO_TICKS(1000), end_ms, buffer);
+
+        if (!g_mesh_rollup.running) {
+            break;
+        }
+
+        /**< The next window ends on the next boundary, also after a clock step */
+        start += elapsed;
+        start_ms = MAX(now_ms, end_ms);
+    }
+
+    MDF_LOGW("Mesh rollup task is exit");
+
+    MESH_STATIC_FREE(rollup_json, buffer);
+    g_mesh_rollup.task = NULL;
+    MESH_STATIC_TASK_EXIT();
+}
+#endif /**< CONFIG_MESH_ROLLUP_ENABLE */
+
+mdf_err_t mesh_rollup_init()
+{
+#ifdef CONFIG_MESH_ROLLUP_ENABLE
+    MDF_ERROR_CHECK(g_mesh_rollup.lock != NULL, MDF_ERR_INVALID_STATE, "Mesh rollup is already initialized");
+
+    g_mesh_rollup.nodes = MESH_STATIC_MALLOC(rollup_nodes, CONFIG_MESH_ROLLUP_NODE_MAX_NUM * sizeof(mesh_rollup_node_t));
+    g_mesh_rollup.closed = MESH_STATIC_MALLOC(rollup_closed, CONFIG_MESH_ROLLUP_NODE_MAX_NUM * sizeof(mesh_rollup_node_t));
+    g_mesh_rollup.lock = MESH_STATIC_MUTEX_CREATE(rollup);
+    MDF_ERROR_CHECK(!g_mesh_rollup.nodes || !g_mesh_rollup.closed || !g_mesh_rollup.lock,
+                    MDF_ERR_NO_MEM, "Allocate mem failed");
+
+    MDF_LOGI("Rollup window: %ds, raw forwarding: Temp %d, Humi %d, sensor_light %d", CONFIG_MESH_ROLLUP_WINDOW_S,
+             g_mesh_rollup_channels[MESH_ROLLUP_TEMP].raw, g_mesh_rollup_channels[MESH_ROLLUP_HUMI].raw,
+             g_mesh_rollup_channels[MESH_ROLLUP_LIGHT].raw);
+#endif /**< CONFIG_MESH_ROLLUP_ENABLE */
+
+    return MDF_OK;
+}
+
+#ifdef CONFIG_MESH_ROLLUP_ENABLE
+/**
+ * @brief Wait for the task to publish the last window and exit
+ */
+static void mesh_rollup_wait_exit()
+{
+    for (int i = 0; i < MESH_ROLLUP_EXIT_WAIT_MS / 10 && g_mesh_rollup.task; ++i) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+#endif /**< CONFIG_MESH_ROLLUP_ENABLE */
+
+mdf_err_t mesh_rollup_start()
+{
+#ifdef CONFIG_MESH_ROLLUP_ENABLE
+    MDF_ERROR_CHECK(g_mesh_rollup.lock == NULL, MDF_ERR_INVALID_STATE, "Mesh rollup is not initialized");
+    MDF_ERROR_CHECK(g_mesh_rollup.running, MDF_ERR_INVALID_STATE, "Mesh rollup is already running");
+
+    /**< The root role came back before the previous task exited */
+    mesh_rollup_wait_exit();
+    MDF_ERROR_CHECK(g_mesh_rollup.task, MDF_ERR_INVALID_STATE, "The previous rollup task is still running");
+
+    xSemaphoreTake(g_mesh_rollup.lock, portMAX_DELAY);
+    g_mesh_rollup.node_num = 0;
+    xSemaphoreGive(g_mesh_rollup.lock);
+
+    g_mesh_rollup.running = true;
+    MESH_STATIC_TASK_CREATE(rollup, mesh_rollup_task, "mesh_rollup",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY - 1, &g_mesh_rollup.task);
+#endif /**< CONFIG_MESH_ROLLUP_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_rollup_stop()
+{
+#ifdef CONFIG_MESH_ROLLUP_ENABLE
+    MDF_ERROR_CHECK(!g_mesh_rollup.running, MDF_ERR_INVALID_STATE, "Mesh rollup has not been started");
+
+    g_mesh_rollup.running = false;
+
+    if (g_mesh_rollup.task) {
+        xTaskNotifyGive(g_mesh_rollup.task);
+        mesh_rollup_wait_exit();
+    }
+#endif /**< CONFIG_MESH_ROLLUP_ENABLE */
+
+    return MDF_OK;
+}
+
+bool mesh_rollup_handle(const uint8_t *addr, const char *data, size_t size)
+{
+#ifdef CONFIG_MESH_ROLLUP_ENABLE
+    float values[MESH_ROLLUP_CHANNEL_MAX];
+    uint8_t found = 0;
+    bool raw = false;
+
+    if (!g_mesh_rollup.running || addr == NULL || data == NULL) {
+        return true;
+    }
+
+    /**< Parse outside the lock, folding is a few compares and adds per channel */
+    for (int i = 0; i < MESH_ROLLUP_CHANNEL_MAX; ++i) {
+        if (mesh_rollup_parse(data, size, g_mesh_rollup_channels[i].key, values + i)) {
+            found |= 1 << i;
+            raw |= g_mesh_rollup_channels[i].raw;
+        }
+    }
+
+    /**< Heartbeats and anything else that is not a reading */
+    if (!found) {
+        return true;
+    }
+
+    xSemaphoreTake(g_mesh_rollup.lock, portMAX_DELAY);
+    mesh_rollup_node_t *node = mesh_rollup_node_get(addr);
+
+    for (int i = 0; i < MESH_ROLLUP_CHANNEL_MAX && node; ++i) {
+        mesh_rollup_acc_t *acc = node->acc + i;
+
+        if (!(found & (1 << i))) {
+            continue;
+        }
+
+        if (acc->count == 0 || values[i] < acc->min) {
+            acc->min = values[i];
+        }
+
+        if (acc->count == 0 || values[i] > acc->max) {
+            acc->max = values[i];
+        }
+
+        acc->sum += values[i];
+        acc->count++;
+    }
+
+    xSemaphoreGive(g_mesh_rollup.lock);
+
+    if (node == NULL) {
+        MDF_LOGW("Too many nodes in this window, forward " MACSTR " raw", MAC2STR(addr));
+        return true;
+    }
+
+    return raw;
+#else
+    return true;
+#endif /**< CONFIG_MESH_ROLLUP_ENABLE */
+}
@@ -0,0 +1,89 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_SEQ_H__
+#define __MESH_SEQ_H__
+
+#include "mdf_common.h"
+#include "mwifi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MESH_SEQ_NONE   (0)     /**< Frame without a sequence number, e.g. from older firmware */
+#define MESH_SEQ_WINDOW (32)    /**< Frames a node may be reordered by before they count as lost */
+
+/**
+ * @brief  Called with each part of a loss report
+ *
+ * @param  data pointer of the JSON report, not null-terminated
+ * @param  size length of the report
+ */
+typedef mdf_err_t (*mesh_seq_report_cb_t)(const char *data, size_t size);
+
+/**
+ * @brief  Sequence number of the next frame of this node
+ *
+ * @note   Numbers start at a random value at every boot, so the root can
+ *         tell a restarted node from a stream of duplicates, and never
+ *         take the value MESH_SEQ_NONE
+ *
+ * @return Sequence number, to be carried in the `custom` field of
+ *         mwifi_data_type_t or in an aggregate record
+ */
+uint32_t mesh_seq_next();
+
+/**
+ * @brief  Account for a frame received by the root
+ *
+ * @param  addr address of the node that produced the frame
+ * @param  seq  sequence number of the frame
+ *
+ * @note   A sequence number more than MESH_SEQ_WINDOW behind the newest of
+ *         the node is a late frame, dropped and counted as a duplicate.
+ *         Only a jump by thousands of numbers either way is taken as a
+ *         restart of the node
+ *
+ * @return false if the frame is a duplicate or late and must be dropped
+ */
+bool mesh_seq_check(const uint8_t *addr, uint32_t seq);
+
+/**
+ * @brief  Report the frames received, lost and duplicated per node since the
+ *         previous report, then start a new interval
+ *
+ * @param  cb called with chunks of at most 1 KB, each a JSON object
+ *            {"seq":[{"addr":"30aea4000002","rx":98,"lost":2,"dup":1,"loss":0.020},...]}
+ *            where loss is lost / (rx + lost)
+ *
+ * @note   Nodes without any frame in the interval are forgotten
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NO_MEM
+ *     - the first error returned by cb
+ */
+mdf_err_t mesh_seq_report(mesh_seq_report_cb_t cb);
+
+/**
+ * @brief  Number of nodes tracked by the root, for a metrics gauge
+ */
+uint32_t mesh_seq_get_node_num();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_SEQ_H__ */
@@ -0,0 +1,250 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_seq.h"
+#include "esp_system.h"
+#include "mesh_static.h"
+
+#define MESH_SEQ_RESYNC_GAP     (4096)  /**< A jump by more than this either way is a restart, not a loss */
+#define MESH_SEQ_REPORT_SIZE    (1024)
+#define MESH_SEQ_NODE_JSON_LEN  (96)    /**< Upper bound of one node in the report */
+
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint16_t dup;               /**< Duplicates and late frames dropped in this interval */
+    uint32_t top;               /**< Newest sequence number */
+    uint32_t window;            /**< Bit i is set if top - i has been received */
+    uint32_t rx;                /**< Frames received in this interval */
+    uint32_t lost;              /**< Frames that left the window unreceived in this interval */
+} mesh_seq_node_t;
+
+MESH_STATIC_BUFFER_DEFINE(seq_nodes, CONFIG_MESH_SEQ_NODE_MAX_NUM * sizeof(mesh_seq_node_t));
+MESH_STATIC_BUFFER_DEFINE(seq_report, MESH_SEQ_REPORT_SIZE);
+MESH_STATIC_BUFFER_DEFINE(seq_snapshot, CONFIG_MESH_SEQ_NODE_MAX_NUM * sizeof(mesh_seq_node_t));
+
+static struct mesh_seq {
+    portMUX_TYPE lock;
+    bool started;
+    uint32_t next;
+    size_t node_num;
+    mesh_seq_node_t *nodes;     /**< Sorted by address, a static pool or allocated by the first mesh_seq_check() */
+} g_mesh_seq = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+    .nodes = MESH_STATIC_BUFFER(seq_nodes),
+};
+
+static const char *TAG = "mesh_seq";
+
+uint32_t mesh_seq_next()
+{
+    uint32_t seq = MESH_SEQ_NONE;
+    uint32_t start = esp_random();
+
+    portENTER_CRITICAL(&g_mesh_seq.lock);
+
+    if (!g_mesh_seq.started) {
+        g_mesh_seq.next = start;
+        g_mesh_seq.started = true;
+    }
+
+    /**< Skip MESH_SEQ_NONE when the counter wraps */
+    seq = g_mesh_seq.next++ ? : g_mesh_seq.next++;
+
+    portEXIT_CRITICAL(&g_mesh_seq.lock);
+
+    return seq;
+}
+
+/**
+ * @brief Binary search, must be called with the lock held
+ *
+ * @return Index of the node, or of the entry it would be inserted before
+ */
+static size_t mesh_seq_find(const uint8_t *addr, bool *found)
+{
+    size_t low = 0, high = g_mesh_seq.node_num;
+
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        int cmp = memcmp(g_mesh_seq.nodes[mid].addr, addr, MWIFI_ADDR_LEN);
+
+        if (cmp == 0) {
+            *found = true;
+            return mid;
+        }
+
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    *found = false;
+    return low;
+}
+
+/**
+ * @brief Start the window of a node at seq, frames before it are not accounted
+ */
+static void mesh_seq_resync(mesh_seq_node_t *node, uint32_t seq)
+{
+    node->top = seq;
+    node->window = UINT32_MAX;
+    node->rx++;
+}
+
+bool mesh_seq_check(const uint8_t *addr, uint32_t seq)
+{
+    bool found = false;
+    bool fresh = true;
+
+    if (addr == NULL || seq == MESH_SEQ_NONE) {
+        return true;
+    }
+
+    /**< Only the root needs the table, allocated outside the critical section */
+    if (g_mesh_seq.nodes == NULL) {
+        mesh_seq_node_t *nodes = MDF_CALLOC(CONFIG_MESH_SEQ_NODE_MAX_NUM, sizeof(mesh_seq_node_t));
+        MDF_ERROR_CHECK(nodes == NULL, true, "Allocate mem failed");
+
+        portENTER_CRITICAL(&g_mesh_seq.lock);
+
+        if (g_mesh_seq.nodes == NULL) {
+            g_mesh_seq.nodes = nodes;
+            nodes = NULL;
+        }
+
+        portEXIT_CRITICAL(&g_mesh_seq.lock);
+        MDF_FREE(nodes);
+    }
+
+    portENTER_CRITICAL(&g_mesh_seq.lock);
+
+    size_t index = mesh_seq_find(addr, &found);
+    mesh_seq_node_t *node = g_mesh_seq.nodes + index;
+
+    if (!found && g_mesh_seq.node_num < CONFIG_MESH_SEQ_NODE_MAX_NUM) {
+        memmove(node + 1, node, (g_mesh_seq.node_num - index) * sizeof(mesh_seq_node_t));
+        memset(node, 0, sizeof(mesh_seq_node_t));
+        memcpy(node->addr, addr, MWIFI_ADDR_LEN);
+        g_mesh_seq.node_num++;
+        mesh_seq_resync(node, seq);
+    } else if (found) {
+        uint32_t ahead = seq - node->top;
+        uint32_t behind = node->top - seq;
+
+        if (ahead > 0 && ahead <= MESH_SEQ_RESYNC_GAP) {
+            /**< The bits shifted out of the window and the numbers jumped over are lost */
+            uint32_t out = ahead < MESH_SEQ_WINDOW ? node->window >> (MESH_SEQ_WINDOW - ahead) : node->window;
+            uint32_t out_num = ahead < MESH_SEQ_WINDOW ? ahead : MESH_SEQ_WINDOW;
+            node->lost += out_num - __builtin_popcount(out);
+            node->lost += ahead > MESH_SEQ_WINDOW ? ahead - MESH_SEQ_WINDOW : 0;
+            node->window = ahead < MESH_SEQ_WINDOW ? (node->window << ahead) | 1 : 1;
+            node->top = seq;
+            node->rx++;
+        } else if (behind < MESH_SEQ_WINDOW) {
+            fresh = !(node->window & (1UL << behind));
+            node->window |= 1UL << behind;
+            node->rx += fresh;
+            node->dup += !fresh;
+        } else if (behind <= MESH_SEQ_RESYNC_GAP) {
+            /**< Out of the window, a late frame can not be told from a duplicate and was counted lost already */
+            fresh = false;
+            node->dup++;
+        } else {
+            mesh_seq_resync(node, seq);
+        }
+    }
+
+    portEXIT_CRITICAL(&g_mesh_seq.lock);
+
+    return fresh;
+}
+
+mdf_err_t mesh_seq_report(mesh_seq_report_cb_t cb)
+{
+    MDF_PARAM_CHECK(cb);
+
+    mdf_err_t ret = MDF_OK;
+    size_t node_num = 0;
+    int size = 0;
+
+    if (g_mesh_seq.nodes == NULL) {
+        return MDF_OK;
+    }
+
+    char *buffer = MESH_STATIC_MALLOC(seq_report, MESH_SEQ_REPORT_SIZE);
+    mesh_seq_node_t *nodes = MESH_STATIC_MALLOC(seq_snapshot, CONFIG_MESH_SEQ_NODE_MAX_NUM * sizeof(mesh_seq_node_t));
+
+    if (buffer == NULL || nodes == NULL) {
+        MESH_STATIC_FREE(seq_report, buffer);
+        MESH_STATIC_FREE(seq_snapshot, nodes);
+        return MDF_ERR_NO_MEM;
+    }
+
+    /**< Snapshot and reset the counters, quiet nodes are dropped from the table */
+    portENTER_CRITICAL(&g_mesh_seq.lock);
+
+    for (size_t i = 0; i < g_mesh_seq.node_num; ++i) {
+        mesh_seq_node_t *node = g_mesh_seq.nodes + i;
+
+        if (!node->rx && !node->lost && !node->dup) {
+            continue;
+        }
+
+        nodes[node_num] = *node;
+        node->rx = node->lost = node->dup = 0;
+        g_mesh_seq.nodes[node_num++] = *node;
+    }
+
+    g_mesh_seq.node_num = node_num;
+
+    portEXIT_CRITICAL(&g_mesh_seq.lock);
+
+    for (size_t i = 0; i < node_num && ret == MDF_OK; ++i) {
+        const mesh_seq_node_t *node = nodes + i;
+        uint32_t total = node->rx + node->lost;
+
+        if (size == 0) {
+            size = snprintf(buffer, MESH_SEQ_REPORT_SIZE, "{\"seq\":[");
+        }
+
+        size += snprintf(buffer + size, MESH_SEQ_REPORT_SIZE - size,
+                         "{\"addr\":\"%02x%02x%02x%02x%02x%02x\",\"rx\":%u,\"lost\":%u,\"dup\":%u,\"loss\":%.3f},",
+                         MAC2STR(node->addr), node->rx, node->lost, node->dup,
+                         total ? (float)node->lost / total : 0);
+
+        if (i + 1 == node_num || size + MESH_SEQ_NODE_JSON_LEN + 2 > MESH_SEQ_REPORT_SIZE) {
+            /**< Replace the trailing comma */
+            size += snprintf(buffer + size - 1, MESH_SEQ_REPORT_SIZE - size + 1, "]}") - 1;
+            ret = cb(buffer, size);
+            size = 0;
+        }
+    }
+
+    MESH_STATIC_FREE(seq_report, buffer);
+    MESH_STATIC_FREE(seq_snapshot, nodes);
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> Loss report of %d nodes", mdf_err_to_name(ret), node_num);
+    }
+
+    return ret;
+}
+
+uint32_t mesh_seq_get_node_num()
+{
+    return g_mesh_seq.node_num;
+}
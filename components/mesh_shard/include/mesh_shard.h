@@ -0,0 +1,122 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_SHARD_H__
+#define __MESH_SHARD_H__
+
+#include "mdf_common.h"
+#include "mesh_shard_policy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MESH_SHARD_STATE_VERSION (1)
+
+/**
+ * @brief Load of the root, broadcast with protocol MESH_PROTO_SHARD_STATE
+ */
+typedef struct {
+    uint8_t version;        /**< MESH_SHARD_STATE_VERSION */
+    uint8_t load;           /**< Load of the root in percent */
+    uint16_t shed_permille; /**< Share of the leaf nodes asked to choose a mesh again */
+} __attribute__((packed)) mesh_shard_state_t;
+
+/**
+ * @brief Vendor specific element every node adds to its beacons and probe
+ *        responses, read by the nodes that choose a mesh
+ */
+typedef struct {
+    uint8_t version;                     /**< MESH_SHARD_STATE_VERSION */
+    uint8_t mesh_id[MESH_SHARD_ID_LEN];
+    uint8_t load;                        /**< Last load of the root in percent */
+    uint8_t layer;                       /**< Layer of the node sending the beacon */
+} __attribute__((packed)) mesh_shard_ie_t;
+
+/**
+ * @brief  Parse the list of meshes of the field, CONFIG_MESH_SHARD_MESH_IDS
+ *
+ * @param  home_id mesh of the node configuration, always part of the list
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mesh_shard_init(const uint8_t *home_id);
+
+/**
+ * @brief  Choose the mesh to join from the loads advertised in the beacons
+ *         of the meshes in range
+ *
+ * @param  mesh_id mesh the node is configured for, replaced by the chosen one
+ *
+ * @note   Wi-Fi must be started and the mesh stopped, the scan takes a few seconds.
+ *         When no mesh of the field is heard the mesh is picked from the list
+ *         by the MAC address, so that a field booting at once still spreads.
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_FAIL, the scan failed and mesh_id is unchanged
+ */
+mdf_err_t mesh_shard_select(uint8_t *mesh_id);
+
+/**
+ * @brief  Start reporting the load of the root, called when the device becomes the root
+ *
+ * @note   The load is broadcast to the mesh and published as {"shard":{...}} on the
+ *         diag topic, so the cloud sees every mesh of the field
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_shard_root_start();
+
+/**
+ * @brief  Stop reporting the load
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_shard_root_stop();
+
+/**
+ * @brief  Handle the load broadcast by the root
+ *
+ * @param  data pointer of the mesh_shard_state_t frame
+ * @param  size length of the frame
+ *
+ * @note   Updates the beacon element of the node. A leaf node asked to shed
+ *         leaves the mesh with probability shed_permille and chooses again.
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mesh_shard_handle_state(const uint8_t *data, size_t size);
+
+/**
+ * @brief  Get the last load of the root of this mesh
+ *
+ * @return Percent
+ */
+uint32_t mesh_shard_get_load();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_SHARD_H__ */
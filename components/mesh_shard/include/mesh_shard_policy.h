@@ -0,0 +1,120 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_SHARD_POLICY_H__
+#define __MESH_SHARD_POLICY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Placement of nodes on one of several meshes covering the same field.
+ *
+ *        Every root reports a load in percent. A node joins the mesh with the
+ *        lowest score, the load of its root plus hop_cost for every layer
+ *        between the node and that root. A root at high_load or above asks a
+ *        share of its leaf nodes to choose again, sized so that the load
+ *        would drop to target_load.
+ *
+ * @note  The code has no platform dependencies and is shared with the host
+ *        simulator in tools/mesh_shard.
+ */
+
+#define MESH_SHARD_ID_LEN (6)
+
+typedef struct {
+    uint16_t node_capacity; /**< Nodes a root forwards at 100 % load */
+    uint8_t hop_cost;       /**< Load in percent one more layer is worth */
+    uint8_t hysteresis;     /**< Score a mesh must be better by to leave the current one */
+    uint8_t high_load;      /**< Load from which a root sheds nodes */
+    uint8_t target_load;    /**< Load shedding aims for */
+    int8_t min_rssi;        /**< Meshes only heard below this are ignored */
+} mesh_shard_policy_t;
+
+/**
+ * @brief A mesh heard during a scan, from the closest of its nodes
+ */
+typedef struct {
+    uint8_t mesh_id[MESH_SHARD_ID_LEN];
+    uint8_t load;  /**< Load of the root in percent */
+    uint8_t layer; /**< Layer of the node heard, the joining node would be one below */
+    int8_t rssi;
+} mesh_shard_candidate_t;
+
+/**
+ * @brief  Load of a root in percent
+ *
+ * @param  policy    placement policy
+ * @param  node_num  nodes in the mesh, the root included
+ * @param  queue_num messages waiting for the uplink
+ * @param  queue_max capacity of the uplink queue, 0 if it is not known
+ * @param  connected the root is connected to the broker
+ *
+ * @return The larger of the node and the queue share, 100 without a broker
+ */
+uint8_t mesh_shard_policy_load(const mesh_shard_policy_t *policy, uint32_t node_num,
+                               uint32_t queue_num, uint32_t queue_max, bool connected);
+
+/**
+ * @brief  Share of its leaf nodes a root asks to choose a mesh again
+ *
+ * @param  policy placement policy
+ * @param  load   load of the root in percent
+ *
+ * @return Per mille, 0 below high_load
+ */
+uint16_t mesh_shard_policy_shed(const mesh_shard_policy_t *policy, uint8_t load);
+
+/**
+ * @brief  Score of a mesh for a joining node, lower is better
+ */
+int mesh_shard_policy_score(const mesh_shard_policy_t *policy, const mesh_shard_candidate_t *candidate);
+
+/**
+ * @brief  Add a heard mesh to the candidates, keeping the best node per mesh
+ *
+ * @param  policy     placement policy
+ * @param  candidates candidates heard so far
+ * @param  num        number of candidates
+ * @param  max_num    capacity of candidates
+ * @param  heard      mesh heard
+ *
+ * @return The new number of candidates
+ */
+size_t mesh_shard_policy_merge(const mesh_shard_policy_t *policy, mesh_shard_candidate_t *candidates,
+                               size_t num, size_t max_num, const mesh_shard_candidate_t *heard);
+
+/**
+ * @brief  Choose the mesh to join
+ *
+ * @param  policy     placement policy
+ * @param  candidates meshes heard
+ * @param  num        number of candidates
+ * @param  current    mesh the node is on, NULL if none
+ *
+ * @return Index of the chosen candidate, -1 if none was heard
+ */
+int mesh_shard_policy_select(const mesh_shard_policy_t *policy, const mesh_shard_candidate_t *candidates,
+                             size_t num, const uint8_t *current);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_SHARD_POLICY_H__ */
@@ -0,0 +1,381 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_shard.h"
+#include "mesh_proto.h"
+#include "mesh_fairq.h"
+#include "mesh_mqtt_handle.h"
+#include "mesh_static.h"
+#include "mwifi.h"
+#include "esp_wifi.h"
+
+#ifdef CONFIG_MESH_SHARD_ENABLE
+#define MESH_SHARD_IE_TYPE      (0x5d) /**< Type of the vendor element under the Espressif OUI */
+#define MESH_SHARD_HIGH_REPORTS (2)    /**< Consecutive reports at high load before shedding */
+#define MESH_SHARD_REPORT_LEN   (128)
+
+#ifdef CONFIG_MESH_FAIRQ_ENABLE
+#define MESH_SHARD_QUEUE_MAX_NUM CONFIG_MESH_FAIRQ_QUEUE_MAX_NUM
+#else
+#define MESH_SHARD_QUEUE_MAX_NUM (0)
+#endif /**< CONFIG_MESH_FAIRQ_ENABLE */
+
+static const uint8_t g_mesh_shard_oui[] = {0x18, 0xfe, 0x34};
+
+static const mesh_shard_policy_t g_mesh_shard_policy = {
+    .node_capacity = CONFIG_MESH_SHARD_NODE_CAPACITY,
+    .hop_cost = CONFIG_MESH_SHARD_HOP_COST,
+    .hysteresis = CONFIG_MESH_SHARD_HYSTERESIS,
+    .high_load = CONFIG_MESH_SHARD_HIGH_LOAD,
+    .target_load = CONFIG_MESH_SHARD_TARGET_LOAD,
+    .min_rssi = CONFIG_MESH_SHARD_MIN_RSSI,
+};
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+
+static struct mesh_shard {
+#ifdef CONFIG_MESH_SHARD_ENABLE
+    portMUX_TYPE lock; /**< Guards the candidates, they are added from the Wi-Fi task */
+    size_t mesh_num;
+    uint8_t mesh_ids[CONFIG_MESH_SHARD_MESH_MAX_NUM][MESH_SHARD_ID_LEN];
+    size_t candidate_num;
+    mesh_shard_candidate_t candidates[CONFIG_MESH_SHARD_MESH_MAX_NUM];
+    uint8_t mesh_id[MESH_SHARD_ID_LEN]; /**< Mesh joined */
+    int64_t join_time;                  /**< Time the mesh was chosen, us */
+    bool leaving;
+    uint8_t high_num;
+    TaskHandle_t task;
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+    bool running;
+    uint8_t load;
+} g_mesh_shard = {
+#ifdef CONFIG_MESH_SHARD_ENABLE
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+};
+
+static const char *TAG = "mesh_shard";
+
+#ifdef CONFIG_MESH_SHARD_ENABLE
+MESH_STATIC_TASK_DEFINE(shard, 3 * 1024);
+MESH_STATIC_TASK_DEFINE(shard_rejoin, 3 * 1024);
+
+static bool mesh_shard_is_listed(const uint8_t *mesh_id)
+{
+    for (int i = 0; i < g_mesh_shard.mesh_num; ++i) {
+        if (!memcmp(g_mesh_shard.mesh_ids[i], mesh_id, MESH_SHARD_ID_LEN)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void mesh_shard_vendor_ie_cb(void *ctx, wifi_vendor_ie_type_t type, const uint8_t sa[6],
+                                    const vendor_ie_data_t *vnd_ie, int rssi)
+{
+    mesh_shard_ie_t ie = {0};
+
+    if (memcmp(vnd_ie->vendor_oui, g_mesh_shard_oui, sizeof(g_mesh_shard_oui))
+            || vnd_ie->vendor_oui_type != MESH_SHARD_IE_TYPE
+            || vnd_ie->length < sizeof(g_mesh_shard_oui) + 1 + sizeof(mesh_shard_ie_t)) {
+        return;
+    }
+
+    memcpy(&ie, vnd_ie->payload, sizeof(ie));
+
+    if (ie.version != MESH_SHARD_STATE_VERSION || !mesh_shard_is_listed(ie.mesh_id)) {
+        return;
+    }
+
+    mesh_shard_candidate_t heard = {
+        .load = ie.load,
+        .layer = ie.layer,
+        .rssi = rssi,
+    };
+    memcpy(heard.mesh_id, ie.mesh_id, MESH_SHARD_ID_LEN);
+
+    portENTER_CRITICAL(&g_mesh_shard.lock);
+    g_mesh_shard.candidate_num = mesh_shard_policy_merge(&g_mesh_shard_policy, g_mesh_shard.candidates,
+                                                         g_mesh_shard.candidate_num, CONFIG_MESH_SHARD_MESH_MAX_NUM, &heard);
+    portEXIT_CRITICAL(&g_mesh_shard.lock);
+}
+
+/**
+ * @brief Advertise the load of the root in the beacons and probe responses of this node
+ */
+static void mesh_shard_set_ie(uint8_t load, uint8_t layer)
+{
+    uint8_t buffer[sizeof(vendor_ie_data_t) + sizeof(mesh_shard_ie_t)];
+    vendor_ie_data_t *vnd_ie = (vendor_ie_data_t *)buffer;
+    mesh_shard_ie_t ie = {
+        .version = MESH_SHARD_STATE_VERSION,
+        .load = load,
+        .layer = layer,
+    };
+
+    memcpy(ie.mesh_id, g_mesh_shard.mesh_id, MESH_SHARD_ID_LEN);
+    vnd_ie->element_id = WIFI_VENDOR_IE_ELEMENT_ID;
+    vnd_ie->length = sizeof(g_mesh_shard_oui) + 1 + sizeof(mesh_shard_ie_t);
+    memcpy(vnd_ie->vendor_oui, g_mesh_shard_oui, sizeof(g_mesh_shard_oui));
+    vnd_ie->vendor_oui_type = MESH_SHARD_IE_TYPE;
+    memcpy(vnd_ie->payload, &ie, sizeof(ie));
+
+    /**< An element is replaced by disabling it first, ESP-MESH uses the first index */
+    esp_wifi_set_vendor_ie(false, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_1, NULL);
+    esp_wifi_set_vendor_ie(true, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_1, vnd_ie);
+    esp_wifi_set_vendor_ie(false, WIFI_VND_IE_TYPE_PROBE_RESP, WIFI_VND_IE_ID_1, NULL);
+    esp_wifi_set_vendor_ie(true, WIFI_VND_IE_TYPE_PROBE_RESP, WIFI_VND_IE_ID_1, vnd_ie);
+}
+
+static void mesh_shard_rejoin_task(void *arg)
+{
+    mdf_err_t ret = MDF_OK;
+    mwifi_config_t config = {0};
+
+    /**< Spread the nodes that leave after the same report over the interval */
+    vTaskDelay(pdMS_TO_TICKS(esp_random() % (CONFIG_MESH_SHARD_INTERVAL_S * 1000)));
+
+    MDF_LOGI("Root is overloaded, choose the mesh again");
+
+    mwifi_get_config(&config);
+    mwifi_stop();
+
+    ret = mesh_shard_select(config.mesh_id);
+
+    if (ret == MDF_OK) {
+        mwifi_set_config(&config);
+    }
+
+    ret = mwifi_start();
+
+    if (ret != MDF_OK) {
+        MDF_LOGE("<%s> mwifi_start", mdf_err_to_name(ret));
+    }
+
+    g_mesh_shard.leaving = false;
+    MESH_STATIC_TASK_EXIT();
+}
+
+static void mesh_shard_root_task(void *arg)
+{
+    mdf_err_t ret = MDF_OK;
+    char buffer[MESH_SHARD_REPORT_LEN];
+    uint8_t sta_mac[MWIFI_ADDR_LEN] = {0};
+    uint8_t dest_addr[] = MWIFI_ADDR_ANY;
+    mwifi_data_type_t data_type = {
+        .communicate = MWIFI_COMMUNICATE_BROADCAST,
+        .protocol = MESH_PROTO_SHARD_STATE,
+    };
+    mesh_shard_state_t state = {
+        .version = MESH_SHARD_STATE_VERSION,
+    };
+
+    esp_wifi_get_mac(ESP_IF_WIFI_STA, sta_mac);
+    MDF_LOGI("Mesh shard task is running");
+
+    while (g_mesh_shard.running) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_MESH_SHARD_INTERVAL_S * 1000));
+
+        if (!g_mesh_shard.running || !mwifi_is_connected()) {
+            continue;
+        }
+
+        int node_num = esp_mesh_get_total_node_num();
+        state.load = mesh_shard_policy_load(&g_mesh_shard_policy, node_num, mesh_fairq_get_queue_num(),
+                                            MESH_SHARD_QUEUE_MAX_NUM, mesh_mqtt_is_connect());
+
+        /**< A single busy report is a burst, not a saturated root */
+        g_mesh_shard.high_num = state.load >= CONFIG_MESH_SHARD_HIGH_LOAD ? g_mesh_shard.high_num + 1 : 0;
+        state.shed_permille = g_mesh_shard.high_num >= MESH_SHARD_HIGH_REPORTS
+                              ? mesh_shard_policy_shed(&g_mesh_shard_policy, state.load) : 0;
+        g_mesh_shard.load = state.load;
+        mesh_shard_set_ie(state.load, 1);
+
+        if (state.shed_permille) {
+            MDF_LOGW("Root load: %d%%, asking %d per mille of the leaf nodes to move", state.load, state.shed_permille);
+        }
+
+        ret = mwifi_root_write(dest_addr, 1, &data_type, &state, sizeof(state), true);
+
+        if (ret != MDF_OK) {
+            MDF_LOGW("<%s> mwifi_root_write", mdf_err_to_name(ret));
+        }
+
+        int size = snprintf(buffer, sizeof(buffer), "{\"shard\":{\"mesh_id\":\"%.6s\",\"load\":%d,\"nodes\":%d,\"shed\":%d}}",
+                            (char *)g_mesh_shard.mesh_id, state.load, node_num, state.shed_permille);
+        ret = mesh_mqtt_write_diag(sta_mac, buffer, size);
+
+        if (ret != MDF_OK) {
+            MDF_LOGD("<%s> mesh_mqtt_write_diag", mdf_err_to_name(ret));
+        }
+    }
+
+    MDF_LOGW("Mesh shard task is exit");
+
+    g_mesh_shard.task = NULL;
+    MESH_STATIC_TASK_EXIT();
+}
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+
+mdf_err_t mesh_shard_init(const uint8_t *home_id)
+{
+    MDF_PARAM_CHECK(home_id);
+
+#ifdef CONFIG_MESH_SHARD_ENABLE
+    const char *list = CONFIG_MESH_SHARD_MESH_IDS;
+
+    g_mesh_shard.mesh_num = 1;
+    memcpy(g_mesh_shard.mesh_ids[0], home_id, MESH_SHARD_ID_LEN);
+    memcpy(g_mesh_shard.mesh_id, home_id, MESH_SHARD_ID_LEN);
+
+    for (const char *id = list; *id != '\0';) {
+        const char *end = strchr(id, ',');
+        size_t len = end ? end - id : strlen(id);
+
+        MDF_ERROR_CHECK(len != MESH_SHARD_ID_LEN, MDF_ERR_INVALID_ARG, "Mesh IDs must be 6 characters: %s", list);
+
+        if (!mesh_shard_is_listed((const uint8_t *)id)) {
+            MDF_ERROR_CHECK(g_mesh_shard.mesh_num >= CONFIG_MESH_SHARD_MESH_MAX_NUM, MDF_ERR_INVALID_ARG,
+                            "More than %d meshes: %s", CONFIG_MESH_SHARD_MESH_MAX_NUM, list);
+            memcpy(g_mesh_shard.mesh_ids[g_mesh_shard.mesh_num++], id, MESH_SHARD_ID_LEN);
+        }
+
+        id += end ? len + 1 : len;
+    }
+
+    MDF_LOGI("Field of %d meshes, node capacity: %d", g_mesh_shard.mesh_num, CONFIG_MESH_SHARD_NODE_CAPACITY);
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_shard_select(uint8_t *mesh_id)
+{
+    MDF_PARAM_CHECK(mesh_id);
+
+#ifdef CONFIG_MESH_SHARD_ENABLE
+    if (g_mesh_shard.mesh_num <= 1) {
+        return MDF_OK;
+    }
+
+    wifi_scan_config_t scan_config = {
+        .show_hidden = true,
+    };
+
+    g_mesh_shard.candidate_num = 0;
+    esp_wifi_set_vendor_ie_cb(mesh_shard_vendor_ie_cb, NULL);
+    esp_err_t ret = esp_wifi_scan_start(&scan_config, true);
+    esp_wifi_set_vendor_ie_cb(NULL, NULL);
+    esp_wifi_scan_stop();
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_FAIL, "<%s> esp_wifi_scan_start", mdf_err_to_name(ret));
+
+    mesh_shard_candidate_t chosen = {0};
+    portENTER_CRITICAL(&g_mesh_shard.lock);
+    size_t candidate_num = g_mesh_shard.candidate_num;
+    int index = mesh_shard_policy_select(&g_mesh_shard_policy, g_mesh_shard.candidates, candidate_num, mesh_id);
+
+    if (index >= 0) {
+        chosen = g_mesh_shard.candidates[index];
+    }
+
+    portEXIT_CRITICAL(&g_mesh_shard.lock);
+
+    if (index >= 0) {
+        memcpy(mesh_id, chosen.mesh_id, MESH_SHARD_ID_LEN);
+        MDF_LOGI("Join mesh %.6s of %d heard, load: %d%%, layer: %d, rssi: %d",
+                 (char *)mesh_id, candidate_num, chosen.load, chosen.layer + 1, chosen.rssi);
+    } else {
+        uint8_t sta_mac[MWIFI_ADDR_LEN] = {0};
+        esp_wifi_get_mac(ESP_IF_WIFI_STA, sta_mac);
+        memcpy(mesh_id, g_mesh_shard.mesh_ids[(sta_mac[4] << 8 | sta_mac[5]) % g_mesh_shard.mesh_num], MESH_SHARD_ID_LEN);
+        MDF_LOGI("No mesh of the field heard, join mesh %.6s", (char *)mesh_id);
+    }
+
+    memcpy(g_mesh_shard.mesh_id, mesh_id, MESH_SHARD_ID_LEN);
+    g_mesh_shard.join_time = esp_timer_get_time();
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_shard_root_start()
+{
+    MDF_ERROR_CHECK(g_mesh_shard.running, MDF_ERR_INVALID_STATE, "Mesh shard is already running");
+#ifdef CONFIG_MESH_SHARD_ENABLE
+    MDF_ERROR_CHECK(g_mesh_shard.task, MDF_ERR_INVALID_STATE, "Mesh shard task has not exited");
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+
+    g_mesh_shard.running = true;
+
+#ifdef CONFIG_MESH_SHARD_ENABLE
+    g_mesh_shard.high_num = 0;
+    MESH_STATIC_TASK_CREATE(shard, mesh_shard_root_task, "mesh_shard",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, &g_mesh_shard.task);
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_shard_root_stop()
+{
+    MDF_ERROR_CHECK(!g_mesh_shard.running, MDF_ERR_INVALID_STATE, "Mesh shard has not been started");
+
+    g_mesh_shard.running = false;
+
+#ifdef CONFIG_MESH_SHARD_ENABLE
+    if (g_mesh_shard.task) {
+        xTaskNotifyGive(g_mesh_shard.task);
+    }
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_shard_handle_state(const uint8_t *data, size_t size)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(size < sizeof(mesh_shard_state_t), MDF_ERR_INVALID_ARG, "State is too short, size: %d", size);
+
+    mesh_shard_state_t state = {0};
+    memcpy(&state, data, sizeof(mesh_shard_state_t));
+    MDF_ERROR_CHECK(state.version != MESH_SHARD_STATE_VERSION, MDF_ERR_INVALID_ARG,
+                    "Unsupported state version: %d", state.version);
+
+    g_mesh_shard.load = state.load;
+
+#ifdef CONFIG_MESH_SHARD_ENABLE
+    mesh_shard_set_ie(state.load, esp_mesh_get_layer());
+
+    /**
+     * @brief Only leaf nodes move, a relay would take its subtree along. A node
+     *        that just chose its mesh waits for the load to reflect it.
+     */
+    if (!state.shed_permille || g_mesh_shard.leaving || esp_mesh_get_routing_table_size() > 1
+            || esp_timer_get_time() - g_mesh_shard.join_time < 3LL * CONFIG_MESH_SHARD_INTERVAL_S * 1000000
+            || esp_random() % 1000 >= state.shed_permille) {
+        return MDF_OK;
+    }
+
+    g_mesh_shard.leaving = true;
+    MESH_STATIC_TASK_CREATE(shard_rejoin, mesh_shard_rejoin_task, "mesh_shard_rejoin",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL);
+#endif /**< CONFIG_MESH_SHARD_ENABLE */
+
+    return MDF_OK;
+}
+
+uint32_t mesh_shard_get_load()
+{
+    return g_mesh_shard.load;
+}
@@ -0,0 +1,97 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include "mesh_shard_policy.h"
+
+uint8_t mesh_shard_policy_load(const mesh_shard_policy_t *policy, uint32_t node_num,
+                               uint32_t queue_num, uint32_t queue_max, bool connected)
+{
+    if (!connected) {
+        return 100;
+    }
+
+    uint32_t load = policy->node_capacity ? node_num * 100 / policy->node_capacity : 0;
+
+    if (queue_max && queue_num * 100 / queue_max > load) {
+        load = queue_num * 100 / queue_max;
+    }
+
+    return load > 100 ? 100 : load;
+}
+
+uint16_t mesh_shard_policy_shed(const mesh_shard_policy_t *policy, uint8_t load)
+{
+    if (load < policy->high_load || load <= policy->target_load) {
+        return 0;
+    }
+
+    return (uint32_t)(load - policy->target_load) * 1000 / load;
+}
+
+int mesh_shard_policy_score(const mesh_shard_policy_t *policy, const mesh_shard_candidate_t *candidate)
+{
+    return candidate->load + policy->hop_cost * candidate->layer;
+}
+
+size_t mesh_shard_policy_merge(const mesh_shard_policy_t *policy, mesh_shard_candidate_t *candidates,
+                               size_t num, size_t max_num, const mesh_shard_candidate_t *heard)
+{
+    if (heard->rssi < policy->min_rssi) {
+        return num;
+    }
+
+    for (size_t i = 0; i < num; ++i) {
+        if (memcmp(candidates[i].mesh_id, heard->mesh_id, MESH_SHARD_ID_LEN)) {
+            continue;
+        }
+
+        /**< The load is the same from every node of a mesh, the freshest copy wins ties */
+        if (heard->layer <= candidates[i].layer) {
+            candidates[i] = *heard;
+        }
+
+        return num;
+    }
+
+    if (num < max_num) {
+        candidates[num++] = *heard;
+    }
+
+    return num;
+}
+
+int mesh_shard_policy_select(const mesh_shard_policy_t *policy, const mesh_shard_candidate_t *candidates,
+                             size_t num, const uint8_t *current)
+{
+    int best = -1;
+    int stay = -1;
+
+    for (size_t i = 0; i < num; ++i) {
+        if (best < 0 || mesh_shard_policy_score(policy, candidates + i) < mesh_shard_policy_score(policy, candidates + best)) {
+            best = i;
+        }
+
+        if (current && !memcmp(candidates[i].mesh_id, current, MESH_SHARD_ID_LEN)) {
+            stay = i;
+        }
+    }
+
+    if (stay >= 0 && mesh_shard_policy_score(policy, candidates + stay)
+            <= mesh_shard_policy_score(policy, candidates + best) + policy->hysteresis) {
+        return stay;
+    }
+
+    return best;
+}
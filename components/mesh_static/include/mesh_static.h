@@ -0,0 +1,183 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef __MESH_STATIC_H__
+#define __MESH_STATIC_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Long-lived tasks, queues, mutexes and frame buffers, allocated from
+ *        the heap or, with CONFIG_MESH_STATIC_MEMORY, from pools in .bss
+ *
+ *        The pools are named mesh_static_<kind>_<name>, the budget report of
+ *        the build finds them by these names in the ELF.
+ *
+ *        MESH_STATIC_TASK_DEFINE(xxx, 3 * 1024);
+ *        MESH_STATIC_TASK_CREATE(xxx, xxx_task, "xxx", NULL, prio, &handle);
+ *        ...
+ *        MESH_STATIC_TASK_EXIT();    at the end of xxx_task, in place of vTaskDelete(NULL)
+ *
+ *        MESH_STATIC_TASK_TRY_CREATE() does not wait for the previous task of
+ *        the slot, use it where blocking is not allowed, e.g. in the event loop.
+ */
+
+#ifdef CONFIG_MESH_STATIC_MEMORY
+
+typedef struct mesh_static_task {
+    uint32_t stack_size;
+    StackType_t *stack;
+    StaticTask_t tcb;
+    TaskHandle_t handle;
+    volatile bool exited;           /**< The task called mesh_static_task_exit() */
+    struct mesh_static_task *next;
+} mesh_static_task_t;
+
+#define MESH_STATIC_TASK_DEFINE(name, size) \
+    static StackType_t mesh_static_stack_##name[(size) / sizeof(StackType_t)]; \
+    static mesh_static_task_t mesh_static_task_##name = {.stack_size = (size), .stack = mesh_static_stack_##name}
+
+#define MESH_STATIC_TASK_CREATE(name, task, task_name, arg, priority, handle) \
+    mesh_static_task_create(&mesh_static_task_##name, task, task_name, arg, priority, handle)
+
+#define MESH_STATIC_TASK_TRY_CREATE(name, task, task_name, arg, priority, handle) \
+    mesh_static_task_try_create(&mesh_static_task_##name, task, task_name, arg, priority, handle)
+
+#define MESH_STATIC_TASK_EXIT() mesh_static_task_exit()
+
+#define MESH_STATIC_MUTEX_DEFINE(name) static StaticSemaphore_t mesh_static_mutex_##name
+#define MESH_STATIC_MUTEX_CREATE(name) xSemaphoreCreateMutexStatic(&mesh_static_mutex_##name)
+
+#define MESH_STATIC_SEMAPHORE_DEFINE(name) static StaticSemaphore_t mesh_static_semaphore_##name
+#define MESH_STATIC_BINARY_CREATE(name) xSemaphoreCreateBinaryStatic(&mesh_static_semaphore_##name)
+#define MESH_STATIC_COUNTING_CREATE(name, max, initial) \
+    xSemaphoreCreateCountingStatic(max, initial, &mesh_static_semaphore_##name)
+
+#define MESH_STATIC_QUEUE_DEFINE(name, length, item_size) \
+    static uint8_t mesh_static_queue_##name[(length) * (item_size)]; \
+    static StaticQueue_t mesh_static_queue_tcb_##name
+
+#define MESH_STATIC_QUEUE_CREATE(name, length, item_size) \
+    xQueueCreateStatic(length, item_size, mesh_static_queue_##name, &mesh_static_queue_tcb_##name)
+
+#define MESH_STATIC_TIMER_DEFINE(name) static StaticTimer_t mesh_static_timer_##name
+#define MESH_STATIC_TIMER_CREATE(name, timer_name, period, auto_reload, id, cb) \
+    xTimerCreateStatic(timer_name, period, auto_reload, id, cb, &mesh_static_timer_##name)
+
+/**
+ * @brief A frame buffer belongs to the one task or module that defines it,
+ *        the size given to MESH_STATIC_MALLOC must be a constant
+ */
+#define MESH_STATIC_BUFFER_DEFINE(name, size) \
+    static uint8_t mesh_static_buffer_##name[size] __attribute__((aligned(4)))
+
+#define MESH_STATIC_MALLOC(name, size) \
+    ((void)sizeof(char[sizeof(mesh_static_buffer_##name) >= (size) ? 1 : -1]), \
+     memset(mesh_static_buffer_##name, 0, size))
+
+#define MESH_STATIC_FREE(name, ptr) do { (ptr) = NULL; } while (0)
+
+/**
+ * @brief The pool itself, for tables that are otherwise allocated on first use
+ */
+#define MESH_STATIC_BUFFER(name) ((void *)mesh_static_buffer_##name)
+
+#else
+
+#define MESH_STATIC_TASK_DEFINE(name, size) \
+    static const uint32_t mesh_static_stack_size_##name = (size)
+
+#define MESH_STATIC_TASK_CREATE(name, task, task_name, arg, priority, handle) \
+    xTaskCreate(task, task_name, mesh_static_stack_size_##name, arg, priority, handle)
+
+#define MESH_STATIC_TASK_TRY_CREATE MESH_STATIC_TASK_CREATE
+
+#define MESH_STATIC_TASK_EXIT() vTaskDelete(NULL)
+
+#define MESH_STATIC_MUTEX_DEFINE(name)
+#define MESH_STATIC_MUTEX_CREATE(name) xSemaphoreCreateMutex()
+
+#define MESH_STATIC_SEMAPHORE_DEFINE(name)
+#define MESH_STATIC_BINARY_CREATE(name) xSemaphoreCreateBinary()
+#define MESH_STATIC_COUNTING_CREATE(name, max, initial) xSemaphoreCreateCounting(max, initial)
+
+#define MESH_STATIC_QUEUE_DEFINE(name, length, item_size)
+#define MESH_STATIC_QUEUE_CREATE(name, length, item_size) xQueueCreate(length, item_size)
+
+#define MESH_STATIC_TIMER_DEFINE(name)
+#define MESH_STATIC_TIMER_CREATE(name, timer_name, period, auto_reload, id, cb) \
+    xTimerCreate(timer_name, period, auto_reload, id, cb)
+
+#define MESH_STATIC_BUFFER_DEFINE(name, size)
+#define MESH_STATIC_MALLOC(name, size) MDF_CALLOC(1, size)
+#define MESH_STATIC_FREE(name, ptr) MDF_FREE(ptr)
+#define MESH_STATIC_BUFFER(name) NULL
+
+#endif /**< CONFIG_MESH_STATIC_MEMORY */
+
+#ifdef CONFIG_MESH_STATIC_MEMORY
+
+/**
+ * @brief  Start a task on the stack and control block of its slot
+ *
+ * @param  slot      slot defined with MESH_STATIC_TASK_DEFINE
+ * @param  task      entry of the task, it must end with MESH_STATIC_TASK_EXIT()
+ * @param  task_name name of the task
+ * @param  arg       argument of the task
+ * @param  priority  priority of the task
+ * @param  handle    the handle of the task, may be NULL
+ *
+ * @note   The previous task of the slot is deleted here, after it exited,
+ *         so its control block is never reused while the idle task may
+ *         still release it. A task that is stopping is given a second to
+ *         exit.
+ *
+ * @return
+ *     - pdPASS
+ *     - pdFAIL the previous task of the slot is still running
+ */
+BaseType_t mesh_static_task_create(mesh_static_task_t *slot, TaskFunction_t task, const char *task_name,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle);
+
+/**
+ * @brief  Same as mesh_static_task_create(), without waiting for the
+ *         previous task of the slot
+ *
+ * @note   For callers that must not block, such as the event loop. They
+ *         retry later on pdFAIL.
+ *
+ * @return
+ *     - pdPASS
+ *     - pdFAIL the previous task of the slot has not exited yet
+ */
+BaseType_t mesh_static_task_try_create(mesh_static_task_t *slot, TaskFunction_t task, const char *task_name,
+                                       void *arg, UBaseType_t priority, TaskHandle_t *handle);
+
+/**
+ * @brief  End the calling task, it is suspended until its slot is reused
+ */
+void mesh_static_task_exit(void);
+
+#endif /**< CONFIG_MESH_STATIC_MEMORY */
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_STATIC_H__ */
@@ -0,0 +1,95 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mesh_static.h"
+
+#ifdef CONFIG_MESH_STATIC_MEMORY
+
+#define MESH_STATIC_EXIT_WAIT_MS (1000)  /**< How long a new task waits for the previous one of its slot */
+
+static mesh_static_task_t *g_mesh_static_tasks = NULL;
+static portMUX_TYPE g_mesh_static_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *TAG = "mesh_static";
+
+static BaseType_t mesh_static_task_start(mesh_static_task_t *slot, TaskFunction_t task, const char *task_name,
+                                         void *arg, UBaseType_t priority, TaskHandle_t *handle, uint32_t wait_ms)
+{
+    MDF_ERROR_CHECK(!slot || !task, pdFAIL, "Invalid task slot");
+
+    if (slot->handle) {
+        /**< A task blocked without timeout is reported as suspended too, only the flag is reliable */
+        for (uint32_t i = 0; i < wait_ms / 10 && !slot->exited; ++i) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+
+        /**< A caller that does not wait retries, it reports the final failure itself */
+        if (!slot->exited) {
+            if (wait_ms) {
+                MDF_LOGW("The previous %s task is still running", task_name);
+            }
+
+            return pdFAIL;
+        }
+
+        /**< Deleting another, suspended task releases it at once, it never waits for the idle task */
+        vTaskDelete(slot->handle);
+        slot->handle = NULL;
+    } else {
+        portENTER_CRITICAL(&g_mesh_static_lock);
+        slot->next = g_mesh_static_tasks;
+        g_mesh_static_tasks = slot;
+        portEXIT_CRITICAL(&g_mesh_static_lock);
+    }
+
+    slot->exited = false;
+    slot->handle = xTaskCreateStatic(task, task_name, slot->stack_size, arg, priority,
+                                     slot->stack, &slot->tcb);
+
+    if (handle) {
+        *handle = slot->handle;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t mesh_static_task_create(mesh_static_task_t *slot, TaskFunction_t task, const char *task_name,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return mesh_static_task_start(slot, task, task_name, arg, priority, handle, MESH_STATIC_EXIT_WAIT_MS);
+}
+
+BaseType_t mesh_static_task_try_create(mesh_static_task_t *slot, TaskFunction_t task, const char *task_name,
+                                       void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return mesh_static_task_start(slot, task, task_name, arg, priority, handle, 0);
+}
+
+void mesh_static_task_exit(void)
+{
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+
+    for (mesh_static_task_t *slot = g_mesh_static_tasks; slot; slot = slot->next) {
+        if (slot->handle == current) {
+            slot->exited = true;
+            vTaskSuspend(NULL);
+        }
+    }
+
+    MDF_LOGE("Task is not in a static slot");
+    vTaskDelete(NULL);
+}
+
+#endif /**< CONFIG_MESH_STATIC_MEMORY */
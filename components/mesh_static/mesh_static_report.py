@@ -0,0 +1,113 @@
+#!/usr/bin/env python
+#
+# Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Memory budget of a CONFIG_MESH_STATIC_MEMORY build, run after linking:
+
+    mesh_static_report.py --nm xtensa-esp32s2-elf-nm --objdump xtensa-esp32s2-elf-objdump \
+                          [--budget KB] smart_agriculture.elf
+
+The pools are found by the names mesh_static.h gives them, mesh_static_<kind>_<name>.
+Exits with status 1 when the pools are larger than the budget.
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+
+# Longest prefix first, queue_tcb_ must not be taken for queue_
+KINDS = (
+    ('queue_tcb', 'control'),
+    ('semaphore', 'control'),
+    ('mutex', 'control'),
+    ('timer', 'control'),
+    ('task', 'control'),
+    ('stack', 'stack'),
+    ('queue', 'queue'),
+    ('buffer', 'buffer'),
+)
+COLUMNS = ('stack', 'control', 'queue', 'buffer')
+DRAM_SECTIONS = ('.dram0.data', '.dram0.bss')
+
+
+def read_pools(nm, elf):
+    pools = {}
+    output = subprocess.check_output([nm, '-S', '--defined-only', elf]).decode()
+
+    for line in output.splitlines():
+        fields = line.split()
+
+        # Only data and bss symbols that have a size
+        if len(fields) != 4 or fields[2] not in 'bBdD' or not fields[3].startswith('mesh_static_'):
+            continue
+
+        symbol = re.sub(r'\.\d+$', '', fields[3][len('mesh_static_'):])
+
+        for prefix, column in KINDS:
+            if symbol.startswith(prefix + '_'):
+                pool = pools.setdefault(symbol[len(prefix) + 1:], dict.fromkeys(COLUMNS, 0))
+                pool[column] += int(fields[1], 16)
+                break
+
+    return pools
+
+
+def read_dram(objdump, elf):
+    size = 0
+    output = subprocess.check_output([objdump, '-h', elf]).decode()
+
+    for line in output.splitlines():
+        fields = line.split()
+
+        if len(fields) > 2 and fields[1] in DRAM_SECTIONS:
+            size += int(fields[2], 16)
+
+    return size
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Memory budget of the static pools')
+    parser.add_argument('--nm', default='nm')
+    parser.add_argument('--objdump', default='objdump')
+    parser.add_argument('--budget', type=int, default=0, help='KB, 0 only prints the report')
+    parser.add_argument('elf')
+    args = parser.parse_args()
+
+    pools = read_pools(args.nm, args.elf)
+    total = 0
+
+    print('Static memory budget (bytes)')
+    print('  %-20s %8s %8s %8s %8s %8s' % (('pool',) + COLUMNS + ('total',)))
+
+    for name in sorted(pools, key=lambda name: -sum(pools[name].values())):
+        pool = pools[name]
+        size = sum(pool.values())
+        total += size
+        print('  %-20s %8d %8d %8d %8d %8d' % ((name,) + tuple(pool[column] for column in COLUMNS) + (size,)))
+
+    print('  %-20s %44d' % ('total', total))
+    print('  %-20s %44d' % ('DRAM .data + .bss', read_dram(args.objdump, args.elf)))
+
+    if args.budget and total > args.budget * 1024:
+        print('Static pools exceed the budget of %d KB by %d bytes' % (args.budget, total - args.budget * 1024))
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,91 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_TIME_H__
+#define __MESH_TIME_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MESH_TIME_BEACON_VERSION (1)
+
+/**
+ * @brief Time beacon broadcast by the root with protocol MESH_PROTO_TIME_BEACON
+ */
+typedef struct {
+    uint8_t version;  /**< MESH_TIME_BEACON_VERSION */
+    uint8_t reserved;
+    uint16_t seq;     /**< Incremented on every beacon, used to drop stale copies */
+    int64_t epoch_us; /**< Root wall clock when the beacon was sent, microseconds since epoch */
+} __attribute__((packed)) mesh_time_beacon_t;
+
+/**
+ * @brief  Start SNTP on the root and broadcast time beacons to the mesh
+ *
+ * @param  server SNTP server name or address
+ *
+ * @note   Waits a short while for the beacon task of the previous root term to exit
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE, already running or the previous beacon task is still running
+ */
+mdf_err_t mesh_time_root_start(const char *server);
+
+/**
+ * @brief  Stop SNTP and the beacon task, called when the device loses the root role
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t mesh_time_root_stop();
+
+/**
+ * @brief  Feed a received time beacon into the local clock model
+ *
+ * @param  data pointer of the beacon frame
+ * @param  size length of the beacon frame
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_INVALID_STATE, the beacon is stale
+ */
+mdf_err_t mesh_time_handle_beacon(const uint8_t *data, size_t size);
+
+/**
+ * @brief  Check if the clock has been synchronized with the root
+ *
+ * @return
+ *     - true
+ *     - false
+ */
+bool mesh_time_is_synced();
+
+/**
+ * @brief  Get the drift corrected wall clock
+ *
+ * @return  Milliseconds since epoch, 0 if the clock has never been synchronized
+ */
+int64_t mesh_time_now_ms();
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MESH_TIME_H__ */
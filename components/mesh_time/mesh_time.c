@@ -0,0 +1,249 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_time.h"
+#include "mesh_proto.h"
+#include "mwifi.h"
+#include "mesh_static.h"
+#include "esp_sntp.h"
+
+/**
+ * @brief An error above this is treated as a clock step (new root, SNTP
+ *        correction) rather than drift, and restarts the drift estimation.
+ */
+#define MESH_TIME_STEP_US (1000 * 1000)
+
+/**
+ * @brief Beacons up to this many sequence numbers behind the last one are
+ *        duplicates; anything older comes from a rebooted root and resyncs.
+ */
+#define MESH_TIME_SEQ_WINDOW (16)
+
+#define MESH_TIME_EXIT_WAIT_MS (200) /**< How long a new root term waits for the beacon task of the last one */
+
+static struct mesh_time {
+    portMUX_TYPE lock;
+    bool is_synced;
+    bool is_root; /**< The system clock is disciplined by SNTP */
+    bool beacon_running;
+    uint16_t seq;
+    int64_t local_ref_us;  /**< esp_timer time of the last beacon */
+    int64_t remote_ref_us; /**< Root wall clock of the last beacon */
+    int32_t drift_ppm;     /**< Root clock rate relative to the local one */
+    TaskHandle_t beacon_task;
+    char server[64];
+} g_mesh_time = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+MESH_STATIC_TASK_DEFINE(time_beacon, 3 * 1024);
+
+static const char *TAG = "mesh_time";
+
+static int64_t mesh_time_system_us()
+{
+    struct timeval tv = {0};
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void mesh_time_sync_cb(struct timeval *tv)
+{
+    MDF_LOGI("SNTP synchronized, epoch: %ld", (long)tv->tv_sec);
+
+    portENTER_CRITICAL(&g_mesh_time.lock);
+    g_mesh_time.is_root   = true;
+    g_mesh_time.is_synced = true;
+    portEXIT_CRITICAL(&g_mesh_time.lock);
+
+    /**< Send the first beacon right away instead of waiting a full interval */
+    if (g_mesh_time.beacon_task) {
+        xTaskNotifyGive(g_mesh_time.beacon_task);
+    }
+}
+
+static void mesh_time_beacon_task(void *arg)
+{
+    mdf_err_t ret = MDF_OK;
+    uint8_t dest_addr[] = MWIFI_ADDR_ANY;
+    mwifi_data_type_t data_type = {
+        .communicate = MWIFI_COMMUNICATE_BROADCAST,
+        .protocol = MESH_PROTO_TIME_BEACON,
+    };
+    mesh_time_beacon_t beacon = {
+        .version = MESH_TIME_BEACON_VERSION,
+    };
+
+    MDF_LOGI("Time beacon task is running");
+
+    while (g_mesh_time.beacon_running) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_MESH_TIME_BEACON_INTERVAL * 1000));
+
+        if (!g_mesh_time.beacon_running || !g_mesh_time.is_root || !mwifi_is_connected()) {
+            continue;
+        }
+
+        /**
+         * @brief The sequence continues from the last beacon this device has seen as a
+         *        node, so that nodes accept the beacons of a newly elected root.
+         */
+        beacon.seq = ++g_mesh_time.seq;
+        beacon.epoch_us = mesh_time_system_us();
+        ret = mwifi_root_write(dest_addr, 1, &data_type, &beacon, sizeof(beacon), true);
+        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mwifi_root_write", mdf_err_to_name(ret));
+    }
+
+    MDF_LOGW("Time beacon task is exit");
+
+    g_mesh_time.beacon_task = NULL;
+    MESH_STATIC_TASK_EXIT();
+}
+
+mdf_err_t mesh_time_root_start(const char *server)
+{
+    MDF_PARAM_CHECK(server);
+    MDF_ERROR_CHECK(g_mesh_time.beacon_running, MDF_ERR_INVALID_STATE, "Time service is already running");
+
+    /**< The beacon task of the previous term would see beacon_running set again and keep going */
+    for (int i = 0; i < MESH_TIME_EXIT_WAIT_MS / 10 && g_mesh_time.beacon_task; ++i) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    MDF_ERROR_CHECK(g_mesh_time.beacon_task, MDF_ERR_INVALID_STATE, "The previous beacon task has not exited");
+
+    strncpy(g_mesh_time.server, server, sizeof(g_mesh_time.server) - 1);
+
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, g_mesh_time.server);
+    sntp_set_time_sync_notification_cb(mesh_time_sync_cb);
+    sntp_init();
+
+    g_mesh_time.beacon_running = true;
+    MESH_STATIC_TASK_CREATE(time_beacon, mesh_time_beacon_task, "mesh_time_beacon",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, &g_mesh_time.beacon_task);
+
+    MDF_LOGI("SNTP server: %s, beacon interval: %ds", g_mesh_time.server, CONFIG_MESH_TIME_BEACON_INTERVAL);
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_time_root_stop()
+{
+    MDF_ERROR_CHECK(!g_mesh_time.beacon_running, MDF_ERR_INVALID_STATE, "Time service has not been started");
+
+    sntp_stop();
+
+    /**< Keep running on the free-running model until the next root's beacon arrives */
+    int64_t system_us = mesh_time_system_us();
+    portENTER_CRITICAL(&g_mesh_time.lock);
+
+    if (g_mesh_time.is_root) {
+        g_mesh_time.local_ref_us  = esp_timer_get_time();
+        g_mesh_time.remote_ref_us = system_us;
+        g_mesh_time.drift_ppm     = 0;
+    }
+
+    g_mesh_time.is_root = false;
+    g_mesh_time.beacon_running = false;
+    portEXIT_CRITICAL(&g_mesh_time.lock);
+
+    if (g_mesh_time.beacon_task) {
+        xTaskNotifyGive(g_mesh_time.beacon_task);
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t mesh_time_handle_beacon(const uint8_t *data, size_t size)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(size < sizeof(mesh_time_beacon_t), MDF_ERR_INVALID_ARG, "Beacon is too short, size: %d", size);
+
+    mesh_time_beacon_t beacon = {0};
+    int64_t local_us = esp_timer_get_time();
+    mdf_err_t ret = MDF_OK;
+
+    memcpy(&beacon, data, sizeof(mesh_time_beacon_t));
+    MDF_ERROR_CHECK(beacon.version != MESH_TIME_BEACON_VERSION, MDF_ERR_INVALID_ARG,
+                    "Unsupported beacon version: %d", beacon.version);
+
+    portENTER_CRITICAL(&g_mesh_time.lock);
+
+    if (g_mesh_time.is_root) {
+        ret = MDF_ERR_INVALID_STATE;
+    } else if (!g_mesh_time.is_synced || (int16_t)(beacon.seq - g_mesh_time.seq) <= -MESH_TIME_SEQ_WINDOW) {
+        g_mesh_time.drift_ppm = 0;
+        g_mesh_time.is_synced = true;
+    } else if ((int16_t)(beacon.seq - g_mesh_time.seq) <= 0) {
+        ret = MDF_ERR_INVALID_STATE;
+    } else {
+        int64_t elapsed_local  = local_us - g_mesh_time.local_ref_us;
+        int64_t elapsed_remote = beacon.epoch_us - g_mesh_time.remote_ref_us;
+        int64_t predicted_us   = g_mesh_time.remote_ref_us + elapsed_local
+                                 + elapsed_local * g_mesh_time.drift_ppm / 1000000;
+        int64_t error_us       = beacon.epoch_us - predicted_us;
+
+        if (elapsed_local <= 0 || error_us > MESH_TIME_STEP_US || error_us < -MESH_TIME_STEP_US) {
+            g_mesh_time.drift_ppm = 0;
+        } else {
+            /**< Low-pass the measured rate so a single delayed beacon does not skew it */
+            int32_t measured_ppm = (elapsed_remote - elapsed_local) * 1000000 / elapsed_local;
+            g_mesh_time.drift_ppm += (measured_ppm - g_mesh_time.drift_ppm) / 4;
+
+            if (g_mesh_time.drift_ppm > CONFIG_MESH_TIME_MAX_DRIFT_PPM) {
+                g_mesh_time.drift_ppm = CONFIG_MESH_TIME_MAX_DRIFT_PPM;
+            } else if (g_mesh_time.drift_ppm < -CONFIG_MESH_TIME_MAX_DRIFT_PPM) {
+                g_mesh_time.drift_ppm = -CONFIG_MESH_TIME_MAX_DRIFT_PPM;
+            }
+        }
+    }
+
+    if (ret == MDF_OK) {
+        g_mesh_time.seq = beacon.seq;
+        g_mesh_time.local_ref_us  = local_us;
+        g_mesh_time.remote_ref_us = beacon.epoch_us;
+    }
+
+    portEXIT_CRITICAL(&g_mesh_time.lock);
+
+    MDF_LOGD("Beacon seq: %d, drift: %d ppm", beacon.seq, g_mesh_time.drift_ppm);
+
+    return ret;
+}
+
+bool mesh_time_is_synced()
+{
+    return g_mesh_time.is_synced;
+}
+
+int64_t mesh_time_now_ms()
+{
+    int64_t now_us = 0;
+
+    if (!g_mesh_time.is_synced) {
+        return 0;
+    }
+
+    /**< gettimeofday() takes a lock, it must not be called in the critical section */
+    if (g_mesh_time.is_root) {
+        return mesh_time_system_us() / 1000;
+    }
+
+    portENTER_CRITICAL(&g_mesh_time.lock);
+    int64_t elapsed = esp_timer_get_time() - g_mesh_time.local_ref_us;
+    now_us = g_mesh_time.remote_ref_us + elapsed + elapsed * g_mesh_time.drift_ppm / 1000000;
+    portEXIT_CRITICAL(&g_mesh_time.lock);
+
+    return now_us / 1000;
+}
@@ -0,0 +1,99 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __NODE_CONFIG_H__
+#define __NODE_CONFIG_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Version of the node_config_t layout stored in NVS.
+ *
+ * @note Fields are only ever appended to node_config_t. A blob written by an
+ *       older schema is loaded over the defaults, so new fields keep their
+ *       Kconfig defaults. Bump the version whenever a field is appended and
+ *       record the new length in g_node_config_schema_size.
+ */
+#define NODE_CONFIG_SCHEMA_VERSION (3)
+
+#define NODE_CONFIG_GAIN_ONE (10000) /**< Calibration gain of 1.0 */
+
+/**
+ * @brief Runtime configuration of a node
+ */
+typedef struct {
+    char router_ssid[32];            /**< Router SSID */
+    char router_password[64];        /**< Router password */
+    char mesh_id[7];                 /**< Mesh network identification, 6 characters */
+    char mqtt_url[128];              /**< MQTT broker url, used by the root */
+    uint32_t upload_interval_min_ms; /**< Upload interval while readings change quickly */
+    uint32_t upload_interval_max_ms; /**< Upload interval while readings are stable */
+    uint16_t change_threshold;       /**< Change in 0.1 units that selects the minimum interval */
+    uint16_t metrics_interval_s;     /**< Interval of the metrics report, 0 to disable (schema 2) */
+    int16_t temp_offset;             /**< Temperature calibration offset in 0.01 C (schema 3) */
+    int16_t humi_offset;             /**< Humidity calibration offset in 0.01 %RH (schema 3) */
+    int16_t light_offset;            /**< Light calibration offset in ADC counts (schema 3) */
+    uint16_t temp_gain;              /**< Temperature calibration gain, NODE_CONFIG_GAIN_ONE is 1.0 (schema 3) */
+    uint16_t humi_gain;              /**< Humidity calibration gain (schema 3) */
+    uint16_t light_gain;             /**< Light calibration gain (schema 3) */
+} node_config_t;
+
+/**
+ * @brief  Load the configuration from NVS, falling back to the Kconfig defaults
+ *
+ * @note   NVS must have been initialized
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_FAIL
+ */
+mdf_err_t node_config_init();
+
+/**
+ * @brief  Get a copy of the current configuration
+ *
+ * @param  config pointer of the configuration
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t node_config_get(node_config_t *config);
+
+/**
+ * @brief  Apply a partial configuration update and persist it
+ *
+ * @param  data pointer of a JSON object, e.g. {"upload_interval_min":2000}
+ * @param  size length of data
+ * @param  restart_required set to true if a network field has changed and the
+ *                          device has to restart to apply it, can be NULL
+ *
+ * @note   The update is validated as a whole, nothing is applied if any field is invalid
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_FAIL
+ */
+mdf_err_t node_config_update(const char *data, size_t size, bool *restart_required);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __NODE_CONFIG_H__ */
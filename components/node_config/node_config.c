@@ -0,0 +1,302 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "node_config.h"
+#include "cJSON.h"
+#include "nvs.h"
+#include "mesh_static.h"
+#include <sys/param.h>
+
+#define NODE_CONFIG_NAMESPACE "node_config"
+#define NODE_CONFIG_KEY       "config"
+
+typedef enum {
+    NODE_CONFIG_FIELD_STRING = 0,
+    NODE_CONFIG_FIELD_U16,
+    NODE_CONFIG_FIELD_U32,
+    NODE_CONFIG_FIELD_I16,
+} node_config_field_type_t;
+
+/**
+ * @brief Description of a field that can be updated at runtime
+ */
+typedef struct {
+    const char *key;               /**< Key in the JSON update */
+    node_config_field_type_t type;
+    size_t offset;                 /**< Offset in node_config_t */
+    size_t size;                   /**< Size of the member in node_config_t */
+    int32_t min;                   /**< Minimum value, or minimum length of a string */
+    int32_t max;                   /**< Maximum value, or maximum length of a string */
+    bool network;                  /**< The device has to restart to apply it */
+} node_config_field_t;
+
+typedef struct {
+    uint16_t version; /**< NODE_CONFIG_SCHEMA_VERSION of the stored blob */
+    uint16_t size;    /**< sizeof(node_config_t) of the stored blob */
+    node_config_t config;
+} node_config_blob_t;
+
+#define NODE_CONFIG_FIELD(key, type, member, min, max, network) \
+    { key, type, offsetof(node_config_t, member), sizeof(((node_config_t *)0)->member), min, max, network }
+
+static const node_config_field_t g_node_config_fields[] = {
+    NODE_CONFIG_FIELD("router_ssid", NODE_CONFIG_FIELD_STRING, router_ssid, 1, 31, true),
+    NODE_CONFIG_FIELD("router_password", NODE_CONFIG_FIELD_STRING, router_password, 0, 63, true),
+    NODE_CONFIG_FIELD("mesh_id", NODE_CONFIG_FIELD_STRING, mesh_id, 6, 6, true),
+    NODE_CONFIG_FIELD("mqtt_url", NODE_CONFIG_FIELD_STRING, mqtt_url, 8, 127, true),
+    NODE_CONFIG_FIELD("upload_interval_min", NODE_CONFIG_FIELD_U32, upload_interval_min_ms, 1000, 3600000, false),
+    NODE_CONFIG_FIELD("upload_interval_max", NODE_CONFIG_FIELD_U32, upload_interval_max_ms, 1000, 3600000, false),
+    NODE_CONFIG_FIELD("change_threshold", NODE_CONFIG_FIELD_U16, change_threshold, 1, 1000, false),
+    NODE_CONFIG_FIELD("metrics_interval", NODE_CONFIG_FIELD_U16, metrics_interval_s, 0, 3600, false),
+    NODE_CONFIG_FIELD("temp_offset", NODE_CONFIG_FIELD_I16, temp_offset, -2000, 2000, false),
+    NODE_CONFIG_FIELD("humi_offset", NODE_CONFIG_FIELD_I16, humi_offset, -2000, 2000, false),
+    NODE_CONFIG_FIELD("light_offset", NODE_CONFIG_FIELD_I16, light_offset, -8191, 8191, false),
+    NODE_CONFIG_FIELD("temp_gain", NODE_CONFIG_FIELD_U16, temp_gain, 5000, 20000, false),
+    NODE_CONFIG_FIELD("humi_gain", NODE_CONFIG_FIELD_U16, humi_gain, 5000, 20000, false),
+    NODE_CONFIG_FIELD("light_gain", NODE_CONFIG_FIELD_U16, light_gain, 5000, 20000, false),
+};
+
+/**
+ * @brief Valid length of node_config_t for every schema version. Tail padding
+ *        can hide an appended field, so the stored size alone is not enough.
+ */
+static const size_t g_node_config_schema_size[NODE_CONFIG_SCHEMA_VERSION + 1] = {
+    [1] = offsetof(node_config_t, metrics_interval_s),
+    [2] = offsetof(node_config_t, temp_offset),
+    [3] = sizeof(node_config_t),
+};
+
+static node_config_t g_node_config;
+static SemaphoreHandle_t g_node_config_lock = NULL;
+MESH_STATIC_MUTEX_DEFINE(node_config);
+
+static const char *TAG = "node_config";
+
+static void node_config_set_default(node_config_t *config)
+{
+    memset(config, 0, sizeof(node_config_t));
+    strncpy(config->router_ssid, CONFIG_ROUTER_SSID, sizeof(config->router_ssid) - 1);
+    strncpy(config->router_password, CONFIG_ROUTER_PASSWORD, sizeof(config->router_password) - 1);
+    strncpy(config->mesh_id, CONFIG_MESH_ID, sizeof(config->mesh_id) - 1);
+    strncpy(config->mqtt_url, CONFIG_MQTT_URL, sizeof(config->mqtt_url) - 1);
+    config->upload_interval_min_ms = CONFIG_UPLOAD_INTERVAL_MIN;
+    config->upload_interval_max_ms = CONFIG_UPLOAD_INTERVAL_MAX;
+    config->change_threshold       = CONFIG_CHANGE_THRESHOLD;
+    config->metrics_interval_s     = CONFIG_METRICS_INTERVAL;
+    config->temp_gain              = NODE_CONFIG_GAIN_ONE;
+    config->humi_gain              = NODE_CONFIG_GAIN_ONE;
+    config->light_gain             = NODE_CONFIG_GAIN_ONE;
+}
+
+static mdf_err_t node_config_load(node_config_t *config)
+{
+    nvs_handle_t handle = 0;
+    node_config_blob_t *blob = NULL;
+    size_t size = 0;
+
+    mdf_err_t ret = nvs_open(NODE_CONFIG_NAMESPACE, NVS_READONLY, &handle);
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> nvs_open", mdf_err_to_name(ret));
+
+    ret = nvs_get_blob(handle, NODE_CONFIG_KEY, NULL, &size);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> nvs_get_blob", mdf_err_to_name(ret));
+
+    if (size < offsetof(node_config_blob_t, config)) {
+        MDF_LOGW("Invalid blob size: %d", size);
+        ret = MDF_ERR_INVALID_SIZE;
+        goto EXIT;
+    }
+
+    blob = MDF_MALLOC(size);
+
+    if (blob == NULL) {
+        MDF_LOGE("Allocate mem failed");
+        ret = MDF_ERR_NO_MEM;
+        goto EXIT;
+    }
+
+    ret = nvs_get_blob(handle, NODE_CONFIG_KEY, blob, &size);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> nvs_get_blob", mdf_err_to_name(ret));
+
+    /**
+     * @brief Blobs of an older schema are shorter, the appended fields keep
+     *        their defaults. A newer schema (after a downgrade) is truncated.
+     */
+    size_t config_size = MIN(size - offsetof(node_config_blob_t, config), sizeof(node_config_t));
+    config_size = MIN(config_size, blob->size);
+
+    if (blob->version <= NODE_CONFIG_SCHEMA_VERSION) {
+        config_size = MIN(config_size, g_node_config_schema_size[blob->version]);
+    }
+
+    memcpy(config, &blob->config, config_size);
+
+    if (blob->version != NODE_CONFIG_SCHEMA_VERSION) {
+        MDF_LOGI("Migrate config from schema %d to %d", blob->version, NODE_CONFIG_SCHEMA_VERSION);
+    }
+
+EXIT:
+    MDF_FREE(blob);
+    nvs_close(handle);
+    return ret;
+}
+
+static mdf_err_t node_config_save(const node_config_t *config)
+{
+    nvs_handle_t handle = 0;
+    node_config_blob_t blob = {
+        .version = NODE_CONFIG_SCHEMA_VERSION,
+        .size    = sizeof(node_config_t),
+    };
+
+    memcpy(&blob.config, config, sizeof(node_config_t));
+
+    mdf_err_t ret = nvs_open(NODE_CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> nvs_open", mdf_err_to_name(ret));
+
+    ret = nvs_set_blob(handle, NODE_CONFIG_KEY, &blob, sizeof(blob));
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> nvs_set_blob", mdf_err_to_name(ret));
+    ret = nvs_commit(handle);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> nvs_commit", mdf_err_to_name(ret));
+
+EXIT:
+    nvs_close(handle);
+    return ret;
+}
+
+static mdf_err_t node_config_apply_field(node_config_t *config, const node_config_field_t *field, const cJSON *item)
+{
+    uint8_t *member = (uint8_t *)config + field->offset;
+
+    if (field->type == NODE_CONFIG_FIELD_STRING) {
+        MDF_ERROR_CHECK(!cJSON_IsString(item), MDF_ERR_INVALID_ARG, "%s should be string type", field->key);
+
+        size_t len = strlen(item->valuestring);
+        MDF_ERROR_CHECK(len < (size_t)field->min || len > (size_t)field->max || len >= field->size, MDF_ERR_INVALID_ARG,
+                        "Invalid length of %s: %d", field->key, len);
+
+        memset(member, 0, field->size);
+        memcpy(member, item->valuestring, len);
+        return MDF_OK;
+    }
+
+    MDF_ERROR_CHECK(!cJSON_IsNumber(item), MDF_ERR_INVALID_ARG, "%s should be number type", field->key);
+    MDF_ERROR_CHECK(item->valuedouble < field->min || item->valuedouble > field->max, MDF_ERR_INVALID_ARG,
+                    "%s out of range [%d, %d]", field->key, field->min, field->max);
+
+    if (field->type == NODE_CONFIG_FIELD_U16) {
+        *(uint16_t *)member = (uint16_t)item->valuedouble;
+    } else if (field->type == NODE_CONFIG_FIELD_I16) {
+        *(int16_t *)member = (int16_t)item->valuedouble;
+    } else {
+        *(uint32_t *)member = (uint32_t)item->valuedouble;
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t node_config_init()
+{
+    MDF_ERROR_CHECK(g_node_config_lock != NULL, MDF_ERR_INVALID_STATE, "Config has already been initialized");
+
+    node_config_set_default(&g_node_config);
+
+    if (node_config_load(&g_node_config) != MDF_OK) {
+        MDF_LOGI("No stored config, use the defaults");
+        node_config_set_default(&g_node_config);
+    }
+
+    g_node_config_lock = MESH_STATIC_MUTEX_CREATE(node_config);
+    MDF_ERROR_CHECK(g_node_config_lock == NULL, MDF_FAIL, "Create mutex failed");
+
+    MDF_LOGI("Config schema: %d, mesh_id: %s, upload interval: [%u, %u] ms, threshold: %u",
+             NODE_CONFIG_SCHEMA_VERSION, g_node_config.mesh_id, g_node_config.upload_interval_min_ms,
+             g_node_config.upload_interval_max_ms, g_node_config.change_threshold);
+
+    return MDF_OK;
+}
+
+mdf_err_t node_config_get(node_config_t *config)
+{
+    MDF_PARAM_CHECK(config);
+    MDF_ERROR_CHECK(g_node_config_lock == NULL, MDF_ERR_NOT_INIT, "Config has not been initialized");
+
+    xSemaphoreTake(g_node_config_lock, portMAX_DELAY);
+    memcpy(config, &g_node_config, sizeof(node_config_t));
+    xSemaphoreGive(g_node_config_lock);
+
+    return MDF_OK;
+}
+
+mdf_err_t node_config_update(const char *data, size_t size, bool *restart_required)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(g_node_config_lock == NULL, MDF_ERR_NOT_INIT, "Config has not been initialized");
+
+    mdf_err_t ret = MDF_OK;
+    bool changed = false;
+    bool network_changed = false;
+    node_config_t config = {0};
+
+    cJSON *obj = cJSON_ParseWithLength(data, size);
+    MDF_ERROR_CHECK(obj == NULL, MDF_ERR_INVALID_ARG, "Parse JSON error");
+
+    if (!cJSON_IsObject(obj)) {
+        MDF_LOGW("Config should be object type");
+        cJSON_Delete(obj);
+        return MDF_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(g_node_config_lock, portMAX_DELAY);
+    memcpy(&config, &g_node_config, sizeof(node_config_t));
+
+    for (int i = 0; i < sizeof(g_node_config_fields) / sizeof(g_node_config_fields[0]); ++i) {
+        const node_config_field_t *field = g_node_config_fields + i;
+        cJSON *item = cJSON_GetObjectItem(obj, field->key);
+
+        if (item == NULL) {
+            continue;
+        }
+
+        ret = node_config_apply_field(&config, field, item);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Apply %s", mdf_err_to_name(ret), field->key);
+
+        if (memcmp((uint8_t *)&g_node_config + field->offset, (uint8_t *)&config + field->offset, field->size)) {
+            changed = true;
+            network_changed |= field->network;
+        }
+    }
+
+    if (config.upload_interval_min_ms > config.upload_interval_max_ms) {
+        MDF_LOGW("upload_interval_min is greater than upload_interval_max");
+        ret = MDF_ERR_INVALID_ARG;
+        goto EXIT;
+    }
+
+    if (changed) {
+        ret = node_config_save(&config);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> node_config_save", mdf_err_to_name(ret));
+        memcpy(&g_node_config, &config, sizeof(node_config_t));
+        MDF_LOGI("Config updated, restart required: %d", network_changed);
+    }
+
+EXIT:
+    xSemaphoreGive(g_node_config_lock);
+    cJSON_Delete(obj);
+
+    if (restart_required) {
+        *restart_required = (ret == MDF_OK) && network_changed;
+    }
+
+    return ret;
+}
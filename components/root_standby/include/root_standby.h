@@ -0,0 +1,174 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __ROOT_STANDBY_H__
+#define __ROOT_STANDBY_H__
+
+#include "mdf_common.h"
+#include "mwifi.h"
+#include "mesh_mqtt_handle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define ROOT_STANDBY_STATE_VERSION (5)
+#define ROOT_STANDBY_URL_MAX_LEN   (128)
+
+/**
+ * @brief Header of the root state snapshot sent with protocol MESH_PROTO_ROOT_STATE
+ *
+ *        header
+ *        node_num x root_standby_node_info_t
+ *        [uint8_t url_len, url] if ROOT_STANDBY_FLAG_OTA
+ *        command_num x {uint16_t addrs_num, uint16_t size, uint32_t id, uint8_t type, addrs, data}
+ *        [uint16_t groups_len, groups] if ROOT_STANDBY_FLAG_GROUPS, see mesh_group_export()
+ */
+typedef struct {
+    uint8_t version;     /**< ROOT_STANDBY_STATE_VERSION */
+    uint8_t flags;       /**< ROOT_STANDBY_FLAG_* */
+    uint8_t node_num;
+    uint8_t command_num;
+} __attribute__((packed)) root_standby_state_header_t;
+
+#define ROOT_STANDBY_FLAG_OTA    (1 << 0) /**< A firmware upgrade is in progress */
+#define ROOT_STANDBY_FLAG_GROUPS (1 << 1) /**< The group table follows the commands */
+
+/**
+ * @brief Entry of the node table
+ */
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint8_t layer;      /**< Mesh layer from the last heartbeat, 0 if unknown */
+    uint8_t reserved;
+    uint16_t age_s;     /**< Seconds since the node was last heard of */
+    uint16_t rx_count;  /**< Frames received from the node, wraps around */
+} __attribute__((packed)) root_standby_node_info_t;
+
+/**
+ * @brief  Initialize the root state tables, called once at startup
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t root_standby_init();
+
+/**
+ * @brief  Start mirroring the state, called when the device becomes root
+ *
+ * @note   The state received as a standby root is kept if it is recent,
+ *         otherwise the device starts with empty tables
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t root_standby_start();
+
+/**
+ * @brief  Stop mirroring the state, called when the device loses the root role
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_STATE
+ */
+mdf_err_t root_standby_stop();
+
+/**
+ * @brief  Record a frame received by the root from a node
+ *
+ * @param  addr address of the node
+ * @param  data pointer of the frame, heartbeats update the layer of the node
+ * @param  size length of the frame
+ */
+void root_standby_node_seen(const uint8_t *addr, const char *data, size_t size);
+
+/**
+ * @brief  Get the number of nodes in the node table
+ *
+ * @return Number of nodes
+ */
+uint32_t root_standby_get_node_num();
+
+/**
+ * @brief  Record a downlink command before it is delivered
+ *
+ * @param  request command received from the cloud
+ * @param  handle  set to the handle of the entry, 0 if it was not recorded
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG, more than 65535 addresses or bytes of data
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t root_standby_command_push(const mesh_mqtt_data_t *request, uint32_t *handle);
+
+/**
+ * @brief  Remove a command once it has been handled, whether it was delivered,
+ *         rejected or reported unreachable to the cloud
+ *
+ * @param  handle handle given by root_standby_command_push(), 0 is ignored
+ */
+void root_standby_command_done(uint32_t handle);
+
+/**
+ * @brief  Take the oldest undelivered command inherited from the previous root
+ *
+ * @param  request pointer of the command, freed like the requests of mesh_mqtt_read
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND
+ */
+mdf_err_t root_standby_command_pop(mesh_mqtt_data_t **request);
+
+/**
+ * @brief  Record the firmware upgrade in progress
+ *
+ * @param  url firmware URL, NULL once the upgrade has finished
+ */
+void root_standby_ota_set(const char *url);
+
+/**
+ * @brief  Get the firmware upgrade in progress
+ *
+ * @param  url  buffer of the firmware URL
+ * @param  size length of the buffer
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND
+ */
+mdf_err_t root_standby_ota_get(char *url, size_t size);
+
+/**
+ * @brief  Load a snapshot sent by the root, called on the standby roots
+ *
+ * @param  data pointer of the snapshot
+ * @param  size length of the snapshot
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_NO_MEM
+ *     - MDF_ERR_NOT_SUPPORTED, CONFIG_ROOT_STANDBY_ENABLE is not set
+ */
+mdf_err_t root_standby_handle_state(const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __ROOT_STANDBY_H__ */
@@ -0,0 +1,596 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/param.h>
+#include "root_standby.h"
+#include "mesh_proto.h"
+#include "mwifi.h"
+#include "mesh_static.h"
+#include "mesh_group.h"
+
+/**
+ * @brief Layer of the nodes directly below the root
+ */
+#define ROOT_STANDBY_CANDIDATE_LAYER (2)
+
+#define ROOT_STANDBY_COMMAND_HEADER_LEN (9) /**< addrs_num, size, id and type of a command in the snapshot */
+
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint8_t layer;
+    uint16_t rx_count;
+    TickType_t last_seen;
+} root_standby_node_t;
+
+typedef struct {
+    uint32_t handle; /**< Local to this root, not part of the snapshot */
+    uint16_t addrs_num;
+    uint16_t size;
+    uint32_t id;     /**< Correlation id, so the next root still collects the acknowledgements */
+    uint8_t type;    /**< mesh_mqtt_publish_data_type_t of the data */
+    uint8_t *buffer; /**< Addresses followed by the data */
+} root_standby_command_t;
+
+static struct root_standby {
+    SemaphoreHandle_t lock;
+    size_t node_num;
+    root_standby_node_t nodes[CONFIG_ROOT_STANDBY_NODE_MAX_NUM];
+    size_t command_num; /**< Oldest command first */
+    root_standby_command_t commands[CONFIG_ROOT_STANDBY_COMMAND_MAX_NUM];
+    uint32_t command_handle; /**< Handle of the last pushed command */
+    char ota_url[ROOT_STANDBY_URL_MAX_LEN];
+    bool has_state;        /**< A snapshot of the previous root has been received */
+    TickType_t state_tick; /**< When the snapshot was received */
+    bool running;
+    TaskHandle_t task;
+} g_root_standby;
+
+MESH_STATIC_MUTEX_DEFINE(root_standby);
+#ifdef CONFIG_ROOT_STANDBY_ENABLE
+MESH_STATIC_TASK_DEFINE(root_standby, 3 * 1024);
+MESH_STATIC_BUFFER_DEFINE(root_standby, MWIFI_PAYLOAD_LEN);
+#endif /**< CONFIG_ROOT_STANDBY_ENABLE */
+
+static const char *TAG = "root_standby";
+
+static void root_standby_commands_clear()
+{
+    for (int i = 0; i < g_root_standby.command_num; ++i) {
+        MDF_FREE(g_root_standby.commands[i].buffer);
+    }
+
+    g_root_standby.command_num = 0;
+}
+
+static void root_standby_notify()
+{
+    if (g_root_standby.running && g_root_standby.task) {
+        xTaskNotifyGive(g_root_standby.task);
+    }
+}
+
+#ifdef CONFIG_ROOT_STANDBY_ENABLE
+/**
+ * @brief Serialize the state and select the standby roots, must be called with the lock held
+ */
+static size_t root_standby_serialize(uint8_t *buffer, size_t buffer_size,
+                                     uint8_t candidates[][MWIFI_ADDR_LEN], size_t *candidate_num)
+{
+    root_standby_state_header_t *header = (root_standby_state_header_t *)buffer;
+    size_t size = sizeof(root_standby_state_header_t);
+    TickType_t now = xTaskGetTickCount();
+
+    memset(header, 0, sizeof(root_standby_state_header_t));
+    header->version = ROOT_STANDBY_STATE_VERSION;
+    *candidate_num = 0;
+
+    for (int i = 0; i < g_root_standby.node_num && size + sizeof(root_standby_node_info_t) <= buffer_size; ++i) {
+        const root_standby_node_t *node = g_root_standby.nodes + i;
+        uint32_t age_s = (now - node->last_seen) * portTICK_PERIOD_MS / 1000;
+        root_standby_node_info_t info = {
+            .layer    = node->layer,
+            .age_s    = age_s > UINT16_MAX ? UINT16_MAX : age_s,
+            .rx_count = node->rx_count,
+        };
+
+        memcpy(info.addr, node->addr, MWIFI_ADDR_LEN);
+        memcpy(buffer + size, &info, sizeof(root_standby_node_info_t));
+        size += sizeof(root_standby_node_info_t);
+        header->node_num++;
+
+        if (node->layer == ROOT_STANDBY_CANDIDATE_LAYER && *candidate_num < CONFIG_ROOT_STANDBY_CANDIDATE_NUM) {
+            memcpy(candidates[(*candidate_num)++], node->addr, MWIFI_ADDR_LEN);
+        }
+    }
+
+    size_t url_len = strlen(g_root_standby.ota_url);
+
+    if (url_len && size + 1 + url_len <= buffer_size) {
+        header->flags |= ROOT_STANDBY_FLAG_OTA;
+        buffer[size++] = url_len;
+        memcpy(buffer + size, g_root_standby.ota_url, url_len);
+        size += url_len;
+    }
+
+    /**< Commands that do not fit are left out, they are usually delivered long before the next root takes over */
+    for (int i = 0; i < g_root_standby.command_num; ++i) {
+        const root_standby_command_t *command = g_root_standby.commands + i;
+        size_t command_size = command->addrs_num * MWIFI_ADDR_LEN + command->size;
+
+        if (size + ROOT_STANDBY_COMMAND_HEADER_LEN + command_size > buffer_size) {
+            continue;
+        }
+
+        buffer[size++] = command->addrs_num & 0xff;
+        buffer[size++] = command->addrs_num >> 8;
+        buffer[size++] = command->size & 0xff;
+        buffer[size++] = command->size >> 8;
+
+        for (int j = 0; j < 4; ++j) {
+            buffer[size++] = command->id >> (j * 8);
+        }
+
+        buffer[size++] = command->type;
+
+        memcpy(buffer + size, command->buffer, command_size);
+        size += command_size;
+        header->command_num++;
+    }
+
+    size_t group_size = size + 2 < buffer_size ? mesh_group_export(buffer + size + 2, buffer_size - size - 2) : 0;
+
+    if (group_size) {
+        header->flags |= ROOT_STANDBY_FLAG_GROUPS;
+        buffer[size++] = group_size & 0xff;
+        buffer[size++] = group_size >> 8;
+        size += group_size;
+    }
+
+    return size;
+}
+
+static void root_standby_sync_task(void *arg)
+{
+    mdf_err_t ret = MDF_OK;
+    uint8_t *buffer = MESH_STATIC_MALLOC(root_standby, MWIFI_PAYLOAD_LEN);
+    uint8_t candidates[CONFIG_ROOT_STANDBY_CANDIDATE_NUM][MWIFI_ADDR_LEN];
+    size_t candidate_num = 0;
+    mwifi_data_type_t data_type = {.protocol = MESH_PROTO_ROOT_STATE};
+
+    MDF_LOGI("Root standby task is running");
+
+    while (g_root_standby.running && buffer != NULL) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_ROOT_STANDBY_SYNC_INTERVAL * 1000));
+
+        if (!g_root_standby.running || !mwifi_is_connected()) {
+            continue;
+        }
+
+        xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+        size_t size = root_standby_serialize(buffer, MWIFI_PAYLOAD_LEN, candidates, &candidate_num);
+        xSemaphoreGive(g_root_standby.lock);
+
+        if (candidate_num == 0) {
+            MDF_LOGD("No standby root available");
+            continue;
+        }
+
+        ret = mwifi_root_write((uint8_t *)candidates, candidate_num, &data_type, buffer, size, true);
+        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mwifi_root_write", mdf_err_to_name(ret));
+    }
+
+    MDF_LOGW("Root standby task is exit");
+
+    MESH_STATIC_FREE(root_standby, buffer);
+    g_root_standby.task = NULL;
+    MESH_STATIC_TASK_EXIT();
+}
+#endif /**< CONFIG_ROOT_STANDBY_ENABLE */
+
+mdf_err_t root_standby_init()
+{
+    MDF_ERROR_CHECK(g_root_standby.lock != NULL, MDF_ERR_INVALID_STATE, "Root standby is already initialized");
+
+    g_root_standby.lock = MESH_STATIC_MUTEX_CREATE(root_standby);
+    MDF_ERROR_CHECK(g_root_standby.lock == NULL, MDF_ERR_NO_MEM, "Create mutex failed");
+
+    return MDF_OK;
+}
+
+mdf_err_t root_standby_start()
+{
+    MDF_ERROR_CHECK(g_root_standby.lock == NULL, MDF_ERR_INVALID_STATE, "Root standby is not initialized");
+    MDF_ERROR_CHECK(g_root_standby.running, MDF_ERR_INVALID_STATE, "Root standby is already running");
+
+#ifdef CONFIG_ROOT_STANDBY_ENABLE
+    xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+
+    if (g_root_standby.has_state) {
+        TickType_t age = xTaskGetTickCount() - g_root_standby.state_tick;
+
+        /**< The previous root may have handed over to another root long ago */
+        if (age > pdMS_TO_TICKS(CONFIG_ROOT_STANDBY_SYNC_INTERVAL * 3 * 1000)) {
+            MDF_LOGW("Snapshot of the previous root is %ds old, discard it", age * portTICK_PERIOD_MS / 1000);
+            root_standby_commands_clear();
+            g_root_standby.ota_url[0] = '\0';
+        } else {
+            MDF_LOGI("Resume from the previous root, nodes: %d, commands: %d, ota: %s",
+                     g_root_standby.node_num, g_root_standby.command_num,
+                     g_root_standby.ota_url[0] ? g_root_standby.ota_url : "none");
+        }
+
+        g_root_standby.has_state = false;
+    }
+
+    xSemaphoreGive(g_root_standby.lock);
+
+    g_root_standby.running = true;
+    MESH_STATIC_TASK_CREATE(root_standby, root_standby_sync_task, "root_standby",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY - 1, &g_root_standby.task);
+#endif /**< CONFIG_ROOT_STANDBY_ENABLE */
+
+    return MDF_OK;
+}
+
+mdf_err_t root_standby_stop()
+{
+    MDF_ERROR_CHECK(!g_root_standby.running, MDF_ERR_INVALID_STATE, "Root standby has not been started");
+
+    g_root_standby.running = false;
+
+    if (g_root_standby.task) {
+        xTaskNotifyGive(g_root_standby.task);
+    }
+
+    return MDF_OK;
+}
+
+void root_standby_node_seen(const uint8_t *addr, const char *data, size_t size)
+{
+    static const char layer_key[] = "\"layer\":";
+    root_standby_node_t *node = NULL;
+    TickType_t now = xTaskGetTickCount();
+    const char *layer = data ? memmem(data, size, layer_key, sizeof(layer_key) - 1) : NULL;
+
+    if (addr == NULL || g_root_standby.lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+
+    for (int i = 0; i < g_root_standby.node_num && !node; ++i) {
+        if (!memcmp(g_root_standby.nodes[i].addr, addr, MWIFI_ADDR_LEN)) {
+            node = g_root_standby.nodes + i;
+        }
+    }
+
+    if (node == NULL && g_root_standby.node_num < CONFIG_ROOT_STANDBY_NODE_MAX_NUM) {
+        node = g_root_standby.nodes + g_root_standby.node_num++;
+        memset(node, 0, sizeof(root_standby_node_t));
+        memcpy(node->addr, addr, MWIFI_ADDR_LEN);
+    } else if (node == NULL) {
+        /**< Replace the node that has been silent for the longest time */
+        node = g_root_standby.nodes;
+
+        for (int i = 1; i < g_root_standby.node_num; ++i) {
+            if (now - g_root_standby.nodes[i].last_seen > now - node->last_seen) {
+                node = g_root_standby.nodes + i;
+            }
+        }
+
+        memset(node, 0, sizeof(root_standby_node_t));
+        memcpy(node->addr, addr, MWIFI_ADDR_LEN);
+    }
+
+    if (layer != NULL && layer + sizeof(layer_key) - 1 < data + size) {
+        node->layer = atoi(layer + sizeof(layer_key) - 1);
+    }
+
+    node->last_seen = now;
+    node->rx_count++;
+
+    xSemaphoreGive(g_root_standby.lock);
+}
+
+uint32_t root_standby_get_node_num()
+{
+    return g_root_standby.node_num;
+}
+
+mdf_err_t root_standby_command_push(const mesh_mqtt_data_t *request, uint32_t *handle)
+{
+    MDF_PARAM_CHECK(request);
+    MDF_PARAM_CHECK(handle);
+
+    *handle = 0;
+    MDF_ERROR_CHECK(g_root_standby.lock == NULL, MDF_ERR_INVALID_STATE, "Root standby is not initialized");
+    MDF_ERROR_CHECK(request->addrs_num > UINT16_MAX || request->size > UINT16_MAX, MDF_ERR_INVALID_ARG,
+                    "Command is too large to mirror, addrs_num: %d, size: %d", (int)request->addrs_num, (int)request->size);
+
+    size_t addrs_size = request->addrs_num * MWIFI_ADDR_LEN;
+    uint8_t *buffer = MDF_MALLOC(addrs_size + request->size);
+    MDF_ERROR_CHECK(buffer == NULL, MDF_ERR_NO_MEM, "Allocate mem failed");
+
+    memcpy(buffer, request->addrs_list, addrs_size);
+    memcpy(buffer + addrs_size, request->data, request->size);
+
+    xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+
+    if (g_root_standby.command_num == CONFIG_ROOT_STANDBY_COMMAND_MAX_NUM) {
+        MDF_LOGW("Too many undelivered commands, drop the oldest");
+        MDF_FREE(g_root_standby.commands[0].buffer);
+        memmove(g_root_standby.commands, g_root_standby.commands + 1,
+                (CONFIG_ROOT_STANDBY_COMMAND_MAX_NUM - 1) * sizeof(root_standby_command_t));
+        g_root_standby.command_num--;
+    }
+
+    /**< 0 stands for no entry */
+    if (++g_root_standby.command_handle == 0) {
+        g_root_standby.command_handle = 1;
+    }
+
+    root_standby_command_t *command = g_root_standby.commands + g_root_standby.command_num++;
+    command->handle    = g_root_standby.command_handle;
+    command->addrs_num = request->addrs_num;
+    command->size      = request->size;
+    command->id        = request->id;
+    command->type      = request->type;
+    command->buffer    = buffer;
+    *handle            = command->handle;
+
+    xSemaphoreGive(g_root_standby.lock);
+
+    root_standby_notify();
+
+    return MDF_OK;
+}
+
+void root_standby_command_done(uint32_t handle)
+{
+    bool found = false;
+
+    if (g_root_standby.lock == NULL || handle == 0) {
+        return;
+    }
+
+    xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+
+    /**< Already gone if it was dropped as the oldest of a full table */
+    for (int i = 0; i < g_root_standby.command_num && !found; ++i) {
+        if (g_root_standby.commands[i].handle == handle) {
+            MDF_FREE(g_root_standby.commands[i].buffer);
+            g_root_standby.command_num--;
+            memmove(g_root_standby.commands + i, g_root_standby.commands + i + 1,
+                    (g_root_standby.command_num - i) * sizeof(root_standby_command_t));
+            found = true;
+        }
+    }
+
+    xSemaphoreGive(g_root_standby.lock);
+
+    if (found) {
+        root_standby_notify();
+    }
+}
+
+mdf_err_t root_standby_command_pop(mesh_mqtt_data_t **request)
+{
+    MDF_PARAM_CHECK(request);
+    MDF_ERROR_CHECK(g_root_standby.lock == NULL, MDF_ERR_INVALID_STATE, "Root standby is not initialized");
+
+    mdf_err_t ret = MDF_ERR_NOT_FOUND;
+    root_standby_command_t command = {0};
+
+    xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+
+    if (g_root_standby.command_num > 0) {
+        command = g_root_standby.commands[0];
+        g_root_standby.command_num--;
+        memmove(g_root_standby.commands, g_root_standby.commands + 1,
+                g_root_standby.command_num * sizeof(root_standby_command_t));
+        ret = MDF_OK;
+    }
+
+    xSemaphoreGive(g_root_standby.lock);
+
+    if (ret != MDF_OK) {
+        return ret;
+    }
+
+    size_t addrs_size = command.addrs_num * MWIFI_ADDR_LEN;
+    mesh_mqtt_data_t *item = MDF_CALLOC(1, sizeof(mesh_mqtt_data_t));
+    MDF_ERROR_GOTO(item == NULL, _no_mem, "Allocate mem failed");
+    item->addrs_list = MDF_MALLOC(addrs_size);
+    item->data = MDF_MALLOC(command.size + 1);
+    MDF_ERROR_GOTO(item->addrs_list == NULL || item->data == NULL, _no_mem, "Allocate mem failed");
+
+    item->addrs_num = command.addrs_num;
+    item->size = command.size;
+    item->id = command.id;
+    item->type = command.type;
+    memcpy(item->addrs_list, command.buffer, addrs_size);
+    memcpy(item->data, command.buffer + addrs_size, command.size);
+    item->data[command.size] = '\0';
+
+    MDF_FREE(command.buffer);
+    *request = item;
+    return MDF_OK;
+
+_no_mem:
+
+    if (item != NULL) {
+        MDF_FREE(item->addrs_list);
+        MDF_FREE(item->data);
+        MDF_FREE(item);
+    }
+
+    MDF_FREE(command.buffer);
+    return MDF_ERR_NO_MEM;
+}
+
+void root_standby_ota_set(const char *url)
+{
+    if (g_root_standby.lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+
+    if (url != NULL) {
+        strncpy(g_root_standby.ota_url, url, sizeof(g_root_standby.ota_url) - 1);
+    } else {
+        g_root_standby.ota_url[0] = '\0';
+    }
+
+    xSemaphoreGive(g_root_standby.lock);
+
+    root_standby_notify();
+}
+
+mdf_err_t root_standby_ota_get(char *url, size_t size)
+{
+    MDF_PARAM_CHECK(url);
+    MDF_ERROR_CHECK(g_root_standby.lock == NULL, MDF_ERR_INVALID_STATE, "Root standby is not initialized");
+
+    mdf_err_t ret = MDF_ERR_NOT_FOUND;
+
+    xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+
+    if (g_root_standby.ota_url[0] && size > strlen(g_root_standby.ota_url)) {
+        strcpy(url, g_root_standby.ota_url);
+        ret = MDF_OK;
+    }
+
+    xSemaphoreGive(g_root_standby.lock);
+
+    return ret;
+}
+
+mdf_err_t root_standby_handle_state(const uint8_t *data, size_t size)
+{
+#ifndef CONFIG_ROOT_STANDBY_ENABLE
+    return MDF_ERR_NOT_SUPPORTED;
+#else
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(g_root_standby.lock == NULL, MDF_ERR_INVALID_STATE, "Root standby is not initialized");
+    MDF_ERROR_CHECK(size < sizeof(root_standby_state_header_t), MDF_ERR_INVALID_ARG, "Snapshot is too short, size: %d", size);
+
+    mdf_err_t ret = MDF_OK;
+    root_standby_state_header_t header = {0};
+    root_standby_command_t commands[CONFIG_ROOT_STANDBY_COMMAND_MAX_NUM] = {0};
+    size_t command_num = 0;
+    char ota_url[ROOT_STANDBY_URL_MAX_LEN] = {0};
+    size_t offset = sizeof(root_standby_state_header_t);
+    const uint8_t *groups = NULL;
+    size_t group_size = 0;
+
+    memcpy(&header, data, sizeof(root_standby_state_header_t));
+    MDF_ERROR_CHECK(header.version != ROOT_STANDBY_STATE_VERSION, MDF_ERR_INVALID_ARG,
+                    "Unsupported snapshot version: %d", header.version);
+
+    const uint8_t *nodes = data + offset;
+    offset += header.node_num * sizeof(root_standby_node_info_t);
+    MDF_ERROR_CHECK(offset > size, MDF_ERR_INVALID_ARG, "Node table is truncated");
+
+    if (header.flags & ROOT_STANDBY_FLAG_OTA) {
+        MDF_ERROR_CHECK(offset + 1 > size || offset + 1 + data[offset] > size, MDF_ERR_INVALID_ARG, "OTA url is truncated");
+        memcpy(ota_url, data + offset + 1, MIN(data[offset], sizeof(ota_url) - 1));
+        offset += 1 + data[offset];
+    }
+
+    for (int i = 0; i < header.command_num; ++i) {
+        ret = MDF_ERR_INVALID_ARG;
+        MDF_ERROR_GOTO(offset + ROOT_STANDBY_COMMAND_HEADER_LEN > size, EXIT, "Command is truncated");
+
+        uint16_t addrs_num = data[offset] | data[offset + 1] << 8;
+        uint16_t command_size = data[offset + 2] | data[offset + 3] << 8;
+        uint32_t id = data[offset + 4] | data[offset + 5] << 8 | data[offset + 6] << 16 | (uint32_t)data[offset + 7] << 24;
+        uint8_t type = data[offset + 8];
+        size_t buffer_size = addrs_num * MWIFI_ADDR_LEN + command_size;
+        offset += ROOT_STANDBY_COMMAND_HEADER_LEN;
+
+        MDF_ERROR_GOTO(offset + buffer_size > size, EXIT, "Command is truncated");
+
+        if (command_num == CONFIG_ROOT_STANDBY_COMMAND_MAX_NUM) {
+            ret = MDF_OK;
+            break;
+        }
+
+        ret = MDF_ERR_NO_MEM;
+        commands[command_num].buffer = MDF_MALLOC(buffer_size);
+        MDF_ERROR_GOTO(commands[command_num].buffer == NULL, EXIT, "Allocate mem failed");
+        memcpy(commands[command_num].buffer, data + offset, buffer_size);
+        commands[command_num].addrs_num = addrs_num;
+        commands[command_num].size = command_size;
+        commands[command_num].id = id;
+        commands[command_num].type = type;
+        command_num++;
+        offset += buffer_size;
+        ret = MDF_OK;
+    }
+
+    if (header.flags & ROOT_STANDBY_FLAG_GROUPS && command_num == header.command_num) {
+        ret = MDF_ERR_INVALID_ARG;
+        MDF_ERROR_GOTO(offset + 2 > size, EXIT, "Group table is truncated");
+        group_size = data[offset] | data[offset + 1] << 8;
+        MDF_ERROR_GOTO(offset + 2 + group_size > size, EXIT, "Group table is truncated");
+        groups = data + offset + 2;
+        ret = MDF_OK;
+    }
+
+    TickType_t now = xTaskGetTickCount();
+
+    xSemaphoreTake(g_root_standby.lock, portMAX_DELAY);
+
+    g_root_standby.node_num = MIN(header.node_num, CONFIG_ROOT_STANDBY_NODE_MAX_NUM);
+
+    for (int i = 0; i < g_root_standby.node_num; ++i) {
+        root_standby_node_info_t info;
+        root_standby_node_t *node = g_root_standby.nodes + i;
+
+        memcpy(&info, nodes + i * sizeof(root_standby_node_info_t), sizeof(root_standby_node_info_t));
+        memcpy(node->addr, info.addr, MWIFI_ADDR_LEN);
+        node->layer     = info.layer;
+        node->rx_count  = info.rx_count;
+        node->last_seen = now - pdMS_TO_TICKS(info.age_s * 1000);
+    }
+
+    root_standby_commands_clear();
+    memcpy(g_root_standby.commands, commands, command_num * sizeof(root_standby_command_t));
+    g_root_standby.command_num = command_num;
+    command_num = 0;
+
+    strcpy(g_root_standby.ota_url, ota_url);
+    g_root_standby.has_state  = true;
+    g_root_standby.state_tick = now;
+
+    xSemaphoreGive(g_root_standby.lock);
+
+    MDF_LOGD("Snapshot received, nodes: %d, commands: %d", header.node_num, header.command_num);
+
+    /**< Outside the lock, the table is written to NVS when it changed */
+    if (groups != NULL) {
+        ret = mesh_group_import(groups, group_size);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_group_import", mdf_err_to_name(ret));
+    }
+
+EXIT:
+
+    for (int i = 0; i < command_num; ++i) {
+        MDF_FREE(commands[i].buffer);
+    }
+
+    return ret;
+#endif /**< CONFIG_ROOT_STANDBY_ENABLE */
+}
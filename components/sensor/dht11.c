@@ -1,11 +1,19 @@
 #include "dht11.h"
 #include "esp_task_wdt.h"
+#include "mesh_time.h"
+#include "node_config.h"
+#include "mesh_aggregate.h"
+#include "sensor_pipeline.h"
+#include "mesh_dlog.h"
 #define TAG "DHT11"
 
-#define UPLOAD_INTERVAL_MIN 5000  // 最小上传间隔，单位为毫秒
-#define UPLOAD_INTERVAL_MAX 30000 // 最大上传间隔，单位为毫秒
+static TaskHandle_t g_dht11_task = NULL;    // 采样任务,用于立即采样的通知
+static TickType_t g_burst_interval = 0;     // 高频采样间隔,0表示未开启
+static TickType_t g_burst_end = 0;          // 高频采样结束时刻
+static portMUX_TYPE g_burst_lock = portMUX_INITIALIZER_UNLOCKED; // 命令任务写,采样任务读,两个值须一起更新
+
 #define TEMP_HUMI_PIN DHT11_PIN   // 温湿度传感器引脚
-#define CHANGE_THRESHOLD 0.3      // 温湿度变化的阈值
+// 上传间隔和变化阈值由node_config提供,可通过MQTT在运行时修改
 
 static void InputInitial(void) // 设置端口为输入
 {
@@ -137,6 +145,33 @@ static uint8_t Read_DHT11(DHT11_Data_TypeDef *DHT11_Data)
     }
 }
 
+// 一帧温湿度和光照转为Q16.16定点数,温湿度的小数部分单位为0.1
+static void dht11_to_raw(const DHT11_Data_TypeDef *dhtData, uint16_t light, sensor_q16_t raw[SENSOR_CHANNEL_MAX])
+{
+    raw[SENSOR_CHANNEL_TEMP] = sensor_q16_from_ratio(dhtData->temp_int * 10 + dhtData->temp_deci, 10);
+    raw[SENSOR_CHANNEL_HUMI] = sensor_q16_from_ratio(dhtData->humi_int * 10 + dhtData->humi_deci, 10);
+    raw[SENSOR_CHANNEL_LIGHT] = light * SENSOR_Q16_ONE;
+}
+
+// 光照以整数ADC计数上报,校准偏移可能使其为负,负值按0上报
+static uint16_t dht11_light_count(const sensor_pipeline_t *pipeline)
+{
+    int32_t light = sensor_q16_round(pipeline->value[SENSOR_CHANNEL_LIGHT], 1);
+
+    return light > 0 ? light : 0;
+}
+
+// 按node_config中的本节点校准参数设置各通道的增益和偏移
+static void dht11_calibration_set(sensor_pipeline_t *pipeline, const node_config_t *config)
+{
+    sensor_pipeline_set_calibration(pipeline, SENSOR_CHANNEL_TEMP, sensor_q16_from_ratio(config->temp_gain, NODE_CONFIG_GAIN_ONE),
+                                    sensor_q16_from_ratio(config->temp_offset, 100));
+    sensor_pipeline_set_calibration(pipeline, SENSOR_CHANNEL_HUMI, sensor_q16_from_ratio(config->humi_gain, NODE_CONFIG_GAIN_ONE),
+                                    sensor_q16_from_ratio(config->humi_offset, 100));
+    sensor_pipeline_set_calibration(pipeline, SENSOR_CHANNEL_LIGHT, sensor_q16_from_ratio(config->light_gain, NODE_CONFIG_GAIN_ONE),
+                                    config->light_offset * SENSOR_Q16_ONE);
+}
+
 // 创建读取温湿度的任务
 static void dht11_init(void)
 {
@@ -189,81 +224,165 @@ static void dht11_init(void)
 
 void dht11_task(void *pvParameters)
 {
-    char *dht11_buff = NULL;
+    char dht11_buff[160] = {0};  // 上报的json,不再每次采样从堆上分配
 
     TickType_t lastUploadTime = 0;
-    uint16_t uploadInterval = UPLOAD_INTERVAL_MIN / portTICK_PERIOD_MS; // 初始上传间隔，单位为系统时钟周期
-
-    DHT11_Data_TypeDef prevDhtData; // 上一次的温湿度数据
-    prevDhtData.humi_int = 0;
-    prevDhtData.humi_deci = 0;
-    prevDhtData.temp_int = 0;
-    prevDhtData.temp_deci = 0;
+    node_config_t config = {0};
+    node_config_get(&config);
+    TickType_t uploadInterval = config.upload_interval_min_ms / portTICK_PERIOD_MS; // 初始上传间隔，单位为系统时钟周期
+
+    // 采样->校准->滤波->变化比较->编码全程使用定点数,S2没有FPU,不使用浮点运算
+    sensor_pipeline_t pipeline;
+    sensor_pipeline_init(&pipeline, CONFIG_SENSOR_FILTER_WEIGHT);
+    sensor_q16_t raw[SENSOR_CHANNEL_MAX] = {0};
+    char temp_str[SENSOR_Q16_STR_SIZE] = "";
+    char humi_str[SENSOR_Q16_STR_SIZE] = "";
     // 定义sensir_light的值
     uint16_t sensor_light = 0;
-    mwifi_data_type_t data_type = {0x0};
     mdf_err_t ret = MDF_OK;
     size_t size = 0;
 
+    bool sampleNow = false;
+
     esp_task_wdt_delete(NULL);
     dht11_init();
+    g_dht11_task = xTaskGetCurrentTaskHandle();
     while (1)
     {
-        if (xTaskGetTickCount() - lastUploadTime >= uploadInterval)
+        // 高频采样期间使用命令指定的间隔,到期后恢复自适应间隔
+        TickType_t now = xTaskGetTickCount();
+        portENTER_CRITICAL(&g_burst_lock);
+        TickType_t burstInterval = g_burst_interval;
+        if (burstInterval && (int32_t)(now - g_burst_end) >= 0)
+        {
+            g_burst_interval = burstInterval = 0;
+        }
+        portEXIT_CRITICAL(&g_burst_lock);
+
+        if (sampleNow || xTaskGetTickCount() - lastUploadTime >= (burstInterval ? burstInterval : uploadInterval))
         {
+            sampleNow = false;
             DHT11_Data_TypeDef dhtData; // 温湿度数据
+            char ts_field[32] = "";     // 采样时间戳,时钟未同步时不上报
 
             lastUploadTime = xTaskGetTickCount(); // 更新上次上传时间
+            node_config_get(&config);             // 获取最新的上传间隔和阈值
             if (Read_DHT11(&dhtData))
             {
+                // 在采样时刻打时间戳,避免mesh排队和重传造成的误差
+                int64_t sample_ts = mesh_time_now_ms();
+                if (sample_ts > 0)
+                {
+                    snprintf(ts_field, sizeof(ts_field), ",\"ts\":%lld", (long long)sample_ts);
+                }
                 // 执行上传温湿度的操作
                 // 数据转为json格式放在dht11_buff中
                 sensor_light = adc1_get_raw(ADC2_CHANNEL_3);
-                size = asprintf(&dht11_buff, "{\"version\":\"%s\",\"Temp\":\"%.2f\",\"Humi\":\"%.2f\",\"sensor_light\":\"%d\"}", VERSION, dhtData.temp_int + dhtData.temp_deci / 10.0, dhtData.humi_int + dhtData.humi_deci / 10.0, sensor_light);
-                ret = mwifi_write(NULL, &data_type, dht11_buff, size, true);
-                MDF_LOGD("Node send, size: %d, data: %s", size, dht11_buff);
-                MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mwifi_write", mdf_err_to_name(ret));
-                // 读取sensor_light引脚的模拟量
-
-                printf("sensor_light = %d\n", sensor_light);
-                printf("Temp=%.2f--Humi=%.2f%%RH \r\n", dhtData.temp_int + dhtData.temp_deci / 10.0, dhtData.humi_int + dhtData.humi_deci / 10.0);
-                free(dht11_buff);
+                dht11_to_raw(&dhtData, sensor_light, raw);
+                dht11_calibration_set(&pipeline, &config);
+                sensor_pipeline_push(&pipeline, raw);
+                sensor_q16_format(pipeline.value[SENSOR_CHANNEL_TEMP], temp_str);
+                sensor_q16_format(pipeline.value[SENSOR_CHANNEL_HUMI], humi_str);
+                sensor_light = dht11_light_count(&pipeline);
+                size = snprintf(dht11_buff, sizeof(dht11_buff), "{\"version\":\"%s\",\"Temp\":\"%s\",\"Humi\":\"%s\",\"sensor_light\":\"%d\"%s}", VERSION, temp_str, humi_str, sensor_light, ts_field);
+                ret = mesh_aggregate_write(dht11_buff, size); // 开启聚合时由父节点合并转发
+                MESH_DLOGD("Node send, size: %d, data: %s", size, dht11_buff);
+                MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mesh_aggregate_write", mdf_err_to_name(ret));
+                // 每次采样都打印,只记录参数,由主机格式化
+                MESH_DLOGI("Temp=%s--Humi=%s%%RH, sensor_light = %d", temp_str, humi_str, sensor_light);
             }
             else
             {
-                printf("DHT11 Read Error!\r\n");
+                MESH_DLOGW("DHT11 Read Error!");
             }
 
-            // 根据当前温湿度数据，调整上传间隔
-            if (abs(dhtData.humi_int - prevDhtData.humi_int) >= CHANGE_THRESHOLD ||
-                abs(dhtData.temp_int - prevDhtData.temp_int) >= CHANGE_THRESHOLD)
+            // 根据校准滤波后的温湿度，调整上传间隔,阈值单位为0.1
+            // 阈值向下取整,抵消两次采样各自的定点舍入,与原先按0.1整数比较的结果一致
+            TickType_t intervalMin = config.upload_interval_min_ms / portTICK_PERIOD_MS;
+            TickType_t intervalMax = config.upload_interval_max_ms / portTICK_PERIOD_MS;
+            sensor_q16_t threshold = config.change_threshold * SENSOR_Q16_ONE / 10;
+            if (sensor_pipeline_changed(&pipeline, SENSOR_CHANNEL_HUMI, threshold) || sensor_pipeline_changed(&pipeline, SENSOR_CHANNEL_TEMP, threshold))
             {
-                uploadInterval = UPLOAD_INTERVAL_MIN / portTICK_PERIOD_MS;
+                uploadInterval = intervalMin;
             }
             else
             {
-                uploadInterval = UPLOAD_INTERVAL_MAX / portTICK_PERIOD_MS;
+                uploadInterval = intervalMax;
             }
-            if (dhtData.humi_int > 80)
+            if (pipeline.value[SENSOR_CHANNEL_HUMI] >= 81 * SENSOR_Q16_ONE)
             {
                 uploadInterval += 100; // 增加100个系统时钟周期
-                if (uploadInterval > UPLOAD_INTERVAL_MAX / portTICK_PERIOD_MS)
+                if (uploadInterval > intervalMax)
                 {
-                    uploadInterval = UPLOAD_INTERVAL_MAX / portTICK_PERIOD_MS;
+                    uploadInterval = intervalMax;
                 }
             }
-            else if (dhtData.humi_int < 60)
+            else if (pipeline.value[SENSOR_CHANNEL_HUMI] < 60 * SENSOR_Q16_ONE)
             {
                 uploadInterval -= 100; // 减小100个系统时钟周期
-                if (uploadInterval < UPLOAD_INTERVAL_MIN / portTICK_PERIOD_MS)
+                if (uploadInterval < intervalMin)
                 {
-                    uploadInterval = UPLOAD_INTERVAL_MIN / portTICK_PERIOD_MS;
+                    uploadInterval = intervalMin;
                 }
             }
-
-            prevDhtData = dhtData; // 更新上一次的温湿度数据
         }
 
-        vTaskDelay(1000 / portTICK_PERIOD_MS); // 任务延时，单位为系统时钟周期
+        sampleNow = ulTaskNotifyTake(pdTRUE, 1000 / portTICK_PERIOD_MS) > 0; // 任务延时，可被立即采样命令唤醒
     }
 }
+
+// ESP-NOW叶子节点每次唤醒只采样一次,不运行采样任务
+bool dht11_read_once(int16_t *temp, uint16_t *humi, uint16_t *light)
+{
+    DHT11_Data_TypeDef dhtData;
+    sensor_pipeline_t pipeline;
+    sensor_q16_t raw[SENSOR_CHANNEL_MAX];
+    node_config_t config = {0};
+
+    dht11_init();
+    if (!Read_DHT11(&dhtData))
+    {
+        return false;
+    }
+
+    // 单次采样只做校准,不经过滤波
+    sensor_pipeline_init(&pipeline, 100);
+    if (node_config_get(&config) == MDF_OK)
+    {
+        dht11_calibration_set(&pipeline, &config);
+    }
+
+    dht11_to_raw(&dhtData, adc1_get_raw(ADC2_CHANNEL_3), raw);
+    sensor_pipeline_push(&pipeline, raw);
+    *temp = sensor_q16_round(pipeline.value[SENSOR_CHANNEL_TEMP], 10);
+    *humi = sensor_q16_round(pipeline.value[SENSOR_CHANNEL_HUMI], 10);
+    *light = dht11_light_count(&pipeline);
+    return true;
+}
+
+void dht11_sample_now(void)
+{
+    if (g_dht11_task != NULL)
+    {
+        xTaskNotifyGive(g_dht11_task);
+    }
+}
+
+void dht11_burst(uint16_t interval_s, uint16_t duration_s)
+{
+    // 直接按秒换算节拍,pdMS_TO_TICKS(duration_s * 1000)在32位节拍下会溢出
+    TickType_t duration = (TickType_t)duration_s * configTICK_RATE_HZ;
+    TickType_t interval = (TickType_t)interval_s * configTICK_RATE_HZ;
+    TickType_t now = xTaskGetTickCount();
+
+    portENTER_CRITICAL(&g_burst_lock);
+    g_burst_end = now + duration;
+    g_burst_interval = duration_s ? interval : 0;
+    portEXIT_CRITICAL(&g_burst_lock);
+    dht11_sample_now(); // 立即按新的间隔开始
+}
+
+void dht11_relay_set(bool on)
+{
+    gpio_set_level(RELAY_PIN, on ? 1 : 0);
+}
@@ -21,5 +21,9 @@
 
 #define VERSION "1.0.0"// 版本号
 void dht11_task(void *pvParameters);
+void dht11_sample_now(void);                                  // 立即采样一次并上报
+void dht11_burst(uint16_t interval_s, uint16_t duration_s);   // 在duration_s内按interval_s高频采样,duration_s为0时结束
+void dht11_relay_set(bool on);                                // 设置继电器状态
+bool dht11_read_once(int16_t *temp, uint16_t *humi, uint16_t *light); // 不运行采样任务时单次采样,温湿度单位为0.1
 
 #endif
\ No newline at end of file
@@ -0,0 +1,146 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef __SENSOR_PIPELINE_H__
+#define __SENSOR_PIPELINE_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Readings are signed Q16.16 fixed-point numbers. The ESP32-S2 has
+ *        no FPU, every float operation is a soft-float library call, so the
+ *        sample to report path never leaves integer arithmetic.
+ */
+typedef int32_t sensor_q16_t;
+
+#define SENSOR_Q16_SHIFT    (16)
+#define SENSOR_Q16_ONE      ((sensor_q16_t)1 << SENSOR_Q16_SHIFT)
+#define SENSOR_WEIGHT_SHIFT (30)  /**< Filter weights are Q2.30, 1 % in Q16 would be off by 0.05 % */
+#define SENSOR_WEIGHT_ONE   ((int32_t)1 << SENSOR_WEIGHT_SHIFT)
+#define SENSOR_Q16_STR_SIZE (12) /**< "-32768.00" and the terminating null, with room to spare */
+
+typedef enum {
+    SENSOR_CHANNEL_TEMP = 0,  /**< Temperature, C */
+    SENSOR_CHANNEL_HUMI,      /**< Relative humidity, %RH */
+    SENSOR_CHANNEL_LIGHT,     /**< Raw ADC reading of the light sensor */
+    SENSOR_CHANNEL_MAX,
+} sensor_channel_t;
+
+/**
+ * @brief Per-node correction of a channel, value = raw * gain + offset
+ */
+typedef struct {
+    sensor_q16_t gain;
+    sensor_q16_t offset;
+} sensor_calibration_t;
+
+typedef struct {
+    sensor_calibration_t calibration[SENSOR_CHANNEL_MAX];
+    int32_t weight;                         /**< Weight of a new sample in the filter, SENSOR_WEIGHT_ONE disables it */
+    sensor_q16_t value[SENSOR_CHANNEL_MAX]; /**< Calibrated and filtered readings */
+    sensor_q16_t prev[SENSOR_CHANNEL_MAX];  /**< Readings before the last sample, for the delta compare */
+    bool primed;                            /**< The filter holds a sample */
+} sensor_pipeline_t;
+
+/**
+ * @brief  Convert num / den to Q16.16, rounded to nearest
+ *
+ * @param  num numerator, |num| < 32768
+ * @param  den denominator, greater than 0
+ *
+ * @return num / den in Q16.16
+ */
+sensor_q16_t sensor_q16_from_ratio(int32_t num, int32_t den);
+
+/**
+ * @brief  Round a reading to an integer number of 1 / scale units, e.g. 0.1 C
+ *         with a scale of 10
+ *
+ * @param  value reading
+ * @param  scale units per integer, 1 for whole units
+ *
+ * @return value * scale, rounded half away from zero
+ */
+int32_t sensor_q16_round(sensor_q16_t value, int32_t scale);
+
+/**
+ * @brief  Format a reading with two decimals, as "%.2f" would
+ *
+ * @param  value  reading
+ * @param  buffer at least SENSOR_Q16_STR_SIZE bytes
+ *
+ * @return length of the string, without the terminating null
+ */
+size_t sensor_q16_format(sensor_q16_t value, char *buffer);
+
+/**
+ * @brief  Apply a calibration to a raw reading
+ *
+ * @param  calibration gain and offset of the channel
+ * @param  raw         reading as sampled
+ *
+ * @return calibrated reading
+ */
+sensor_q16_t sensor_calibrate(const sensor_calibration_t *calibration, sensor_q16_t raw);
+
+/**
+ * @brief  Reset a pipeline, every channel starts uncalibrated
+ *
+ * @param  pipeline       pipeline
+ * @param  filter_percent weight of a new sample in the filter, 100 disables it
+ */
+void sensor_pipeline_init(sensor_pipeline_t *pipeline, uint8_t filter_percent);
+
+/**
+ * @brief  Set the calibration of a channel, takes effect with the next sample
+ *
+ * @param  pipeline pipeline
+ * @param  channel  channel
+ * @param  gain     gain, SENSOR_Q16_ONE for none
+ * @param  offset   offset in the unit of the channel, added after the gain
+ */
+void sensor_pipeline_set_calibration(sensor_pipeline_t *pipeline, sensor_channel_t channel,
+                                     sensor_q16_t gain, sensor_q16_t offset);
+
+/**
+ * @brief  Calibrate and filter a sample of every channel
+ *
+ * @param  pipeline pipeline
+ * @param  raw      raw readings, indexed by sensor_channel_t
+ */
+void sensor_pipeline_push(sensor_pipeline_t *pipeline, const sensor_q16_t raw[SENSOR_CHANNEL_MAX]);
+
+/**
+ * @brief  Check whether the last sample moved a channel by at least threshold
+ *
+ * @param  pipeline  pipeline
+ * @param  channel   channel
+ * @param  threshold change in the unit of the channel
+ *
+ * @return
+ *     - true  the reading has changed
+ *     - false the reading is stable
+ */
+bool sensor_pipeline_changed(const sensor_pipeline_t *pipeline, sensor_channel_t channel, sensor_q16_t threshold);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __SENSOR_PIPELINE_H__ */
@@ -0,0 +1,127 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "sensor_pipeline.h"
+
+#define SENSOR_Q16_HALF (SENSOR_Q16_ONE >> 1)
+
+/**
+ * @brief Products are taken in 64 bits. The S2 multiplier returns the high
+ *        word, so this is a few instructions and no library call. Divisions
+ *        stay 32-bit, which the S2 does in hardware.
+ */
+static inline sensor_q16_t sensor_q16_mul(sensor_q16_t a, sensor_q16_t b)
+{
+    return (sensor_q16_t)(((int64_t)a * b + SENSOR_Q16_HALF) >> SENSOR_Q16_SHIFT);
+}
+
+sensor_q16_t sensor_q16_from_ratio(int32_t num, int32_t den)
+{
+    int32_t scaled = num * SENSOR_Q16_ONE;
+
+    return (scaled < 0 ? scaled - den / 2 : scaled + den / 2) / den;
+}
+
+int32_t sensor_q16_round(sensor_q16_t value, int32_t scale)
+{
+    int64_t scaled = (int64_t)value * scale;
+
+    if (scaled < 0) {
+        return -(int32_t)((-scaled + SENSOR_Q16_HALF) >> SENSOR_Q16_SHIFT);
+    }
+
+    return (int32_t)((scaled + SENSOR_Q16_HALF) >> SENSOR_Q16_SHIFT);
+}
+
+size_t sensor_q16_format(sensor_q16_t value, char *buffer)
+{
+    int32_t hundredths = sensor_q16_round(value, 100);
+    uint32_t magnitude = hundredths < 0 ? -(uint32_t)hundredths : (uint32_t)hundredths;
+    char digits[SENSOR_Q16_STR_SIZE];
+    size_t num = 0;
+    size_t len = 0;
+
+    /**< At least three digits, "0.05" and not ".5" */
+    do {
+        digits[num++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude || num < 3);
+
+    if (hundredths < 0) {
+        buffer[len++] = '-';
+    }
+
+    while (num > 0) {
+        buffer[len++] = digits[--num];
+
+        if (num == 2) {
+            buffer[len++] = '.';
+        }
+    }
+
+    buffer[len] = '\0';
+
+    return len;
+}
+
+sensor_q16_t sensor_calibrate(const sensor_calibration_t *calibration, sensor_q16_t raw)
+{
+    return sensor_q16_mul(raw, calibration->gain) + calibration->offset;
+}
+
+void sensor_pipeline_init(sensor_pipeline_t *pipeline, uint8_t filter_percent)
+{
+    memset(pipeline, 0, sizeof(sensor_pipeline_t));
+
+    for (int i = 0; i < SENSOR_CHANNEL_MAX; ++i) {
+        pipeline->calibration[i].gain = SENSOR_Q16_ONE;
+    }
+
+    pipeline->weight = (filter_percent == 0 || filter_percent >= 100) ? SENSOR_WEIGHT_ONE
+                       : (int32_t)(((int64_t)filter_percent << SENSOR_WEIGHT_SHIFT) / 100);
+}
+
+void sensor_pipeline_set_calibration(sensor_pipeline_t *pipeline, sensor_channel_t channel,
+                                     sensor_q16_t gain, sensor_q16_t offset)
+{
+    pipeline->calibration[channel].gain   = gain;
+    pipeline->calibration[channel].offset = offset;
+}
+
+void sensor_pipeline_push(sensor_pipeline_t *pipeline, const sensor_q16_t raw[SENSOR_CHANNEL_MAX])
+{
+    for (int i = 0; i < SENSOR_CHANNEL_MAX; ++i) {
+        sensor_q16_t value = sensor_calibrate(pipeline->calibration + i, raw[i]);
+
+        /**< The first sample is compared against zero, as an unsampled node always reports */
+        pipeline->prev[i] = pipeline->value[i];
+
+        if (!pipeline->primed || pipeline->weight == SENSOR_WEIGHT_ONE) {
+            pipeline->value[i] = value;
+        } else {
+            int64_t step = (int64_t)(value - pipeline->value[i]) * pipeline->weight;
+            pipeline->value[i] += (sensor_q16_t)((step + (SENSOR_WEIGHT_ONE >> 1)) >> SENSOR_WEIGHT_SHIFT);
+        }
+    }
+
+    pipeline->primed = true;
+}
+
+bool sensor_pipeline_changed(const sensor_pipeline_t *pipeline, sensor_channel_t channel, sensor_q16_t threshold)
+{
+    int64_t delta = (int64_t)pipeline->value[channel] - pipeline->prev[channel];
+
+    return (delta < 0 ? -delta : delta) >= threshold;
+}
@@ -1,21 +1,49 @@
 #include "mwifi.h"
 #include "mupgrade.h"
 #include "mesh_mqtt_handle.h"
+#include "mesh_proto.h"
+#include "mesh_time.h"
+#include "node_config.h"
+#include "mesh_metrics.h"
+#include "root_standby.h"
+#include "mesh_aggregate.h"
+#include "mesh_rollup.h"
+#include "mesh_group.h"
+#include "mesh_ack.h"
+#include "mesh_command.h"
+#include "mesh_fairq.h"
+#include "mesh_seq.h"
+#include "mesh_shard.h"
+#include "mesh_espnow.h"
+#include "mesh_static.h"
+#include "mesh_dlog.h"
 #include "mdf_common.h"
+#include "esp_attr.h"
 #include "dht11.h"
 
-#define MY_ROUTER_SSID "ESPRESSIF"
-#define MY_ROUTER_PASSWORD "20020806"
-#define MY_MESH_ID "123456"
-#define MY_MQTT_URL "mqtt://124.222.71.199:1883/mqtt"
-
 static const char *TAG = "smart_agriculture";
 esp_netif_t *sta_netif;
 
+// 长期运行的任务和帧缓冲,开启MESH_STATIC_MEMORY时在链接时分配
+MESH_STATIC_TASK_DEFINE(ota, CONFIG_OTA_TASK_STACK_SIZE);
+MESH_STATIC_TASK_DEFINE(root, CONFIG_ROOT_TASK_STACK_SIZE);
+MESH_STATIC_TASK_DEFINE(node_read, CONFIG_NODE_TASK_STACK_SIZE);
+MESH_STATIC_TASK_DEFINE(node_write, CONFIG_NODE_TASK_STACK_SIZE);
+MESH_STATIC_TASK_DEFINE(dht11, CONFIG_SENSOR_TASK_STACK_SIZE);
+MESH_STATIC_BUFFER_DEFINE(ota, MWIFI_PAYLOAD_LEN);
+MESH_STATIC_BUFFER_DEFINE(node_read, MWIFI_PAYLOAD_LEN);
+MESH_STATIC_BUFFER_DEFINE(node_write, MWIFI_PAYLOAD_LEN);
+
+// 事件循环中不能等待上一个任务退出,任务槽被占用时通过这两个事件稍后重试,ctx为已重试的次数
+#define MDF_EVENT_CUSTOM_NODE_READ_START (MDF_EVENT_CUSTOM_BASE + 0x10)
+#define MDF_EVENT_CUSTOM_ROOT_START      (MDF_EVENT_CUSTOM_BASE + 0x11)
+#define TASK_START_RETRY_MS              (100)
+#define TASK_START_RETRY_NUM             (20)
+
 static void ota_task(void *arg)
 {
     mdf_err_t ret = MDF_OK;
-    uint8_t *data = MDF_MALLOC(MWIFI_PAYLOAD_LEN);
+    uint8_t *data = MESH_STATIC_MALLOC(ota, MWIFI_PAYLOAD_LEN);
     char name[32] = {0x0};
     int total_size = 0;
     int start_time = 0;
@@ -34,6 +62,7 @@ static void ota_task(void *arg)
      *      in the example we will start the firmware upgrade after 30 seconds.
      */
     vTaskDelay(10 * 1000 / portTICK_PERIOD_MS);
+    root_standby_ota_set((char *)arg); // 升级过程中根节点切换时,由新的根节点继续升级
     esp_http_client_config_t config = {
         .url = (char *)arg,
         .transport_type = HTTP_TRANSPORT_UNKNOWN,
@@ -139,25 +168,179 @@ static void ota_task(void *arg)
     MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mwifi_root_recv", mdf_err_to_name(ret));
 
 EXIT:
-    MDF_FREE(data);
+    root_standby_ota_set(NULL);
+    MESH_STATIC_FREE(ota, data);
     mupgrade_result_free(&upgrade_result);
     esp_http_client_close(client);
     esp_http_client_cleanup(client);
-    vTaskDelete(NULL);
+    MESH_STATIC_TASK_EXIT();
+}
+
+/**
+ * @brief Apply a configuration update from the cloud and forward it to the addressed nodes.
+ *        The root applies it to itself as well when it is addressed.
+ */
+static mdf_err_t root_config_handle(const mesh_mqtt_data_t *request, const cJSON *config_json)
+{
+    mdf_err_t ret = MDF_OK;
+    mwifi_data_type_t data_type = {.protocol = MESH_PROTO_CONFIG, .custom = request->id};
+    uint8_t addr_any[] = MWIFI_ADDR_ANY;
+    uint8_t addr_root[] = MWIFI_ADDR_ROOT;
+    uint8_t sta_mac[MWIFI_ADDR_LEN] = {0};
+    uint8_t *dest_addrs = MDF_MALLOC(request->addrs_num * MWIFI_ADDR_LEN);
+    size_t dest_addrs_num = 0;
+    bool update_self = false;
+    bool restart = false;
+    char *config_str = cJSON_PrintUnformatted(config_json);
+
+    MDF_ERROR_GOTO(dest_addrs == NULL || config_str == NULL, EXIT, "Allocate mem failed");
+    esp_wifi_get_mac(ESP_IF_WIFI_STA, sta_mac);
+
+    // 下发给根节点自身的配置不需要经过mesh转发
+    for (int i = 0; i < request->addrs_num; i++)
+    {
+        const uint8_t *addr = request->addrs_list + i * MWIFI_ADDR_LEN;
+
+        if (!memcmp(addr, addr_root, MWIFI_ADDR_LEN) || !memcmp(addr, sta_mac, MWIFI_ADDR_LEN))
+        {
+            update_self = true;
+            continue;
+        }
+
+        if (!memcmp(addr, addr_any, MWIFI_ADDR_LEN))
+        {
+            update_self = true;
+        }
+
+        memcpy(dest_addrs + dest_addrs_num * MWIFI_ADDR_LEN, addr, MWIFI_ADDR_LEN);
+        dest_addrs_num++;
+    }
+
+    if (dest_addrs_num > 0)
+    {
+        ret = mwifi_root_write(dest_addrs, dest_addrs_num, &data_type, config_str, strlen(config_str), true);
+        if (ret != MDF_OK && request->id)
+        {
+            mesh_ack_cancel(request->id, MESH_ACK_UNREACHABLE);
+        }
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mwifi_root_write", mdf_err_to_name(ret));
+    }
+
+    if (update_self)
+    {
+        ret = node_config_update(config_str, strlen(config_str), &restart);
+        mesh_ack_complete(sta_mac, request->id, ret == MDF_OK ? MESH_ACK_OK : MESH_ACK_INVALID); // 根节点自身的结果直接记录
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> node_config_update", mdf_err_to_name(ret));
+    }
+
+    if (restart)
+    {
+        MDF_LOGW("Network config changed, the device will restart after 3 seconds");
+        vTaskDelay(pdMS_TO_TICKS(3000));
+        esp_restart();
+    }
+
+EXIT:
+    MDF_FREE(dest_addrs);
+    MDF_FREE(config_str);
+    return ret;
+}
+
+// 合并帧中的每条记录按产生它的节点去重、限速和排队,与节点直接发来的数据一样
+static void root_aggregate_record_cb(const uint8_t *addr, uint32_t seq, const char *data, size_t size, void *arg)
+{
+    mwifi_data_type_t record_type = {.protocol = MESH_PROTO_DATA, .custom = seq};
+
+    if (!mesh_seq_check(addr, seq) || !mesh_fairq_admit(addr))
+    {
+        return;
+    }
+
+    char *record = MDF_MALLOC(size);
+    if (record == NULL)
+    {
+        MDF_LOGW("Allocate mem failed");
+        return;
+    }
+
+    memcpy(record, data, size);
+    mdf_err_t ret = mesh_fairq_push(addr, &record_type, record, size);
+    if (ret != MDF_OK)
+    {
+        MDF_LOGW("<%s> mesh_fairq_push", mdf_err_to_name(ret));
+    }
+}
+
+// 调度任务按节点轮流取出的上行数据,在这里发布
+static void root_uplink_handle(const uint8_t *src_addr, const mwifi_data_type_t *data_type, char *data, size_t size)
+{
+    mdf_err_t ret = MDF_OK;
+
+    if (data_type->protocol == MESH_PROTO_ACK)
+    { // 节点对命令的确认,按关联ID汇总后统一发布
+        root_standby_node_seen(src_addr, data, size);
+        ret = mesh_ack_handle(src_addr, data_type->custom, (uint8_t *)data, size);
+    }
+    else if (data_type->protocol == MESH_PROTO_METRICS)
+    { // 节点的运行状态,发布到诊断主题
+        root_standby_node_seen(src_addr, data, size);
+        ret = mesh_mqtt_write_diag((uint8_t *)src_addr, data, size);
+    }
+    else if (mesh_rollup_handle(src_addr, data, size))
+    { // 计入窗口统计,未开启原始数据转发的读数不再逐条发布
+        root_standby_node_seen(src_addr, data, size);
+        ret = mesh_mqtt_write((uint8_t *)src_addr, data, size, MESH_MQTT_DATA_JSON);
+    }
+    else
+    {
+        root_standby_node_seen(src_addr, data, size);
+    }
+
+    if (ret != MDF_OK)
+    {
+        MDF_LOGW("<%s> mesh_mqtt_publish", mdf_err_to_name(ret));
+    }
 }
 
 static void root_task(void *arg)
 {
     mdf_err_t ret = MDF_OK;
-    char *data = MDF_MALLOC(MWIFI_PAYLOAD_LEN);
+    char *data = NULL;
     size_t size = MWIFI_PAYLOAD_LEN;
     mwifi_data_type_t data_type = {0};
+    mwifi_data_type_t request_type = {0};
     uint8_t src_addr[MWIFI_ADDR_LEN] = {0};
 
     mesh_mqtt_data_t *request = NULL;
+    uint32_t standby_handle = 0;
+    char ota_url[ROOT_STANDBY_URL_MAX_LEN] = {0};
 
     MDF_LOGI("Root task is running");
 
+    // 从上一个根节点同步的状态中恢复
+    ret = root_standby_start();
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> root_standby_start", mdf_err_to_name(ret));
+
+    ret = mesh_rollup_start();
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_rollup_start", mdf_err_to_name(ret));
+
+    ret = mesh_ack_start();
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_ack_start", mdf_err_to_name(ret));
+
+    ret = mesh_fairq_start(root_uplink_handle);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_fairq_start", mdf_err_to_name(ret));
+
+    // 向本网络的节点和周围的新节点通告根节点负载
+    ret = mesh_shard_root_start();
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mesh_shard_root_start", mdf_err_to_name(ret));
+
+    if (root_standby_ota_get(ota_url, sizeof(ota_url)) == MDF_OK)
+    {
+        MDF_LOGI("Resume firmware upgrade: %s", ota_url);
+        MESH_STATIC_TASK_CREATE(ota, ota_task, "ota_task",
+                                strdup(ota_url), CONFIG_MDF_TASK_DEFAULT_PRIOTY - 2, NULL);
+    }
+
     while (mwifi_is_connected() && esp_mesh_is_root())
     {
         if (!mwifi_get_root_status())
@@ -165,83 +348,152 @@ static void root_task(void *arg)
             vTaskDelay(500 / portTICK_RATE_MS);
             continue;
         }
+        /**
+         * @brief Recv data from node, and forward to mqtt server.
+         */
+        ret = mwifi_root_read(src_addr, &data_type, &data, &size, portMAX_DELAY); // data由mwifi分配,处理后释放
+        if (ret != MDF_OK)
+        {
+            mesh_metrics_inc(MESH_METRICS_MESH_RX_ERROR);
+            MDF_LOGW("<%s> mwifi_root_read", mdf_err_to_name(ret));
+            continue;
+        }
+
         if (data_type.upgrade)
         { // This mesh package contains upgrade data.
             ret = mupgrade_root_handle(src_addr, data, size);
+            MDF_FREE(data);
             MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mupgrade_root_handle", mdf_err_to_name(ret));
         }
-        /**
-         * @brief Recv data from node, and forward to mqtt server.
-         */
-        ret = mwifi_root_read(src_addr, &data_type, &data, &size, portMAX_DELAY);
-        MDF_ERROR_GOTO(ret != MDF_OK, MEM_FREE, "<%s> mwifi_root_read", mdf_err_to_name(ret));
-
-        ret = mesh_mqtt_write(src_addr, data, size, MESH_MQTT_DATA_JSON);
-
-        MDF_ERROR_GOTO(ret != MDF_OK, MEM_FREE, "<%s> mesh_mqtt_publish", mdf_err_to_name(ret));
+        else if (data_type.protocol == MESH_PROTO_AGGREGATE)
+        { // 中间节点合并的多条数据,拆成记录后按原节点排队,转发节点不会因此占去多个节点的份额
+            ret = mesh_aggregate_foreach((uint8_t *)data, size, root_aggregate_record_cb, NULL);
+            MDF_FREE(data);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mesh_aggregate_foreach", mdf_err_to_name(ret));
+        }
+        else if ((data_type.protocol == MESH_PROTO_DATA || data_type.protocol == MESH_PROTO_METRICS)
+                 && !mesh_seq_check(src_addr, data_type.custom))
+        { // 网络层重传产生的重复帧,序号已经收到过
+            MDF_FREE(data);
+        }
+        else if (data_type.protocol != MESH_PROTO_ACK && !mesh_fairq_admit(src_addr))
+        { // 超出速率的节点直接丢弃,确认是命令的应答不限速
+            MDF_FREE(data);
+        }
+        else
+        { // 按源节点排队,由调度任务轮流发布,单个节点无法占满上行
+            ret = mesh_fairq_push(src_addr, &data_type, data, size);
+            data = NULL;
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mesh_fairq_push", mdf_err_to_name(ret));
+        }
 
         /**
          * @brief Recv data from mqtt data queue, and forward to special device.
          */
-        ret = mesh_mqtt_read(&request, pdMS_TO_TICKS(500));
+        ret = root_standby_command_pop(&request); // 先处理上一个根节点未送达的命令
         if (ret != MDF_OK)
         {
-            MDF_FREE(request);
-            continue;
+            ret = mesh_mqtt_read(&request, pdMS_TO_TICKS(500));
         }
-        else
+        if (ret != MDF_OK)
         {
-            // 如果收到的数据是json格式的数据，那么就解析出来
-            cJSON *json = cJSON_Parse(request->data);
-            char *firmware_name = NULL;
-            if (json == NULL)
-            {
-                MDF_LOGE("JSON Parse Error format");
-                continue;
-            } // 如果消息是{"url":"http://wepper.club:8070/mupgrade.bin","version":"1.0.0"}，那么就解析出来
-            cJSON *url = cJSON_GetObjectItem(json, "url");
-            cJSON *version = cJSON_GetObjectItem(json, "version");
-            if (url == NULL || version == NULL)
-            {
-                MDF_LOGE("JSON Parse Error format");
-                continue;
-            }
+            continue;
+        }
+
+        if (request->addrs_err == MDF_OK)
+        { // 目标分组无法展开的命令只需应答,不交给下一个根节点
+            root_standby_command_push(request, &standby_handle);
+        }
+
+        cJSON *json = cJSON_ParseWithLength(request->data, request->size);
+        cJSON *url = cJSON_GetObjectItem(json, "url");
+        cJSON *version = cJSON_GetObjectItem(json, "version");
+        cJSON *config_json = cJSON_GetObjectItem(json, "config");
+        cJSON *groups_json = cJSON_GetObjectItem(json, "groups");
+
+        if (request->addrs_err != MDF_OK)
+        { // 命令指向未知或没有成员的分组,直接向云端报告
+            mesh_ack_reject(request->id, request->addrs_err == MDF_ERR_INVALID_ARG ? MESH_ACK_INVALID : MESH_ACK_UNREACHABLE);
+        }
+        else if (url != NULL && version != NULL)
+        { // 如果消息是{"url":"http://wepper.club:8070/mupgrade.bin","version":"1.0.0"}，那么就解析出来
             // 将url-valuestring的值使用字符处理函数赋值给firmware_name
-            firmware_name = (char *)malloc(strlen(url->valuestring) + 1);
+            char *firmware_name = (char *)malloc(strlen(url->valuestring) + 1);
             strcpy(firmware_name, url->valuestring);
 
             MDF_LOGI("url: %s, version: %s", firmware_name, version->valuestring);
-            cJSON_Delete(json);
-            xTaskCreate(ota_task, "ota_task", 8 * 1024,
-                        firmware_name, CONFIG_MDF_TASK_DEFAULT_PRIOTY - 2, NULL);
+            if (MESH_STATIC_TASK_CREATE(ota, ota_task, "ota_task",
+                                        firmware_name, CONFIG_MDF_TASK_DEFAULT_PRIOTY - 2, NULL) != pdPASS)
+            { // 上一次升级还没有结束
+                MDF_FREE(firmware_name);
+            }
         }
-        if (ret != MDF_OK)
+        else if (config_json != NULL)
+        { // 如果消息是{"config":{"upload_interval_min":2000}}，那么下发配置
+            if (request->id)
+            {
+                mesh_ack_track(request->id, request->addrs_list, request->addrs_num);
+            }
+            ret = root_config_handle(request, config_json);
+            MDF_ERROR_GOTO(ret != MDF_OK, MEM_FREE, "<%s> root_config_handle", mdf_err_to_name(ret));
+        }
+        else if (groups_json != NULL)
+        { // 如果消息是{"groups":[{"id":1,"add":["30aea4000002"]}]}，那么更新根节点上的分组
+            ret = mesh_group_update(request->data, request->size);
+            MDF_ERROR_GOTO(ret != MDF_OK, MEM_FREE, "<%s> mesh_group_update", mdf_err_to_name(ret));
+        }
+        else
         {
-            continue;
+            if (request->id)
+            { // 需要确认的命令,由根节点汇总各节点的结果
+                mesh_ack_track(request->id, request->addrs_list, request->addrs_num);
+            }
+            request_type.protocol = request->type == MESH_MQTT_DATA_BYTES ? MESH_PROTO_COMMAND : MESH_PROTO_DATA; // 二进制数据按命令帧下发
+            request_type.custom = request->id;
+            ret = mwifi_root_write(request->addrs_list, request->addrs_num, &request_type, request->data, request->size, true); // root节点向子节点发送数据
+            if (ret != MDF_OK)
+            {
+                mesh_metrics_inc(MESH_METRICS_MESH_TX_ERROR);
+                MDF_LOGW("<%s> mwifi_root_write", mdf_err_to_name(ret));
+                if (request->id)
+                {
+                    mesh_ack_cancel(request->id, MESH_ACK_UNREACHABLE);
+                }
+            }
         }
 
-        ret = mwifi_root_write(request->addrs_list, request->addrs_num, &data_type, request->data, request->size, true); // root节点向子节点发送数据
-        MDF_ERROR_GOTO(ret != MDF_OK, MEM_FREE, "<%s> mwifi_root_write", mdf_err_to_name(ret));
-
     MEM_FREE:
-        // MDF_FREE(root);
-        MDF_FREE(request->addrs_list);
-        MDF_FREE(request->data);
-        MDF_FREE(request);
-        // MDF_FREE(firmware_name);
+        root_standby_command_done(standby_handle); // 无论送达、解析失败还是已向云端报告不可达,都不再交给下一个根节点重发
+        standby_handle = 0;
+        cJSON_Delete(json);
+        json = NULL;
+
+        if (request != NULL)
+        {
+            MDF_FREE(request->addrs_list);
+            MDF_FREE(request->data);
+            MDF_FREE(request);
+        }
     }
 
+EXIT:
     MDF_LOGW("Root task is exit");
 
     MDF_FREE(data);
+    root_standby_stop();
+    mesh_rollup_stop();
+    mesh_ack_stop();
+    mesh_fairq_stop();
+    mesh_shard_root_stop();
     mesh_mqtt_stop();
-    vTaskDelete(NULL);
+    mesh_time_root_stop();
+    MESH_STATIC_TASK_EXIT();
 }
 
 static void node_read_task(void *arg)
 {
     mdf_err_t ret = MDF_OK;
-    char *data = MDF_MALLOC(MWIFI_PAYLOAD_LEN);
+    char *data = MESH_STATIC_MALLOC(node_read, MWIFI_PAYLOAD_LEN);
     size_t size = MWIFI_PAYLOAD_LEN;
     mwifi_data_type_t data_type = {0x0};
     uint8_t src_addr[MWIFI_ADDR_LEN] = {0};
@@ -251,45 +503,182 @@ static void node_read_task(void *arg)
     while (mwifi_is_connected())
     {
         size = MWIFI_PAYLOAD_LEN;
-        memset(data, 0, MWIFI_PAYLOAD_LEN);
         ret = mwifi_read(src_addr, &data_type, data, &size, portMAX_DELAY);
-        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mwifi_root_recv", mdf_err_to_name(ret));
+        if (ret != MDF_OK)
+        {
+            mesh_metrics_inc(MESH_METRICS_MESH_RX_ERROR);
+            MDF_LOGW("<%s> mwifi_root_recv", mdf_err_to_name(ret));
+            continue;
+        }
 
         if (data_type.upgrade)
         { // This mesh package contains upgrade data.
             ret = mupgrade_handle(src_addr, data, size);
             MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mupgrade_handle", mdf_err_to_name(ret));
         }
+        else if (data_type.protocol == MESH_PROTO_TIME_BEACON)
+        { // 根节点广播的时间信标,用于校准本地时钟
+            ret = mesh_time_handle_beacon((uint8_t *)data, size);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mesh_time_handle_beacon", mdf_err_to_name(ret));
+        }
+        else if (data_type.protocol == MESH_PROTO_AGGREGATE)
+        { // 子节点的合并数据,并入本节点的下一批一起转发
+            ret = mesh_aggregate_handle((uint8_t *)data, size);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mesh_aggregate_handle", mdf_err_to_name(ret));
+        }
+        else if (data_type.protocol == MESH_PROTO_PARENT)
+        { // 父节点告知其STA地址,合并数据直接发给父节点
+            ret = mesh_aggregate_handle_parent(src_addr, (uint8_t *)data, size);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mesh_aggregate_handle_parent", mdf_err_to_name(ret));
+        }
+        else if (data_type.protocol == MESH_PROTO_ROOT_STATE)
+        { // 作为备用根节点,保存根节点的状态快照
+            ret = root_standby_handle_state((uint8_t *)data, size);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> root_standby_handle_state", mdf_err_to_name(ret));
+        }
+        else if (data_type.protocol == MESH_PROTO_CONFIG)
+        { // 云端下发的运行时配置
+            bool restart = false;
+            ret = node_config_update(data, size, &restart);
+            mesh_ack_send(data_type.custom, ret == MDF_OK ? MESH_ACK_OK : MESH_ACK_INVALID);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> node_config_update", mdf_err_to_name(ret));
+
+            if (restart)
+            {
+                MDF_LOGW("Network config changed, the device will restart after 3 seconds");
+                vTaskDelay(pdMS_TO_TICKS(3000));
+                esp_restart();
+            }
+        }
+        else if (data_type.protocol == MESH_PROTO_COMMAND)
+        { // 二进制命令帧,按操作码查表执行
+            mesh_ack_send(data_type.custom, mesh_command_dispatch((uint8_t *)data, size));
+        }
+        else if (data_type.protocol == MESH_PROTO_SHARD_STATE)
+        { // 根节点过载时部分叶子节点重新选择网络
+            ret = mesh_shard_handle_state((uint8_t *)data, size);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mesh_shard_handle_state", mdf_err_to_name(ret));
+        }
         else
         {
-            MDF_LOGI("Receive [ROOT] addr: " MACSTR ", size: %d, data: %s",
-                     MAC2STR(src_addr), size, data);
+            MESH_DLOGI("Receive [ROOT] addr: " MACSTR ", size: %d, data: %.*s",
+                       MAC2STR(src_addr), size, (int)size, data);
 
             /**
              * @brief Finally, the node receives a restart notification. Restart it yourself..
              */
-            if (!strcmp(data, "restart"))
-            {
-                MDF_LOGI("Restart the version of the switching device");
-                MDF_LOGW("The device will restart after 3 seconds");
-                vTaskDelay(pdMS_TO_TICKS(3000));
-                esp_restart();
+            if (size == strlen("restart") && !memcmp(data, "restart", size))
+            { // 兼容旧的字符串命令
+                mesh_ack_send(data_type.custom, mesh_command_execute(MESH_COMMAND_RESTART, NULL, 0));
+            }
+            else
+            { // 其他命令节点还不支持
+                mesh_ack_send(data_type.custom, MESH_ACK_UNSUPPORTED);
             }
         }
     }
 
     MDF_LOGW("Node read task is exit");
 
-    MDF_FREE(data);
-    vTaskDelete(NULL);
+    MESH_STATIC_FREE(node_read, data);
+    MESH_STATIC_TASK_EXIT();
+}
+
+static void node_restart_timer_cb(TimerHandle_t timer)
+{
+    esp_restart();
+}
+
+/**
+ * @brief Restart later, so the acknowledgement of the command is sent first
+ */
+static mesh_ack_result_t node_command_restart(const uint8_t *args, size_t size)
+{
+    static TimerHandle_t timer = NULL;
+    MESH_STATIC_TIMER_DEFINE(node_restart);
+
+    if (timer == NULL)
+    {
+        timer = MESH_STATIC_TIMER_CREATE(node_restart, "node_restart", pdMS_TO_TICKS(3000), pdFALSE, NULL,
+                                         node_restart_timer_cb);
+    }
+
+    if (timer == NULL || xTimerStart(timer, 0) != pdPASS)
+    {
+        return MESH_ACK_FAILED;
+    }
+
+    MDF_LOGW("The device will restart after 3 seconds");
+    return MESH_ACK_OK;
 }
 
+static mesh_ack_result_t node_command_relay_set(const uint8_t *args, size_t size)
+{
+    if (args[0] > 1)
+    {
+        return MESH_ACK_INVALID;
+    }
+
+    dht11_relay_set(args[0]);
+    return MESH_ACK_OK;
+}
+
+static mesh_ack_result_t node_command_config_set(const uint8_t *args, size_t size)
+{
+    bool restart = false;
+    mdf_err_t ret = node_config_update((const char *)args, size, &restart);
+
+    if (ret != MDF_OK)
+    {
+        MDF_LOGW("<%s> node_config_update", mdf_err_to_name(ret));
+        return MESH_ACK_INVALID;
+    }
+
+    return restart ? node_command_restart(NULL, 0) : MESH_ACK_OK;
+}
+
+static mesh_ack_result_t node_command_sample_now(const uint8_t *args, size_t size)
+{
+    dht11_sample_now();
+    return MESH_ACK_OK;
+}
+
+static mesh_ack_result_t node_command_burst(const uint8_t *args, size_t size)
+{
+    uint16_t interval_s = args[0] | args[1] << 8;
+    uint16_t duration_s = args[2] | args[3] << 8;
+
+    if (duration_s && !interval_s)
+    {
+        return MESH_ACK_INVALID;
+    }
+
+    dht11_burst(interval_s, duration_s);
+    return MESH_ACK_OK;
+}
+
+static mesh_ack_result_t node_command_log_level(const uint8_t *args, size_t size)
+{
+    char module[MESH_DLOG_MODULE_MAX_LEN] = {0};
+
+    memcpy(module, args + 1, size - 1);
+    return mesh_dlog_level_set(module, (esp_log_level_t)args[0]) == MDF_OK ? MESH_ACK_OK : MESH_ACK_INVALID;
+}
+
+static const mesh_command_t g_node_commands[] = {
+    {MESH_COMMAND_RESTART,    0, 0,                 node_command_restart},
+    {MESH_COMMAND_RELAY_SET,  1, 1,                 node_command_relay_set},
+    {MESH_COMMAND_CONFIG_SET, 2, MWIFI_PAYLOAD_LEN, node_command_config_set},
+    {MESH_COMMAND_SAMPLE_NOW, 0, 0,                 node_command_sample_now},
+    {MESH_COMMAND_BURST,      4, 4,                 node_command_burst},
+    {MESH_COMMAND_LOG_LEVEL,  2, MESH_DLOG_MODULE_MAX_LEN, node_command_log_level},
+};
+
 void node_write_task(void *arg)
 {
     mdf_err_t ret = MDF_OK;
     size_t size = 0;
-    char *data = MDF_MALLOC(MWIFI_PAYLOAD_LEN);
-    mwifi_data_type_t data_type = {0x0};
+    char *data = MESH_STATIC_MALLOC(node_write, MWIFI_PAYLOAD_LEN);
     uint8_t sta_mac[MWIFI_ADDR_LEN] = {0};
     mesh_addr_t parent_mac = {0};
 
@@ -305,21 +694,78 @@ void node_write_task(void *arg)
         }
 
         esp_mesh_get_parent_bssid(&parent_mac);
-        size = asprintf(&data, "{\"type\":\"heartbeat\", \"self\": \"%02x%02x%02x%02x%02x%02x\", \"parent\":\"%02x%02x%02x%02x%02x%02x\",\"layer\":%d}",
+        size = snprintf(data, MWIFI_PAYLOAD_LEN, MESH_PROTO_HEARTBEAT_FORMAT,
                         MAC2STR(sta_mac), MAC2STR(parent_mac.addr), esp_mesh_get_layer());
 
-        MDF_LOGD("Node send, size: %d, data: %s", size, data);
-        ret = mwifi_write(NULL, &data_type, data, size, true);
-        MDF_FREE(data);
-        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mwifi_write", mdf_err_to_name(ret));
+        MESH_DLOGD("Node send, size: %d, data: %s", size, data);
+        ret = mesh_aggregate_write(data, size);
+        if (ret != MDF_OK)
+        {
+            MDF_LOGW("<%s> mesh_aggregate_write", mdf_err_to_name(ret));
+        }
 
         vTaskDelay(3000 / portTICK_RATE_MS);
     }
 
     MDF_LOGW("Node write task is exit");
 
-    MDF_FREE(data);
-    vTaskDelete(NULL);
+    MESH_STATIC_FREE(node_write, data);
+    MESH_STATIC_TASK_EXIT();
+}
+
+static mdf_err_t root_seq_report_cb(const char *data, size_t size)
+{
+    uint8_t sta_mac[MWIFI_ADDR_LEN] = {0};
+
+    esp_wifi_get_mac(ESP_IF_WIFI_STA, sta_mac);
+    return mesh_mqtt_write_diag(sta_mac, data, size);
+}
+
+/**
+ * @brief Deliver a diagnostics message, a metrics report or a batch of
+ *        deferred log records. The root publishes its own directly, the
+ *        other nodes send them to the root which publishes them on their
+ *        behalf.
+ */
+static mdf_err_t diag_write_cb(const char *data, size_t size)
+{
+    mdf_err_t ret = MDF_OK;
+    mwifi_data_type_t data_type = {.protocol = MESH_PROTO_METRICS};
+    uint8_t sta_mac[MWIFI_ADDR_LEN] = {0};
+
+    if (esp_mesh_is_root())
+    {
+        MDF_ERROR_CHECK(!mesh_mqtt_is_connect(), MDF_ERR_INVALID_STATE, "MQTT is not connected");
+        esp_wifi_get_mac(ESP_IF_WIFI_STA, sta_mac);
+        return mesh_mqtt_write_diag(sta_mac, data, size);
+    }
+
+    MDF_ERROR_CHECK(!mwifi_is_connected() || !mwifi_get_root_status(), MDF_ERR_INVALID_STATE, "Root is not reachable");
+
+    data_type.custom = mesh_seq_next();
+    ret = mwifi_write(NULL, &data_type, data, size, true);
+    if (ret != MDF_OK)
+    {
+        mesh_metrics_inc(MESH_METRICS_MESH_TX_ERROR);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Deliver a metrics report, the root follows its own with the loss
+ *        statistics of every node
+ */
+static mdf_err_t metrics_report_cb(const char *data, size_t size)
+{
+    mdf_err_t ret = diag_write_cb(data, size);
+
+    if (esp_mesh_is_root() && mesh_mqtt_is_connect())
+    {
+        mesh_seq_report(root_seq_report_cb);
+    }
+
+    return ret;
 }
 
 /**
@@ -341,8 +787,7 @@ static mdf_err_t event_loop_cb(mdf_event_loop_t event, void *ctx)
         {
             esp_netif_dhcpc_start(sta_netif);
         }
-        xTaskCreate(node_read_task, "node_read_task", 4 * 1024,
-                    NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL);
+        mdf_event_loop_send(MDF_EVENT_CUSTOM_NODE_READ_START, (void *)0);
 
         break;
     case MDF_EVENT_MWIFI_PARENT_DISCONNECTED:
@@ -371,12 +816,56 @@ static mdf_err_t event_loop_cb(mdf_event_loop_t event, void *ctx)
         break;
     }
     case MDF_EVENT_MWIFI_ROOT_GOT_IP: // 根节点获取到IP,也就是根节点连接到了路由器,则连接mqtt
+    {
         MDF_LOGI("Root obtains the IP address. It is posted by LwIP stack automatically");
-        xTaskCreate(root_task, "root_read_task", 16 * 1024,
-                    NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL);
-        mesh_mqtt_start(MY_MQTT_URL);
+        mdf_event_loop_send(MDF_EVENT_CUSTOM_ROOT_START, (void *)0);
+        break;
+    }
+
+    case MDF_EVENT_CUSTOM_NODE_READ_START:
+    {
+        intptr_t retry_num = (intptr_t)ctx;
+
+        if (MESH_STATIC_TASK_TRY_CREATE(node_read, node_read_task, "node_read_task",
+                                        NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL) == pdPASS)
+        {
+            break;
+        }
+
+        if (retry_num < TASK_START_RETRY_NUM)
+        {
+            mdf_event_loop_delay_send(event, (void *)(retry_num + 1), pdMS_TO_TICKS(TASK_START_RETRY_MS));
+        }
+        else
+        {
+            MDF_LOGE("The previous node read task did not exit");
+        }
+        break;
+    }
 
+    case MDF_EVENT_CUSTOM_ROOT_START:
+    {
+        intptr_t retry_num = (intptr_t)ctx;
+
+        // 上一个根节点任务退出时会停止MQTT和时间同步,等它退出后再启动
+        if (MESH_STATIC_TASK_TRY_CREATE(root, root_task, "root_read_task",
+                                        NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL) == pdPASS)
+        {
+            node_config_t node_config = {0};
+            node_config_get(&node_config);
+            mesh_mqtt_start(node_config.mqtt_url);
+            mesh_time_root_start(CONFIG_MESH_TIME_SNTP_SERVER);
+        }
+        else if (retry_num < TASK_START_RETRY_NUM)
+        {
+            mdf_event_loop_delay_send(event, (void *)(retry_num + 1), pdMS_TO_TICKS(TASK_START_RETRY_MS));
+        }
+        else
+        {
+            MDF_LOGE("The previous root task did not exit");
+        }
         break;
+    }
 
     case MDF_EVENT_MUPGRADE_STARTED:
     {
@@ -394,12 +883,7 @@ static mdf_err_t event_loop_cb(mdf_event_loop_t event, void *ctx)
     case MDF_EVENT_CUSTOM_MQTT_CONNECTED:
     {
         MDF_LOGI("MQTT connect");
-        mdf_err_t err = mesh_mqtt_subscribe();
-        if (err != MDF_OK)
-        {
-            MDF_LOGE("Subscribe failed");
-        }
-        err = mesh_mqtt_update_topo();
+        mdf_err_t err = mesh_mqtt_update_topo();
         if (err != MDF_OK)
         {
             MDF_LOGE("Update topo failed");
@@ -447,24 +931,68 @@ static mdf_err_t wifi_init()
     return MDF_OK;
 }
 
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+/**
+ * @brief Leaf sensor node: one reading per wake-up over ESP-NOW, then deep sleep
+ */
+static void leaf_node_run(const node_config_t *node_config)
+{
+    static RTC_DATA_ATTR int16_t prev_temp = 0; // 上一次的读数,深度睡眠后保留
+    static RTC_DATA_ATTR uint16_t prev_humi = 0;
+    int16_t temp = 0;
+    uint16_t humi = 0;
+    uint16_t light = 0;
+    uint32_t sleep_ms = node_config->upload_interval_max_ms;
+
+    if (dht11_read_once(&temp, &humi, &light))
+    {
+        mesh_espnow_sample_t sample = {.temp = temp, .humi = humi, .light = light};
+        mdf_err_t ret = mesh_espnow_leaf_send(&mesh_espnow_transport_wifi, &sample);
+        if (ret != MDF_OK)
+        {
+            MDF_LOGW("<%s> mesh_espnow_leaf_send", mdf_err_to_name(ret));
+        }
+
+        // 与采样任务相同,变化超过阈值时按最小间隔上报
+        if (abs(temp - prev_temp) >= node_config->change_threshold || abs(humi - prev_humi) >= node_config->change_threshold)
+        {
+            sleep_ms = node_config->upload_interval_min_ms;
+        }
+        prev_temp = temp;
+        prev_humi = humi;
+    }
+    else
+    {
+        MDF_LOGW("DHT11 read error");
+    }
+
+    mesh_espnow_leaf_sleep(sleep_ms);
+}
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+
 void app_main()
 {
     mwifi_init_config_t cfg = MWIFI_INIT_CONFIG_DEFAULT();
     mwifi_config_t config = {
         .channel = 0,
-        .router_ssid = MY_ROUTER_SSID,
-        .router_password = MY_ROUTER_PASSWORD,
-        .mesh_id = MY_MESH_ID,
     };
+    node_config_t node_config = {0};
 
     /**
      * @brief Set the log level for serial port printing.
      */
-    esp_log_level_set("*", ESP_LOG_INFO);
+    mesh_dlog_level_set("*", ESP_LOG_INFO);
 
     esp_log_level_set("mupgrade_root", ESP_LOG_DEBUG);
 
-    esp_log_level_set(TAG, ESP_LOG_DEBUG);
+    mesh_dlog_level_set(TAG, ESP_LOG_DEBUG);
+
+    // 高频日志只记录格式串地址和参数,由低优先级任务输出,主机端解码
+#ifdef CONFIG_MESH_DLOG_SINK_MQTT
+    MDF_ERROR_ASSERT(mesh_dlog_start(diag_write_cb));
+#else
+    MDF_ERROR_ASSERT(mesh_dlog_start(NULL));
+#endif /**< CONFIG_MESH_DLOG_SINK_MQTT */
 
     MDF_LOGI("Starting OTA example ...");
 
@@ -473,14 +1001,73 @@ void app_main()
      */
     MDF_ERROR_ASSERT(mdf_event_loop_init(event_loop_cb));
     MDF_ERROR_ASSERT(wifi_init());
+
+    /**
+     * @brief Load the runtime configuration, NVS is initialized by wifi_init().
+     */
+    MDF_ERROR_ASSERT(node_config_init());
+    MDF_ERROR_ASSERT(node_config_get(&node_config));
+
+#ifdef CONFIG_MESH_ESPNOW_LEAF
+    // 叶子传感器节点不加入mesh,读数经ESP-NOW交给附近的mesh节点后深度睡眠
+    leaf_node_run(&node_config);
+#endif /**< CONFIG_MESH_ESPNOW_LEAF */
+
+    MDF_ERROR_ASSERT(root_standby_init());
+    MDF_ERROR_ASSERT(mesh_rollup_init());
+    MDF_ERROR_ASSERT(mesh_group_init());
+    MDF_ERROR_ASSERT(mesh_ack_init());
+    MDF_ERROR_ASSERT(mesh_fairq_init());
+    MDF_ERROR_ASSERT(mesh_shard_init((uint8_t *)node_config.mesh_id));
+
+    for (int i = 0; i < sizeof(g_node_commands) / sizeof(g_node_commands[0]); ++i)
+    {
+        MDF_ERROR_ASSERT(mesh_command_register(g_node_commands + i));
+    }
+
+    strncpy(config.router_ssid, node_config.router_ssid, sizeof(config.router_ssid));
+    strncpy(config.router_password, node_config.router_password, sizeof(config.router_password));
+    memcpy(config.mesh_id, node_config.mesh_id, sizeof(config.mesh_id));
+
+    // 同一田地有多个网络时,加入负载最低的网络;扫描失败时加入配置的网络
+    mdf_err_t ret = mesh_shard_select(config.mesh_id);
+
+    if (ret != MDF_OK)
+    {
+        MDF_LOGW("<%s> mesh_shard_select, join the configured mesh", mdf_err_to_name(ret));
+        memcpy(config.mesh_id, node_config.mesh_id, sizeof(config.mesh_id));
+    }
+
     MDF_ERROR_ASSERT(mwifi_init(&cfg));
     MDF_ERROR_ASSERT(mwifi_set_config(&config));
     MDF_ERROR_ASSERT(mwifi_start());
-
-    xTaskCreate(node_write_task, "node_write_task", 4 * 1024,
-                NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL);
+    MDF_ERROR_ASSERT(mesh_aggregate_start());
+
+    // 接收附近叶子节点经ESP-NOW发来的读数,按叶子节点地址上报
+    MDF_ERROR_ASSERT(mesh_espnow_relay_start(&mesh_espnow_transport_wifi, mesh_aggregate_inject));
+
+    MESH_STATIC_TASK_CREATE(node_write, node_write_task, "node_write_task",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL);
+
+    // 周期上报堆内存、任务CPU占用和错误计数
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("mqtt_q", mesh_mqtt_get_queue_depth));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("inflight", mesh_mqtt_get_inflight_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("conn_ms", mesh_mqtt_get_connect_ms));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("ready_ms", mesh_mqtt_get_ready_ms));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("nodes", root_standby_get_node_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("agg_in", mesh_aggregate_get_record_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("agg_out", mesh_aggregate_get_frame_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("groups", mesh_group_get_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("acks", mesh_ack_get_pending_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("up_q", mesh_fairq_get_queue_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("throttled", mesh_fairq_get_throttled_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("seq_nodes", mesh_seq_get_node_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("load", mesh_shard_get_load));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("espnow", mesh_espnow_get_relay_num));
+    MDF_ERROR_ASSERT(mesh_metrics_register_gauge("dlog_lost", mesh_dlog_get_lost_num));
+    MDF_ERROR_ASSERT(mesh_metrics_start(metrics_report_cb));
 
     // 新建读取dht11任务
-    xTaskCreate(dht11_task, "dht11_task", 4 * 1024,
-                NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY + 1, NULL);
+    MESH_STATIC_TASK_CREATE(dht11, dht11_task, "dht11_task",
+                            NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY + 1, NULL);
 }
\ No newline at end of file
@@ -0,0 +1,544 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+/**
+ * Host simulator of in-network aggregation, see components/mesh_aggregate.
+ *
+ *   mesh_aggregate_sim [-f FANOUT] [-d DEPTH] [-p REPORT_MS] [-w WINDOW_MS] [-b BYTES]
+ *                      [-r RATE_MBPS] [-t DURATION_S] [-s SEED] [-x]
+ *
+ * The component is built as is, in virtual time, and every node of a full
+ * tree of DEPTH layers with FANOUT children per node runs its own copy of the
+ * module state. Parents announce themselves to their children as they would
+ * on MESH_EVENT_CHILD_CONNECTED. Every node but the root sends a reading of
+ * BYTES every REPORT_MS, with a random phase, and relays flush their batch
+ * WINDOW_MS after its first record. -x sends every reading as a frame of
+ * its own to the root, as without CONFIG_MESH_AGGREGATE_ENABLE.
+ *
+ * Every hop of a frame costs SIM_FRAME_OVERHEAD_US plus its bytes and
+ * SIM_FRAME_HEADER_SIZE at RATE_MBPS of airtime, all links share one
+ * channel. Reported: frames and airtime per reading, channel and root load,
+ * and the latency from the reading to the root.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**< The firmware is built with the warning set of ESP-IDF, which leaves out these two */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#include "mesh_aggregate.c"
+#pragma GCC diagnostic pop
+
+#define SIM_NODE_MAX_NUM       (1024)
+#define SIM_FRAME_MAX_NUM      (4096)
+#define SIM_HOP_MS             (5)    /**< Latency of one hop */
+#define SIM_FRAME_OVERHEAD_US  (250)  /**< DIFS, mean backoff, preamble and the ACK of a unicast frame */
+#define SIM_FRAME_HEADER_SIZE  (60)   /**< 802.11 MAC header, ESP-MESH header and FCS */
+
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint8_t softap_addr[MWIFI_ADDR_LEN];
+    int parent;                  /**< Index of the parent, -1 for the root */
+    int layer;                   /**< 1 for the root */
+    uint32_t next_report;        /**< ms */
+    uint32_t flush_time;         /**< End of the window, 0 if no batch is open */
+    uint8_t children[MESH_AGGREGATE_CHILD_QUEUE_LEN][MWIFI_ADDR_LEN];
+    int child_num;               /**< Queued by the MESH_EVENT_CHILD_CONNECTED handler */
+    struct mesh_aggregate state; /**< g_mesh_aggregate of the node */
+} sim_node_t;
+
+typedef struct {
+    uint32_t time;               /**< Reception by dest */
+    int src;
+    int dest;
+    uint8_t protocol;
+    size_t size;
+    uint8_t data[MWIFI_PAYLOAD_LEN];
+} sim_frame_t;
+
+static struct sim {
+    uint32_t now;                /**< Virtual time, ms */
+    int current;                 /**< Node whose state is in g_mesh_aggregate */
+    int dummy;
+    double rate_mbps;
+    uint32_t window_ms;          /**< CONFIG_MESH_AGGREGATE_WINDOW_MS, the sim plays the task */
+    esp_event_handler_t child_handler;
+    uint64_t frames;             /**< Hops of every frame */
+    uint64_t bytes;
+    double airtime_us;
+    uint64_t root_frames;
+    double root_airtime_us;      /**< Last hop, into the root */
+    uint64_t readings;
+    uint64_t delivered;
+    uint64_t latency_sum;
+    uint32_t latency_max;
+    uint32_t seq;
+} g_sim;
+
+static sim_node_t g_nodes[SIM_NODE_MAX_NUM];
+static int g_node_num;
+static sim_frame_t g_frames[SIM_FRAME_MAX_NUM];
+static int g_frame_num;
+static uint32_t g_seed = 1;
+
+esp_event_base_t const MESH_EVENT = "MESH_EVENT";
+
+static uint32_t sim_random()
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+
+/**
+ * @brief Switch g_mesh_aggregate to the state of a node
+ */
+static void sim_enter(int node)
+{
+    g_sim.current = node;
+    g_mesh_aggregate = g_nodes[node].state;
+}
+
+static void sim_leave()
+{
+    g_nodes[g_sim.current].state = g_mesh_aggregate;
+}
+
+static int sim_find(const uint8_t *addr)
+{
+    for (int i = 0; i < g_node_num; ++i) {
+        if (!memcmp(g_nodes[i].addr, addr, MWIFI_ADDR_LEN)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**< Only what mesh_aggregate.c calls, its task is driven by the main loop */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return &g_sim.dummy;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait_ticks)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pdTRUE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    return g_nodes + g_sim.current;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait_ticks)
+{
+    sim_node_t *node = queue;
+
+    if (node->child_num == MESH_AGGREGATE_CHILD_QUEUE_LEN) {
+        return pdFALSE;
+    }
+
+    memcpy(node->children[node->child_num++], item, MWIFI_ADDR_LEN);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait_ticks)
+{
+    sim_node_t *node = queue;
+
+    if (node->child_num == 0) {
+        return pdFALSE;
+    }
+
+    memcpy(item, node->children[0], MWIFI_ADDR_LEN);
+    memmove(node->children[0], node->children[1], --node->child_num * MWIFI_ADDR_LEN);
+    return pdTRUE;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_size, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    *handle = g_nodes + g_sim.current;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    sim_node_t *node = task;
+    bool empty = g_mesh_aggregate.batch == NULL || ((mesh_aggregate_header_t *)g_mesh_aggregate.batch)->record_num == 0;
+
+    /**< A window is open until the task flushes, later records join the batch. A
+         child that connected is announced to by sim_build() */
+    if (!empty && node->flush_time == 0) {
+        node->flush_time = g_sim.now + g_sim.window_ms;
+    }
+
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    return 0;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id,
+                                     esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    g_sim.child_handler = event_handler;
+    return ESP_OK;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    const sim_node_t *node = g_nodes + g_sim.current;
+    memcpy(mac, type == ESP_MAC_WIFI_SOFTAP ? node->softap_addr : node->addr, MWIFI_ADDR_LEN);
+    return ESP_OK;
+}
+
+bool esp_mesh_is_root(void)
+{
+    return g_nodes[g_sim.current].parent < 0;
+}
+
+int esp_mesh_get_layer(void)
+{
+    return g_nodes[g_sim.current].layer;
+}
+
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t *bssid)
+{
+    const sim_node_t *node = g_nodes + g_sim.current;
+
+    if (node->parent < 0) {
+        return ESP_FAIL;
+    }
+
+    memcpy(bssid->addr, g_nodes[node->parent].softap_addr, MWIFI_ADDR_LEN);
+    return ESP_OK;
+}
+
+bool mwifi_is_connected(void)
+{
+    return true;
+}
+
+void mesh_metrics_inc(mesh_metrics_counter_t counter)
+{
+}
+
+uint32_t mesh_seq_next()
+{
+    return ++g_sim.seq;
+}
+
+const char *mdf_err_to_name(mdf_err_t err)
+{
+    return "";
+}
+
+/**
+ * @brief Every hop of a frame takes airtime, it reaches dest after the last one
+ */
+mdf_err_t mwifi_write(const uint8_t *dest_addrs, const mwifi_data_type_t *data_type,
+                      const void *data, size_t size, bool block)
+{
+    int src = g_sim.current;
+    int dest = dest_addrs ? sim_find(dest_addrs) : 0;
+    int hops = dest_addrs ? 1 : g_nodes[src].layer - 1;
+    double airtime_us = SIM_FRAME_OVERHEAD_US + (size + SIM_FRAME_HEADER_SIZE) * 8 / g_sim.rate_mbps;
+
+    if (dest < 0 || hops <= 0 || g_frame_num == SIM_FRAME_MAX_NUM) {
+        return MDF_FAIL;
+    }
+
+    g_sim.frames += hops;
+    g_sim.bytes += hops * (size + SIM_FRAME_HEADER_SIZE);
+    g_sim.airtime_us += hops * airtime_us;
+
+    if (dest == 0) {
+        g_sim.root_frames++;
+        g_sim.root_airtime_us += airtime_us;
+    }
+
+    sim_frame_t *frame = g_frames + g_frame_num++;
+    frame->time = g_sim.now + hops * SIM_HOP_MS;
+    frame->src = src;
+    frame->dest = dest;
+    frame->protocol = data_type->protocol;
+    frame->size = size;
+    memcpy(frame->data, data, size);
+
+    return MDF_OK;
+}
+#pragma GCC diagnostic pop
+
+static void sim_deliver_reading(const char *data, size_t size)
+{
+    char reading[64] = {0};
+    uint32_t time = 0;
+
+    memcpy(reading, data, size < sizeof(reading) ? size : sizeof(reading) - 1);
+
+    if (sscanf(reading, "{\"ts\":%u", &time) == 1) {
+        uint32_t latency = g_sim.now - time;
+        g_sim.delivered++;
+        g_sim.latency_sum += latency;
+        g_sim.latency_max = latency > g_sim.latency_max ? latency : g_sim.latency_max;
+    }
+}
+
+static void sim_root_record_cb(const uint8_t *addr, uint32_t seq, const char *data, size_t size, void *arg)
+{
+    (void)addr, (void)seq, (void)arg;
+    sim_deliver_reading(data, size);
+}
+
+static void sim_deliver(const sim_frame_t *frame)
+{
+    sim_enter(frame->dest);
+
+    if (frame->dest == 0) {
+        if (frame->protocol == MESH_PROTO_AGGREGATE) {
+            mesh_aggregate_foreach(frame->data, frame->size, sim_root_record_cb, NULL);
+        } else {
+            sim_deliver_reading((const char *)frame->data, frame->size);
+        }
+    } else if (frame->protocol == MESH_PROTO_AGGREGATE) {
+        mesh_aggregate_handle(frame->data, frame->size);
+    } else if (frame->protocol == MESH_PROTO_PARENT) {
+        mesh_aggregate_handle_parent(g_nodes[frame->src].addr, frame->data, frame->size);
+    }
+
+    sim_leave();
+}
+
+static void sim_receive()
+{
+    static sim_frame_t frame;
+
+    for (int i = 0; i < g_frame_num;) {
+        if (g_frames[i].time > g_sim.now) {
+            ++i;
+            continue;
+        }
+
+        /**< Delivery may queue new frames */
+        frame = g_frames[i];
+        g_frames[i] = g_frames[--g_frame_num];
+        sim_deliver(&frame);
+    }
+}
+
+static void sim_report(int index, uint32_t period_ms, size_t size)
+{
+    char reading[MWIFI_PAYLOAD_LEN];
+    int len = snprintf(reading, sizeof(reading), "{\"ts\":%u,\"v\":\"", g_sim.now);
+
+    memset(reading + len, 'x', size - len - 2);
+    memcpy(reading + size - 2, "\"}", 2);
+
+    sim_enter(index);
+    mesh_aggregate_write(reading, size);
+    sim_leave();
+
+    g_sim.readings++;
+    g_nodes[index].next_report += period_ms;
+}
+
+/**
+ * @brief Full tree in breadth-first order, node 0 is the root
+ */
+static int sim_build(int fanout, int depth, uint32_t report_ms, bool aggregate)
+{
+    int layer_start = 0;
+    int layer_num = 1;
+
+    g_node_num = 0;
+
+    for (int layer = 1; layer <= depth; ++layer) {
+        for (int i = 0; i < layer_num; ++i) {
+            sim_node_t *node = g_nodes + g_node_num;
+
+            if (g_node_num == SIM_NODE_MAX_NUM) {
+                return -1;
+            }
+
+            memset(node, 0, sizeof(*node));
+            node->addr[0] = 0x30;
+            node->addr[4] = g_node_num >> 8;
+            node->addr[5] = g_node_num;
+            memcpy(node->softap_addr, node->addr, MWIFI_ADDR_LEN);
+            node->softap_addr[0] |= 0x02;    /**< Locally administered, not the station MAC plus one */
+            node->layer = layer;
+            node->parent = layer == 1 ? -1 : layer_start - (layer_num / fanout) + i / fanout;
+            node->next_report = sim_random() % report_ms;
+            g_node_num++;
+
+            memset(&g_mesh_aggregate, 0, sizeof(g_mesh_aggregate));
+            g_sim.current = g_node_num - 1;
+            MDF_ERROR_ASSERT(mesh_aggregate_start());
+
+            if (!aggregate) {
+                MDF_FREE(g_mesh_aggregate.batch);
+                MDF_FREE(g_mesh_aggregate.spare);
+            }
+
+            sim_leave();
+        }
+
+        layer_start += layer_num;
+        layer_num *= fanout;
+    }
+
+    /**< Children connect, their parents announce themselves */
+    for (int i = 1; i < g_node_num; ++i) {
+        mesh_event_child_connected_t child = {0};
+        memcpy(child.mac, g_nodes[i].addr, MWIFI_ADDR_LEN);
+
+        sim_enter(g_nodes[i].parent);
+        g_sim.child_handler(NULL, MESH_EVENT, MESH_EVENT_CHILD_CONNECTED, &child);
+        mesh_aggregate_announce();
+        sim_leave();
+    }
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-f FANOUT] [-d DEPTH] [-p REPORT_MS] [-w WINDOW_MS] [-b BYTES] "
+            "[-r RATE_MBPS] [-t DURATION_S] [-s SEED] [-x]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    int fanout = 3;
+    int depth = 4;
+    uint32_t report_ms = 10 * 1000;
+    size_t size = 96;
+    uint32_t duration_s = 600;
+    bool aggregate = true;
+    int opt = 0;
+
+    g_sim.rate_mbps = 13;
+    g_sim.window_ms = CONFIG_MESH_AGGREGATE_WINDOW_MS;
+
+    while ((opt = getopt(argc, argv, "f:d:p:w:b:r:t:s:x")) != -1) {
+        switch (opt) {
+            case 'f':
+                fanout = atoi(optarg);
+                break;
+
+            case 'd':
+                depth = atoi(optarg);
+                break;
+
+            case 'p':
+                report_ms = atoi(optarg);
+                break;
+
+            case 'w':
+                g_sim.window_ms = atoi(optarg);
+                break;
+
+            case 'b':
+                size = atoi(optarg);
+                break;
+
+            case 'r':
+                g_sim.rate_mbps = atof(optarg);
+                break;
+
+            case 't':
+                duration_s = atoi(optarg);
+                break;
+
+            case 's':
+                g_seed = (uint32_t)strtoul(optarg, NULL, 0) * 2 + 1;
+                break;
+
+            case 'x':
+                aggregate = false;
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (fanout <= 0 || depth < 2 || report_ms == 0 || g_sim.window_ms == 0 || size < 32 || size > 512
+            || g_sim.rate_mbps <= 0 || duration_s == 0 || sim_build(fanout, depth, report_ms, aggregate) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (g_sim.now = 0; g_sim.now < duration_s * 1000; ++g_sim.now) {
+        for (int i = 1; i < g_node_num; ++i) {
+            if (g_sim.now >= g_nodes[i].next_report) {
+                sim_report(i, report_ms, size);
+            }
+
+            if (g_nodes[i].flush_time && g_sim.now >= g_nodes[i].flush_time) {
+                g_nodes[i].flush_time = 0;
+                sim_enter(i);
+                mesh_aggregate_flush();
+                sim_leave();
+            }
+        }
+
+        sim_receive();
+    }
+
+    double readings = g_sim.readings ? g_sim.readings : 1;
+    double delivered = g_sim.delivered ? g_sim.delivered : 1;
+
+    printf("%s, %d nodes, fanout %d, depth %d, report %u ms, window %u ms, %zu bytes, %.1f Mbps, %u s\n",
+           aggregate ? "aggregate" : "per reading", g_node_num, fanout, depth, report_ms,
+           g_sim.window_ms, size, g_sim.rate_mbps, duration_s);
+    printf("readings        sent %llu  delivered %llu  in flight at the end %llu\n",
+           (unsigned long long)g_sim.readings, (unsigned long long)g_sim.delivered,
+           (unsigned long long)(g_sim.readings - g_sim.delivered));
+    printf("per reading     frames %6.2f  bytes %7.1f  airtime us %7.1f\n",
+           g_sim.frames / readings, g_sim.bytes / readings, g_sim.airtime_us / readings);
+    printf("channel busy    %6.2f %%  root rx %6.2f frames/s  %6.2f %%\n",
+           g_sim.airtime_us / (duration_s * 10000.0), g_sim.root_frames / (double)duration_s,
+           g_sim.root_airtime_us / (duration_s * 10000.0));
+    printf("latency ms      mean %6.1f  max %6u\n", g_sim.latency_sum / delivered, g_sim.latency_max);
+
+    return 0;
+}
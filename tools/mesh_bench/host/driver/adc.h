@@ -0,0 +1,26 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __HOST_DRIVER_ADC_H__
+#define __HOST_DRIVER_ADC_H__
+
+#define ADC_WIDTH_BIT_13 4
+#define ADC2_CHANNEL_3   3
+#define ADC_ATTEN_DB_11  3
+
+int adc1_config_width(int width);
+int adc1_config_channel_atten(int channel, int atten);
+int adc1_get_raw(int channel);
+
+#endif /**< __HOST_DRIVER_ADC_H__ */
@@ -0,0 +1,45 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __HOST_ESP_MESH_H__
+#define __HOST_ESP_MESH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+ESP_EVENT_DECLARE_BASE(MESH_EVENT);
+
+typedef enum {
+    MESH_EVENT_CHILD_CONNECTED = 3,
+} mesh_event_id_t;
+
+typedef union {
+    uint8_t addr[6];
+} mesh_addr_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t aid;
+} mesh_event_child_connected_t;
+
+bool esp_mesh_is_root(void);
+int esp_mesh_get_layer(void);
+int esp_mesh_get_routing_table_size(void);
+esp_err_t esp_mesh_get_routing_table(mesh_addr_t *mac, int len, int *size);
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t *bssid);
+esp_err_t esp_mesh_get_id(mesh_addr_t *id);
+
+#endif /**< __HOST_ESP_MESH_H__ */
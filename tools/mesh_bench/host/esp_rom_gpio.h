@@ -0,0 +1,23 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __HOST_ESP_ROM_GPIO_H__
+#define __HOST_ESP_ROM_GPIO_H__
+
+#include <stdint.h>
+
+void esp_rom_gpio_pad_select_gpio(uint32_t gpio_num);
+void esp_rom_delay_us(uint32_t us);
+
+#endif /**< __HOST_ESP_ROM_GPIO_H__ */
@@ -0,0 +1,81 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __HOST_MDF_COMMON_H__
+#define __HOST_MDF_COMMON_H__
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_mesh.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+typedef int32_t mdf_err_t;
+
+#define MDF_OK                   ESP_OK
+#define MDF_FAIL                 ESP_FAIL
+#define MDF_ERR_NO_MEM           ESP_ERR_NO_MEM
+#define MDF_ERR_INVALID_ARG      ESP_ERR_INVALID_ARG
+#define MDF_ERR_INVALID_STATE    ESP_ERR_INVALID_STATE
+#define MDF_ERR_INVALID_SIZE     ESP_ERR_INVALID_SIZE
+#define MDF_ERR_NOT_FOUND        ESP_ERR_NOT_FOUND
+#define MDF_ERR_NOT_SUPPORTED    ESP_ERR_NOT_SUPPORTED
+#define MDF_ERR_TIMEOUT          ESP_ERR_TIMEOUT
+#define MDF_ERR_NOT_INIT         ESP_ERR_INVALID_STATE
+
+/**< Logging is compiled out, it would dominate the timings. TAG stays referenced */
+#define MDF_LOGE(...) do { (void)TAG; } while (0)
+#define MDF_LOGW(...) do { (void)TAG; } while (0)
+#define MDF_LOGI(...) do { (void)TAG; } while (0)
+#define MDF_LOGD(...) do { (void)TAG; } while (0)
+#define MDF_LOGV(...) do { (void)TAG; } while (0)
+
+#define MDF_MALLOC  malloc
+#define MDF_CALLOC  calloc
+#define MDF_REALLOC realloc
+#define MDF_FREE(ptr) do { free(ptr); (ptr) = NULL; } while (0)
+
+#define MDF_ERROR_CHECK(con, err, ...)   do { if (con) { return err; } } while (0)
+#define MDF_ERROR_GOTO(con, label, ...)  do { if (con) { goto label; } } while (0)
+#define MDF_ERROR_CONTINUE(con, ...)     { if (con) { continue; } }
+#define MDF_ERROR_BREAK(con, ...)        { if (con) { break; } }
+#define MDF_ERROR_ASSERT(err)            do { if ((err) != MDF_OK) { abort(); } } while (0)
+#define MDF_PARAM_CHECK(con)             do { if (!(con)) { return MDF_ERR_INVALID_ARG; } } while (0)
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+typedef uint32_t mdf_event_loop_t;
+
+#define MDF_EVENT_MWIFI_BASE 0x0
+#define MDF_EVENT_CUSTOM_BASE 0x1000
+
+const char *mdf_err_to_name(mdf_err_t err);
+mdf_err_t mdf_event_loop_send(mdf_event_loop_t event, void *ctx);
+
+#endif /**< __HOST_MDF_COMMON_H__ */
@@ -0,0 +1,23 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __HOST_MLINK_H__
+#define __HOST_MLINK_H__
+
+#include <stdint.h>
+
+uint8_t *mlink_mac_str2hex(const char *mac_str, uint8_t *mac_hex);
+char *mlink_mac_hex2str(const uint8_t *mac_hex, char *mac_str);
+
+#endif /**< __HOST_MLINK_H__ */
@@ -0,0 +1,48 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __HOST_MWIFI_H__
+#define __HOST_MWIFI_H__
+
+#include "mdf_common.h"
+
+#define MWIFI_ADDR_LEN       6
+#define MWIFI_PAYLOAD_LEN    1456
+#define MWIFI_ADDR_ANY       {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
+#define MWIFI_ADDR_ROOT      {0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
+
+enum {
+    MWIFI_COMMUNICATE_UNICAST,
+    MWIFI_COMMUNICATE_MULTICAST,
+    MWIFI_COMMUNICATE_BROADCAST,
+};
+
+typedef struct {
+    bool compression : 1;
+    bool upgrade     : 1;
+    uint8_t communicate : 2;
+    bool group       : 1;
+    uint8_t reserved : 3;
+    uint8_t protocol;
+    uint32_t custom;
+} __attribute__((packed)) mwifi_data_type_t;
+
+bool mwifi_is_connected(void);
+bool mwifi_get_root_status(void);
+mdf_err_t mwifi_write(const uint8_t *dest_addrs, const mwifi_data_type_t *data_type,
+                      const void *data, size_t size, bool block);
+mdf_err_t mwifi_root_write(const uint8_t *addrs_list, size_t addrs_num, const mwifi_data_type_t *data_type,
+                           const void *data, size_t size, bool block);
+
+#endif /**< __HOST_MWIFI_H__ */
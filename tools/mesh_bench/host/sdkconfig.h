@@ -0,0 +1,53 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __HOST_SDKCONFIG_H__
+#define __HOST_SDKCONFIG_H__
+
+/**
+ * @brief Configuration of the host build, the Kconfig defaults of the
+ *        components under benchmark. Options are added with BENCH_CONFIG, e.g.
+ *        make clean bench BENCH_CONFIG=-DCONFIG_MESH_MQTT_COMPRESS
+ */
+
+#define CONFIG_MESH_MQTT_TOPIC_SHARED 1
+#define CONFIG_MESH_MQTT_TLS_NONE 1
+#define CONFIG_MESH_AGGREGATE_WINDOW_MS 200
+#define CONFIG_MESH_GROUP_MAX_NUM 16
+#define CONFIG_MESH_GROUP_NODE_MAX_NUM 64
+#define CONFIG_MESH_SEQ_NODE_MAX_NUM 256
+#define CONFIG_MESH_METRICS_GAUGE_MAX_NUM 24
+#define CONFIG_MESH_TIME_BEACON_INTERVAL 30
+#define CONFIG_MESH_TIME_MAX_DRIFT_PPM 500
+#define CONFIG_MESH_COMMAND_MAX_NUM 16
+#define CONFIG_SENSOR_FILTER_WEIGHT 100
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_MDF_TASK_DEFAULT_PRIOTY 6
+#define CONFIG_MESH_DLOG_ENABLE 1
+#define CONFIG_MESH_DLOG_BUFFER_SIZE 4096
+#define CONFIG_MESH_DLOG_STRING_MAX_LEN 64
+#define CONFIG_MESH_DLOG_SINK_CONSOLE 1
+#define CONFIG_MESH_DLOG_FLUSH_MS 2000
+#define CONFIG_MESH_DLOG_MODULE_MAX_NUM 16
+
+/**< Both ends of the ESP-NOW fast path run against the loopback transport */
+#define CONFIG_MESH_ESPNOW_RELAY 1
+#define CONFIG_MESH_ESPNOW_LEAF 1
+#define CONFIG_MESH_ESPNOW_CHANNEL 0
+#define CONFIG_MESH_ESPNOW_OFFER_WINDOW_MS 30
+#define CONFIG_MESH_ESPNOW_ACTIVE_MA 70
+#define CONFIG_MESH_ESPNOW_SLEEP_UA 20
+#define CONFIG_MESH_ESPNOW_SUPPLY_MV 3300
+
+#endif /**< __HOST_SDKCONFIG_H__ */
@@ -0,0 +1,524 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Host implementations of the ESP-IDF and ESP-MDF functions used by
+ *        the code under benchmark. They do as little as possible so the
+ *        timings are those of the firmware code, not of the shims.
+ */
+
+#include <time.h>
+
+#include "mdf_common.h"
+#include "mwifi.h"
+#include "mlink.h"
+#include "mqtt_client.h"
+#include "driver/gpio.h"
+#include "driver/adc.h"
+#include "esp_rom_gpio.h"
+#include "esp_task_wdt.h"
+#include "freertos/timers.h"
+#include "nvs.h"
+#include "mesh_metrics.h"
+#include "mesh_time.h"
+#include "node_config.h"
+#include "mesh_aggregate.h"
+#include "esp_sleep.h"
+#include "esp_sntp.h"
+#include "mesh_bench.h"
+
+/**< Most stubs ignore their arguments */
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+#define HOST_SHIM_ROUTE_MAX_NUM    1024
+#define HOST_SHIM_DHT11_EDGE_NUM   (2 + 40 * 2 + 1)
+
+static struct host_shim {
+    int route_num;
+    size_t publish_bytes;
+    int msg_id;
+    int dummy;                                        /**< Target of the opaque handles */
+    int64_t timer_us;                                 /**< Fixed esp_timer time, 0 for the monotonic clock */
+    bool gpio_input;
+    uint32_t gpio_level;
+    uint32_t dht11_now_us;                            /**< Virtual time since the host released the line */
+    int dht11_edge;
+    uint32_t dht11_edges[HOST_SHIM_DHT11_EDGE_NUM];   /**< End of each level, the line starts low */
+} g_host_shim;
+
+void host_shim_set_route_num(int route_num)
+{
+    g_host_shim.route_num = route_num < HOST_SHIM_ROUTE_MAX_NUM ? route_num : HOST_SHIM_ROUTE_MAX_NUM;
+}
+
+/**
+ * @brief Response of the sensor: 80 us low, 80 us high, then every bit is
+ *        50 us low followed by 26 us (0) or 70 us (1) high, then 50 us low.
+ */
+void host_shim_set_dht11_frame(const uint8_t frame[5])
+{
+    uint32_t now = 0;
+    int edge = 0;
+
+    g_host_shim.dht11_edges[edge++] = now += 80;
+    g_host_shim.dht11_edges[edge++] = now += 80;
+
+    for (int i = 0; i < 40; ++i) {
+        g_host_shim.dht11_edges[edge++] = now += 50;
+        g_host_shim.dht11_edges[edge++] = now += (frame[i / 8] & (0x80 >> (i % 8))) ? 70 : 26;
+    }
+
+    g_host_shim.dht11_edges[edge++] = now += 50;
+}
+
+size_t host_shim_get_publish_bytes()
+{
+    return g_host_shim.publish_bytes;
+}
+
+const char *mdf_err_to_name(mdf_err_t err)
+{
+    return err == MDF_OK ? "MDF_OK" : "MDF_FAIL";
+}
+
+mdf_err_t mdf_event_loop_send(mdf_event_loop_t event, void *ctx)
+{
+    return MDF_OK;
+}
+
+void host_shim_set_timer(int64_t timer_us)
+{
+    g_host_shim.timer_us = timer_us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+
+    if (g_host_shim.timer_us) {
+        return g_host_shim.timer_us;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    const uint8_t addr[6] = {0x30, 0xae, 0xa4, 0x00, 0x00, 0x01};
+    memcpy(mac, addr, sizeof(addr));
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t *mac)
+{
+    return esp_read_mac(mac, ESP_MAC_WIFI_STA);
+}
+
+int esp_mesh_get_layer(void)
+{
+    return 2;
+}
+
+int esp_mesh_get_routing_table_size(void)
+{
+    return g_host_shim.route_num;
+}
+
+esp_err_t esp_mesh_get_routing_table(mesh_addr_t *mac, int len, int *size)
+{
+    int num = g_host_shim.route_num < len / (int)sizeof(mesh_addr_t) ? g_host_shim.route_num : len / (int)sizeof(mesh_addr_t);
+
+    for (int i = 0; i < num; ++i) {
+        const uint8_t addr[6] = {0x30, 0xae, 0xa4, 0x00, i >> 8, i & 0xff};
+        memcpy(mac[i].addr, addr, sizeof(addr));
+    }
+
+    *size = num;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t *bssid)
+{
+    const uint8_t addr[6] = {0x30, 0xae, 0xa4, 0x00, 0x00, 0x02};
+    memcpy(bssid->addr, addr, sizeof(addr));
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_id(mesh_addr_t *id)
+{
+    const uint8_t addr[6] = {0x12, 0x34, 0x56, 0x78, 0x90, 0xab};
+    memcpy(id->addr, addr, sizeof(addr));
+    return ESP_OK;
+}
+
+uint32_t esp_random(void)
+{
+    return random();
+}
+
+void esp_deep_sleep(uint64_t time_in_us)
+{
+    exit(0);
+}
+
+bool mwifi_is_connected(void)
+{
+    return true;
+}
+
+mdf_err_t mwifi_root_write(const uint8_t *addrs_list, size_t addrs_num, const mwifi_data_type_t *data_type,
+                           const void *data, size_t size, bool block)
+{
+    return MDF_OK;
+}
+
+bool mwifi_get_root_status(void)
+{
+    return true;
+}
+
+mdf_err_t mwifi_write(const uint8_t *dest_addrs, const mwifi_data_type_t *data_type,
+                      const void *data, size_t size, bool block)
+{
+    return MDF_OK;
+}
+
+uint8_t *mlink_mac_str2hex(const char *mac_str, uint8_t *mac_hex)
+{
+    unsigned int mac_data[6] = {0};
+
+    sscanf(mac_str, "%02x%02x%02x%02x%02x%02x", mac_data, mac_data + 1, mac_data + 2,
+           mac_data + 3, mac_data + 4, mac_data + 5);
+
+    for (int i = 0; i < 6; i++) {
+        mac_hex[i] = mac_data[i];
+    }
+
+    return mac_hex;
+}
+
+char *mlink_mac_hex2str(const uint8_t *mac_hex, char *mac_str)
+{
+    sprintf(mac_str, "%02x%02x%02x%02x%02x%02x", MAC2STR(mac_hex));
+    return mac_str;
+}
+
+/**< The client only counts what would have gone out */
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    return (esp_mqtt_client_handle_t)&g_host_shim.dummy;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return ++g_host_shim.msg_id;
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+    return ++g_host_shim.msg_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                            int len, int qos, int retain)
+{
+    g_host_shim.publish_bytes += strlen(topic) + len;
+    return ++g_host_shim.msg_id;
+}
+
+/**< A single task runs, the kernel objects only need to be distinct from NULL */
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    return &g_host_shim.dummy;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait_ticks)
+{
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait_ticks)
+{
+    return pdFALSE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return 0;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return &g_host_shim.dummy;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    return &g_host_shim.dummy;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait_ticks)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *id,
+                           TimerCallbackFunction_t cb)
+{
+    return &g_host_shim.dummy;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait_ticks)
+{
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait_ticks)
+{
+    return pdPASS;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t wait_ticks)
+{
+    return pdPASS;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_size, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+void vTaskSuspendAll(void)
+{
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+    return pdFALSE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return NULL;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+}
+
+void sntp_setoperatingmode(uint8_t operating_mode)
+{
+}
+
+void sntp_setservername(uint8_t idx, const char *server)
+{
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback)
+{
+}
+
+void sntp_init(void)
+{
+}
+
+void sntp_stop(void)
+{
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+esp_err_t esp_task_wdt_delete(TaskHandle_t handle)
+{
+    return ESP_OK;
+}
+
+/**
+ * @brief The DHT11 line. Releasing it (switching to input) starts the sensor
+ *        response, every poll costs 1 us of virtual time, as does each
+ *        microsecond of esp_rom_delay_us().
+ */
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    g_host_shim.gpio_input = mode == GPIO_MODE_INPUT;
+
+    if (g_host_shim.gpio_input) {
+        g_host_shim.dht11_now_us = 0;
+        g_host_shim.dht11_edge = 0;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    g_host_shim.gpio_level = level;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (!g_host_shim.gpio_input) {
+        return g_host_shim.gpio_level;
+    }
+
+    uint32_t now = g_host_shim.dht11_now_us++;
+
+    while (g_host_shim.dht11_edge < HOST_SHIM_DHT11_EDGE_NUM && now >= g_host_shim.dht11_edges[g_host_shim.dht11_edge]) {
+        g_host_shim.dht11_edge++;
+    }
+
+    /**< Pulled up once the sensor is done */
+    return g_host_shim.dht11_edge < HOST_SHIM_DHT11_EDGE_NUM ? g_host_shim.dht11_edge & 1 : 1;
+}
+
+void esp_rom_gpio_pad_select_gpio(uint32_t gpio_num)
+{
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    g_host_shim.dht11_now_us += us;
+}
+
+int adc1_config_width(int width)
+{
+    return ESP_OK;
+}
+
+int adc1_config_channel_atten(int channel, int atten)
+{
+    return ESP_OK;
+}
+
+int adc1_get_raw(int channel)
+{
+    return 2048;
+}
+
+/**< Components outside of the benchmark */
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    *out_handle = 1;
+    return open_mode == NVS_READONLY ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+void mesh_metrics_inc(mesh_metrics_counter_t counter)
+{
+}
+
+/**< Replaced by the clock model of mesh_time.c where it is linked in */
+__attribute__((weak)) int64_t mesh_time_now_ms()
+{
+    return esp_timer_get_time() / 1000;
+}
+
+mdf_err_t node_config_get(node_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->temp_gain  = NODE_CONFIG_GAIN_ONE;
+    config->humi_gain  = NODE_CONFIG_GAIN_ONE;
+    config->light_gain = NODE_CONFIG_GAIN_ONE;
+    return MDF_OK;
+}
+
+mdf_err_t mesh_aggregate_write(const char *data, size_t size)
+{
+    return MDF_OK;
+}
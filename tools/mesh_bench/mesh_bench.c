@@ -0,0 +1,563 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Benchmarks of the firmware hot paths, built for the host
+ *
+ *   mesh_bench [-t MIN_TIME_MS] [-f FILTER] [-b BASELINE] [-r THRESHOLD_PCT]
+ *
+ *        Prints one JSON object per benchmark. Saved output passed back
+ *        with -b is compared by ns_per_op, a slowdown above the threshold
+ *        (default 10 %) is flagged and the exit status is 2.
+ */
+
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mesh_bench.h"
+#include "mesh_proto.h"
+#include "mesh_group.h"
+#include "mesh_dlog.h"
+#include "mbedtls/base64.h"
+
+#define MESH_BENCH_BASELINE_MAX_NUM 64
+
+typedef struct {
+    const char *name;
+    bool (*setup)(void);          /**< Prepare the input and check that the operation works, optional */
+    void (*run)(void);            /**< One operation */
+} mesh_bench_t;
+
+typedef struct {
+    char name[32];
+    double ns_per_op;
+} mesh_bench_baseline_t;
+
+/**
+ * @brief Allocation statistics of the measured loop, kept by the malloc
+ *        wrappers below. Heap usage is malloc_usable_size(), not the
+ *        requested size.
+ */
+static struct mesh_bench_alloc {
+    bool enabled;
+    uint64_t alloc_num;
+    uint64_t alloc_bytes;
+    int64_t live_bytes;
+    int64_t peak_bytes;
+} g_alloc;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static void mesh_bench_alloc_add(void *ptr)
+{
+    if (g_alloc.enabled && ptr) {
+        size_t size = malloc_usable_size(ptr);
+        g_alloc.alloc_num++;
+        g_alloc.alloc_bytes += size;
+        g_alloc.live_bytes += size;
+
+        if (g_alloc.live_bytes > g_alloc.peak_bytes) {
+            g_alloc.peak_bytes = g_alloc.live_bytes;
+        }
+    }
+}
+
+static void mesh_bench_alloc_remove(void *ptr)
+{
+    if (g_alloc.enabled && ptr) {
+        g_alloc.live_bytes -= malloc_usable_size(ptr);
+    }
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    mesh_bench_alloc_add(ptr);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __libc_calloc(nmemb, size);
+    mesh_bench_alloc_add(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    mesh_bench_alloc_remove(ptr);
+    ptr = __libc_realloc(ptr, size);
+    mesh_bench_alloc_add(ptr);
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    mesh_bench_alloc_remove(ptr);
+    __libc_free(ptr);
+}
+
+/**< Inputs, shaped like the traffic of a running mesh */
+static const char g_subscribe_topic[] = "mesh/30aea4000001/toDevice";
+static const char g_command_json[] = "{\"addr\":[\"30aea4000002\",\"30aea4000003\",\"30aea4000004\"],"
+                                     "\"type\":\"json\",\"data\":{\"relay\":1,\"interval\":5000}}";
+static const char g_command_string[] = "{\"addr\":[\"30aea4000002\"],\"type\":\"string\",\"data\":\"relay on\"}";
+static const char g_reading[] = "{\"version\":\"1.0.0\",\"Temp\":\"24.30\",\"Humi\":\"55.00\","
+                                "\"sensor_light\":\"2048\",\"ts\":1700000000000}";
+static const uint8_t g_dht11_frame[5] = {55, 0, 24, 3, 55 + 0 + 24 + 3};
+static uint8_t g_node_addr[MWIFI_ADDR_LEN] = {0x30, 0xae, 0xa4, 0x00, 0x00, 0x02};
+
+static char g_command_bytes[MWIFI_PAYLOAD_LEN * 2 + 64];
+static uint8_t g_binary[MWIFI_PAYLOAD_LEN];
+static char g_base64[MWIFI_PAYLOAD_LEN * 2];
+static size_t g_base64_len;
+
+static void mesh_bench_parse(const char *payload)
+{
+    mesh_mqtt_data_t *request = mesh_bench_mqtt_parse_data(g_subscribe_topic, payload, strlen(payload));
+    mesh_bench_mqtt_data_free(request);
+}
+
+static bool mesh_bench_parse_check(const char *payload, size_t size)
+{
+    mesh_mqtt_data_t *request = mesh_bench_mqtt_parse_data(g_subscribe_topic, payload, strlen(payload));
+    bool ok = request && request->data && request->size == size;
+    mesh_bench_mqtt_data_free(request);
+    return ok;
+}
+
+static bool mesh_bench_binary_setup(void)
+{
+    for (size_t i = 0; i < sizeof(g_binary); ++i) {
+        g_binary[i] = i * 31 + 7;
+    }
+
+    return mbedtls_base64_encode((uint8_t *)g_base64, sizeof(g_base64), &g_base64_len, g_binary, 256) == 0;
+}
+
+static bool mqtt_parse_json_setup(void)
+{
+    return mesh_bench_parse_check(g_command_json, strlen("{\"relay\":1,\"interval\":5000}"));
+}
+
+static void mqtt_parse_json_run(void)
+{
+    mesh_bench_parse(g_command_json);
+}
+
+static bool mqtt_parse_string_setup(void)
+{
+    return mesh_bench_parse_check(g_command_string, strlen("relay on"));
+}
+
+static void mqtt_parse_string_run(void)
+{
+    mesh_bench_parse(g_command_string);
+}
+
+static bool mqtt_parse_bytes_setup(void)
+{
+    if (!mesh_bench_binary_setup()) {
+        return false;
+    }
+
+    snprintf(g_command_bytes, sizeof(g_command_bytes), "{\"addr\":[\"30aea4000002\"],\"type\":\"bytes\",\"data\":\"%s\"}", g_base64);
+    return mesh_bench_parse_check(g_command_bytes, 256);
+}
+
+static void mqtt_parse_bytes_run(void)
+{
+    mesh_bench_parse(g_command_bytes);
+}
+
+/**< A command to a group of 32 nodes, expanded on every parse */
+static const char g_command_group[] = "{\"group\":1,\"type\":\"json\",\"data\":{\"relay\":1}}";
+
+static bool mqtt_parse_group_setup(void)
+{
+    char update[64 + 32 * 16] = "{\"groups\":[{\"id\":1,\"set\":[";
+    size_t len = strlen(update);
+
+    for (int i = 0; i < 32; ++i) {
+        len += snprintf(update + len, sizeof(update) - len, "%s\"30aea4%06x\"", i ? "," : "", 0x100 + i);
+    }
+
+    len += snprintf(update + len, sizeof(update) - len, "]}]}");
+
+    if (mesh_group_get_num() == 0 && (mesh_group_init() != MDF_OK || mesh_group_update(update, len) != MDF_OK)) {
+        return false;
+    }
+
+    mesh_mqtt_data_t *request = mesh_bench_mqtt_parse_data(g_subscribe_topic, g_command_group, strlen(g_command_group));
+    bool ok = request && request->addrs_num == 32;
+    mesh_bench_mqtt_data_free(request);
+    return ok;
+}
+
+static void mqtt_parse_group_run(void)
+{
+    mesh_bench_parse(g_command_group);
+}
+
+#ifdef CONFIG_MESH_MQTT_BINARY
+static const char g_binary_topic[] = "mesh/30aea4000001/toDevice" MESH_MQTT_BINARY_SUFFIX;
+static uint8_t g_command_binary[sizeof(mesh_mqtt_bin_header_t) + 256];
+
+static bool mqtt_parse_binary_setup(void)
+{
+    if (!mesh_bench_binary_setup()
+            || !mesh_mqtt_bin_encode(g_command_binary, sizeof(g_command_binary), g_node_addr, MESH_MQTT_DATA_BYTES, g_binary, 256)) {
+        return false;
+    }
+
+    mesh_mqtt_data_t *request = mesh_bench_mqtt_parse_data(g_binary_topic, (char *)g_command_binary, sizeof(g_command_binary));
+    bool ok = request && request->size == 256 && !memcmp(request->data, g_binary, 256);
+    mesh_bench_mqtt_data_free(request);
+    return ok;
+}
+
+static void mqtt_parse_binary_run(void)
+{
+    mesh_mqtt_data_t *request = mesh_bench_mqtt_parse_data(g_binary_topic, (char *)g_command_binary, sizeof(g_command_binary));
+    mesh_bench_mqtt_data_free(request);
+}
+#endif /**< CONFIG_MESH_MQTT_BINARY */
+
+static bool mesh_bench_write_check(mesh_mqtt_publish_data_type_t type, const char *data, size_t size)
+{
+    size_t publish_bytes = host_shim_get_publish_bytes();
+    return mesh_mqtt_write(g_node_addr, data, size, type) == MDF_OK && host_shim_get_publish_bytes() > publish_bytes;
+}
+
+static bool mqtt_write_json_setup(void)
+{
+    return mesh_bench_write_check(MESH_MQTT_DATA_JSON, g_reading, strlen(g_reading));
+}
+
+static void mqtt_write_json_run(void)
+{
+    mesh_mqtt_write(g_node_addr, g_reading, strlen(g_reading), MESH_MQTT_DATA_JSON);
+}
+
+static bool mqtt_write_string_setup(void)
+{
+    return mesh_bench_write_check(MESH_MQTT_DATA_STRING, g_reading, strlen(g_reading));
+}
+
+static void mqtt_write_string_run(void)
+{
+    mesh_mqtt_write(g_node_addr, g_reading, strlen(g_reading), MESH_MQTT_DATA_STRING);
+}
+
+static bool mqtt_write_bytes_setup(void)
+{
+    return mesh_bench_binary_setup() && mesh_bench_write_check(MESH_MQTT_DATA_BYTES, (char *)g_binary, 256);
+}
+
+static void mqtt_write_bytes_run(void)
+{
+    mesh_mqtt_write(g_node_addr, (char *)g_binary, 256, MESH_MQTT_DATA_BYTES);
+}
+
+/**< A full mesh payload, the library cost without the JSON around it */
+static bool base64_encode_setup(void)
+{
+    return mesh_bench_binary_setup();
+}
+
+static void base64_encode_run(void)
+{
+    size_t olen = 0;
+    mbedtls_base64_encode((uint8_t *)g_base64, sizeof(g_base64), &olen, g_binary, sizeof(g_binary));
+}
+
+static bool base64_decode_setup(void)
+{
+    return mesh_bench_binary_setup()
+           && mbedtls_base64_encode((uint8_t *)g_base64, sizeof(g_base64), &g_base64_len, g_binary, sizeof(g_binary)) == 0;
+}
+
+static void base64_decode_run(void)
+{
+    size_t olen = 0;
+    mbedtls_base64_decode(g_binary, sizeof(g_binary), &olen, (uint8_t *)g_base64, g_base64_len);
+}
+
+static bool dht11_read_setup(void)
+{
+    uint8_t frame[5] = {0};
+
+    host_shim_set_dht11_frame(g_dht11_frame);
+    return mesh_bench_dht11_read(frame) && !memcmp(frame, g_dht11_frame, sizeof(frame));
+}
+
+static void dht11_read_run(void)
+{
+    uint8_t frame[5];
+    mesh_bench_dht11_read(frame);
+}
+
+static bool sensor_pipeline_setup(void)
+{
+    mesh_bench_sensor_init(25);
+    return true;
+}
+
+static void heartbeat_format_run(void)
+{
+    static char data[MWIFI_PAYLOAD_LEN];
+    mesh_addr_t parent_mac = {0};
+    uint8_t sta_mac[MWIFI_ADDR_LEN] = {0};
+
+    esp_wifi_get_mac(ESP_IF_WIFI_STA, sta_mac);
+    esp_mesh_get_parent_bssid(&parent_mac);
+
+    snprintf(data, sizeof(data), MESH_PROTO_HEARTBEAT_FORMAT, MAC2STR(sta_mac), MAC2STR(parent_mac.addr), esp_mesh_get_layer());
+}
+
+static bool topo_update_10_setup(void)
+{
+    host_shim_set_route_num(10);
+    return mesh_mqtt_update_topo() == MDF_OK;
+}
+
+static bool topo_update_100_setup(void)
+{
+    host_shim_set_route_num(100);
+    return mesh_mqtt_update_topo() == MDF_OK;
+}
+
+static void topo_update_run(void)
+{
+    mesh_mqtt_update_topo();
+}
+
+static const mesh_espnow_sample_t g_espnow_sample = {.temp = 231, .humi = 645, .light = 2048};
+
+static bool espnow_leaf_send_setup(void)
+{
+    /**< The first reading scans for the relay, the benchmark measures the ones after */
+    return mesh_bench_espnow_start() && mesh_bench_espnow_leaf_send(&g_espnow_sample);
+}
+
+static void espnow_leaf_send_run(void)
+{
+    mesh_bench_espnow_leaf_send(&g_espnow_sample);
+}
+
+static const char *TAG = "mesh_bench";
+
+/**< A payload as node_read_task() logs it, not null-terminated */
+static const char g_dlog_payload[] = "{\"Temp\":\"24.30\",\"Humi\":\"55.00\",\"sensor_light\":\"2048\"}xxxx";
+static const size_t g_dlog_payload_size = sizeof(g_dlog_payload) - 5;
+
+static void dlog_write(void)
+{
+    MESH_DLOGI("Receive [ROOT] addr: " MACSTR ", size: %d, data: %.*s",
+               MAC2STR(g_node_addr), (int)g_dlog_payload_size, (int)g_dlog_payload_size, g_dlog_payload);
+}
+
+/**< The record layout is checked by the dlog_write test of mesh_test */
+static bool dlog_write_setup(void)
+{
+    uint8_t record[MESH_DLOG_RECORD_MAX_SIZE];
+
+    while (mesh_dlog_read(record, sizeof(record))) {
+    }
+
+    dlog_write();
+    return mesh_dlog_read(record, sizeof(record)) > 0;
+}
+
+/**< The drain task takes every record in the firmware, the cost of both sides is measured */
+static void dlog_write_run(void)
+{
+    uint8_t record[MESH_DLOG_RECORD_MAX_SIZE];
+
+    dlog_write();
+    mesh_dlog_read(record, sizeof(record));
+}
+
+static void dlog_snprintf_run(void)
+{
+    static char data[256];
+
+    snprintf(data, sizeof(data), "Receive [ROOT] addr: " MACSTR ", size: %d, data: %.*s",
+             MAC2STR(g_node_addr), (int)g_dlog_payload_size, (int)g_dlog_payload_size, g_dlog_payload);
+}
+
+static const mesh_bench_t g_benches[] = {
+    {"mqtt_parse_json",     mqtt_parse_json_setup,     mqtt_parse_json_run},
+    {"mqtt_parse_string",   mqtt_parse_string_setup,   mqtt_parse_string_run},
+    {"mqtt_parse_bytes",    mqtt_parse_bytes_setup,    mqtt_parse_bytes_run},
+    {"mqtt_parse_group",    mqtt_parse_group_setup,    mqtt_parse_group_run},
+#ifdef CONFIG_MESH_MQTT_BINARY
+    {"mqtt_parse_binary",   mqtt_parse_binary_setup,   mqtt_parse_binary_run},
+#endif /**< CONFIG_MESH_MQTT_BINARY */
+    {"mqtt_write_json",     mqtt_write_json_setup,     mqtt_write_json_run},
+    {"mqtt_write_string",   mqtt_write_string_setup,   mqtt_write_string_run},
+    {"mqtt_write_bytes",    mqtt_write_bytes_setup,    mqtt_write_bytes_run},
+    {"base64_encode_1456",  base64_encode_setup,       base64_encode_run},
+    {"base64_decode_1456",  base64_decode_setup,       base64_decode_run},
+    {"dht11_read",          dht11_read_setup,          dht11_read_run},
+    {"sensor_pipeline_q16", sensor_pipeline_setup,     mesh_bench_sensor_fixed_run},
+    {"sensor_pipeline_f64", sensor_pipeline_setup,     mesh_bench_sensor_float_run},
+    {"heartbeat_format",    NULL,                      heartbeat_format_run},
+    {"topo_update_10",      topo_update_10_setup,      topo_update_run},
+    {"topo_update_100",     topo_update_100_setup,     topo_update_run},
+    {"espnow_leaf_send",    espnow_leaf_send_setup,    espnow_leaf_send_run},
+    {"dlog_write",          dlog_write_setup,          dlog_write_run},
+    {"dlog_snprintf",       NULL,                      dlog_snprintf_run},
+};
+
+static double mesh_bench_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/**
+ * @brief Load the ns_per_op of every benchmark from a previous run
+ */
+static int mesh_bench_load_baseline(const char *path, mesh_bench_baseline_t *baseline, int max_num)
+{
+    char line[512];
+    int num = 0;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    while (num < max_num && fgets(line, sizeof(line), fp)) {
+        char *ns = strstr(line, "\"ns_per_op\":");
+
+        if (sscanf(line, "{\"bench\":\"%31[^\"]\"", baseline[num].name) == 1 && ns
+                && sscanf(ns, "\"ns_per_op\":%lf", &baseline[num].ns_per_op) == 1) {
+            num++;
+        }
+    }
+
+    fclose(fp);
+    return num;
+}
+
+int main(int argc, char *argv[])
+{
+    double min_time_ms = 500;
+    double threshold_pct = 10;
+    const char *filter = NULL;
+    const char *baseline_path = NULL;
+    mesh_bench_baseline_t baseline[MESH_BENCH_BASELINE_MAX_NUM];
+    int baseline_num = 0;
+    int regression_num = 0;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "t:f:b:r:")) != -1) {
+        switch (opt) {
+            case 't':
+                min_time_ms = atof(optarg);
+                break;
+
+            case 'f':
+                filter = optarg;
+                break;
+
+            case 'b':
+                baseline_path = optarg;
+                break;
+
+            case 'r':
+                threshold_pct = atof(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-t MIN_TIME_MS] [-f FILTER] [-b BASELINE] [-r THRESHOLD_PCT]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (baseline_path && (baseline_num = mesh_bench_load_baseline(baseline_path, baseline, MESH_BENCH_BASELINE_MAX_NUM)) < 0) {
+        return 1;
+    }
+
+    if (mesh_mqtt_start("mqtt://localhost") != MDF_OK) {
+        fprintf(stderr, "Unable to start the MQTT handler\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); ++i) {
+        const mesh_bench_t *bench = g_benches + i;
+        uint64_t iterations = 0;
+        double elapsed_ns = 0;
+
+        if (filter && !strstr(bench->name, filter)) {
+            continue;
+        }
+
+        if (bench->setup && !bench->setup()) {
+            fprintf(stderr, "%s: setup failed\n", bench->name);
+            return 1;
+        }
+
+        /**< Warm up, then grow the batch until it runs for the minimum time */
+        bench->run();
+
+        for (uint64_t batch = 1; elapsed_ns < min_time_ms * 1e6; batch *= 2) {
+            memset(&g_alloc, 0, sizeof(g_alloc));
+            g_alloc.enabled = true;
+            double start = mesh_bench_now_ns();
+
+            for (uint64_t n = 0; n < batch; ++n) {
+                bench->run();
+            }
+
+            elapsed_ns = mesh_bench_now_ns() - start;
+            g_alloc.enabled = false;
+            iterations = batch;
+        }
+
+        double ns_per_op = elapsed_ns / iterations;
+
+        printf("{\"bench\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,\"ops_per_s\":%.0f,"
+               "\"allocs_per_op\":%.2f,\"alloc_bytes_per_op\":%.1f,\"peak_heap_bytes\":%lld",
+               bench->name, (unsigned long long)iterations, ns_per_op, 1e9 / ns_per_op,
+               (double)g_alloc.alloc_num / iterations, (double)g_alloc.alloc_bytes / iterations,
+               (long long)g_alloc.peak_bytes);
+
+        for (int j = 0; j < baseline_num; ++j) {
+            if (!strcmp(baseline[j].name, bench->name) && baseline[j].ns_per_op > 0) {
+                double change_pct = (ns_per_op / baseline[j].ns_per_op - 1) * 100;
+                bool regression = change_pct > threshold_pct;
+                regression_num += regression;
+                printf(",\"baseline_ns_per_op\":%.1f,\"change_pct\":%.1f,\"regression\":%s",
+                       baseline[j].ns_per_op, change_pct, regression ? "true" : "false");
+                break;
+            }
+        }
+
+        printf("}\n");
+        fflush(stdout);
+    }
+
+    mesh_mqtt_stop();
+
+    return regression_num ? 2 : 0;
+}
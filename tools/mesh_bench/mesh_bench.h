@@ -0,0 +1,70 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_BENCH_H__
+#define __MESH_BENCH_H__
+
+#include "mesh_mqtt_handle.h"
+#include "mesh_espnow.h"
+
+/**
+ * @brief Entry points into the static functions of the firmware sources,
+ *        see mesh_bench_mqtt.c and mesh_bench_dht11.c. parse_raw() takes the
+ *        topic as esp-mqtt delivers it, not null-terminated.
+ */
+mesh_mqtt_data_t *mesh_bench_mqtt_parse_data(const char *topic, const char *payload, size_t payload_size);
+mesh_mqtt_data_t *mesh_bench_mqtt_parse_raw(const char *topic, size_t topic_size, const char *payload, size_t payload_size);
+void mesh_bench_mqtt_data_free(mesh_mqtt_data_t *request);
+bool mesh_bench_dht11_read(uint8_t frame[5]);
+
+/**
+ * @brief The fixed-point sensor pipeline of dht11_task() next to a double
+ *        precision model of it, see mesh_bench_dht11.c. check() feeds both
+ *        with drifting readings under random calibrations and filter
+ *        weights. It is false if a reading is off by more than 0.001 (0.1
+ *        ADC counts for light), if a formatted reading differs away from a
+ *        rounding point, or if an uncalibrated delta compare differs from
+ *        the integer compare it replaced.
+ */
+bool mesh_bench_sensor_check(int pipeline_num, int sample_num);
+void mesh_bench_sensor_init(int filter_percent);
+void mesh_bench_sensor_fixed_run();
+void mesh_bench_sensor_float_run();
+
+/**
+ * @brief Both ends of the ESP-NOW fast path over a loopback transport, see
+ *        mesh_bench_espnow.c. leaf_send() is true once the relay has handed
+ *        the reading to the uplink.
+ */
+bool mesh_bench_espnow_start();
+bool mesh_bench_espnow_leaf_send(const mesh_espnow_sample_t *sample);
+void mesh_bench_espnow_relay_recv(const uint8_t *data, size_t size);
+
+/**
+ * @brief The clock model of mesh_time.c, see mesh_bench_time.c, linked into
+ *        mesh_test only. host_shim_set_timer() drives the local clock.
+ *        set_exiting() leaves the beacon task of a previous root term behind.
+ */
+int32_t mesh_bench_time_drift_ppm();
+void mesh_bench_time_set_exiting(bool exiting);
+
+/**
+ * @brief Host side of the platform shims, see host_shim.c
+ */
+void host_shim_set_route_num(int route_num);
+void host_shim_set_timer(int64_t timer_us);
+void host_shim_set_dht11_frame(const uint8_t frame[5]);
+size_t host_shim_get_publish_bytes();
+
+#endif /**< __MESH_BENCH_H__ */
@@ -0,0 +1,234 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Builds the DHT11 driver as part of the benchmark so the frame
+ *        decoder and the conversions into the fixed-point pipeline, which
+ *        are static, can be called directly
+ */
+
+/**< The firmware is built with the warning set of ESP-IDF, which leaves out -Wunused-parameter */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "dht11.c"
+#pragma GCC diagnostic pop
+#include "mesh_bench.h"
+
+bool mesh_bench_dht11_read(uint8_t frame[5])
+{
+    DHT11_Data_TypeDef data = {0};
+
+    if (!Read_DHT11(&data)) {
+        return false;
+    }
+
+    frame[0] = data.humi_int;
+    frame[1] = data.humi_deci;
+    frame[2] = data.temp_int;
+    frame[3] = data.temp_deci;
+    frame[4] = data.check_sum;
+
+    return true;
+}
+
+/**
+ * @brief Double precision model of the sample, calibrate, filter and
+ *        delta-compare steps of dht11_task()
+ */
+typedef struct {
+    double gain[SENSOR_CHANNEL_MAX];
+    double offset[SENSOR_CHANNEL_MAX];
+    double weight;
+    double value[SENSOR_CHANNEL_MAX];
+    double prev[SENSOR_CHANNEL_MAX];
+    bool primed;
+} mesh_bench_sensor_ref_t;
+
+static void mesh_bench_sensor_ref_init(mesh_bench_sensor_ref_t *ref, const node_config_t *config, int filter_percent)
+{
+    memset(ref, 0, sizeof(*ref));
+    ref->gain[SENSOR_CHANNEL_TEMP]    = config->temp_gain / (double)NODE_CONFIG_GAIN_ONE;
+    ref->gain[SENSOR_CHANNEL_HUMI]    = config->humi_gain / (double)NODE_CONFIG_GAIN_ONE;
+    ref->gain[SENSOR_CHANNEL_LIGHT]   = config->light_gain / (double)NODE_CONFIG_GAIN_ONE;
+    ref->offset[SENSOR_CHANNEL_TEMP]  = config->temp_offset / 100.0;
+    ref->offset[SENSOR_CHANNEL_HUMI]  = config->humi_offset / 100.0;
+    ref->offset[SENSOR_CHANNEL_LIGHT] = config->light_offset;
+    ref->weight = filter_percent / 100.0;
+}
+
+static void mesh_bench_sensor_ref_push(mesh_bench_sensor_ref_t *ref, const DHT11_Data_TypeDef *data, uint16_t light)
+{
+    double raw[SENSOR_CHANNEL_MAX] = {
+        data->temp_int + data->temp_deci / 10.0,
+        data->humi_int + data->humi_deci / 10.0,
+        light,
+    };
+
+    for (int i = 0; i < SENSOR_CHANNEL_MAX; ++i) {
+        double value = raw[i] * ref->gain[i] + ref->offset[i];
+        ref->prev[i] = ref->value[i];
+        ref->value[i] = ref->primed ? ref->value[i] + (value - ref->value[i]) * ref->weight : value;
+    }
+
+    ref->primed = true;
+}
+
+/**
+ * @brief A reading that drifts by up to +-step per sample, as a sensor does
+ */
+static int mesh_bench_sensor_walk(int value, int step, int min, int max)
+{
+    value += rand() % (2 * step + 1) - step;
+    return value < min ? min : value > max ? max : value;
+}
+
+bool mesh_bench_sensor_check(int pipeline_num, int sample_num)
+{
+    /**< Light is reported in whole ADC counts, temperature and humidity with two decimals */
+    const double tolerance[SENSOR_CHANNEL_MAX] = {0.001, 0.001, 0.1};
+    double max_error[SENSOR_CHANNEL_MAX] = {0};
+    int error_num = 0;
+    int format_error_num = 0;
+    int delta_error_num = 0;
+
+    srand(1);
+
+    for (int n = 0; n < pipeline_num; ++n) {
+        node_config_t config = {
+            .change_threshold = 1 + rand() % 20,
+            .temp_offset  = rand() % 4001 - 2000,
+            .humi_offset  = rand() % 4001 - 2000,
+            .light_offset = rand() % 1001 - 500,
+            .temp_gain    = 5000 + rand() % 15001,
+            .humi_gain    = 5000 + rand() % 15001,
+            .light_gain   = 5000 + rand() % 15001,
+        };
+
+        /**< A quarter of the pipelines is uncalibrated and unfiltered, the old integer delta compare must hold */
+        bool identity = n % 4 == 0;
+        int filter_percent = identity ? 100 : 1 + rand() % 100;
+
+        if (identity) {
+            config.temp_offset = config.humi_offset = config.light_offset = 0;
+            config.temp_gain = config.humi_gain = config.light_gain = NODE_CONFIG_GAIN_ONE;
+        }
+
+        sensor_pipeline_t pipeline;
+        mesh_bench_sensor_ref_t ref;
+        sensor_q16_t raw[SENSOR_CHANNEL_MAX];
+        sensor_q16_t threshold = config.change_threshold * SENSOR_Q16_ONE / 10;
+        int temp = rand() % 500, humi = 200 + rand() % 750, light = rand() % 8192;
+        int prev_temp = 0, prev_humi = 0;
+
+        sensor_pipeline_init(&pipeline, filter_percent);
+        dht11_calibration_set(&pipeline, &config);
+        mesh_bench_sensor_ref_init(&ref, &config, filter_percent);
+
+        for (int i = 0; i < sample_num; ++i) {
+            temp  = mesh_bench_sensor_walk(temp, 5, 0, 500);
+            humi  = mesh_bench_sensor_walk(humi, 10, 200, 950);
+            light = mesh_bench_sensor_walk(light, 200, 0, 8191);
+
+            DHT11_Data_TypeDef data = {humi / 10, humi % 10, temp / 10, temp % 10, 0};
+            dht11_to_raw(&data, light, raw);
+            sensor_pipeline_push(&pipeline, raw);
+            mesh_bench_sensor_ref_push(&ref, &data, light);
+
+            for (int c = 0; c < SENSOR_CHANNEL_MAX; ++c) {
+                double error = fabs((double)pipeline.value[c] / SENSOR_Q16_ONE - ref.value[c]);
+                max_error[c] = error > max_error[c] ? error : max_error[c];
+                error_num += error > tolerance[c];
+            }
+
+            /**< Formatted readings may only differ where the reference lies within the error of a rounding point */
+            for (int c = SENSOR_CHANNEL_TEMP; c <= SENSOR_CHANNEL_HUMI; ++c) {
+                char fixed[SENSOR_Q16_STR_SIZE];
+                char reference[32];
+                double rounding = fabs(ref.value[c] * 100 - floor(ref.value[c] * 100) - 0.5);
+
+                sensor_q16_format(pipeline.value[c], fixed);
+                snprintf(reference, sizeof(reference), "%.2f", ref.value[c]);
+
+                /**< sensor_q16_format() drops the sign of zero */
+                if (strcmp(fixed, strcmp(reference, "-0.00") ? reference : "0.00") && rounding > 0.1) {
+                    format_error_num++;
+                }
+            }
+
+            if (identity) {
+                bool changed = abs(temp - prev_temp) >= config.change_threshold
+                               || abs(humi - prev_humi) >= config.change_threshold;
+
+                if (changed != (sensor_pipeline_changed(&pipeline, SENSOR_CHANNEL_TEMP, threshold)
+                                || sensor_pipeline_changed(&pipeline, SENSOR_CHANNEL_HUMI, threshold))) {
+                    delta_error_num++;
+                }
+
+                prev_temp = temp;
+                prev_humi = humi;
+            }
+        }
+    }
+
+    if (error_num || format_error_num || delta_error_num) {
+        fprintf(stderr, "sensor pipeline: max error %g C, %g %%RH, %g counts, %d readings, %d formatted readings "
+                "and %d delta compares differ from the reference\n", max_error[SENSOR_CHANNEL_TEMP],
+                max_error[SENSOR_CHANNEL_HUMI], max_error[SENSOR_CHANNEL_LIGHT], error_num, format_error_num, delta_error_num);
+        return false;
+    }
+
+    return true;
+}
+
+static sensor_pipeline_t g_sensor_pipeline;
+static mesh_bench_sensor_ref_t g_sensor_ref;
+static DHT11_Data_TypeDef g_sensor_data = {55, 0, 24, 3, 0};
+static char g_sensor_str[2][32];
+static node_config_t g_sensor_config = {
+    .change_threshold = 3, .temp_offset = -150, .humi_offset = 220, .light_offset = 12,
+    .temp_gain = 10125, .humi_gain = 9870, .light_gain = 10000,
+};
+
+void mesh_bench_sensor_init(int filter_percent)
+{
+    sensor_pipeline_init(&g_sensor_pipeline, filter_percent);
+    mesh_bench_sensor_ref_init(&g_sensor_ref, &g_sensor_config, filter_percent);
+}
+
+void mesh_bench_sensor_fixed_run()
+{
+    sensor_q16_t raw[SENSOR_CHANNEL_MAX];
+    sensor_q16_t threshold = g_sensor_config.change_threshold * SENSOR_Q16_ONE / 10;
+
+    g_sensor_data.temp_deci = (g_sensor_data.temp_deci + 1) % 10;
+    dht11_to_raw(&g_sensor_data, 1234, raw);
+    dht11_calibration_set(&g_sensor_pipeline, &g_sensor_config);
+    sensor_pipeline_push(&g_sensor_pipeline, raw);
+    sensor_pipeline_changed(&g_sensor_pipeline, SENSOR_CHANNEL_TEMP, threshold);
+    sensor_pipeline_changed(&g_sensor_pipeline, SENSOR_CHANNEL_HUMI, threshold);
+    sensor_q16_format(g_sensor_pipeline.value[SENSOR_CHANNEL_TEMP], g_sensor_str[0]);
+    sensor_q16_format(g_sensor_pipeline.value[SENSOR_CHANNEL_HUMI], g_sensor_str[1]);
+}
+
+void mesh_bench_sensor_float_run()
+{
+    double threshold = g_sensor_config.change_threshold / 10.0;
+
+    g_sensor_data.temp_deci = (g_sensor_data.temp_deci + 1) % 10;
+    mesh_bench_sensor_ref_push(&g_sensor_ref, &g_sensor_data, 1234);
+    (void)(fabs(g_sensor_ref.value[SENSOR_CHANNEL_TEMP] - g_sensor_ref.prev[SENSOR_CHANNEL_TEMP]) >= threshold
+           || fabs(g_sensor_ref.value[SENSOR_CHANNEL_HUMI] - g_sensor_ref.prev[SENSOR_CHANNEL_HUMI]) >= threshold);
+    snprintf(g_sensor_str[0], sizeof(g_sensor_str[0]), "%.2f", g_sensor_ref.value[SENSOR_CHANNEL_TEMP]);
+    snprintf(g_sensor_str[1], sizeof(g_sensor_str[1]), "%.2f", g_sensor_ref.value[SENSOR_CHANNEL_HUMI]);
+}
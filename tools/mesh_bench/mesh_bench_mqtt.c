@@ -0,0 +1,44 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Builds the MQTT handler as part of the benchmark so the parser,
+ *        which is static, can be called directly
+ */
+
+/**< The firmware is built with the warning set of ESP-IDF, which leaves out -Wunused-parameter */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "mesh_mqtt_handle.c"
+#pragma GCC diagnostic pop
+#include "mesh_bench.h"
+
+mesh_mqtt_data_t *mesh_bench_mqtt_parse_data(const char *topic, const char *payload, size_t payload_size)
+{
+    return mesh_mqtt_parse_data(topic, strlen(topic), payload, payload_size);
+}
+
+mesh_mqtt_data_t *mesh_bench_mqtt_parse_raw(const char *topic, size_t topic_size, const char *payload, size_t payload_size)
+{
+    return mesh_mqtt_parse_data(topic, topic_size, payload, payload_size);
+}
+
+void mesh_bench_mqtt_data_free(mesh_mqtt_data_t *request)
+{
+    if (request) {
+        MDF_FREE(request->addrs_list);
+        MDF_FREE(request->data);
+        MDF_FREE(request);
+    }
+}
@@ -0,0 +1,37 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Builds the time synchronization as part of the unit tests
+ */
+
+/**< The firmware is built with the warning set of ESP-IDF, which leaves out -Wunused-parameter */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "mesh_time.c"
+#pragma GCC diagnostic pop
+
+#include "mesh_bench.h"
+
+int32_t mesh_bench_time_drift_ppm()
+{
+    return g_mesh_time.drift_ppm;
+}
+
+void mesh_bench_time_set_exiting(bool exiting)
+{
+    static int task;
+
+    g_mesh_time.beacon_task = exiting ? (TaskHandle_t)&task : NULL;
+}
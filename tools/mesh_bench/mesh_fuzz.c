@@ -0,0 +1,391 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Fuzzer of the downlink decoders: mesh_mqtt_parse_data() on JSON and
+ *        binary topics and on arbitrary topics, mesh_mqtt_bin_decode(),
+ *        mesh_group_update(), mesh_command_dispatch() and the frames a
+ *        relay receives over ESP-NOW
+ *
+ *   mesh_fuzz [-n RUNS] [-s SEED]     mutate built-in seeds
+ *   mesh_fuzz FILE...                 replay inputs, e.g. a saved crash
+ *
+ *        Built with AddressSanitizer and UndefinedBehaviorSanitizer, an input
+ *        that trips them is written to crash-mesh_fuzz before the process
+ *        exits. `make fuzz-libfuzzer` links the same entry point against
+ *        libFuzzer instead of this driver, it needs clang.
+ */
+
+#include <sanitizer/common_interface_defs.h>
+#include <unistd.h>
+
+#include "mesh_bench.h"
+#include "mesh_group.h"
+#include "mesh_command.h"
+
+#define MESH_FUZZ_INPUT_MAX_LEN 4096
+
+static const char g_json_topic[] = "mesh/30aea4000001/toDevice";
+static const char g_any_topic[] = "mesh/ffffffffffff/toDevice";
+static const char g_binary_topic[] = "mesh/30aea4000001/toDevice" MESH_MQTT_BINARY_SUFFIX;
+
+/**
+ * @brief The decoders see exactly the bytes of the input in buffers of their
+ *        own size, so the sanitizer catches any read past the end
+ */
+static void mesh_fuzz_parse(const char *topic, size_t topic_size, const uint8_t *payload, size_t payload_size)
+{
+    char *topic_copy = malloc(topic_size ? topic_size : 1);
+    char *payload_copy = malloc(payload_size ? payload_size : 1);
+
+    memcpy(topic_copy, topic, topic_size);
+    memcpy(payload_copy, payload, payload_size);
+
+    mesh_mqtt_data_t *request = mesh_bench_mqtt_parse_raw(topic_copy, topic_size, payload_copy, payload_size);
+
+    if (request) {
+        /**< Touch everything the root task will read */
+        volatile uint8_t sum = 0;
+
+        for (size_t i = 0; i < request->addrs_num * 6; ++i) {
+            sum += request->addrs_list[i];
+        }
+
+        for (size_t i = 0; i < request->size; ++i) {
+            sum += request->data[i];
+        }
+    }
+
+    mesh_bench_mqtt_data_free(request);
+    free(topic_copy);
+    free(payload_copy);
+}
+
+static void mesh_fuzz_bin_decode(const uint8_t *payload, size_t payload_size)
+{
+    mesh_mqtt_bin_header_t header;
+    const uint8_t *data = NULL;
+    uint8_t *copy = malloc(payload_size ? payload_size : 1);
+
+    memcpy(copy, payload, payload_size);
+
+    if (mesh_mqtt_bin_decode(copy, payload_size, &header, &data) == MDF_OK) {
+        uint8_t encoded[MESH_FUZZ_INPUT_MAX_LEN + sizeof(header)];
+        size_t encoded_size = mesh_mqtt_bin_encode(encoded, sizeof(encoded), header.addr, header.type, data, header.size);
+
+        /**< A valid message survives a round trip unchanged */
+        if (encoded_size != payload_size || memcmp(encoded, copy, payload_size)) {
+            fprintf(stderr, "Binary message changed by a round trip\n");
+            abort();
+        }
+    }
+
+    free(copy);
+}
+
+/**
+ * @brief Reads every byte of its arguments, so a view past the frame is caught
+ */
+static mesh_ack_result_t mesh_fuzz_command(const uint8_t *args, size_t size)
+{
+    volatile uint8_t sum = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        sum += args[i];
+    }
+
+    return sum & 0x01 ? MESH_ACK_OK : MESH_ACK_FAILED;
+}
+
+/**
+ * @brief The first byte selects the decoder, the rest is the payload. With
+ *        an arbitrary topic the topic runs up to the first newline.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *input, size_t size)
+{
+    if (size < 1 || size > MESH_FUZZ_INPUT_MAX_LEN) {
+        return 0;
+    }
+
+    const uint8_t *payload = input + 1;
+    size_t payload_size = size - 1;
+
+    /**< Groups persist across inputs, so "group" commands find members */
+    if (mesh_group_get_num() == 0) {
+        static const char groups[] = "{\"groups\":[{\"id\":1,\"set\":[\"30aea4000002\",\"30aea4000003\"]}]}";
+        mesh_group_init();
+        mesh_group_update(groups, strlen(groups));
+    }
+
+    if (mesh_command_execute(MESH_COMMAND_RESTART, NULL, 0) == MESH_ACK_UNSUPPORTED) {
+        static const mesh_command_t commands[] = {
+            {MESH_COMMAND_RESTART,    0, 0,    mesh_fuzz_command},
+            {MESH_COMMAND_RELAY_SET,  1, 1,    mesh_fuzz_command},
+            {MESH_COMMAND_CONFIG_SET, 2, 1456, mesh_fuzz_command},
+            {MESH_COMMAND_BURST,      4, 4,    mesh_fuzz_command},
+            {MESH_COMMAND_LOG_LEVEL,  2, 16,   mesh_fuzz_command},
+        };
+
+        for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i) {
+            mesh_command_register(commands + i);
+        }
+    }
+
+    if (!mesh_bench_espnow_start()) {
+        return 0;
+    }
+
+    switch (input[0] % 8) {
+        case 0:
+            mesh_fuzz_parse(g_json_topic, strlen(g_json_topic), payload, payload_size);
+            break;
+
+        case 1:
+            mesh_fuzz_parse(g_any_topic, strlen(g_any_topic), payload, payload_size);
+            break;
+
+        case 2:
+            mesh_fuzz_parse(g_binary_topic, strlen(g_binary_topic), payload, payload_size);
+            break;
+
+        case 3: {
+            const uint8_t *newline = memchr(payload, '\n', payload_size);
+            size_t topic_size = newline ? (size_t)(newline - payload) : payload_size;
+            size_t rest = newline ? payload_size - topic_size - 1 : 0;
+            mesh_fuzz_parse((const char *)payload, topic_size, payload + payload_size - rest, rest);
+            break;
+        }
+
+        case 5: {
+            char *copy = malloc(payload_size ? payload_size : 1);
+            memcpy(copy, payload, payload_size);
+            mesh_group_update(copy, payload_size);
+            free(copy);
+            break;
+        }
+
+        case 6: {
+            uint8_t *copy = malloc(payload_size ? payload_size : 1);
+            memcpy(copy, payload, payload_size);
+            mesh_command_dispatch(copy, payload_size);
+            free(copy);
+            break;
+        }
+
+        case 7:
+            mesh_bench_espnow_relay_recv(payload, payload_size);
+            break;
+
+        default:
+            mesh_fuzz_bin_decode(payload, payload_size);
+            break;
+    }
+
+    return 0;
+}
+
+#ifdef MESH_FUZZ_LIBFUZZER
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    (void)argc;
+    (void)argv;
+
+    if (mesh_mqtt_start("mqtt://localhost") != MDF_OK) {
+        fprintf(stderr, "Unable to start the MQTT handler\n");
+        exit(1);
+    }
+
+    return 0;
+}
+#else
+#define MESH_FUZZ_SEED(input) {input, sizeof(input) - 1}
+
+static const uint8_t *g_input;
+static size_t g_input_size;
+
+static const struct {
+    const char *data;
+    size_t size;
+} g_seeds[] = {
+    MESH_FUZZ_SEED("\x00{\"addr\":[\"30aea4000002\",\"30aea4000003\"],\"type\":\"json\",\"data\":{\"relay\":1}}"),
+    MESH_FUZZ_SEED("\x00{\"addr\":[\"30aea4000002\"],\"type\":\"bytes\",\"data\":\"AAECAwQFBgc=\"}"),
+    MESH_FUZZ_SEED("\x00{\"addr\":[\"30aea4000002\"],\"type\":\"string\",\"data\":\"relay on\"}"),
+    MESH_FUZZ_SEED("\x01{\"type\":\"json\",\"data\":{\"config\":{\"upload_interval_min\":2000}}}"),
+    MESH_FUZZ_SEED("\x02\x30\xae\xa4\x00\x00\x02\x00\x05\x00relay"),
+    MESH_FUZZ_SEED("\x03mesh/ffffffffffff/toDevice/bin\n\x30\xae\xa4\x00\x00\x02\x01\x05\x00relay"),
+    MESH_FUZZ_SEED("\x04\x30\xae\xa4\x00\x00\x02\x00\x04\x00\x01\x02\x03\x04"),
+    MESH_FUZZ_SEED("\x00{\"group\":[1,2],\"type\":\"json\",\"data\":{\"relay\":1}}"),
+    MESH_FUZZ_SEED("\x05{\"groups\":[{\"id\":2,\"name\":\"g2\",\"add\":[\"30aea4000004\"],\"remove\":[\"30aea4000002\"]},{\"id\":1,\"delete\":true}]}"),
+    MESH_FUZZ_SEED("\x06\x02\x01\x00\x01\x05\x04\x00\x05\x00\x3c\x00\x01\x00\x00"),
+    MESH_FUZZ_SEED("\x07\x01\x00"),
+    MESH_FUZZ_SEED("\x07\x01\x02\x01\x00\x00\x80\xe7\x00\x85\x02\x00\x08\x2c\x01\x10\x27\x00\x00"),
+};
+
+static void mesh_fuzz_save_input(void)
+{
+    FILE *fp = fopen("crash-mesh_fuzz", "wb");
+
+    if (fp) {
+        fwrite(g_input, 1, g_input_size, fp);
+        fclose(fp);
+        fprintf(stderr, "Input of %zu bytes written to crash-mesh_fuzz\n", g_input_size);
+    }
+}
+
+static void mesh_fuzz_run(const uint8_t *input, size_t size)
+{
+    g_input = input;
+    g_input_size = size;
+    LLVMFuzzerTestOneInput(input, size);
+}
+
+/**
+ * @brief Byte flips, interesting values, insertions, deletions and splices
+ *        with another seed, a few at a time
+ */
+static size_t mesh_fuzz_mutate(uint8_t *input, size_t size)
+{
+    static const uint8_t interesting[] = {0x00, 0x01, 0x7f, 0x80, 0xff, '"', '\\', '{', '[', '/', ',', ':', '='};
+    int mutation_num = 1 + rand() % 4;
+
+    for (int i = 0; i < mutation_num; ++i) {
+        size_t pos = size ? rand() % size : 0;
+
+        switch (rand() % 6) {
+            case 0:
+                if (size) {
+                    input[pos] ^= 1 << (rand() % 8);
+                }
+
+                break;
+
+            case 1:
+                if (size) {
+                    input[pos] = interesting[rand() % sizeof(interesting)];
+                }
+
+                break;
+
+            case 2:
+                if (size < MESH_FUZZ_INPUT_MAX_LEN) {
+                    memmove(input + pos + 1, input + pos, size - pos);
+                    input[pos] = rand();
+                    size++;
+                }
+
+                break;
+
+            case 3:
+                if (size > 1) {
+                    size_t len = 1 + rand() % (size - pos);
+                    memmove(input + pos, input + pos + len, size - pos - len);
+                    size -= len;
+                }
+
+                break;
+
+            case 4:
+                size = pos + 1 < size ? pos + 1 : size;
+                break;
+
+            default: {
+                int seed = rand() % (sizeof(g_seeds) / sizeof(g_seeds[0]));
+                size_t from = rand() % g_seeds[seed].size;
+                size_t len = g_seeds[seed].size - from;
+
+                if (pos + len <= MESH_FUZZ_INPUT_MAX_LEN) {
+                    memcpy(input + pos, g_seeds[seed].data + from, len);
+                    size = pos + len > size ? pos + len : size;
+                }
+
+                break;
+            }
+        }
+    }
+
+    return size;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t input[MESH_FUZZ_INPUT_MAX_LEN + 1];
+    unsigned long runs = 100000;
+    unsigned int seed = 1;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                runs = strtoul(optarg, NULL, 0);
+                break;
+
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-n RUNS] [-s SEED] [FILE...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    __sanitizer_set_death_callback(mesh_fuzz_save_input);
+
+    if (mesh_mqtt_start("mqtt://localhost") != MDF_OK) {
+        fprintf(stderr, "Unable to start the MQTT handler\n");
+        return 1;
+    }
+
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i) {
+            FILE *fp = fopen(argv[i], "rb");
+
+            if (!fp) {
+                perror(argv[i]);
+                return 1;
+            }
+
+            size_t size = fread(input, 1, sizeof(input) - 1, fp);
+            fclose(fp);
+            mesh_fuzz_run(input, size);
+        }
+
+        return 0;
+    }
+
+    srand(seed);
+
+    for (unsigned long run = 0; run < runs; ++run) {
+        int index = rand() % (sizeof(g_seeds) / sizeof(g_seeds[0]));
+        size_t size = g_seeds[index].size;
+
+        memcpy(input, g_seeds[index].data, size);
+
+        /**< Keep mutating the same input for a while, deeper than a single step */
+        for (int step = 0; step < 8; ++step) {
+            size = mesh_fuzz_mutate(input, size);
+            mesh_fuzz_run(input, size);
+        }
+
+        if ((run + 1) % 100000 == 0) {
+            fprintf(stderr, "%lu runs\n", run + 1);
+        }
+    }
+
+    printf("%lu runs without a finding\n", runs);
+    mesh_mqtt_stop();
+
+    return 0;
+}
+#endif /**< MESH_FUZZ_LIBFUZZER */
@@ -0,0 +1,381 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/**
+ * @brief Unit tests of firmware helpers that have no hardware dependency,
+ *        static functions are reached by including their source. The exit
+ *        status is the number of failed tests, see `make test`.
+ */
+
+#include <math.h>
+
+#include "mesh_bench.h"
+#include "mesh_dlog.h"
+#include "mesh_group.h"
+#include "mesh_seq.h"
+#include "mesh_time.h"
+
+#define MESH_TEST_SEQ_GAP 4096  /**< MESH_SEQ_RESYNC_GAP of mesh_seq.c */
+#define MESH_TEST_TIME_SEQ_WINDOW 16  /**< MESH_TIME_SEQ_WINDOW of mesh_time.c */
+
+#define CONFIG_MESH_ROLLUP_ENABLE 1
+#define CONFIG_MESH_ROLLUP_WINDOW_S 60
+#define CONFIG_MESH_ROLLUP_NODE_MAX_NUM 4
+#define CONFIG_MESH_ROLLUP_RAW_TEMP 1
+/**< The firmware is built with the warning set of ESP-IDF, which leaves out -Wunused-parameter */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "mesh_rollup.c"
+#pragma GCC diagnostic pop
+
+typedef struct {
+    const char *name;
+    void (*run)();
+} mesh_test_t;
+
+static int g_check_failures;
+
+#define MESH_TEST_CHECK(con) do { \
+        if (!(con)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #con); \
+            g_check_failures++; \
+        } \
+    } while (0)
+
+#define MESH_TEST_FLOAT_EQ(a, b) (fabsf((a) - (b)) < 1e-4f)
+
+static bool mesh_test_rollup_parse_str(const char *data, const char *key, float *value)
+{
+    return mesh_rollup_parse(data, strlen(data), key, value);
+}
+
+static void rollup_parse()
+{
+    float value = 0;
+
+    MESH_TEST_CHECK(mesh_test_rollup_parse_str("{\"Temp\":\"25.40\",\"Humi\":\"60\"}", "Temp", &value)
+                    && MESH_TEST_FLOAT_EQ(value, 25.4f));
+    MESH_TEST_CHECK(mesh_test_rollup_parse_str("{\"Temp\":\"25.40\",\"Humi\":\"60\"}", "Humi", &value)
+                    && MESH_TEST_FLOAT_EQ(value, 60.0f));
+    MESH_TEST_CHECK(mesh_test_rollup_parse_str("{\"Temp\":-3.5}", "Temp", &value)
+                    && MESH_TEST_FLOAT_EQ(value, -3.5f));
+    MESH_TEST_CHECK(mesh_test_rollup_parse_str("{\"Temp\": \"-0.25\"}", "Temp", &value)
+                    && MESH_TEST_FLOAT_EQ(value, -0.25f));
+    MESH_TEST_CHECK(mesh_test_rollup_parse_str("{\"sensor_light\":812}", "sensor_light", &value)
+                    && MESH_TEST_FLOAT_EQ(value, 812.0f));
+
+    /**< A key that ends like another one is not taken for it */
+    MESH_TEST_CHECK(mesh_test_rollup_parse_str("{\"xTemp\":1,\"Temp\":2}", "Temp", &value)
+                    && MESH_TEST_FLOAT_EQ(value, 2.0f));
+    MESH_TEST_CHECK(!mesh_test_rollup_parse_str("{\"xTemp\":1}", "Temp", &value));
+
+    MESH_TEST_CHECK(!mesh_test_rollup_parse_str("{\"Humi\":60}", "Temp", &value));
+    MESH_TEST_CHECK(!mesh_test_rollup_parse_str("{\"Temp\":\"\"}", "Temp", &value));
+    MESH_TEST_CHECK(!mesh_test_rollup_parse_str("{\"Temp\":\"n/a\"}", "Temp", &value));
+    MESH_TEST_CHECK(!mesh_test_rollup_parse_str("{\"Temp\":-}", "Temp", &value));
+    MESH_TEST_CHECK(!mesh_test_rollup_parse_str("{\"type\":\"heartbeat\"}", "Temp", &value));
+
+    /**< Readings are not null-terminated, nothing past size is read */
+    const char reading[] = "{\"Temp\":12.345}";
+    MESH_TEST_CHECK(mesh_rollup_parse(reading, strlen("{\"Temp\":12.3"), "Temp", &value)
+                    && MESH_TEST_FLOAT_EQ(value, 12.3f));
+    MESH_TEST_CHECK(!mesh_rollup_parse(reading, strlen("{\"Temp\":"), "Temp", &value));
+    MESH_TEST_CHECK(!mesh_rollup_parse(reading, strlen("{\"Temp\""), "Temp", &value));
+}
+
+static void rollup_handle()
+{
+    const uint8_t addr[MWIFI_ADDR_LEN] = {0x30, 0xae, 0xa4, 0x00, 0x00, 0x01};
+    const char *readings[] = {
+        "{\"Temp\":\"21.5\",\"Humi\":\"40\"}",
+        "{\"Temp\":\"19.5\",\"Humi\":\"50\"}",
+        "{\"Temp\":\"24.0\",\"sensor_light\":300}",
+    };
+
+    if (g_mesh_rollup.lock == NULL) {
+        MESH_TEST_CHECK(mesh_rollup_init() == MDF_OK);
+    }
+
+    g_mesh_rollup.node_num = 0;
+    g_mesh_rollup.running = true;
+
+    for (size_t i = 0; i < sizeof(readings) / sizeof(readings[0]); ++i) {
+        /**< Temperature is forwarded raw, a reading with it too */
+        MESH_TEST_CHECK(mesh_rollup_handle(addr, readings[i], strlen(readings[i])));
+    }
+
+    MESH_TEST_CHECK(mesh_rollup_handle(addr, "{\"type\":\"heartbeat\"}", strlen("{\"type\":\"heartbeat\"}")));
+    MESH_TEST_CHECK(g_mesh_rollup.node_num == 1);
+
+    const mesh_rollup_node_t *node = g_mesh_rollup.nodes;
+    const mesh_rollup_acc_t *temp = node->acc + MESH_ROLLUP_TEMP;
+    const mesh_rollup_acc_t *humi = node->acc + MESH_ROLLUP_HUMI;
+    const mesh_rollup_acc_t *light = node->acc + MESH_ROLLUP_LIGHT;
+
+    MESH_TEST_CHECK(!memcmp(node->addr, addr, MWIFI_ADDR_LEN));
+    MESH_TEST_CHECK(temp->count == 3 && MESH_TEST_FLOAT_EQ(temp->min, 19.5f)
+                    && MESH_TEST_FLOAT_EQ(temp->max, 24.0f) && MESH_TEST_FLOAT_EQ(temp->sum, 65.0f));
+    MESH_TEST_CHECK(humi->count == 2 && MESH_TEST_FLOAT_EQ(humi->min, 40.0f) && MESH_TEST_FLOAT_EQ(humi->max, 50.0f));
+    MESH_TEST_CHECK(light->count == 1 && MESH_TEST_FLOAT_EQ(light->sum, 300.0f));
+
+    /**< Light alone is only kept in the rollup */
+    MESH_TEST_CHECK(!mesh_rollup_handle(addr, "{\"sensor_light\":310}", strlen("{\"sensor_light\":310}")));
+
+    /**< Nodes beyond the table are forwarded raw */
+    for (int i = 0; i < CONFIG_MESH_ROLLUP_NODE_MAX_NUM; ++i) {
+        uint8_t other[MWIFI_ADDR_LEN] = {0x30, 0xae, 0xa4, 0x00, 0x01, i};
+        mesh_rollup_handle(other, "{\"sensor_light\":1}", strlen("{\"sensor_light\":1}"));
+    }
+
+    MESH_TEST_CHECK(g_mesh_rollup.node_num == CONFIG_MESH_ROLLUP_NODE_MAX_NUM);
+
+    g_mesh_rollup.running = false;
+    MESH_TEST_CHECK(mesh_rollup_handle(addr, "{\"sensor_light\":310}", strlen("{\"sensor_light\":310}")));
+}
+
+static mdf_err_t mesh_test_group_update(const char *data)
+{
+    return mesh_group_update(data, strlen(data));
+}
+
+static void group_export()
+{
+    uint8_t table[512];
+    uint8_t copy[512];
+    uint8_t *addrs_list = NULL;
+    size_t addrs_num = 0;
+    uint16_t ids[] = {1, 2, 3};
+
+    MESH_TEST_CHECK(mesh_group_init() == MDF_OK);
+
+    MESH_TEST_CHECK(mesh_test_group_update("{\"groups\":[{\"id\":1,\"name\":\"g1\",\"set\":[\"30aea4000002\",\"30aea4000003\"]},"
+                                           "{\"id\":2,\"set\":[\"30aea4000003\"]},{\"id\":3,\"delete\":true}]}") == MDF_OK);
+
+    size_t size = mesh_group_export(table, sizeof(table));
+    MESH_TEST_CHECK(size == 4 + 2 * 7 + 2 * (2 + MESH_GROUP_NAME_MAX_LEN + (CONFIG_MESH_GROUP_NODE_MAX_NUM + 31) / 32 * 4));
+    MESH_TEST_CHECK(mesh_group_export(table, size - 1) == 0);
+
+    /**< A standby root replaces whatever it had with the table of the root */
+    MESH_TEST_CHECK(mesh_test_group_update("{\"groups\":[{\"id\":1,\"delete\":true},{\"id\":3,\"set\":[\"30aea4000009\"]}]}") == MDF_OK);
+    MESH_TEST_CHECK(mesh_group_import(table, size) == MDF_OK);
+    MESH_TEST_CHECK(mesh_group_get_num() == 2);
+    MESH_TEST_CHECK(mesh_group_export(copy, sizeof(copy)) == size && !memcmp(copy, table, size));
+
+    MESH_TEST_CHECK(mesh_group_expand(ids, 1, &addrs_list, &addrs_num) == MDF_OK && addrs_num == 2);
+    MDF_FREE(addrs_list);
+    MESH_TEST_CHECK(mesh_group_expand(ids + 2, 1, &addrs_list, &addrs_num) == MDF_ERR_NOT_FOUND);
+    MESH_TEST_CHECK(mesh_group_expand(ids, 3, &addrs_list, &addrs_num) == MDF_OK && addrs_num == 2);
+    MDF_FREE(addrs_list);
+
+    /**< Truncated, padded or from another version, the table is kept */
+    MESH_TEST_CHECK(mesh_group_import(table, size - 1) == MDF_ERR_INVALID_ARG);
+    MESH_TEST_CHECK(mesh_group_import(table, sizeof(table)) == MDF_ERR_INVALID_ARG);
+    copy[0]++;
+    MESH_TEST_CHECK(mesh_group_import(copy, size) == MDF_ERR_INVALID_ARG);
+    MESH_TEST_CHECK(mesh_group_get_num() == 2);
+}
+
+static void seq_check()
+{
+    const uint8_t addr[MWIFI_ADDR_LEN] = {0x30, 0xae, 0xa4, 0x00, 0x00, 0x02};
+    uint32_t top = UINT32_MAX - 2;
+
+    MESH_TEST_CHECK(mesh_seq_check(addr, top));
+    MESH_TEST_CHECK(!mesh_seq_check(addr, top));
+
+    /**< Across the wrap, skipping MESH_SEQ_NONE, then reordered within the window */
+    MESH_TEST_CHECK(mesh_seq_check(addr, 2));
+    MESH_TEST_CHECK(mesh_seq_check(addr, UINT32_MAX));
+    MESH_TEST_CHECK(!mesh_seq_check(addr, UINT32_MAX));
+    top = 2;
+
+    /**< A late frame is dropped and the window stays where it is */
+    MESH_TEST_CHECK(mesh_seq_check(addr, top + 100));
+    top += 100;
+    MESH_TEST_CHECK(!mesh_seq_check(addr, top - MESH_SEQ_WINDOW));
+    MESH_TEST_CHECK(!mesh_seq_check(addr, top - MESH_TEST_SEQ_GAP));
+    MESH_TEST_CHECK(!mesh_seq_check(addr, top));
+    MESH_TEST_CHECK(mesh_seq_check(addr, top - 1));
+    MESH_TEST_CHECK(!mesh_seq_check(addr, top - 1));
+
+    /**< A large jump either way is a restart, the window starts over */
+    top -= MESH_TEST_SEQ_GAP + 1;
+    MESH_TEST_CHECK(mesh_seq_check(addr, top));
+    MESH_TEST_CHECK(!mesh_seq_check(addr, top));
+    MESH_TEST_CHECK(!mesh_seq_check(addr, top - 1));
+    top += 2 * (MESH_TEST_SEQ_GAP + 1);
+    MESH_TEST_CHECK(mesh_seq_check(addr, top));
+    MESH_TEST_CHECK(!mesh_seq_check(addr, top - 1));
+    MESH_TEST_CHECK(mesh_seq_check(addr, top + 1));
+    MESH_TEST_CHECK(mesh_seq_get_node_num() == 1);
+}
+
+/**< Fixed-point against double precision readings, see mesh_bench_sensor_check() */
+static void sensor_q16()
+{
+    MESH_TEST_CHECK(mesh_bench_sensor_check(400, 2000));
+}
+
+static void espnow_format()
+{
+    mesh_espnow_reading_t reading = {
+        .sample = {.temp = -5, .humi = 645, .light = 2048},
+        .wake_ms = 120,
+        .energy_uj = 3400,
+    };
+    char buffer[192];
+
+    int len = mesh_espnow_reading_format(&reading, 0, buffer, sizeof(buffer));
+    MESH_TEST_CHECK(len == (int)strlen(buffer) && !strcmp(buffer, "{\"Temp\":\"-0.50\",\"Humi\":\"64.50\",\"sensor_light\":\"2048\","
+                                                          "\"wake_ms\":120,\"energy_uj\":3400}"));
+
+    reading.sample.temp = 231;
+    len = mesh_espnow_reading_format(&reading, 1700000000123LL, buffer, sizeof(buffer));
+    MESH_TEST_CHECK(len == (int)strlen(buffer) && !strcmp(buffer, "{\"Temp\":\"23.10\",\"Humi\":\"64.50\",\"sensor_light\":\"2048\","
+                                                          "\"wake_ms\":120,\"energy_uj\":3400,\"ts\":1700000000123}"));
+
+    /**< Out of range readings of a forged frame are clamped */
+    reading.sample.temp = INT16_MIN;
+    reading.sample.humi = UINT16_MAX;
+    len = mesh_espnow_reading_format(&reading, 0, buffer, sizeof(buffer));
+    MESH_TEST_CHECK(len == (int)strlen(buffer) && !strcmp(buffer, "{\"Temp\":\"-3276.70\",\"Humi\":\"3276.70\",\"sensor_light\":\"2048\","
+                                                          "\"wake_ms\":120,\"energy_uj\":3400}"));
+}
+
+static void dlog_write()
+{
+    const uint8_t addr[MWIFI_ADDR_LEN] = {0x30, 0xae, 0xa4, 0x00, 0x00, 0x02};
+    const char payload[] = "{\"Temp\":\"24.30\"}xxxx";
+    const int payload_size = sizeof(payload) - 5;
+    uint8_t record[MESH_DLOG_RECORD_MAX_SIZE];
+    uint32_t words[4];
+
+    while (mesh_dlog_read(record, sizeof(record))) {
+    }
+
+    /**< TAG is the one of mesh_rollup.c */
+    MESH_DLOGI("Receive [ROOT] addr: " MACSTR ", size: %d, data: %.*s",
+               MAC2STR(addr), payload_size, payload_size, payload);
+    size_t size = mesh_dlog_read(record, sizeof(record));
+    memcpy(words, record, sizeof(words));
+
+    /**< Six bytes of the address, the size, the precision, then the length byte and the payload */
+    const uint8_t *args = record + sizeof(words);
+
+    MESH_TEST_CHECK(size >= sizeof(words) + 8 * 4 + 1 + payload_size && size % 4 == 0);
+    MESH_TEST_CHECK((words[0] & 0xffff) == size && words[0] >> 24 == MESH_DLOG_MAGIC);
+    MESH_TEST_CHECK((words[0] >> 16 & 0xff) == ESP_LOG_INFO);
+    MESH_TEST_CHECK(words[2] == (uint32_t)(uintptr_t)TAG);
+    MESH_TEST_CHECK(args[5 * 4] == addr[5] && args[8 * 4] == payload_size);
+    MESH_TEST_CHECK(!memcmp(args + 8 * 4 + 1, payload, payload_size));
+    MESH_TEST_CHECK(mesh_dlog_read(record, sizeof(record)) == 0);
+}
+
+static mdf_err_t mesh_test_time_beacon(uint16_t seq, int64_t epoch_us)
+{
+    mesh_time_beacon_t beacon = {
+        .version = MESH_TIME_BEACON_VERSION,
+        .seq = seq,
+        .epoch_us = epoch_us,
+    };
+
+    return mesh_time_handle_beacon((uint8_t *)&beacon, sizeof(beacon));
+}
+
+static void time_beacon()
+{
+    int64_t local_us = 1000 * 1000000LL;
+    int64_t epoch_us = 1700000000 * 1000000LL;
+    int64_t interval_us = CONFIG_MESH_TIME_BEACON_INTERVAL * 1000000LL;
+
+    host_shim_set_timer(local_us);
+    MESH_TEST_CHECK(!mesh_time_is_synced() && mesh_time_now_ms() == 0);
+    MESH_TEST_CHECK(mesh_test_time_beacon(100, epoch_us) == MDF_OK);
+    MESH_TEST_CHECK(mesh_time_is_synced() && mesh_time_now_ms() == epoch_us / 1000);
+
+    /**< Copies and reordered beacons within the window are stale */
+    MESH_TEST_CHECK(mesh_test_time_beacon(100, epoch_us) == MDF_ERR_INVALID_STATE);
+    MESH_TEST_CHECK(mesh_test_time_beacon(100 - MESH_TEST_TIME_SEQ_WINDOW + 1, epoch_us) == MDF_ERR_INVALID_STATE);
+
+    /**< The root clock runs 100 ppm fast, a quarter of each measurement is taken */
+    local_us += interval_us;
+    epoch_us += interval_us + interval_us / 10000;
+    host_shim_set_timer(local_us);
+    MESH_TEST_CHECK(mesh_test_time_beacon(101, epoch_us) == MDF_OK);
+    MESH_TEST_CHECK(mesh_bench_time_drift_ppm() == 25);
+
+    /**< The estimate is clamped, the clock runs on the clamped rate between beacons */
+    for (uint16_t seq = 102; seq < 110; ++seq) {
+        local_us += interval_us;
+        epoch_us += interval_us + interval_us / 500;
+        host_shim_set_timer(local_us);
+        MESH_TEST_CHECK(mesh_test_time_beacon(seq, epoch_us) == MDF_OK);
+        MESH_TEST_CHECK(mesh_bench_time_drift_ppm() <= CONFIG_MESH_TIME_MAX_DRIFT_PPM);
+    }
+
+    MESH_TEST_CHECK(mesh_bench_time_drift_ppm() == CONFIG_MESH_TIME_MAX_DRIFT_PPM);
+    host_shim_set_timer(local_us + 1000 * 1000000LL);
+    MESH_TEST_CHECK(mesh_time_now_ms() == epoch_us / 1000 + 1000 * 1000 + CONFIG_MESH_TIME_MAX_DRIFT_PPM);
+
+    /**< A step of the root clock is not drift, the estimate starts over */
+    local_us += interval_us;
+    epoch_us += interval_us + 5 * 1000000LL;
+    host_shim_set_timer(local_us);
+    MESH_TEST_CHECK(mesh_test_time_beacon(110, epoch_us) == MDF_OK);
+    MESH_TEST_CHECK(mesh_bench_time_drift_ppm() == 0 && mesh_time_now_ms() == epoch_us / 1000);
+
+    /**< Far behind the window, the beacon comes from a rebooted root */
+    MESH_TEST_CHECK(mesh_test_time_beacon(110 - MESH_TEST_TIME_SEQ_WINDOW, epoch_us - 1000000) == MDF_OK);
+    MESH_TEST_CHECK(mesh_time_now_ms() == epoch_us / 1000 - 1000);
+
+    /**< A new root term waits for the beacon task of the last one, then gives up */
+    mesh_bench_time_set_exiting(true);
+    MESH_TEST_CHECK(mesh_time_root_start("127.0.0.1") == MDF_ERR_INVALID_STATE);
+    mesh_bench_time_set_exiting(false);
+    MESH_TEST_CHECK(mesh_time_root_start("127.0.0.1") == MDF_OK);
+    MESH_TEST_CHECK(mesh_time_root_stop() == MDF_OK);
+
+    host_shim_set_timer(0);
+}
+
+static const mesh_test_t g_tests[] = {
+    {"rollup_parse",  rollup_parse},
+    {"rollup_handle", rollup_handle},
+    {"group_export",  group_export},
+    {"seq_check",     seq_check},
+    {"sensor_q16",    sensor_q16},
+    {"espnow_format", espnow_format},
+    {"dlog_write",    dlog_write},
+    {"time_beacon",   time_beacon},
+};
+
+int main(void)
+{
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(g_tests) / sizeof(g_tests[0]); ++i) {
+        int check_failures = g_check_failures;
+
+        g_tests[i].run();
+
+        bool passed = g_check_failures == check_failures;
+        printf("%-24s %s\n", g_tests[i].name, passed ? "ok" : "FAILED");
+        failed += !passed;
+    }
+
+    printf("%d of %d tests failed\n", failed, (int)(sizeof(g_tests) / sizeof(g_tests[0])));
+
+    return failed;
+}
@@ -0,0 +1,146 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Compression ratio and CPU time per message for the messages the root
+ * publishes. Every message is compressed on its own, as on the device.
+ * On the device, the publish path logs the time per message at debug level.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mesh_compress.h"
+
+#define BENCH_MESSAGE_NUM (1000)
+#define BENCH_ROUNDS      (100)
+
+typedef int (*bench_format_t)(char *buffer, size_t size, unsigned seed);
+
+static void bench_mac(char mac[13], unsigned seed)
+{
+    snprintf(mac, 13, "7cdfa1%06x", 0xe20000 + seed % 16);
+}
+
+static int bench_format_sensor(char *buffer, size_t size, unsigned seed)
+{
+    char mac[13];
+    bench_mac(mac, seed);
+
+    return snprintf(buffer, size, "{\"addr\":\"%s\",\"type\":\"json\",\"data\":{\"version\":\"0.0.1\","
+                    "\"Temp\":\"%.2f\",\"Humi\":\"%.2f\",\"sensor_light\":\"%d\",\"ts\":%lld}}",
+                    mac, 18 + (seed % 120) / 10.0, 40 + (seed % 300) / 10.0, (int)(seed * 7 % 4096),
+                    1760870400000LL + seed * 5000LL);
+}
+
+static int bench_format_heartbeat(char *buffer, size_t size, unsigned seed)
+{
+    char mac[13], parent[13];
+    bench_mac(mac, seed);
+    bench_mac(parent, seed / 4);
+
+    return snprintf(buffer, size, "{\"addr\":\"%s\",\"type\":\"json\",\"data\":{\"type\":\"heartbeat\", "
+                    "\"self\": \"%s\", \"parent\":\"%s\",\"layer\":%u}}", mac, mac, parent, 1 + seed % 4);
+}
+
+static int bench_format_metrics(char *buffer, size_t size, unsigned seed)
+{
+    char mac[13];
+    bench_mac(mac, seed);
+
+    return snprintf(buffer, size, "{\"addr\":\"%s\",\"type\":\"json\",\"data\":{\"up\":%u,"
+                    "\"heap\":[%u,%u,%u],\"cnt\":[%u,0,%u,0,0],\"g\":{\"mqtt_q\":%u,\"inflight\":%u},"
+                    "\"task\":[[\"root_read_task\",%u,2012],[\"mesh_metrics\",0,1480],[\"IDLE\",%u,812]]}}",
+                    mac, seed * 60, 120000 - seed % 5000, 98000, 65536, seed % 3, seed % 2,
+                    seed % 3, seed % 8, seed % 20, 80 - seed % 20);
+}
+
+static double bench_elapsed_ns(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static int bench_run(const char *name, bench_format_t format)
+{
+    static char messages[BENCH_MESSAGE_NUM][512];
+    static uint8_t compressed[BENCH_MESSAGE_NUM][MESH_COMPRESS_BOUND(512)];
+    static size_t raw_len[BENCH_MESSAGE_NUM], compressed_len[BENCH_MESSAGE_NUM];
+    static mesh_compress_t ctx;
+    char check[512];
+    size_t raw_total = 0, compressed_total = 0;
+    struct timespec start;
+
+    for (unsigned i = 0; i < BENCH_MESSAGE_NUM; ++i) {
+        raw_len[i] = format(messages[i], sizeof(messages[i]), i);
+        raw_total += raw_len[i];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        for (unsigned i = 0; i < BENCH_MESSAGE_NUM; ++i) {
+            compressed_len[i] = mesh_compress_buffer(&ctx, messages[i], raw_len[i],
+                                                     compressed[i], sizeof(compressed[i]));
+        }
+    }
+
+    double compress_ns = bench_elapsed_ns(&start) / BENCH_ROUNDS / BENCH_MESSAGE_NUM;
+
+    for (unsigned i = 0; i < BENCH_MESSAGE_NUM; ++i) {
+        compressed_total += compressed_len[i];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        for (unsigned i = 0; i < BENCH_MESSAGE_NUM; ++i) {
+            if (mesh_decompress_buffer(compressed[i], compressed_len[i], check, sizeof(check)) != (int)raw_len[i]) {
+                fprintf(stderr, "%s: message %u does not decompress\n", name, i);
+                return -1;
+            }
+        }
+    }
+
+    double decompress_ns = bench_elapsed_ns(&start) / BENCH_ROUNDS / BENCH_MESSAGE_NUM;
+
+    for (unsigned i = 0; i < BENCH_MESSAGE_NUM; ++i) {
+        mesh_decompress_buffer(compressed[i], compressed_len[i], check, sizeof(check));
+
+        if (memcmp(check, messages[i], raw_len[i])) {
+            fprintf(stderr, "%s: message %u differs after a round trip\n", name, i);
+            return -1;
+        }
+    }
+
+    printf("%-10s %8.1f %8.1f %7.1f%% %10.0f %10.0f\n", name,
+           (double)raw_total / BENCH_MESSAGE_NUM, (double)compressed_total / BENCH_MESSAGE_NUM,
+           100.0 * compressed_total / raw_total, compress_ns, decompress_ns);
+    return 0;
+}
+
+int main(void)
+{
+    printf("%-10s %8s %8s %8s %10s %10s\n", "message", "raw B", "comp B", "ratio", "comp ns", "decomp ns");
+
+    if (bench_run("sensor", bench_format_sensor)
+            || bench_run("heartbeat", bench_format_heartbeat)
+            || bench_run("metrics", bench_format_metrics)) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
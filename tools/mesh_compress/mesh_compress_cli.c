@@ -0,0 +1,63 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Compress or decompress one message, e.g. the payload of a mesh/+/toCloud/z topic:
+ *
+ *   mosquitto_sub -t 'mesh/+/toCloud/z' -C 1 | ./mesh_compress -d
+ *   echo -n '{"addr":"..."}' | ./mesh_compress > message.z
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh_compress.h"
+
+#define MESSAGE_MAX_SIZE (64 * 1024)
+
+int main(int argc, char **argv)
+{
+    static uint8_t in[MESSAGE_MAX_SIZE];
+    static uint8_t out[MESH_COMPRESS_BOUND(MESSAGE_MAX_SIZE)];
+    bool decompress = argc > 1 && !strcmp(argv[1], "-d");
+    size_t size = fread(in, 1, sizeof(in), stdin);
+    size_t out_len = 0;
+
+    if (argc > 2 || (argc == 2 && !decompress)) {
+        fprintf(stderr, "usage: %s [-d] < input > output\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!feof(stdin)) {
+        fprintf(stderr, "input is larger than %d bytes\n", MESSAGE_MAX_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    if (decompress) {
+        int ret = mesh_decompress_buffer(in, size, out, sizeof(out));
+
+        if (ret < 0) {
+            fprintf(stderr, "corrupt stream or unknown dictionary version %d\n", size ? in[0] : -1);
+            return EXIT_FAILURE;
+        }
+
+        out_len = ret;
+    } else {
+        static mesh_compress_t ctx;
+        out_len = mesh_compress_buffer(&ctx, in, size, out, sizeof(out));
+    }
+
+    fwrite(out, 1, out_len, stdout);
+    return EXIT_SUCCESS;
+}
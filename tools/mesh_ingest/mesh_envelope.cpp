@@ -0,0 +1,308 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_envelope.h"
+#include "mesh_compress.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace mesh_ingest {
+
+/**
+ * @brief Same as MESH_MQTT_COMPRESS_SUFFIX in mesh_mqtt_handle.h
+ */
+static const char MESH_ENVELOPE_COMPRESS_SUFFIX[] = "/z";
+
+/**
+ * @brief Fields of the node payloads that hold numbers but are not readings
+ */
+static const char *const g_mesh_envelope_skip_keys[] = {"ts", "version", "self", "parent", "type"};
+
+/**
+ * @brief Minimal JSON cursor, only what the envelope needs: strings, numbers
+ *        and skipping whatever else is nested in the data
+ */
+struct mesh_json_cursor {
+    const char *p;
+    const char *end;
+
+    void skip_ws()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+            p++;
+        }
+    }
+
+    bool consume(char c)
+    {
+        skip_ws();
+
+        if (p < end && *p == c) {
+            p++;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool string(std::string *out)
+    {
+        if (!consume('"')) {
+            return false;
+        }
+
+        const char *start = p;
+
+        /**< Escapes are kept as they are, keys and values we use never need them */
+        while (p < end && *p != '"') {
+            p += *p == '\\' ? 2 : 1;
+        }
+
+        if (p >= end) {
+            return false;
+        }
+
+        if (out) {
+            out->assign(start, p - start);
+        }
+
+        p++;
+        return true;
+    }
+
+    bool number(double *out)
+    {
+        skip_ws();
+
+        const char *start = p;
+
+        while (p < end && (isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) {
+            p++;
+        }
+
+        if (p == start || p - start > 31) {
+            return false;
+        }
+
+        char buffer[32];
+        char *tail = nullptr;
+        memcpy(buffer, start, p - start);
+        buffer[p - start] = '\0';
+        *out = strtod(buffer, &tail);
+
+        return *tail == '\0';
+    }
+
+    bool skip()
+    {
+        skip_ws();
+
+        if (p >= end) {
+            return false;
+        }
+
+        if (*p == '"') {
+            return string(nullptr);
+        }
+
+        if (*p == '{' || *p == '[') {
+            int depth = 0;
+
+            for (; p < end; ++p) {
+                if (*p == '"') {
+                    if (!string(nullptr)) {
+                        return false;
+                    }
+
+                    p--;
+                } else if (*p == '{' || *p == '[') {
+                    depth++;
+                } else if ((*p == '}' || *p == ']') && --depth == 0) {
+                    p++;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /**< Numbers, true, false and null */
+        while (p < end && *p != ',' && *p != '}' && *p != ']') {
+            p++;
+        }
+
+        return true;
+    }
+};
+
+static bool mesh_envelope_numeric(const std::string &value, double *out)
+{
+    mesh_json_cursor cursor = {value.data(), value.data() + value.size()};
+
+    return !value.empty() && cursor.number(out) && cursor.p == cursor.end;
+}
+
+static bool mesh_envelope_decode_data(mesh_json_cursor &cursor, mesh_envelope_t &envelope)
+{
+    if (!cursor.consume('{')) {
+        return cursor.skip();
+    }
+
+    if (cursor.consume('}')) {
+        return true;
+    }
+
+    do {
+        std::string key;
+        std::string text;
+        double value = 0;
+        bool numeric = false;
+
+        if (!cursor.string(&key) || !cursor.consume(':')) {
+            return false;
+        }
+
+        cursor.skip_ws();
+
+        if (cursor.p < cursor.end && *cursor.p == '"') {
+            if (!cursor.string(&text)) {
+                return false;
+            }
+
+            if (key == "parent") {
+                envelope.parent = text;
+            }
+
+            numeric = mesh_envelope_numeric(text, &value);
+        } else if (cursor.p < cursor.end && (*cursor.p == '-' || isdigit((unsigned char)*cursor.p))) {
+            numeric = cursor.number(&value);
+        } else if (!cursor.skip()) {
+            return false;
+        }
+
+        if (!numeric) {
+            continue;
+        }
+
+        if (key == "ts") {
+            envelope.ts = (int64_t)value;
+            continue;
+        }
+
+        bool skip = false;
+
+        for (const char *skip_key : g_mesh_envelope_skip_keys) {
+            skip |= key == skip_key;
+        }
+
+        if (!skip) {
+            envelope.readings.push_back({key, (float)value});
+        }
+    } while (cursor.consume(','));
+
+    return cursor.consume('}');
+}
+
+bool mesh_envelope_decode(const char *payload, size_t size, mesh_envelope_t &envelope)
+{
+    mesh_json_cursor cursor = {payload, payload + size};
+
+    envelope = mesh_envelope_t();
+
+    if (!cursor.consume('{')) {
+        return false;
+    }
+
+    do {
+        std::string key;
+
+        if (!cursor.string(&key) || !cursor.consume(':')) {
+            return false;
+        }
+
+        bool ret = key == "addr" ? cursor.string(&envelope.addr)
+                   : key == "type" ? cursor.string(&envelope.type)
+                   : key == "data" ? mesh_envelope_decode_data(cursor, envelope)
+                   : cursor.skip();
+
+        if (!ret) {
+            return false;
+        }
+    } while (cursor.consume(','));
+
+    return cursor.consume('}') && envelope.addr.size() == 12;
+}
+
+static bool mesh_envelope_compressed(const std::string &topic)
+{
+    size_t suffix_len = sizeof(MESH_ENVELOPE_COMPRESS_SUFFIX) - 1;
+
+    return topic.size() >= suffix_len && !topic.compare(topic.size() - suffix_len, suffix_len, MESH_ENVELOPE_COMPRESS_SUFFIX);
+}
+
+bool mesh_envelope_decode_message(const std::string &topic, const std::string &payload, mesh_envelope_t &envelope)
+{
+    if (!mesh_envelope_compressed(topic)) {
+        return mesh_envelope_decode(payload.data(), payload.size(), envelope);
+    }
+
+    char buffer[8192];
+    int size = mesh_decompress_buffer(payload.data(), payload.size(), buffer, sizeof(buffer));
+
+    return size > 0 && mesh_envelope_decode(buffer, size, envelope);
+}
+
+bool mesh_envelope_decode_topo(const std::string &topic, const std::string &payload, std::vector<std::string> &addrs)
+{
+    std::string inflated;
+    const std::string *data = &payload;
+
+    if (mesh_envelope_compressed(topic)) {
+        inflated.resize(16384);
+        int size = mesh_decompress_buffer(payload.data(), payload.size(), &inflated[0], inflated.size());
+
+        if (size <= 0) {
+            return false;
+        }
+
+        inflated.resize(size);
+        data = &inflated;
+    }
+
+    mesh_json_cursor cursor = {data->data(), data->data() + data->size()};
+    addrs.clear();
+
+    if (!cursor.consume('[')) {
+        return false;
+    }
+
+    if (cursor.consume(']')) {
+        return true;
+    }
+
+    do {
+        std::string addr;
+
+        if (!cursor.string(&addr)) {
+            return false;
+        }
+
+        addrs.push_back(addr);
+    } while (cursor.consume(','));
+
+    return cursor.consume(']');
+}
+
+} // namespace mesh_ingest
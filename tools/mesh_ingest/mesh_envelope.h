@@ -0,0 +1,66 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_ENVELOPE_H__
+#define __MESH_ENVELOPE_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mesh_ingest {
+
+struct mesh_envelope_reading_t {
+    std::string channel;
+    float value;
+};
+
+/**
+ * @brief Message published by mesh_mqtt_write():
+ *        {"addr":"30aea4000001","type":"json","data":{"Temp":"23.50","Humi":"41.00","ts":1700000000000}}
+ */
+struct mesh_envelope_t {
+    std::string addr;
+    std::string type;   /**< "json", "string" or "bytes" */
+    int64_t ts = 0;     /**< "ts" of the data, 0 if the node clock was not synchronized */
+    std::string parent; /**< "parent" of a heartbeat, empty otherwise */
+    std::vector<mesh_envelope_reading_t> readings;
+};
+
+/**
+ * @brief  Decode an envelope, every numeric field of a JSON data object becomes a reading
+ *
+ * @note   Numbers sent as strings ("23.50") are accepted, identifiers such as
+ *         "version", "self" and "parent" are not readings
+ *
+ * @return false if the payload is not an envelope
+ */
+bool mesh_envelope_decode(const char *payload, size_t size, mesh_envelope_t &envelope);
+
+/**
+ * @brief  Decode a message as received from the broker, inflating payloads
+ *         published on MESH_MQTT_COMPRESS_SUFFIX topics first
+ */
+bool mesh_envelope_decode_message(const std::string &topic, const std::string &payload, mesh_envelope_t &envelope);
+
+/**
+ * @brief  Decode the routing table published by mesh_mqtt_update_topo(): ["30aea4000001","30aea4000002"]
+ *
+ * @return false if the payload is not an array of strings
+ */
+bool mesh_envelope_decode_topo(const std::string &topic, const std::string &payload, std::vector<std::string> &addrs);
+
+} // namespace mesh_ingest
+
+#endif /**< __MESH_ENVELOPE_H__ */
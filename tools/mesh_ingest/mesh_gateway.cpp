@@ -0,0 +1,275 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Edge gateway: follows the uplink and topo topics of every root on a
+ *        broker, keeps the latest state of each node and serves it to
+ *        dashboards as snapshots and versioned deltas over HTTP and WebSocket.
+ *
+ *   mesh_gateway [-h HOST] [-p PORT] [-t TOPIC]... [-l LISTEN] [-P HTTP_PORT] [-o OFFLINE_S]
+ *   mosquitto_sub -v -t 'mesh/#' | mesh_gateway -f -
+ *
+ *        -f replays "topic payload" lines, the output format of
+ *        mosquitto_sub -v, in place of a broker connection, and keeps
+ *        serving the state they built until interrupted.
+ *
+ *   curl localhost:8080/state
+ *   curl localhost:8080/changes?since=42
+ *   websocat ws://localhost:8080/ws?since=42
+ */
+
+#include "mesh_http.h"
+#include "mesh_mqtt_sub.h"
+#include "mesh_state.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+using namespace mesh_ingest;
+
+static std::atomic<bool> g_stop(false);
+
+static const char *const g_default_topics[] = {
+    "mesh/+/toCloud",
+    "mesh/+/toCloud/z",
+    "mesh/+/+/telemetry",
+    "mesh/+/+/telemetry/z",
+    "mesh/+/topo",
+    "mesh/+/topo/z",
+};
+
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void signal_handler(int)
+{
+    g_stop = true;
+}
+
+class gateway {
+public:
+    gateway(mesh_state &state, mesh_http_server &server)
+        : m_state(state), m_server(server), m_report(std::chrono::steady_clock::now()) {}
+
+    void handle(const std::string &topic, const std::string &payload)
+    {
+        if (m_state.apply(topic, payload, now_ms())) {
+            m_server.notify();
+        }
+
+        m_messages++;
+    }
+
+    /**
+     * @brief Mark silent nodes offline and print the statistics, once a second
+     */
+    void tick(int64_t offline_ms)
+    {
+        if (offline_ms && m_state.expire(now_ms() - offline_ms)) {
+            m_server.notify();
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - m_report).count();
+
+        if (elapsed < 10) {
+            return;
+        }
+
+        uint64_t version = m_state.version();
+        fprintf(stderr, "messages: %llu, changes: %.0f/s, nodes: %zu, websockets: %zu, dropped: %llu\n",
+                (unsigned long long)m_messages.load(), (version - m_last_version) / elapsed, m_state.size(),
+                m_server.websocket_num(), (unsigned long long)m_server.dropped_num());
+
+        m_last_version = version;
+        m_report = now;
+    }
+
+private:
+    mesh_state &m_state;
+    mesh_http_server &m_server;
+    std::chrono::steady_clock::time_point m_report;
+    std::atomic<uint64_t> m_messages{0};
+    uint64_t m_last_version = 0;
+};
+
+static void replay(std::istream &in, gateway &gateway)
+{
+    std::string line;
+
+    while (!g_stop && std::getline(in, line)) {
+        size_t space = line.find(' ');
+
+        if (space != std::string::npos) {
+            gateway.handle(line.substr(0, space), line.substr(space + 1));
+        }
+    }
+}
+
+static void follow(const std::string &host, uint16_t port, const std::vector<std::string> &topics, gateway &gateway)
+{
+    mesh_mqtt_sub client;
+    std::string client_id = "mesh_gateway_" + std::to_string(getpid());
+    int backoff_s = 1;
+    auto handle = [&gateway](const std::string &topic, const std::string &payload) {
+        gateway.handle(topic, payload);
+    };
+
+    while (!g_stop) {
+        if (client.connect(host, port, client_id) && client.subscribe(topics)) {
+            fprintf(stderr, "Following %s:%d\n", host.c_str(), port);
+            backoff_s = 1;
+
+            if (client.run(handle, g_stop)) {
+                break;
+            }
+
+            fprintf(stderr, "Connection to %s:%d lost\n", host.c_str(), port);
+        }
+
+        for (int i = 0; i < backoff_s && !g_stop; ++i) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+
+        backoff_s = std::min(backoff_s * 2, 60);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-h HOST] [-p PORT] [-t TOPIC]... [-f FILE|-] [-l LISTEN] [-P HTTP_PORT] "
+            "[-o OFFLINE_S] [-L LOG_SIZE]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string host = "localhost";
+    std::string listen_host;
+    std::string file;
+    uint16_t port = 1883;
+    uint16_t http_port = 8080;
+    int64_t offline_s = 300;
+    size_t log_size = 65536;
+    std::vector<std::string> topics;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "h:p:t:f:l:P:o:L:")) != -1) {
+        switch (opt) {
+            case 'h':
+                host = optarg;
+                break;
+
+            case 'p':
+                port = atoi(optarg);
+                break;
+
+            case 't':
+                topics.push_back(optarg);
+                break;
+
+            case 'f':
+                file = optarg;
+                break;
+
+            case 'l':
+                listen_host = optarg;
+                break;
+
+            case 'P':
+                http_port = atoi(optarg);
+                break;
+
+            case 'o':
+                offline_s = strtoll(optarg, nullptr, 0);
+                break;
+
+            case 'L':
+                log_size = strtoull(optarg, nullptr, 0);
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (offline_s < 0 || log_size == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (topics.empty()) {
+        topics.assign(std::begin(g_default_topics), std::end(g_default_topics));
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    /**< Versions continue above those of a previous run, its clients take a snapshot */
+    mesh_state state(log_size, (uint64_t)now_ms() * 1000);
+    mesh_http_server server(state);
+
+    if (!server.listen(listen_host, http_port)) {
+        return 1;
+    }
+
+    fprintf(stderr, "Serving on port %d\n", server.port());
+
+    gateway gateway(state, server);
+    std::thread http_thread([&server]() {
+        server.run(g_stop);
+    });
+    std::thread tick_thread([&gateway, offline_s]() {
+        while (!g_stop) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            gateway.tick(offline_s * 1000);
+        }
+    });
+
+    if (file == "-") {
+        replay(std::cin, gateway);
+    } else if (!file.empty()) {
+        std::ifstream in(file);
+
+        if (!in) {
+            perror(file.c_str());
+            g_stop = true;
+        }
+
+        replay(in, gateway);
+    } else {
+        follow(host, port, topics, gateway);
+    }
+
+    /**< A replay is over, the state it built is served until interrupted */
+    while (!g_stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    http_thread.join();
+    tick_thread.join();
+
+    return 0;
+}
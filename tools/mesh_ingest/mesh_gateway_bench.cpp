@@ -0,0 +1,474 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Update throughput of the gateway state, and fan-out latency to
+ *        concurrent WebSocket clients while HTTP clients poll snapshots
+ *
+ *   mesh_gateway_bench [-c CLIENTS] [-N NODES] [-u UPDATES] [-r RATE] [-g GETTERS]
+ *
+ *        The messages go through mesh_state::apply() as they would from the
+ *        broker, at RATE per second (0 for as fast as possible). Latency is
+ *        from apply() to the delta being read by a client, over loopback.
+ */
+
+#include "mesh_http.h"
+#include "mesh_state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace mesh_ingest;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const int64_t BENCH_START_MS = 1700000000000LL;
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now().time_since_epoch()).count();
+}
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static std::string node_name(int node)
+{
+    char name[13];
+    snprintf(name, sizeof(name), "30aea4%06x", node & 0xffffff);
+    return name;
+}
+
+/**
+ * @brief Every message carries a new temperature, so every one is a delta
+ */
+static std::string reading(int node, uint64_t i)
+{
+    char payload[256];
+    snprintf(payload, sizeof(payload),
+             "{\"addr\":\"%s\",\"type\":\"json\",\"data\":{\"version\":\"0.0.1\",\"Temp\":\"%.2f\","
+             "\"Humi\":\"%.2f\",\"sensor_light\":\"%d\",\"ts\":%lld}}",
+             node_name(node).c_str(), 15 + (double)(i % 200000) / 10000, 30 + (double)(i % 50) / 2,
+             (int)(i % 4096), (long long)BENCH_START_MS + (long long)i * 10);
+    return payload;
+}
+
+static void print_latency(const char *name, std::vector<double> &latencies, const char *extra)
+{
+    if (latencies.empty()) {
+        printf("%-24s no samples\n", name);
+        return;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-24s p50 %9.1f us  p99 %9.1f us  max %9.1f us%s\n", name, latencies[latencies.size() / 2],
+           latencies[latencies.size() * 99 / 100], latencies.back(), extra);
+}
+
+static int connect_loopback(uint16_t port)
+{
+    struct sockaddr_in addr = {};
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void send_all(int fd, const std::string &data)
+{
+    if (send(fd, data.data(), data.size(), MSG_NOSIGNAL) != (ssize_t)data.size()) {
+        perror("send");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Read a response head, and a body of Content-Length bytes if there is one
+ */
+static std::string read_response(int fd, std::string &buffer)
+{
+    char chunk[65536];
+    size_t end = 0;
+
+    while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t ret = recv(fd, chunk, sizeof(chunk), 0);
+
+        if (ret <= 0) {
+            fprintf(stderr, "Connection closed by the gateway\n");
+            exit(1);
+        }
+
+        buffer.append(chunk, ret);
+    }
+
+    const char *length = strstr(buffer.c_str(), "Content-Length: ");
+    size_t body_size = length && length < buffer.c_str() + end ? strtoul(length + 16, nullptr, 10) : 0;
+
+    while (buffer.size() < end + 4 + body_size) {
+        ssize_t ret = recv(fd, chunk, sizeof(chunk), 0);
+
+        if (ret <= 0) {
+            fprintf(stderr, "Connection closed by the gateway\n");
+            exit(1);
+        }
+
+        buffer.append(chunk, ret);
+    }
+
+    std::string response = buffer.substr(0, end + 4 + body_size);
+    buffer.erase(0, end + 4 + body_size);
+
+    return response;
+}
+
+struct ws_client_t {
+    int fd;
+    std::string in;
+    uint64_t version = 0;
+};
+
+/**
+ * @brief Take the complete frames out of the buffer, the "v" of each delta
+ *        is passed to cb, snapshots are skipped
+ */
+template <typename cb_t>
+static void parse_frames(ws_client_t &client, cb_t cb)
+{
+    size_t pos = 0;
+
+    for (;;) {
+        const uint8_t *p = (const uint8_t *)client.in.data() + pos;
+        size_t size = client.in.size() - pos;
+        uint64_t length = 0;
+        size_t offset = 2;
+
+        if (size < 2) {
+            break;
+        }
+
+        length = p[1] & 0x7f;
+
+        if (length == 126) {
+            if (size < 4) {
+                break;
+            }
+
+            length = p[2] << 8 | p[3];
+            offset = 4;
+        } else if (length == 127) {
+            if (size < 10) {
+                break;
+            }
+
+            length = 0;
+
+            for (int i = 0; i < 8; ++i) {
+                length = length << 8 | p[2 + i];
+            }
+
+            offset = 10;
+        }
+
+        if (size < offset + length) {
+            break;
+        }
+
+        const char *payload = (const char *)p + offset;
+
+        if (length > 5 && !memcmp(payload, "{\"v\":", 5)) {
+            uint64_t version = strtoull(payload + 5, nullptr, 10);
+            bool snapshot = memmem(payload, length, "\"nodes\":", 8) != nullptr;
+
+            if (!snapshot) {
+                cb(version);
+            }
+
+            client.version = version;
+        }
+
+        pos += offset + length;
+    }
+
+    client.in.erase(0, pos);
+}
+
+int main(int argc, char *argv[])
+{
+    int clients = 200;
+    int nodes = 100;
+    uint64_t updates = 20000;
+    int rate = 2000;
+    int getters = 4;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "c:N:u:r:g:")) != -1) {
+        switch (opt) {
+            case 'c':
+                clients = atoi(optarg);
+                break;
+
+            case 'N':
+                nodes = atoi(optarg);
+                break;
+
+            case 'u':
+                updates = strtoull(optarg, nullptr, 0);
+                break;
+
+            case 'r':
+                rate = atoi(optarg);
+                break;
+
+            case 'g':
+                getters = atoi(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c CLIENTS] [-N NODES] [-u UPDATES] [-r RATE] [-g GETTERS]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (clients < 0 || nodes <= 0 || updates == 0 || rate < 0 || getters < 0) {
+        fprintf(stderr, "Need at least one node and one update\n");
+        return 1;
+    }
+
+    std::vector<std::string> topics;
+    std::vector<std::string> payloads;
+
+    for (int i = 0; i < nodes; ++i) {
+        topics.push_back("mesh/30aea4ffffff/" + node_name(i) + "/telemetry");
+    }
+
+    for (uint64_t i = 0; i < std::min<uint64_t>(updates, 100000); ++i) {
+        payloads.push_back(reading(i % nodes, i));
+    }
+
+    /**< Decode and apply alone, no server */
+    {
+        mesh_state state;
+        auto start = bench_clock::now();
+
+        for (uint64_t i = 0; i < updates; ++i) {
+            state.apply(topics[i % nodes], payloads[i % payloads.size()], BENCH_START_MS + i);
+        }
+
+        printf("%-24s %12.0f updates/s\n", "apply", updates / seconds_since(start));
+
+        start = bench_clock::now();
+        size_t bytes = 0;
+
+        for (int i = 0; i < 1000; ++i) {
+            state.apply(topics[i % nodes], reading(i % nodes, updates + i), BENCH_START_MS + updates + i);
+            bytes += state.snapshot()->size();
+        }
+
+        printf("%-24s %12.1f us, %zu bytes, rebuilt after every update\n", "snapshot",
+               seconds_since(start) * 1e6 / 1000, bytes / 1000);
+    }
+
+    /**< The same through the server, with clients attached */
+    mesh_state state;
+    mesh_http_server server(state);
+    std::atomic<bool> stop(false);
+
+    if (!server.listen("127.0.0.1", 0)) {
+        return 1;
+    }
+
+    for (int i = 0; i < nodes; ++i) {
+        state.apply(topics[i], reading(i, i), BENCH_START_MS);
+    }
+
+    std::thread server_thread([&]() {
+        server.run(stop);
+    });
+
+    std::vector<ws_client_t> ws_clients(clients);
+
+    for (auto &client : ws_clients) {
+        std::string buffer;
+
+        client.fd = connect_loopback(server.port());
+        send_all(client.fd, "GET /ws HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+        std::string response = read_response(client.fd, buffer);
+
+        if (response.find(" 101 ") == std::string::npos
+                || response.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == std::string::npos) {
+            fprintf(stderr, "WebSocket handshake failed: %s\n", response.c_str());
+            return 1;
+        }
+
+        client.in = buffer;
+    }
+
+    /**< Send time of every version, written before apply() so the reader always finds it */
+    uint64_t base = state.version();
+    std::unique_ptr<std::atomic<int64_t>[]> sent(new std::atomic<int64_t>[updates + 1]);
+    std::vector<double> fanout;
+    std::atomic<bool> produced(false);
+
+    fanout.reserve((size_t)clients * updates);
+
+    std::thread reader_thread([&]() {
+        std::vector<struct pollfd> pfds;
+        int64_t deadline = 0;
+        char chunk[65536];
+
+        for (auto &client : ws_clients) {
+            pfds.push_back({client.fd, POLLIN, 0});
+        }
+
+        for (;;) {
+            bool done = produced;
+            size_t caught_up = 0;
+
+            for (auto &client : ws_clients) {
+                caught_up += client.version >= base + updates;
+            }
+
+            if (caught_up == ws_clients.size() || (deadline && now_ns() > deadline)) {
+                break;
+            }
+
+            if (done && !deadline) {
+                deadline = now_ns() + 5000000000LL;
+            }
+
+            if (poll(pfds.data(), pfds.size(), 100) <= 0) {
+                continue;
+            }
+
+            for (size_t i = 0; i < pfds.size(); ++i) {
+                if (!(pfds[i].revents & (POLLIN | POLLHUP))) {
+                    continue;
+                }
+
+                ssize_t ret = recv(pfds[i].fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+
+                if (ret <= 0) {
+                    pfds[i].fd = -1;
+                    continue;
+                }
+
+                int64_t received = now_ns();
+                ws_clients[i].in.append(chunk, ret);
+                parse_frames(ws_clients[i], [&](uint64_t version) {
+                    if (version > base && version <= base + updates) {
+                        fanout.push_back((received - sent[version - base].load(std::memory_order_acquire)) / 1e3);
+                    }
+                });
+            }
+        }
+    });
+
+    std::vector<std::vector<double>> snapshot_latencies(getters);
+    std::vector<std::thread> getter_threads;
+
+    for (int g = 0; g < getters; ++g) {
+        getter_threads.emplace_back([&, g]() {
+            int fd = connect_loopback(server.port());
+            std::string buffer;
+
+            while (!produced) {
+                int64_t start = now_ns();
+                send_all(fd, "GET /state HTTP/1.1\r\nHost: localhost\r\n\r\n");
+                read_response(fd, buffer);
+                snapshot_latencies[g].push_back((now_ns() - start) / 1e3);
+            }
+
+            close(fd);
+        });
+    }
+
+    auto start = bench_clock::now();
+
+    for (uint64_t i = 0; i < updates; ++i) {
+        if (rate) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds((int64_t)(i * 1e9 / rate)));
+        }
+
+        uint64_t node = i % nodes;
+        sent[i + 1].store(now_ns(), std::memory_order_release);
+
+        if (state.apply(topics[node], payloads[(nodes + i) % payloads.size()], BENCH_START_MS + 1 + i) != base + i + 1) {
+            fprintf(stderr, "Update %llu was not a change\n", (unsigned long long)i);
+            return 1;
+        }
+
+        server.notify();
+    }
+
+    double produce_s = seconds_since(start);
+    produced = true;
+    reader_thread.join();
+    double deliver_s = seconds_since(start);
+
+    for (auto &thread : getter_threads) {
+        thread.join();
+    }
+
+    stop = true;
+    server.notify();
+    server_thread.join();
+
+    size_t lagging = 0;
+
+    for (auto &client : ws_clients) {
+        lagging += client.version < base + updates;
+        close(client.fd);
+    }
+
+    char extra[128];
+    snprintf(extra, sizeof(extra), "  %.0f updates/s to %d clients, %.0f deliveries/s",
+             updates / produce_s, clients, fanout.size() / deliver_s);
+    print_latency("fan-out", fanout, extra);
+
+    std::vector<double> snapshots;
+
+    for (auto &latencies : snapshot_latencies) {
+        snapshots.insert(snapshots.end(), latencies.begin(), latencies.end());
+    }
+
+    snprintf(extra, sizeof(extra), "  %zu requests from %d clients", snapshots.size(), getters);
+    print_latency("GET /state", snapshots, extra);
+    printf("%-24s %12zu of %d, dropped by the gateway %llu\n", "clients behind at end", lagging, clients,
+           (unsigned long long)server.dropped_num());
+
+    return lagging ? 2 : 0;
+}
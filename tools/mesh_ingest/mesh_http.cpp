@@ -0,0 +1,709 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_http.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace mesh_ingest {
+
+#define MESH_HTTP_HEADER_MAX_SIZE   (8192)
+#define MESH_HTTP_FRAME_MAX_SIZE    (65536)     /**< Largest frame accepted from a WebSocket client */
+#define MESH_HTTP_CHANGES_MAX_NUM   (10000)     /**< Deltas per /changes response */
+#define MESH_HTTP_FANOUT_MAX_NUM    (4096)      /**< Deltas taken from the state per pass */
+
+static const char MESH_HTTP_WEBSOCKET_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+enum {
+    WEBSOCKET_TEXT  = 0x1,
+    WEBSOCKET_CLOSE = 0x8,
+    WEBSOCKET_PING  = 0x9,
+    WEBSOCKET_PONG  = 0xa,
+};
+
+/**
+ * @brief SHA-1, only for Sec-WebSocket-Accept
+ */
+static void mesh_http_sha1(const std::string &data, uint8_t digest[20])
+{
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    std::string message = data;
+    uint64_t bits = (uint64_t)data.size() * 8;
+
+    message.push_back((char)0x80);
+
+    while (message.size() % 64 != 56) {
+        message.push_back(0);
+    }
+
+    for (int i = 7; i >= 0; --i) {
+        message.push_back((char)(bits >> (i * 8)));
+    }
+
+    auto rol = [](uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    };
+
+    for (size_t block = 0; block < message.size(); block += 64) {
+        uint32_t w[80];
+
+        for (int i = 0; i < 16; ++i) {
+            const uint8_t *p = (const uint8_t *)message.data() + block + i * 4;
+            w[i] = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+        }
+
+        for (int i = 16; i < 80; ++i) {
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f = i < 20 ? ((b & c) | (~b & d)) + 0x5a827999
+                         : i < 40 ? (b ^ c ^ d) + 0x6ed9eba1
+                         : i < 60 ? ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdc
+                         : (b ^ c ^ d) + 0xca62c1d6;
+            uint32_t temp = rol(a, 5) + f + e + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for (int i = 0; i < 20; ++i) {
+        digest[i] = h[i / 4] >> (24 - (i % 4) * 8);
+    }
+}
+
+static std::string mesh_http_base64(const uint8_t *data, size_t size)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t n = data[i] << 16 | (i + 1 < size ? data[i + 1] << 8 : 0) | (i + 2 < size ? data[i + 2] : 0);
+        out.push_back(table[n >> 18 & 0x3f]);
+        out.push_back(table[n >> 12 & 0x3f]);
+        out.push_back(i + 1 < size ? table[n >> 6 & 0x3f] : '=');
+        out.push_back(i + 2 < size ? table[n & 0x3f] : '=');
+    }
+
+    return out;
+}
+
+/**
+ * @brief Append a frame as the server sends it, final and unmasked
+ */
+static void mesh_http_frame(std::string &out, uint8_t opcode, const char *data, size_t size)
+{
+    out.push_back((char)(0x80 | opcode));
+
+    if (size < 126) {
+        out.push_back((char)size);
+    } else if (size < 65536) {
+        out.push_back(126);
+        out.push_back((char)(size >> 8));
+        out.push_back((char)size);
+    } else {
+        out.push_back(127);
+
+        for (int i = 7; i >= 0; --i) {
+            out.push_back((char)((uint64_t)size >> (i * 8)));
+        }
+    }
+
+    out.append(data, size);
+}
+
+static bool mesh_http_query_u64(const std::string &query, const char *name, uint64_t *value)
+{
+    std::string key = std::string(name) + '=';
+
+    for (size_t start = 0; start < query.size();) {
+        size_t end = query.find('&', start);
+        end = end == std::string::npos ? query.size() : end;
+
+        if (!query.compare(start, key.size(), key)) {
+            char *tail = nullptr;
+            std::string text = query.substr(start + key.size(), end - start - key.size());
+            *value = strtoull(text.c_str(), &tail, 10);
+            return !text.empty() && *tail == '\0';
+        }
+
+        start = end + 1;
+    }
+
+    return false;
+}
+
+static const char *mesh_http_reason(int status)
+{
+    switch (status) {
+        case 200:
+            return "OK";
+
+        case 400:
+            return "Bad Request";
+
+        case 404:
+            return "Not Found";
+
+        case 405:
+            return "Method Not Allowed";
+
+        case 410:
+            return "Gone";
+
+        default:
+            return "Request Header Fields Too Large";
+    }
+}
+
+mesh_http_server::mesh_http_server(mesh_state &state, size_t client_buffer_max)
+    : m_state(state), m_client_buffer_max(client_buffer_max)
+{
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+mesh_http_server::~mesh_http_server()
+{
+    for (auto &client : m_clients) {
+        close(client->fd);
+    }
+
+    if (m_listen_fd >= 0) {
+        close(m_listen_fd);
+    }
+
+    if (m_event_fd >= 0) {
+        close(m_event_fd);
+    }
+}
+
+bool mesh_http_server::listen(const std::string &host, uint16_t port)
+{
+    struct addrinfo hints = {};
+    struct addrinfo *result = nullptr;
+    std::string service = std::to_string(port);
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (m_event_fd < 0 || getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &result) != 0) {
+        fprintf(stderr, "Unable to resolve %s\n", host.c_str());
+        return false;
+    }
+
+    for (struct addrinfo *ai = result; ai && m_listen_fd < 0; ai = ai->ai_next) {
+        int one = 1;
+        m_listen_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+
+        if (m_listen_fd < 0) {
+            continue;
+        }
+
+        setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (bind(m_listen_fd, ai->ai_addr, ai->ai_addrlen) != 0 || ::listen(m_listen_fd, SOMAXCONN) != 0) {
+            close(m_listen_fd);
+            m_listen_fd = -1;
+        }
+    }
+
+    freeaddrinfo(result);
+
+    if (m_listen_fd < 0) {
+        fprintf(stderr, "Unable to listen on %s:%d\n", host.c_str(), port);
+        return false;
+    }
+
+    struct sockaddr_storage addr = {};
+    socklen_t addr_len = sizeof(addr);
+    getsockname(m_listen_fd, (struct sockaddr *)&addr, &addr_len);
+    m_port = ntohs(addr.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&addr)->sin6_port
+                   : ((struct sockaddr_in *)&addr)->sin_port);
+
+    return true;
+}
+
+void mesh_http_server::notify()
+{
+    uint64_t one = 1;
+
+    if (write(m_event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("eventfd");
+    }
+}
+
+void mesh_http_server::accept_clients()
+{
+    for (;;) {
+        int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            return;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        m_clients.emplace_back(new client_t);
+        m_clients.back()->fd = fd;
+    }
+}
+
+void mesh_http_server::respond(client_t &client, int status, const std::string &body, bool keep_alive)
+{
+    char head[256];
+
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %d %s\r\n"
+             "Content-Type: application/json\r\n"
+             "Content-Length: %zu\r\n"
+             "Cache-Control: no-store\r\n"
+             "Access-Control-Allow-Origin: *\r\n"
+             "%s\r\n",
+             status, mesh_http_reason(status), body.size(), keep_alive ? "" : "Connection: close\r\n");
+
+    client.out += head;
+    client.out += body;
+    client.close |= !keep_alive;
+}
+
+void mesh_http_server::route(client_t &client, const std::string &target, bool keep_alive)
+{
+    size_t mark = target.find('?');
+    std::string path = target.substr(0, mark);
+    std::string query = mark == std::string::npos ? std::string() : target.substr(mark + 1);
+    uint64_t since = 0;
+
+    if (path == "/state") {
+        respond(client, 200, *m_state.snapshot(), keep_alive);
+    } else if (!path.compare(0, 7, "/state/")) {
+        std::string json;
+
+        if (m_state.node(path.substr(7), json)) {
+            respond(client, 200, json, keep_alive);
+        } else {
+            respond(client, 404, "{\"error\":\"unknown node\"}", keep_alive);
+        }
+    } else if (path == "/changes") {
+        std::vector<mesh_state_delta_t> deltas;
+
+        if (!mesh_http_query_u64(query, "since", &since)) {
+            respond(client, 400, "{\"error\":\"since is missing\"}", keep_alive);
+        } else if (!m_state.changes(since, deltas, MESH_HTTP_CHANGES_MAX_NUM)) {
+            respond(client, 410, "{\"v\":" + std::to_string(m_state.version()) + ",\"resync\":true}", keep_alive);
+        } else {
+            /**< "v" is the version the client is at once it applied them, it pages with since=v */
+            std::string body = "{\"v\":" + std::to_string(deltas.empty() ? since : deltas.back().version)
+                               + ",\"changes\":[";
+
+            for (size_t i = 0; i < deltas.size(); ++i) {
+                body += i ? "," : "";
+                body += deltas[i].json;
+            }
+
+            respond(client, 200, body + "]}", keep_alive);
+        }
+    } else {
+        respond(client, 404, "{\"error\":\"not found\"}", keep_alive);
+    }
+}
+
+void mesh_http_server::upgrade(client_t &client, const std::string &key, const std::string &query)
+{
+    uint8_t digest[20];
+    uint64_t since = 0;
+    std::vector<mesh_state_delta_t> deltas;
+
+    mesh_http_sha1(key + MESH_HTTP_WEBSOCKET_GUID, digest);
+
+    client.out += "HTTP/1.1 101 Switching Protocols\r\n"
+                  "Upgrade: websocket\r\n"
+                  "Connection: Upgrade\r\n"
+                  "Sec-WebSocket-Accept: " + mesh_http_base64(digest, sizeof(digest)) + "\r\n\r\n";
+    client.websocket = true;
+    m_websocket_num++;
+
+    if (mesh_http_query_u64(query, "since", &since) && m_state.changes(since, deltas)) {
+        client.version = since;
+
+        for (const auto &delta : deltas) {
+            mesh_http_frame(client.out, WEBSOCKET_TEXT, delta.json.data(), delta.json.size());
+            client.version = delta.version;
+        }
+    } else {
+        auto snapshot = m_state.snapshot(&client.version);
+        mesh_http_frame(client.out, WEBSOCKET_TEXT, snapshot->data(), snapshot->size());
+    }
+}
+
+/**
+ * @return false if no complete request is buffered
+ */
+bool mesh_http_server::handle_http(client_t &client)
+{
+    size_t end = client.in.find("\r\n\r\n");
+
+    if (end == std::string::npos) {
+        if (client.in.size() > MESH_HTTP_HEADER_MAX_SIZE) {
+            respond(client, 431, "{\"error\":\"request too large\"}", false);
+            client.in.clear();
+        }
+
+        return false;
+    }
+
+    std::string request = client.in.substr(0, end + 2);
+    client.in.erase(0, end + 4);
+
+    size_t line_end = request.find("\r\n");
+    std::string line = request.substr(0, line_end);
+    size_t first = line.find(' ');
+    size_t second = line.find(' ', first + 1);
+
+    if (first == std::string::npos || second == std::string::npos) {
+        respond(client, 400, "{\"error\":\"bad request line\"}", false);
+        return false;
+    }
+
+    std::string method = line.substr(0, first);
+    std::string target = line.substr(first + 1, second - first - 1);
+    bool keep_alive = line.compare(second + 1, std::string::npos, "HTTP/1.0") != 0;
+    std::string upgrade_header;
+    std::string key;
+
+    for (size_t pos = line_end + 2; pos < request.size();) {
+        size_t next = request.find("\r\n", pos);
+        std::string header = request.substr(pos, next - pos);
+        size_t colon = header.find(':');
+        pos = next + 2;
+
+        if (colon == std::string::npos) {
+            continue;
+        }
+
+        std::string name = header.substr(0, colon);
+        std::string value = header.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t") + 1);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        if (name == "connection") {
+            std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+            keep_alive = value.find("close") == std::string::npos
+                         && (keep_alive || value.find("keep-alive") != std::string::npos);
+        } else if (name == "upgrade") {
+            std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+            upgrade_header = value;
+        } else if (name == "sec-websocket-key") {
+            key = value;
+        }
+    }
+
+    if (method != "GET") {
+        respond(client, 405, "{\"error\":\"only GET is served\"}", false);
+        return false;
+    }
+
+    size_t mark = target.find('?');
+
+    if (target.substr(0, mark) == "/ws") {
+        if (upgrade_header != "websocket" || key.empty()) {
+            respond(client, 400, "{\"error\":\"WebSocket upgrade expected\"}", false);
+            return false;
+        }
+
+        upgrade(client, key, mark == std::string::npos ? std::string() : target.substr(mark + 1));
+        return true;
+    }
+
+    route(client, target, keep_alive);
+
+    return keep_alive;
+}
+
+/**
+ * @return false if no complete frame is buffered
+ */
+bool mesh_http_server::handle_websocket(client_t &client)
+{
+    const uint8_t *p = (const uint8_t *)client.in.data();
+    size_t size = client.in.size();
+
+    if (size < 2) {
+        return false;
+    }
+
+    uint8_t opcode = p[0] & 0x0f;
+    bool masked = p[1] & 0x80;
+    uint64_t length = p[1] & 0x7f;
+    size_t offset = 2;
+
+    if (length == 126) {
+        if (size < 4) {
+            return false;
+        }
+
+        length = p[2] << 8 | p[3];
+        offset = 4;
+    } else if (length == 127) {
+        if (size < 10) {
+            return false;
+        }
+
+        length = 0;
+
+        for (int i = 0; i < 8; ++i) {
+            length = length << 8 | p[2 + i];
+        }
+
+        offset = 10;
+    }
+
+    /**< Frames from a client are always masked */
+    if (!masked || length > MESH_HTTP_FRAME_MAX_SIZE) {
+        client.close = true;
+        client.in.clear();
+        return false;
+    }
+
+    if (size < offset + 4 + length) {
+        return false;
+    }
+
+    const uint8_t *mask = p + offset;
+    std::string payload(client.in, offset + 4, length);
+
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] ^= mask[i % 4];
+    }
+
+    client.in.erase(0, offset + 4 + length);
+
+    if (opcode == WEBSOCKET_CLOSE) {
+        mesh_http_frame(client.out, WEBSOCKET_CLOSE, payload.data(), std::min<size_t>(payload.size(), 2));
+        client.close = true;
+        return false;
+    }
+
+    if (opcode == WEBSOCKET_PING) {
+        mesh_http_frame(client.out, WEBSOCKET_PONG, payload.data(), payload.size());
+    }
+
+    /**< Anything else a client sends is ignored, the stream only goes one way */
+    return true;
+}
+
+void mesh_http_server::read_client(client_t &client)
+{
+    char buffer[4096];
+
+    for (;;) {
+        ssize_t ret = recv(client.fd, buffer, sizeof(buffer), 0);
+
+        if (ret > 0) {
+            client.in.append(buffer, ret);
+            continue;
+        }
+
+        if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            client.close = true;
+            client.out.clear();
+            client.out_offset = 0;
+            return;
+        }
+
+        break;
+    }
+
+    while (!client.close && (client.websocket ? handle_websocket(client) : handle_http(client))) {
+    }
+}
+
+void mesh_http_server::flush(client_t &client)
+{
+    while (client.out_offset < client.out.size()) {
+        ssize_t ret = send(client.fd, client.out.data() + client.out_offset,
+                           client.out.size() - client.out_offset, MSG_NOSIGNAL);
+
+        if (ret <= 0) {
+            if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                break;
+            }
+
+            client.close = true;
+            client.out.clear();
+            client.out_offset = 0;
+            return;
+        }
+
+        client.out_offset += ret;
+    }
+
+    if (client.out_offset == client.out.size()) {
+        client.out.clear();
+        client.out_offset = 0;
+    } else if (client.out_offset > client.out.size() / 2) {
+        client.out.erase(0, client.out_offset);
+        client.out_offset = 0;
+    }
+}
+
+/**
+ * @return true if there are more deltas to push
+ */
+bool mesh_http_server::fan_out()
+{
+    std::vector<mesh_state_delta_t> deltas;
+    std::string frames;
+    std::vector<size_t> offsets;
+
+    if (!m_state.changes(m_fanout_version, deltas, MESH_HTTP_FANOUT_MAX_NUM)) {
+        /**< The server fell behind the log, every client starts over from a snapshot */
+        uint64_t version = 0;
+        auto snapshot = m_state.snapshot(&version);
+        std::string frame;
+        mesh_http_frame(frame, WEBSOCKET_TEXT, snapshot->data(), snapshot->size());
+
+        for (auto &client : m_clients) {
+            if (client->websocket && client->version < version) {
+                client->out += frame;
+                client->version = version;
+            }
+        }
+
+        m_fanout_version = version;
+        return false;
+    }
+
+    if (deltas.empty()) {
+        return false;
+    }
+
+    /**< One buffer of frames, a client takes the tail after the last version it has */
+    for (const auto &delta : deltas) {
+        offsets.push_back(frames.size());
+        mesh_http_frame(frames, WEBSOCKET_TEXT, delta.json.data(), delta.json.size());
+    }
+
+    uint64_t first = deltas.front().version;
+    uint64_t last = deltas.back().version;
+
+    for (auto &client : m_clients) {
+        if (!client->websocket || client->close || client->version >= last) {
+            continue;
+        }
+
+        /**< Clients join at the version of the state, never behind m_fanout_version */
+        client->out.append(frames, offsets[client->version + 1 - first], std::string::npos);
+        client->version = last;
+
+        if (client->out.size() - client->out_offset > m_client_buffer_max) {
+            /**< A slow reader must not hold the others back, it resumes with since= */
+            client->close = true;
+            client->out.clear();
+            client->out_offset = 0;
+            m_dropped_num++;
+        }
+    }
+
+    m_fanout_version = last;
+
+    return deltas.size() == MESH_HTTP_FANOUT_MAX_NUM;
+}
+
+void mesh_http_server::run(const std::atomic<bool> &stop)
+{
+    std::vector<struct pollfd> pfds;
+    bool more = false;
+
+    m_fanout_version = m_state.version();
+
+    while (!stop) {
+        pfds.clear();
+        pfds.push_back({m_listen_fd, POLLIN, 0});
+        pfds.push_back({m_event_fd, POLLIN, 0});
+
+        for (auto &client : m_clients) {
+            pfds.push_back({client->fd, (short)(POLLIN | (client->out.size() > client->out_offset ? POLLOUT : 0)), 0});
+        }
+
+        if (poll(pfds.data(), pfds.size(), more ? 0 : 1000) < 0) {
+            continue;
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            uint64_t count = 0;
+
+            if (read(m_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("eventfd");
+            }
+        }
+
+        /**< Existing clients first, the clients accepted below have no pollfd yet */
+        for (size_t i = 0; i < m_clients.size(); ++i) {
+            if (pfds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+                read_client(*m_clients[i]);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            accept_clients();
+        }
+
+        more = fan_out();
+
+        for (auto &client : m_clients) {
+            if (client->out.size() > client->out_offset) {
+                flush(*client);
+            }
+        }
+
+        auto closed = std::remove_if(m_clients.begin(), m_clients.end(), [this](const std::unique_ptr<client_t> &client) {
+            if (!client->close || client->out.size() > client->out_offset) {
+                return false;
+            }
+
+            m_websocket_num -= client->websocket;
+            close(client->fd);
+            return true;
+        });
+
+        m_clients.erase(closed, m_clients.end());
+    }
+}
+
+} // namespace mesh_ingest
@@ -0,0 +1,102 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_HTTP_H__
+#define __MESH_HTTP_H__
+
+#include "mesh_state.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mesh_ingest {
+
+/**
+ * @brief HTTP/1.1 and WebSocket front of a mesh_state, one thread polls
+ *        every connection
+ *
+ *        GET /state                  snapshot of every node
+ *        GET /state/{addr}           one node
+ *        GET /changes?since=V        deltas after V, 410 once V fell out of the log
+ *        GET /ws[?since=V]           WebSocket, the deltas after V or a snapshot
+ *                                    to start from, then every delta as it comes
+ *
+ * @note  A delta is serialized and framed once and the same bytes are queued
+ *        to every WebSocket client. A client that lets more than
+ *        client_buffer_max bytes pile up is disconnected, it resumes with
+ *        the version of the last delta it applied.
+ */
+class mesh_http_server {
+public:
+    explicit mesh_http_server(mesh_state &state, size_t client_buffer_max = 4 << 20);
+    ~mesh_http_server();
+
+    bool listen(const std::string &host, uint16_t port);
+
+    /**
+     * @brief Port bound by listen(), the one picked by the system for port 0
+     */
+    uint16_t port() const { return m_port; }
+
+    /**
+     * @brief Wake up run() to push new deltas, callable from any thread
+     */
+    void notify();
+
+    /**
+     * @brief Serve until stop is set
+     */
+    void run(const std::atomic<bool> &stop);
+
+    size_t websocket_num() const { return m_websocket_num; }
+    uint64_t dropped_num() const { return m_dropped_num; }
+
+private:
+    struct client_t {
+        int fd = -1;
+        std::string in;
+        std::string out;
+        size_t out_offset = 0;
+        bool websocket = false;
+        bool close = false;     /**< Close once out is flushed */
+        uint64_t version = 0;   /**< Last delta queued to a WebSocket client */
+    };
+
+    void accept_clients();
+    void read_client(client_t &client);
+    bool handle_http(client_t &client);
+    bool handle_websocket(client_t &client);
+    void route(client_t &client, const std::string &target, bool keep_alive);
+    void upgrade(client_t &client, const std::string &key, const std::string &query);
+    void respond(client_t &client, int status, const std::string &body, bool keep_alive);
+    bool fan_out();
+    void flush(client_t &client);
+
+    mesh_state &m_state;
+    size_t m_client_buffer_max;
+    int m_listen_fd = -1;
+    int m_event_fd = -1;
+    uint16_t m_port = 0;
+    uint64_t m_fanout_version = 0;
+    std::vector<std::unique_ptr<client_t>> m_clients;
+    std::atomic<size_t> m_websocket_num{0};
+    std::atomic<uint64_t> m_dropped_num{0};
+};
+
+} // namespace mesh_ingest
+
+#endif /**< __MESH_HTTP_H__ */
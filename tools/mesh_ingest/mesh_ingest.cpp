@@ -0,0 +1,236 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Ingestion service: follows the uplink topics of a broker and appends
+ *        every reading to the columnar store.
+ *
+ *   mesh_ingest -d DIR [-h HOST] [-p PORT] [-t TOPIC]...
+ *   mosquitto_sub -v -t 'mesh/#' | mesh_ingest -d DIR -f -
+ *
+ *        -f replays "topic payload" lines, the output format of
+ *        mosquitto_sub -v, in place of a broker connection.
+ */
+
+#include "mesh_envelope.h"
+#include "mesh_mqtt_sub.h"
+#include "mesh_store.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+using namespace mesh_ingest;
+
+static std::atomic<bool> g_stop(false);
+
+static const char *const g_default_topics[] = {
+    "mesh/+/toCloud",
+    "mesh/+/toCloud/z",
+    "mesh/+/+/telemetry",
+    "mesh/+/+/telemetry/z",
+};
+
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void signal_handler(int)
+{
+    g_stop = true;
+}
+
+class ingest {
+public:
+    explicit ingest(mesh_store &store) : m_store(store), m_report(std::chrono::steady_clock::now()) {}
+
+    void handle(const std::string &topic, const std::string &payload)
+    {
+        mesh_envelope_t envelope;
+
+        if (!mesh_envelope_decode_message(topic, payload, envelope)) {
+            m_invalid++;
+            return;
+        }
+
+        /**< Nodes without a synchronized clock leave "ts" out, use the arrival time */
+        int64_t ts = envelope.ts > 0 ? envelope.ts : now_ms();
+
+        for (const auto &reading : envelope.readings) {
+            m_readings += m_store.append(envelope.addr, reading.channel, ts, reading.value);
+        }
+
+        m_messages++;
+        report(false);
+    }
+
+    void report(bool force)
+    {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - m_report).count();
+
+        if (!force && elapsed < 10) {
+            return;
+        }
+
+        fprintf(stderr, "messages: %llu, readings: %llu (%.0f/s), invalid: %llu, stored: %llu\n",
+                (unsigned long long)m_messages, (unsigned long long)m_readings,
+                (m_readings - m_last_readings) / elapsed, (unsigned long long)m_invalid,
+                (unsigned long long)m_store.size());
+
+        m_store.sync(false);
+        m_last_readings = m_readings;
+        m_report = now;
+    }
+
+private:
+    mesh_store &m_store;
+    std::chrono::steady_clock::time_point m_report;
+    uint64_t m_messages = 0;
+    uint64_t m_readings = 0;
+    uint64_t m_last_readings = 0;
+    uint64_t m_invalid = 0;
+};
+
+static void replay(std::istream &in, ingest &ingest)
+{
+    std::string line;
+
+    while (!g_stop && std::getline(in, line)) {
+        size_t space = line.find(' ');
+
+        if (space != std::string::npos) {
+            ingest.handle(line.substr(0, space), line.substr(space + 1));
+        }
+    }
+}
+
+static void follow(const std::string &host, uint16_t port, const std::vector<std::string> &topics, ingest &ingest)
+{
+    mesh_mqtt_sub client;
+    std::string client_id = "mesh_ingest_" + std::to_string(getpid());
+    int backoff_s = 1;
+    auto handle = [&ingest](const std::string &topic, const std::string &payload) {
+        ingest.handle(topic, payload);
+    };
+
+    while (!g_stop) {
+        if (client.connect(host, port, client_id) && client.subscribe(topics)) {
+            fprintf(stderr, "Following %s:%d\n", host.c_str(), port);
+            backoff_s = 1;
+
+            if (client.run(handle, g_stop)) {
+                break;
+            }
+
+            fprintf(stderr, "Connection to %s:%d lost\n", host.c_str(), port);
+        }
+
+        for (int i = 0; i < backoff_s && !g_stop; ++i) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+
+        backoff_s = std::min(backoff_s * 2, 60);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s -d DIR [-h HOST] [-p PORT] [-t TOPIC]... [-f FILE|-] [-s SEGMENT_ROWS]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string dir;
+    std::string host = "localhost";
+    std::string file;
+    uint16_t port = 1883;
+    uint64_t segment_rows = 1 << 20;
+    std::vector<std::string> topics;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "d:h:p:t:f:s:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dir = optarg;
+                break;
+
+            case 'h':
+                host = optarg;
+                break;
+
+            case 'p':
+                port = atoi(optarg);
+                break;
+
+            case 't':
+                topics.push_back(optarg);
+                break;
+
+            case 'f':
+                file = optarg;
+                break;
+
+            case 's':
+                segment_rows = strtoull(optarg, nullptr, 0);
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (dir.empty() || segment_rows == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (topics.empty()) {
+        topics.assign(std::begin(g_default_topics), std::end(g_default_topics));
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    mesh_store store(dir, segment_rows);
+    ingest ingest(store);
+
+    if (file == "-") {
+        replay(std::cin, ingest);
+    } else if (!file.empty()) {
+        std::ifstream in(file);
+
+        if (!in) {
+            perror(file.c_str());
+            return 1;
+        }
+
+        replay(in, ingest);
+    } else {
+        follow(host, port, topics, ingest);
+    }
+
+    ingest.report(true);
+
+    return 0;
+}
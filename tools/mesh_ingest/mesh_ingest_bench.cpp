@@ -0,0 +1,190 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Sustained ingest and query latency of the columnar store
+ *
+ *   mesh_ingest_bench [-n READINGS] [-N NODES] [-q QUERIES] [-d DIR]
+ *
+ *        Every node reports Temp, Humi and sensor_light once a second, so
+ *        -n 100000000 -N 100 is about four days of a 100 node mesh.
+ */
+
+#include "mesh_envelope.h"
+#include "mesh_store.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <unistd.h>
+
+using namespace mesh_ingest;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const int64_t BENCH_START_MS = 1700000000000LL;
+static const char *const g_channels[] = {"Temp", "Humi", "sensor_light"};
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static std::string node_name(int node)
+{
+    char name[13];
+    snprintf(name, sizeof(name), "30aea4%06x", node & 0xffffff);
+    return name;
+}
+
+template <typename query_t>
+static void bench_query(const char *name, int queries, query_t query)
+{
+    std::vector<double> latencies;
+    size_t rows = 0;
+
+    for (int i = 0; i < queries; ++i) {
+        auto start = bench_clock::now();
+        rows += query(i);
+        latencies.push_back(seconds_since(start) * 1e6);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-24s p50 %9.1f us  p99 %9.1f us  rows/query %zu\n", name,
+           latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], rows / queries);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t readings = 10000000;
+    int nodes = 100;
+    int queries = 200;
+    std::string dir = "/tmp/mesh_ingest_bench";
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "n:N:q:d:")) != -1) {
+        switch (opt) {
+            case 'n':
+                readings = strtoull(optarg, nullptr, 0);
+                break;
+
+            case 'N':
+                nodes = atoi(optarg);
+                break;
+
+            case 'q':
+                queries = atoi(optarg);
+                break;
+
+            case 'd':
+                dir = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-n READINGS] [-N NODES] [-q QUERIES] [-d DIR]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (nodes <= 0 || queries <= 0 || readings < (uint64_t)nodes * 3) {
+        fprintf(stderr, "Need at least one reading per node and channel\n");
+        return 1;
+    }
+
+    std::filesystem::remove_all(dir);
+
+    /**< Envelope decoding, on messages as the root publishes them */
+    std::vector<std::string> messages;
+    std::mt19937 rng(1);
+
+    for (int i = 0; i < 1000; ++i) {
+        char message[256];
+        snprintf(message, sizeof(message),
+                 "{\"addr\":\"%s\",\"type\":\"json\",\"data\":{\"version\":\"0.0.1\",\"Temp\":\"%.2f\","
+                 "\"Humi\":\"%.2f\",\"sensor_light\":\"%d\",\"ts\":%lld}}",
+                 node_name(i % nodes).c_str(), 15 + rng() % 2000 / 100.0, 30 + rng() % 5000 / 100.0,
+                 (int)(rng() % 4096), (long long)BENCH_START_MS + i * 1000);
+        messages.push_back(message);
+    }
+
+    mesh_envelope_t envelope;
+    uint64_t decoded = 0;
+    uint64_t decode_num = std::max<uint64_t>(readings / 3, 1000);
+    auto start = bench_clock::now();
+
+    for (uint64_t i = 0; i < decode_num; ++i) {
+        const std::string &message = messages[i % messages.size()];
+        decoded += mesh_envelope_decode(message.data(), message.size(), envelope) ? envelope.readings.size() : 0;
+    }
+
+    double decode_s = seconds_since(start);
+    printf("%-24s %12.0f readings/s\n", "decode", decoded / decode_s);
+
+    /**< Append, node after node so every series grows one row per second */
+    {
+        mesh_store store(dir);
+        std::vector<std::string> names;
+
+        for (int i = 0; i < nodes; ++i) {
+            names.push_back(node_name(i));
+        }
+
+        start = bench_clock::now();
+
+        for (uint64_t i = 0; i < readings; ++i) {
+            uint64_t message = i / 3;
+            int64_t ts = BENCH_START_MS + (int64_t)(message / nodes) * 1000;
+            store.append(names[message % nodes], g_channels[i % 3], ts, (float)(i % 1000) / 10);
+        }
+
+        double append_s = seconds_since(start);
+        printf("%-24s %12.0f readings/s\n", "append", readings / append_s);
+        printf("%-24s %12.0f readings/s\n", "ingest (decode+append)", readings / (append_s + decode_s * readings / decoded));
+
+        start = bench_clock::now();
+        store.sync(true);
+        printf("%-24s %12.3f s\n", "sync", seconds_since(start));
+    }
+
+    /**< Queries on a freshly opened store, as a separate reader would see it */
+    start = bench_clock::now();
+    mesh_store store(dir);
+    printf("%-24s %12.3f s, %llu rows\n", "open", seconds_since(start), (unsigned long long)store.size());
+
+    int64_t span_ms = (int64_t)(readings / 3 / nodes) * 1000;
+    std::uniform_int_distribution<int> node_dist(0, nodes - 1);
+
+    auto random_from = [&](int64_t width) {
+        return BENCH_START_MS + (span_ms > width ? (int64_t)(rng() % (span_ms - width)) : 0);
+    };
+
+    bench_query("raw 1h", queries, [&](int i) {
+        int64_t from = random_from(3600 * 1000);
+        return store.query(node_name(node_dist(rng)), g_channels[i % 3], from, from + 3600 * 1000).size();
+    });
+
+    bench_query("1min buckets over 1d", queries, [&](int i) {
+        int64_t from = random_from(86400 * 1000);
+        return store.query(node_name(node_dist(rng)), g_channels[i % 3], from, from + 86400 * 1000, 60 * 1000).size();
+    });
+
+    bench_query("15min buckets, all", queries, [&](int i) {
+        return store.query(node_name(node_dist(rng)), g_channels[i % 3], 0, INT64_MAX, 15 * 60 * 1000).size();
+    });
+
+    return 0;
+}
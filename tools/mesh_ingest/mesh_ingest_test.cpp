@@ -0,0 +1,476 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Correctness checks of the host services, run by `make test`. The
+ *        gateway is served on a loopback port picked by the system.
+ *
+ *   mesh_ingest_test [-d DIR]
+ *
+ *        The store tests work in DIR, removed before and after. The exit
+ *        status is the number of failed tests.
+ */
+
+#include "mesh_compress.h"
+#include "mesh_envelope.h"
+#include "mesh_http.h"
+#include "mesh_state.h"
+#include "mesh_store.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace mesh_ingest;
+
+namespace fs = std::filesystem;
+
+static int g_check_failures = 0;
+static std::string g_dir = "/tmp/mesh_ingest_test";
+
+#define TEST_CHECK(con) do { \
+        if (!(con)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #con); \
+            g_check_failures++; \
+        } \
+    } while (0)
+
+static std::vector<int64_t> timestamps(const std::vector<mesh_store_point_t> &points)
+{
+    std::vector<int64_t> result;
+
+    for (const auto &point : points) {
+        result.push_back(point.ts);
+    }
+
+    return result;
+}
+
+/**
+ * @brief A reading of node that changes Temp and nothing else, seen is kept
+ */
+static uint64_t state_apply(mesh_state &state, int node, double temp)
+{
+    char topic[64];
+    char payload[128];
+
+    snprintf(topic, sizeof(topic), "mesh/30aea4000000/30aea40000%02x/telemetry", node);
+    snprintf(payload, sizeof(payload), "{\"addr\":\"30aea40000%02x\",\"type\":\"json\",\"data\":{\"Temp\":%g}}",
+             node, temp);
+
+    return state.apply(topic, payload, 1700000000000LL);
+}
+
+/**
+ * @brief One request per connection, the whole response as read until the gateway closes it
+ */
+static std::string http_get(uint16_t port, const std::string &target)
+{
+    struct sockaddr_in addr = {};
+    std::string response;
+    std::string request = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    char chunk[4096];
+    ssize_t ret = 0;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+            || send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) {
+        perror("connect");
+        close(fd);
+        return response;
+    }
+
+    while ((ret = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+        response.append(chunk, ret);
+    }
+
+    close(fd);
+    return response;
+}
+
+static bool http_status(const std::string &response, int status)
+{
+    return response.compare(0, 13, "HTTP/1.1 " + std::to_string(status) + " ") == 0;
+}
+
+static std::string http_body(const std::string &response)
+{
+    size_t end = response.find("\r\n\r\n");
+    return end == std::string::npos ? std::string() : response.substr(end + 4);
+}
+
+static bool envelope_has(const mesh_envelope_t &envelope, const char *channel, float value)
+{
+    for (const auto &reading : envelope.readings) {
+        if (reading.channel == channel) {
+            return reading.value == value;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Four rows per segment, ten rows span three of them
+ */
+static void store_range()
+{
+    mesh_store store(g_dir + "/range", 4);
+
+    for (int64_t ts = 0; ts < 10; ++ts) {
+        TEST_CHECK(store.append("30aea4000001", "Temp", ts, ts * 1.5f));
+    }
+
+    TEST_CHECK(store.size() == 10);
+    TEST_CHECK(fs::exists(g_dir + "/range/30aea4000001/Temp/000002.seg"));
+    TEST_CHECK(!fs::exists(g_dir + "/range/30aea4000001/Temp/000003.seg"));
+
+    /**< Across the rollover from the first segment to the second */
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", 3, 7)) == std::vector<int64_t>({3, 4, 5, 6}));
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", 0, 4)) == std::vector<int64_t>({0, 1, 2, 3}));
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", 4, 5)) == std::vector<int64_t>({4}));
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", 8, 100)) == std::vector<int64_t>({8, 9}));
+    TEST_CHECK(store.query("30aea4000001", "Temp", 10, 100).empty());
+    TEST_CHECK(store.query("30aea4000001", "Humi", 0, 100).empty());
+    TEST_CHECK(store.query("30aea4000001", "Temp", 5, 5).empty());
+
+    auto points = store.query("30aea4000001", "Temp", 7, 8);
+    TEST_CHECK(points.size() == 1 && points[0].value == 10.5f);
+
+    /**< Buckets cross segments too: 0-3 | 4-7 | 8-9 over segments of 4 */
+    auto buckets = store.query("30aea4000001", "Temp", 0, 10, 3);
+    TEST_CHECK(buckets.size() == 4);
+
+    if (buckets.size() == 4) {
+        TEST_CHECK(buckets[0].ts == 0 && buckets[0].count == 3 && buckets[0].min == 0 && buckets[0].max == 3);
+        TEST_CHECK(buckets[1].ts == 3 && buckets[1].count == 3 && buckets[1].sum == (3 + 4 + 5) * 1.5);
+        TEST_CHECK(buckets[2].ts == 6 && buckets[2].count == 3 && buckets[2].min == 9 && buckets[2].max == 12);
+        TEST_CHECK(buckets[3].ts == 9 && buckets[3].count == 1);
+    }
+
+    /**< Buckets stay aligned to multiples of bucket_ms whatever from is */
+    buckets = store.query("30aea4000001", "Temp", 2, 7, 5);
+    TEST_CHECK(buckets.size() == 2);
+
+    if (buckets.size() == 2) {
+        TEST_CHECK(buckets[0].ts == 0 && buckets[0].count == 3);
+        TEST_CHECK(buckets[1].ts == 5 && buckets[1].count == 2);
+    }
+
+    TEST_CHECK(store.query("30aea4000001", "Temp", 0, 10, 0).empty());
+
+    /**< Names come from the network */
+    TEST_CHECK(!store.append("..", "Temp", 0, 0));
+    TEST_CHECK(!store.append("30aea4000001", "a/b", 0, 0));
+    TEST_CHECK(!store.append("", "Temp", 0, 0));
+    TEST_CHECK(store.size() == 10);
+}
+
+/**
+ * @brief Late rows, in the same segment and in a later one
+ */
+static void store_unsorted()
+{
+    mesh_store store(g_dir + "/unsorted", 4);
+
+    for (int64_t ts : {10, 5, 20, 15}) {
+        TEST_CHECK(store.append("30aea4000001", "Temp", ts, (float)ts));
+    }
+
+    /**< The next segment starts before the end of the first one */
+    for (int64_t ts : {12, 30, -3}) {
+        TEST_CHECK(store.append("30aea4000001", "Temp", ts, (float)ts));
+    }
+
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", 5, 16)) == std::vector<int64_t>({5, 10, 12, 15}));
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", -100, 100))
+               == std::vector<int64_t>({-3, 5, 10, 12, 15, 20, 30}));
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", 11, 12)).empty());
+
+    auto buckets = store.query("30aea4000001", "Temp", -100, 100, 10);
+    TEST_CHECK(buckets.size() == 5);
+
+    if (buckets.size() == 5) {
+        /**< Negative timestamps round down to their bucket as well */
+        TEST_CHECK(buckets[0].ts == -10 && buckets[0].count == 1);
+        TEST_CHECK(buckets[1].ts == 0 && buckets[1].count == 1 && buckets[1].min == 5);
+        TEST_CHECK(buckets[2].ts == 10 && buckets[2].count == 3 && buckets[2].min == 10 && buckets[2].max == 15
+                   && buckets[2].sum == 37);
+        TEST_CHECK(buckets[3].ts == 20 && buckets[3].count == 1);
+        TEST_CHECK(buckets[4].ts == 30 && buckets[4].count == 1);
+    }
+}
+
+/**
+ * @brief A store opened again from its files keeps its rows and the names of
+ *        its segment files, a file that fails to open included
+ */
+static void store_reopen()
+{
+    std::string dir = g_dir + "/reopen";
+
+    {
+        mesh_store store(dir, 4);
+
+        for (int64_t ts = 0; ts < 6; ++ts) {
+            store.append("30aea4000001", "Temp", ts, (float)ts);
+        }
+
+        store.append("30aea4000002", "Humi", 100, 40);
+    }
+
+    /**< Stands for a file left by another version, it is skipped and its name kept */
+    std::ofstream(dir + "/30aea4000001/Temp/000005.seg") << "garbage";
+
+    mesh_store store(dir, 4);
+
+    TEST_CHECK(store.size() == 7);
+    TEST_CHECK(store.nodes() == std::vector<std::string>({"30aea4000001", "30aea4000002"}));
+    TEST_CHECK(store.channels("30aea4000002") == std::vector<std::string>({"Humi"}));
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", 0, 100)) == std::vector<int64_t>({0, 1, 2, 3, 4, 5}));
+
+    /**< Two rows fill 000001.seg, the third one needs a new file above 000005.seg */
+    for (int64_t ts = 6; ts < 9; ++ts) {
+        TEST_CHECK(store.append("30aea4000001", "Temp", ts, (float)ts));
+    }
+
+    TEST_CHECK(store.size() == 10);
+    TEST_CHECK(fs::exists(dir + "/30aea4000001/Temp/000006.seg"));
+    TEST_CHECK(fs::file_size(dir + "/30aea4000001/Temp/000005.seg") == 7);
+    TEST_CHECK(timestamps(store.query("30aea4000001", "Temp", 4, 100)) == std::vector<int64_t>({4, 5, 6, 7, 8}));
+
+    auto points = store.query("30aea4000002", "Humi", 0, 1000);
+    TEST_CHECK(points.size() == 1 && points[0].ts == 100 && points[0].value == 40);
+}
+
+static void envelope_decode()
+{
+    mesh_envelope_t envelope;
+    std::string payload = "{\"addr\":\"30aea4000001\",\"type\":\"json\",\"data\":{\"version\":\"0.0.1\","
+                          "\"Temp\":\"23.50\",\"Humi\":41,\"layer\":2,\"self\":\"30aea4000001\","
+                          "\"parent\":\"30aea4000000\",\"ts\":1700000000000}}";
+
+    TEST_CHECK(mesh_envelope_decode(payload.data(), payload.size(), envelope));
+    TEST_CHECK(envelope.addr == "30aea4000001" && envelope.type == "json");
+    TEST_CHECK(envelope.ts == 1700000000000LL);
+    TEST_CHECK(envelope.parent == "30aea4000000");
+    TEST_CHECK(envelope.readings.size() == 3);
+    TEST_CHECK(envelope_has(envelope, "Temp", 23.5f));
+    TEST_CHECK(envelope_has(envelope, "Humi", 41));
+    TEST_CHECK(envelope_has(envelope, "layer", 2));
+
+    /**< Nested values and non-numeric strings are skipped, not readings */
+    payload = "{\"type\":\"json\",\"data\":{\"obj\":{\"a\":1,\"b\":[1,\"}\"]},\"list\":[2,3],\"on\":true,"
+              "\"name\":\"x1\",\"Temp\":-3.25e0},\"extra\":{\"k\":[]},\"addr\":\"30aea4000001\"}";
+    TEST_CHECK(mesh_envelope_decode(payload.data(), payload.size(), envelope));
+    TEST_CHECK(envelope.readings.size() == 1 && envelope_has(envelope, "Temp", -3.25f));
+    TEST_CHECK(envelope.ts == 0 && envelope.parent.empty());
+
+    /**< "string" and "bytes" data carry no readings */
+    payload = "{\"addr\":\"30aea4000001\",\"type\":\"string\",\"data\":\"hello\"}";
+    TEST_CHECK(mesh_envelope_decode(payload.data(), payload.size(), envelope));
+    TEST_CHECK(envelope.type == "string" && envelope.readings.empty());
+
+    payload = "{\"addr\":\"30aea4000001\",\"data\":{}}";
+    TEST_CHECK(mesh_envelope_decode(payload.data(), payload.size(), envelope) && envelope.readings.empty());
+
+    /**< Not envelopes */
+    for (const char *invalid : {"", "[]", "{}", "{\"addr\":\"30aea400\",\"data\":{}}",
+                                "{\"addr\":\"30aea4000001\",\"data\":{\"Temp\":1}",
+                                "{\"addr\":\"30aea4000001\",\"data\":{\"Temp\" 1}}",
+                                "{\"addr\":\"30aea4000001\",\"data\":{\"Temp\":\"1}}",
+                                "{\"addr\":30,\"data\":{}}"}) {
+        TEST_CHECK(!mesh_envelope_decode(invalid, strlen(invalid), envelope));
+    }
+
+    /**< Compressed on the /z topic, as with CONFIG_MESH_MQTT_COMPRESS */
+    static mesh_compress_t compress;
+    payload = "{\"addr\":\"30aea4000002\",\"type\":\"json\",\"data\":{\"Temp\":\"21.00\",\"Humi\":\"40.00\","
+              "\"Temp2\":\"21.00\",\"Humi2\":\"40.00\",\"Temp3\":\"21.00\",\"Humi3\":\"40.00\"}}";
+    std::string compressed(MESH_COMPRESS_BOUND(payload.size()), '\0');
+    compressed.resize(mesh_compress_buffer(&compress, payload.data(), payload.size(), &compressed[0],
+                                           compressed.size()));
+
+    TEST_CHECK(!compressed.empty());
+    TEST_CHECK(mesh_envelope_decode_message("mesh/30aea4000001/toCloud/z", compressed, envelope));
+    TEST_CHECK(envelope.addr == "30aea4000002" && envelope.readings.size() == 6);
+    TEST_CHECK(!mesh_envelope_decode_message("mesh/30aea4000001/toCloud", compressed, envelope));
+    TEST_CHECK(!mesh_envelope_decode_message("mesh/30aea4000001/toCloud/z", payload, envelope));
+    TEST_CHECK(mesh_envelope_decode_message("mesh/30aea4000001/toCloud", payload, envelope));
+
+    std::vector<std::string> addrs;
+    TEST_CHECK(mesh_envelope_decode_topo("mesh/30aea4000001/topo", "[\"30aea4000001\", \"30aea4000002\"]", addrs));
+    TEST_CHECK(addrs == std::vector<std::string>({"30aea4000001", "30aea4000002"}));
+    TEST_CHECK(mesh_envelope_decode_topo("mesh/30aea4000001/topo", "[]", addrs) && addrs.empty());
+    TEST_CHECK(!mesh_envelope_decode_topo("mesh/30aea4000001/topo", "[1]", addrs));
+    TEST_CHECK(!mesh_envelope_decode_topo("mesh/30aea4000001/topo", "[\"30aea4000001\"", addrs));
+}
+
+/**
+ * @brief A log of four deltas, six changes: versions 1 and 2 fell out of it
+ */
+static void state_changes()
+{
+    mesh_state state(4);
+    std::vector<mesh_state_delta_t> deltas;
+
+    for (int i = 1; i <= 6; ++i) {
+        TEST_CHECK(state_apply(state, i % 2, 20 + i) == (uint64_t)i);
+    }
+
+    /**< The same reading again is no change */
+    TEST_CHECK(state_apply(state, 0, 26) == 0);
+    TEST_CHECK(state.version() == 6 && state.size() == 2);
+
+    TEST_CHECK(state.changes(2, deltas) && deltas.size() == 4);
+
+    if (deltas.size() == 4) {
+        TEST_CHECK(deltas[0].version == 3 && deltas[3].version == 6);
+        /**< Only the fields that changed, seen and root are the same as before */
+        TEST_CHECK(deltas[3].json == "{\"v\":6,\"addr\":\"30aea4000000\",\"set\":{\"Temp\":26}}");
+    }
+
+    deltas.clear();
+    TEST_CHECK(state.changes(2, deltas, 2) && deltas.size() == 2 && deltas[1].version == 4);
+    deltas.clear();
+    TEST_CHECK(state.changes(5, deltas) && deltas.size() == 1 && deltas[0].version == 6);
+    deltas.clear();
+    TEST_CHECK(state.changes(6, deltas) && deltas.empty());
+
+    /**< Out of the log, and ahead of it, both need a snapshot */
+    TEST_CHECK(!state.changes(1, deltas));
+    TEST_CHECK(!state.changes(0, deltas));
+    TEST_CHECK(!state.changes(7, deltas));
+    TEST_CHECK(deltas.empty());
+
+    /**< A restarted gateway starts above the versions of its clients */
+    mesh_state restarted(4, 100);
+    TEST_CHECK(restarted.changes(100, deltas) && deltas.empty());
+    TEST_CHECK(!restarted.changes(6, deltas));
+    TEST_CHECK(state_apply(restarted, 1, 20) == 101);
+    TEST_CHECK(restarted.changes(100, deltas) && deltas.size() == 1 && deltas[0].version == 101);
+
+    /**< Expiry is a change too */
+    TEST_CHECK(state.expire(1700000000001LL) == 8);
+    TEST_CHECK(state.expire(1700000000001LL) == 0);
+    std::string json;
+    TEST_CHECK(state.node("30aea4000001", json) && json.find("\"online\":false") != std::string::npos);
+}
+
+static void http_changes()
+{
+    mesh_state state(4);
+    mesh_http_server server(state);
+    std::atomic<bool> stop(false);
+
+    TEST_CHECK(server.listen("127.0.0.1", 0));
+
+    for (int i = 1; i <= 6; ++i) {
+        state_apply(state, i % 2, 20 + i);
+    }
+
+    std::thread server_thread([&]() {
+        server.run(stop);
+    });
+
+    std::string response = http_get(server.port(), "/changes?since=4");
+    TEST_CHECK(http_status(response, 200));
+    TEST_CHECK(http_body(response) == "{\"v\":6,\"changes\":["
+               "{\"v\":5,\"addr\":\"30aea4000001\",\"set\":{\"Temp\":25}},"
+               "{\"v\":6,\"addr\":\"30aea4000000\",\"set\":{\"Temp\":26}}]}");
+
+    response = http_get(server.port(), "/changes?since=6");
+    TEST_CHECK(http_status(response, 200) && http_body(response) == "{\"v\":6,\"changes\":[]}");
+
+    /**< A stale client is told to take a snapshot, and at which version the gateway is */
+    response = http_get(server.port(), "/changes?since=1");
+    TEST_CHECK(http_status(response, 410) && http_body(response) == "{\"v\":6,\"resync\":true}");
+    response = http_get(server.port(), "/changes?since=7");
+    TEST_CHECK(http_status(response, 410));
+
+    TEST_CHECK(http_status(http_get(server.port(), "/changes"), 400));
+    TEST_CHECK(http_status(http_get(server.port(), "/changes?since=x"), 400));
+
+    response = http_get(server.port(), "/state");
+    TEST_CHECK(http_status(response, 200) && http_body(response).compare(0, 15, "{\"v\":6,\"nodes\":") == 0);
+    TEST_CHECK(http_status(http_get(server.port(), "/state/30aea4000001"), 200));
+    TEST_CHECK(http_status(http_get(server.port(), "/state/30aea4ffffff"), 404));
+
+    /**< A client at the "v" of the 410 resumes from there once it took the snapshot */
+    state_apply(state, 1, 30);
+    server.notify();
+    response = http_get(server.port(), "/changes?since=6");
+    TEST_CHECK(http_status(response, 200) && http_body(response).compare(0, 6, "{\"v\":7") == 0);
+
+    stop = true;
+    server.notify();
+    server_thread.join();
+}
+
+static const struct {
+    const char *name;
+    void (*run)();
+} g_tests[] = {
+    {"store_range",     store_range},
+    {"store_unsorted",  store_unsorted},
+    {"store_reopen",    store_reopen},
+    {"envelope_decode", envelope_decode},
+    {"state_changes",   state_changes},
+    {"http_changes",    http_changes},
+};
+
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+            case 'd':
+                g_dir = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-d DIR]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    fs::remove_all(g_dir);
+
+    for (const auto &test : g_tests) {
+        int check_failures = g_check_failures;
+
+        test.run();
+
+        bool passed = g_check_failures == check_failures;
+        printf("%-24s %s\n", test.name, passed ? "ok" : "FAILED");
+        failed += !passed;
+    }
+
+    printf("%d of %d tests failed\n", failed, (int)(sizeof(g_tests) / sizeof(g_tests[0])));
+    fs::remove_all(g_dir);
+
+    return failed;
+}
@@ -0,0 +1,286 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_mqtt_sub.h"
+
+#include <cstdio>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace mesh_ingest {
+
+enum {
+    MQTT_CONNECT     = 1,
+    MQTT_CONNACK     = 2,
+    MQTT_PUBLISH     = 3,
+    MQTT_PUBACK      = 4,
+    MQTT_SUBSCRIBE   = 8,
+    MQTT_SUBACK      = 9,
+    MQTT_PINGREQ     = 12,
+    MQTT_PINGRESP    = 13,
+    MQTT_DISCONNECT  = 14,
+};
+
+static void mesh_mqtt_put_u16(std::string &body, uint16_t value)
+{
+    body.push_back(value >> 8);
+    body.push_back(value & 0xff);
+}
+
+static void mesh_mqtt_put_string(std::string &body, const std::string &value)
+{
+    mesh_mqtt_put_u16(body, value.size());
+    body += value;
+}
+
+static time_t mesh_mqtt_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+mesh_mqtt_sub::~mesh_mqtt_sub()
+{
+    disconnect();
+}
+
+bool mesh_mqtt_sub::send_packet(uint8_t type, const std::string &body)
+{
+    std::string packet(1, type);
+    size_t length = body.size();
+
+    do {
+        uint8_t byte = length % 128;
+        length /= 128;
+        packet.push_back(length ? byte | 0x80 : byte);
+    } while (length);
+
+    packet += body;
+
+    for (size_t sent = 0; sent < packet.size();) {
+        ssize_t ret = send(m_fd, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+
+        if (ret <= 0) {
+            return false;
+        }
+
+        sent += ret;
+    }
+
+    return true;
+}
+
+bool mesh_mqtt_sub::recv_all(void *data, size_t size)
+{
+    for (size_t received = 0; received < size;) {
+        ssize_t ret = recv(m_fd, static_cast<uint8_t *>(data) + received, size - received, 0);
+
+        if (ret <= 0) {
+            return false;
+        }
+
+        received += ret;
+    }
+
+    return true;
+}
+
+bool mesh_mqtt_sub::recv_packet(uint8_t *type, std::string *body)
+{
+    uint8_t byte = 0;
+    size_t length = 0;
+
+    if (!recv_all(type, 1)) {
+        return false;
+    }
+
+    for (int shift = 0; shift < 28; shift += 7) {
+        if (!recv_all(&byte, 1)) {
+            return false;
+        }
+
+        length |= (size_t)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80)) {
+            body->resize(length);
+            return recv_all(&(*body)[0], length);
+        }
+    }
+
+    return false;
+}
+
+bool mesh_mqtt_sub::connect(const std::string &host, uint16_t port, const std::string &client_id, uint16_t keepalive_s)
+{
+    struct addrinfo hints = {};
+    struct addrinfo *result = nullptr;
+    std::string service = std::to_string(port);
+
+    disconnect();
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &result) != 0) {
+        fprintf(stderr, "Unable to resolve %s\n", host.c_str());
+        return false;
+    }
+
+    for (struct addrinfo *ai = result; ai && m_fd < 0; ai = ai->ai_next) {
+        m_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+        if (m_fd >= 0 && ::connect(m_fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    freeaddrinfo(result);
+
+    if (m_fd < 0) {
+        fprintf(stderr, "Unable to connect to %s:%d\n", host.c_str(), port);
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    /**< Protocol level 4 is MQTT 3.1.1, clean session */
+    std::string body;
+    mesh_mqtt_put_string(body, "MQTT");
+    body.push_back(4);
+    body.push_back(0x02);
+    mesh_mqtt_put_u16(body, keepalive_s);
+    mesh_mqtt_put_string(body, client_id);
+
+    uint8_t type = 0;
+    std::string ack;
+    m_keepalive_s = keepalive_s;
+
+    if (!send_packet(MQTT_CONNECT << 4, body) || !recv_packet(&type, &ack)
+            || type >> 4 != MQTT_CONNACK || ack.size() != 2 || ack[1] != 0) {
+        fprintf(stderr, "Connection refused by %s:%d\n", host.c_str(), port);
+        disconnect();
+        return false;
+    }
+
+    return true;
+}
+
+bool mesh_mqtt_sub::subscribe(const std::vector<std::string> &topics)
+{
+    std::string body;
+    uint16_t packet_id = ++m_packet_id ? m_packet_id : ++m_packet_id;
+
+    mesh_mqtt_put_u16(body, packet_id);
+
+    for (const auto &topic : topics) {
+        mesh_mqtt_put_string(body, topic);
+        body.push_back(1);
+    }
+
+    uint8_t type = 0;
+    std::string ack;
+
+    if (!send_packet(MQTT_SUBSCRIBE << 4 | 0x02, body) || !recv_packet(&type, &ack) || type >> 4 != MQTT_SUBACK) {
+        return false;
+    }
+
+    for (size_t i = 2; i < ack.size(); ++i) {
+        if ((uint8_t)ack[i] == 0x80) {
+            fprintf(stderr, "Subscription to %s refused\n", topics[i - 2].c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool mesh_mqtt_sub::run(const message_cb_t &cb, const std::atomic<bool> &stop)
+{
+    time_t last_tx = mesh_mqtt_now();
+
+    while (m_fd >= 0 && !stop) {
+        struct pollfd pfd = {m_fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, 1000);
+
+        if (ret < 0) {
+            continue;
+        }
+
+        if (m_keepalive_s && mesh_mqtt_now() - last_tx >= m_keepalive_s / 2) {
+            if (!send_packet(MQTT_PINGREQ << 4, std::string())) {
+                break;
+            }
+
+            last_tx = mesh_mqtt_now();
+        }
+
+        if (ret == 0) {
+            continue;
+        }
+
+        uint8_t type = 0;
+        std::string body;
+
+        if (!recv_packet(&type, &body)) {
+            break;
+        }
+
+        if (type >> 4 != MQTT_PUBLISH || body.size() < 2) {
+            continue;
+        }
+
+        uint8_t qos = (type >> 1) & 0x03;
+        size_t topic_len = (uint8_t)body[0] << 8 | (uint8_t)body[1];
+        size_t offset = 2 + topic_len + (qos ? 2 : 0);
+
+        if (offset > body.size()) {
+            break;
+        }
+
+        cb(body.substr(2, topic_len), body.substr(offset));
+
+        if (qos == 1) {
+            if (!send_packet(MQTT_PUBACK << 4, body.substr(2 + topic_len, 2))) {
+                break;
+            }
+
+            last_tx = mesh_mqtt_now();
+        }
+    }
+
+    bool stopped = stop;
+    disconnect();
+
+    return stopped;
+}
+
+void mesh_mqtt_sub::disconnect()
+{
+    if (m_fd >= 0) {
+        send_packet(MQTT_DISCONNECT << 4, std::string());
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+} // namespace mesh_ingest
@@ -0,0 +1,63 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_MQTT_SUB_H__
+#define __MESH_MQTT_SUB_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace mesh_ingest {
+
+/**
+ * @brief Blocking MQTT 3.1.1 subscriber over plain TCP, enough to follow a
+ *        local broker without pulling in a client library
+ *
+ * @note  Subscriptions are QoS 1, so the broker keeps retrying a message
+ *        until the PUBACK sent after the callback returns.
+ */
+class mesh_mqtt_sub {
+public:
+    typedef std::function<void(const std::string &topic, const std::string &payload)> message_cb_t;
+
+    ~mesh_mqtt_sub();
+
+    bool connect(const std::string &host, uint16_t port, const std::string &client_id, uint16_t keepalive_s = 30);
+    bool subscribe(const std::vector<std::string> &topics);
+
+    /**
+     * @brief  Receive until the connection drops or stop is set
+     *
+     * @return false if the connection dropped
+     */
+    bool run(const message_cb_t &cb, const std::atomic<bool> &stop);
+
+    void disconnect();
+
+private:
+    bool send_packet(uint8_t type, const std::string &body);
+    bool recv_packet(uint8_t *type, std::string *body);
+    bool recv_all(void *data, size_t size);
+
+    int m_fd = -1;
+    uint16_t m_keepalive_s = 30;
+    uint16_t m_packet_id = 0;
+};
+
+} // namespace mesh_ingest
+
+#endif /**< __MESH_MQTT_SUB_H__ */
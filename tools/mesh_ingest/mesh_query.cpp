@@ -0,0 +1,112 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * @brief Range queries on the store written by mesh_ingest, output is CSV
+ *
+ *   mesh_query -d DIR                                   list the series
+ *   mesh_query -d DIR -n NODE -c CHANNEL [-f FROM_MS] [-t TO_MS] [-b BUCKET_MS]
+ */
+
+#include "mesh_store.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <unistd.h>
+
+using namespace mesh_ingest;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s -d DIR [-n NODE -c CHANNEL [-f FROM_MS] [-t TO_MS] [-b BUCKET_MS]]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string dir;
+    std::string node;
+    std::string channel;
+    int64_t from = 0;
+    int64_t to = std::numeric_limits<int64_t>::max();
+    int64_t bucket_ms = 0;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "d:n:c:f:t:b:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dir = optarg;
+                break;
+
+            case 'n':
+                node = optarg;
+                break;
+
+            case 'c':
+                channel = optarg;
+                break;
+
+            case 'f':
+                from = strtoll(optarg, nullptr, 0);
+                break;
+
+            case 't':
+                to = strtoll(optarg, nullptr, 0);
+                break;
+
+            case 'b':
+                bucket_ms = strtoll(optarg, nullptr, 0);
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (dir.empty() || node.empty() != channel.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    mesh_store store(dir);
+
+    if (node.empty()) {
+        for (const auto &node : store.nodes()) {
+            for (const auto &channel : store.channels(node)) {
+                printf("%s,%s\n", node.c_str(), channel.c_str());
+            }
+        }
+
+        return 0;
+    }
+
+    if (bucket_ms > 0) {
+        printf("ts,min,max,mean,count\n");
+
+        for (const auto &bucket : store.query(node, channel, from, to, bucket_ms)) {
+            printf("%" PRId64 ",%g,%g,%g,%" PRIu64 "\n", bucket.ts, bucket.min, bucket.max,
+                   bucket.sum / bucket.count, bucket.count);
+        }
+    } else {
+        printf("ts,value\n");
+
+        for (const auto &point : store.query(node, channel, from, to)) {
+            printf("%" PRId64 ",%g\n", point.ts, point.value);
+        }
+    }
+
+    return 0;
+}
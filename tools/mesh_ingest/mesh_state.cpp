@@ -0,0 +1,336 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_state.h"
+#include "mesh_envelope.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <set>
+
+namespace mesh_ingest {
+
+/**
+ * @brief Fields kept by the gateway itself, readings of the same name are dropped
+ */
+static const char *const g_mesh_state_reserved[] = {"root", "parent", "online", "seen", "ts"};
+
+static bool mesh_state_addr_valid(const std::string &addr)
+{
+    if (addr.size() != 12) {
+        return false;
+    }
+
+    for (char c : addr) {
+        if (!isxdigit((unsigned char)c)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Channel names are emitted as JSON keys without escaping
+ */
+static bool mesh_state_channel_valid(const std::string &channel)
+{
+    if (channel.empty()) {
+        return false;
+    }
+
+    for (char c : channel) {
+        if ((unsigned char)c < 0x20 || c == '"' || c == '\\') {
+            return false;
+        }
+    }
+
+    for (const char *reserved : g_mesh_state_reserved) {
+        if (channel == reserved) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static std::string mesh_state_quote(const std::string &value)
+{
+    return '"' + value + '"';
+}
+
+static void mesh_state_append_fields(std::string &json, const std::map<std::string, std::string> &fields)
+{
+    json += '{';
+
+    for (auto it = fields.begin(); it != fields.end(); ++it) {
+        if (it != fields.begin()) {
+            json += ',';
+        }
+
+        json += '"';
+        json += it->first;
+        json += "\":";
+        json += it->second;
+    }
+
+    json += '}';
+}
+
+mesh_state::mesh_state(size_t log_size, uint64_t first_version)
+    : m_log_size(log_size ? log_size : 1), m_version(first_version) {}
+
+uint64_t mesh_state::update(const std::string &addr, const fields_t &fields)
+{
+    fields_t &current = m_nodes[addr].fields;
+    fields_t changed;
+
+    for (const auto &field : fields) {
+        auto it = current.find(field.first);
+
+        if (it == current.end() || it->second != field.second) {
+            current[field.first] = field.second;
+            changed.insert(field);
+        }
+    }
+
+    if (changed.empty()) {
+        return 0;
+    }
+
+    char head[64];
+    snprintf(head, sizeof(head), "{\"v\":%" PRIu64 ",\"addr\":\"%s\",\"set\":", ++m_version, addr.c_str());
+
+    std::string json = head;
+    mesh_state_append_fields(json, changed);
+    json += '}';
+
+    m_log.push_back({m_version, std::move(json)});
+
+    if (m_log.size() > m_log_size) {
+        m_log.pop_front();
+    }
+
+    return m_version;
+}
+
+uint64_t mesh_state::apply_topo(const std::string &root, const std::vector<std::string> &addrs)
+{
+    std::set<std::string> members;
+    fields_t fields = {{"root", mesh_state_quote(root)}, {"online", "true"}};
+    uint64_t version = 0;
+
+    for (const auto &addr : addrs) {
+        if (mesh_state_addr_valid(addr)) {
+            members.insert(addr);
+            version = std::max(version, update(addr, fields));
+        }
+    }
+
+    /**< Nodes of this root missing from its routing table have left the mesh */
+    for (auto &node : m_nodes) {
+        auto root_it = node.second.fields.find("root");
+
+        if (root_it != node.second.fields.end() && root_it->second == fields["root"]
+                && !members.count(node.first)) {
+            version = std::max(version, update(node.first, {{"online", "false"}}));
+        }
+    }
+
+    return version;
+}
+
+uint64_t mesh_state::apply(const std::string &topic, const std::string &payload, int64_t now_ms)
+{
+    /**< mesh/{root}/toCloud, mesh/{root}/{node}/telemetry and mesh/{root}/topo, each with an optional /z */
+    std::vector<std::string> segments;
+
+    for (size_t start = 0, end = 0; end != std::string::npos; start = end + 1) {
+        end = topic.find('/', start);
+        segments.push_back(topic.substr(start, end == std::string::npos ? end : end - start));
+    }
+
+    if (segments.size() > 2 && segments.back() == "z") {
+        segments.pop_back();
+    }
+
+    if (segments.size() < 3 || segments[0] != "mesh" || !mesh_state_addr_valid(segments[1])) {
+        return 0;
+    }
+
+    const std::string &root = segments[1];
+    const std::string &kind = segments.back();
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (kind == "topo") {
+        std::vector<std::string> addrs;
+
+        if (!mesh_envelope_decode_topo(topic, payload, addrs)) {
+            return 0;
+        }
+
+        uint64_t version = apply_topo(root, addrs);
+
+        /**< Being in the routing table keeps a node from expiring, "seen" is left to its own messages */
+        for (const auto &addr : addrs) {
+            auto it = m_nodes.find(addr);
+
+            if (it != m_nodes.end()) {
+                it->second.seen_ms = now_ms;
+            }
+        }
+
+        return version;
+    }
+
+    if (kind != "toCloud" && kind != "telemetry") {
+        return 0;
+    }
+
+    mesh_envelope_t envelope;
+
+    if (!mesh_envelope_decode_message(topic, payload, envelope) || !mesh_state_addr_valid(envelope.addr)) {
+        return 0;
+    }
+
+    fields_t fields = {
+        {"root", mesh_state_quote(root)},
+        {"online", "true"},
+        {"seen", std::to_string(now_ms)},
+    };
+
+    if (mesh_state_addr_valid(envelope.parent)) {
+        fields["parent"] = mesh_state_quote(envelope.parent);
+    }
+
+    if (envelope.ts > 0) {
+        fields["ts"] = std::to_string(envelope.ts);
+    }
+
+    for (const auto &reading : envelope.readings) {
+        char value[32];
+
+        if (mesh_state_channel_valid(reading.channel) && std::isfinite(reading.value)) {
+            snprintf(value, sizeof(value), "%g", reading.value);
+            fields[reading.channel] = value;
+        }
+    }
+
+    uint64_t version = update(envelope.addr, fields);
+    m_nodes[envelope.addr].seen_ms = now_ms;
+
+    return version;
+}
+
+uint64_t mesh_state::expire(int64_t before_ms)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    uint64_t version = 0;
+
+    for (auto &node : m_nodes) {
+        auto online = node.second.fields.find("online");
+
+        if (node.second.seen_ms < before_ms && online != node.second.fields.end() && online->second == "true") {
+            version = update(node.first, {{"online", "false"}});
+        }
+    }
+
+    return version;
+}
+
+uint64_t mesh_state::version() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_version;
+}
+
+std::shared_ptr<const std::string> mesh_state::snapshot(uint64_t *version)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (version) {
+        *version = m_version;
+    }
+
+    if (m_snapshot && m_snapshot_version == m_version) {
+        return m_snapshot;
+    }
+
+    auto json = std::make_shared<std::string>("{\"v\":" + std::to_string(m_version) + ",\"nodes\":{");
+
+    for (auto it = m_nodes.begin(); it != m_nodes.end(); ++it) {
+        if (it != m_nodes.begin()) {
+            *json += ',';
+        }
+
+        *json += mesh_state_quote(it->first) + ':';
+        mesh_state_append_fields(*json, it->second.fields);
+    }
+
+    *json += "}}";
+    m_snapshot = json;
+    m_snapshot_version = m_version;
+
+    return m_snapshot;
+}
+
+bool mesh_state::node(const std::string &addr, std::string &json) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_nodes.find(addr);
+
+    if (it == m_nodes.end()) {
+        return false;
+    }
+
+    json = "{\"v\":" + std::to_string(m_version) + ",\"addr\":" + mesh_state_quote(addr) + ",\"state\":";
+    mesh_state_append_fields(json, it->second.fields);
+    json += '}';
+
+    return true;
+}
+
+bool mesh_state::changes(uint64_t since, std::vector<mesh_state_delta_t> &deltas, size_t max_num) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    /**< A version ahead of ours comes from another run of the gateway */
+    if (since >= m_version) {
+        return since == m_version;
+    }
+
+    /**< Versions in the log are consecutive */
+    uint64_t oldest = m_log.empty() ? m_version + 1 : m_log.front().version;
+
+    if (since + 1 < oldest) {
+        return false;
+    }
+
+    for (size_t i = since + 1 - oldest; i < m_log.size() && max_num; ++i, --max_num) {
+        deltas.push_back(m_log[i]);
+    }
+
+    return true;
+}
+
+size_t mesh_state::size() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_nodes.size();
+}
+
+} // namespace mesh_ingest
@@ -0,0 +1,129 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_STATE_H__
+#define __MESH_STATE_H__
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mesh_ingest {
+
+/**
+ * @brief A change of one node, already serialized as it is sent:
+ *        {"v":42,"addr":"30aea4000002","set":{"Temp":23.5,"seen":1700000000000}}
+ */
+struct mesh_state_delta_t {
+    uint64_t version;
+    std::string json;
+};
+
+/**
+ * @brief Latest state of every node of every mesh, built from the uplink
+ *        topics, with a log of versioned deltas
+ *
+ *        Fields of a node, JSON values:
+ *        root     address of the root that published it last
+ *        parent   parent in the last heartbeat
+ *        online   false once the root's routing table drops the node or
+ *                 nothing was heard from it for the offline timeout
+ *        seen     arrival time of the last message in ms
+ *        ts       "ts" of the last reading
+ *        <channel> last value of every reading, "Temp", "Humi", "layer"...
+ *
+ * @note  Every change bumps the version by one and logs the fields that
+ *        changed. A client that holds the state at version v catches up with
+ *        changes(v), a snapshot is needed once v fell out of the log.
+ */
+class mesh_state {
+public:
+    /**
+     * @param log_size      deltas kept for changes()
+     * @param first_version version before the first change, a restarted
+     *                      gateway starts above the versions its clients hold
+     *                      so that they take a snapshot
+     */
+    explicit mesh_state(size_t log_size = 65536, uint64_t first_version = 0);
+
+    /**
+     * @brief  Apply a message as received from the broker, toCloud, telemetry
+     *         and topo topics, compressed or not
+     *
+     * @return version of the change, 0 if nothing changed or the message is not understood
+     */
+    uint64_t apply(const std::string &topic, const std::string &payload, int64_t now_ms);
+
+    /**
+     * @brief  Mark the nodes not seen since before_ms offline
+     *
+     * @return version of the last change, 0 if nothing changed
+     */
+    uint64_t expire(int64_t before_ms);
+
+    uint64_t version() const;
+
+    /**
+     * @brief {"v":42,"nodes":{"30aea4000002":{"root":"30aea4000001",...},...}}
+     *
+     * @param version set to the version of the snapshot
+     *
+     * @note  Serialized once per version, concurrent readers share it
+     */
+    std::shared_ptr<const std::string> snapshot(uint64_t *version = nullptr);
+
+    /**
+     * @brief {"v":42,"addr":"30aea4000002","state":{...}}
+     *
+     * @return false if the node is unknown
+     */
+    bool node(const std::string &addr, std::string &json) const;
+
+    /**
+     * @brief  Deltas with since < version, oldest first, at most max_num
+     *
+     * @return false if some of them already fell out of the log, or since is
+     *         not a version of this state
+     */
+    bool changes(uint64_t since, std::vector<mesh_state_delta_t> &deltas, size_t max_num = SIZE_MAX) const;
+
+    size_t size() const;
+
+private:
+    typedef std::map<std::string, std::string> fields_t;
+
+    struct node_t {
+        fields_t fields;
+        int64_t seen_ms = 0;    /**< Last message or routing table that had the node */
+    };
+
+    uint64_t update(const std::string &addr, const fields_t &fields);
+    uint64_t apply_topo(const std::string &root, const std::vector<std::string> &addrs);
+
+    mutable std::mutex m_lock;
+    std::map<std::string, node_t> m_nodes;
+    std::deque<mesh_state_delta_t> m_log;
+    size_t m_log_size;
+    uint64_t m_version;
+    uint64_t m_snapshot_version = 0;
+    std::shared_ptr<const std::string> m_snapshot;
+};
+
+} // namespace mesh_ingest
+
+#endif /**< __MESH_STATE_H__ */
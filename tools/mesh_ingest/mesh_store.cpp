@@ -0,0 +1,406 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mesh_store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace mesh_ingest {
+
+static const size_t MESH_STORE_HEADER_SIZE = 4096;
+
+static size_t mesh_store_segment_size(uint64_t capacity)
+{
+    return MESH_STORE_HEADER_SIZE + capacity * (sizeof(int64_t) + sizeof(float));
+}
+
+/**
+ * @brief Node and channel names come from the network, keep them to one path component
+ */
+static bool mesh_store_name_valid(const std::string &name)
+{
+    if (name.empty() || name.size() > 64 || name[0] == '.') {
+        return false;
+    }
+
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '.';
+    });
+}
+
+static bool mesh_store_point_less(const mesh_store_point_t &a, const mesh_store_point_t &b)
+{
+    return a.ts < b.ts;
+}
+
+mesh_store_segment::~mesh_store_segment()
+{
+    if (m_base) {
+        munmap(m_base, m_size);
+    }
+}
+
+bool mesh_store_segment::map(int fd, size_t size)
+{
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+
+    m_size   = size;
+    m_base   = static_cast<uint8_t *>(base);
+    m_header = reinterpret_cast<mesh_store_segment_header_t *>(m_base);
+    m_ts     = reinterpret_cast<int64_t *>(m_base + MESH_STORE_HEADER_SIZE);
+    m_values = reinterpret_cast<float *>(m_base + MESH_STORE_HEADER_SIZE + m_header->capacity * sizeof(int64_t));
+
+    return true;
+}
+
+std::unique_ptr<mesh_store_segment> mesh_store_segment::create(const std::string &path, uint64_t capacity)
+{
+    std::unique_ptr<mesh_store_segment> segment(new mesh_store_segment());
+    size_t size = mesh_store_segment_size(capacity);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    if (fd < 0) {
+        perror(path.c_str());
+        return nullptr;
+    }
+
+    /**< Sparse, only the pages that are written take disk space */
+    mesh_store_segment_header_t header = {};
+    memcpy(header.magic, "MSEG", 4);
+    header.version  = MESH_STORE_VERSION;
+    header.capacity = capacity;
+    header.sorted   = 1;
+
+    if (ftruncate(fd, size) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)
+            || !segment->map(fd, size)) {
+        perror(path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    close(fd);
+    return segment;
+}
+
+std::unique_ptr<mesh_store_segment> mesh_store_segment::open(const std::string &path)
+{
+    std::unique_ptr<mesh_store_segment> segment(new mesh_store_segment());
+    mesh_store_segment_header_t header = {};
+    struct stat st = {};
+    int fd = ::open(path.c_str(), O_RDWR);
+
+    if (fd < 0) {
+        perror(path.c_str());
+        return nullptr;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, "MSEG", 4)
+            || header.version != MESH_STORE_VERSION || header.count > header.capacity
+            || fstat(fd, &st) != 0 || (size_t)st.st_size != mesh_store_segment_size(header.capacity)
+            || !segment->map(fd, st.st_size)) {
+        fprintf(stderr, "%s: not a segment file\n", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    close(fd);
+    return segment;
+}
+
+void mesh_store_segment::append(int64_t ts, float value)
+{
+    uint64_t count = m_header->count;
+
+    m_ts[count]     = ts;
+    m_values[count] = value;
+
+    if (count == 0) {
+        m_header->min_ts = ts;
+        m_header->max_ts = ts;
+    } else {
+        m_header->sorted &= ts >= m_header->max_ts;
+        m_header->min_ts  = std::min(m_header->min_ts, ts);
+        m_header->max_ts  = std::max(m_header->max_ts, ts);
+    }
+
+    /**< Publish the row only after both columns are written */
+    __atomic_store_n(&m_header->count, count + 1, __ATOMIC_RELEASE);
+}
+
+std::pair<uint64_t, uint64_t> mesh_store_segment::bounds(int64_t from, int64_t to) const
+{
+    uint64_t count = __atomic_load_n(&m_header->count, __ATOMIC_ACQUIRE);
+
+    if (count == 0 || to <= m_header->min_ts || from > m_header->max_ts) {
+        return {0, 0};
+    }
+
+    if (!m_header->sorted) {
+        return {0, count};
+    }
+
+    const int64_t *ts    = m_ts;
+    const int64_t *begin = std::lower_bound(ts, ts + count, from);
+    const int64_t *end   = std::lower_bound(begin, ts + count, to);
+
+    return {begin - m_ts, end - m_ts};
+}
+
+void mesh_store_segment::range(int64_t from, int64_t to, std::vector<mesh_store_point_t> &points) const
+{
+    auto bounds = this->bounds(from, to);
+
+    for (uint64_t i = bounds.first; i < bounds.second; ++i) {
+        if (m_ts[i] >= from && m_ts[i] < to) {
+            points.push_back({m_ts[i], m_values[i]});
+        }
+    }
+}
+
+void mesh_store_segment::range(int64_t from, int64_t to, int64_t bucket_ms,
+                               std::map<int64_t, mesh_store_bucket_t> &buckets) const
+{
+    auto bounds = this->bounds(from, to);
+    mesh_store_bucket_t *bucket = nullptr;
+
+    for (uint64_t i = bounds.first; i < bounds.second; ++i) {
+        int64_t ts = m_ts[i];
+        float value = m_values[i];
+
+        if (ts < from || ts >= to) {
+            continue;
+        }
+
+        int64_t start = ts - ((ts % bucket_ms) + bucket_ms) % bucket_ms;
+
+        /**< Rows of a sorted segment hit the same bucket many times in a row */
+        if (bucket == nullptr || bucket->ts != start) {
+            auto it = buckets.try_emplace(start, mesh_store_bucket_t {start, value, value, 0, 0}).first;
+            bucket = &it->second;
+        }
+
+        bucket->min = std::min(bucket->min, value);
+        bucket->max = std::max(bucket->max, value);
+        bucket->sum += value;
+        bucket->count++;
+    }
+}
+
+void mesh_store_segment::sync(bool wait) const
+{
+    msync(m_base, m_size, wait ? MS_SYNC : MS_ASYNC);
+}
+
+mesh_store::mesh_store(const std::string &dir, uint64_t segment_capacity)
+    : m_dir(dir), m_segment_capacity(segment_capacity)
+{
+    fs::create_directories(m_dir);
+    load();
+}
+
+mesh_store::~mesh_store()
+{
+    sync(true);
+}
+
+void mesh_store::load()
+{
+    for (const auto &node : fs::directory_iterator(m_dir)) {
+        if (!node.is_directory()) {
+            continue;
+        }
+
+        for (const auto &channel : fs::directory_iterator(node.path())) {
+            std::vector<fs::path> files;
+
+            if (!channel.is_directory()) {
+                continue;
+            }
+
+            for (const auto &file : fs::directory_iterator(channel.path())) {
+                if (file.is_regular_file() && file.path().extension() == ".seg") {
+                    files.push_back(file.path());
+                }
+            }
+
+            /**< Zero padded names, so the order is the order they were created in */
+            std::sort(files.begin(), files.end());
+            series_t &series = m_series[node.path().filename().string() + "/" + channel.path().filename().string()];
+
+            for (const auto &file : files) {
+                /**< Files that fail to open keep their name taken */
+                series.next_index = std::max<uint64_t>(series.next_index,
+                                                       strtoull(file.stem().c_str(), nullptr, 10) + 1);
+
+                auto segment = mesh_store_segment::open(file.string());
+
+                if (segment) {
+                    m_rows += segment->header().count;
+                    series.segments.push_back(std::move(segment));
+                }
+            }
+        }
+    }
+}
+
+mesh_store::series_t *mesh_store::series(const std::string &node, const std::string &channel, bool create)
+{
+    std::string key = node + "/" + channel;
+    auto it = m_series.find(key);
+
+    if (it != m_series.end()) {
+        return &it->second;
+    }
+
+    if (!create || !mesh_store_name_valid(node) || !mesh_store_name_valid(channel)) {
+        return nullptr;
+    }
+
+    fs::create_directories(fs::path(m_dir) / node / channel);
+    return &m_series[key];
+}
+
+bool mesh_store::append(const std::string &node, const std::string &channel, int64_t ts, float value)
+{
+    series_t *series = this->series(node, channel, true);
+
+    if (series == nullptr) {
+        return false;
+    }
+
+    if (series->segments.empty() || series->segments.back()->full()) {
+        char name[32];
+        snprintf(name, sizeof(name), "%06llu.seg", (unsigned long long)series->next_index++);
+
+        auto segment = mesh_store_segment::create((fs::path(m_dir) / node / channel / name).string(), m_segment_capacity);
+
+        if (!segment) {
+            return false;
+        }
+
+        /**< A full segment is never written again, start its writeback now */
+        if (!series->segments.empty()) {
+            series->segments.back()->sync(false);
+        }
+
+        series->segments.push_back(std::move(segment));
+    }
+
+    series->segments.back()->append(ts, value);
+    m_rows++;
+
+    return true;
+}
+
+std::vector<mesh_store_point_t> mesh_store::query(const std::string &node, const std::string &channel,
+                                                  int64_t from, int64_t to)
+{
+    std::vector<mesh_store_point_t> points;
+    series_t *series = this->series(node, channel, false);
+
+    if (series == nullptr) {
+        return points;
+    }
+
+    for (const auto &segment : series->segments) {
+        segment->range(from, to, points);
+    }
+
+    /**< Late rows end up in later segments, or unsorted ones */
+    if (!std::is_sorted(points.begin(), points.end(), mesh_store_point_less)) {
+        std::stable_sort(points.begin(), points.end(), mesh_store_point_less);
+    }
+
+    return points;
+}
+
+std::vector<mesh_store_bucket_t> mesh_store::query(const std::string &node, const std::string &channel,
+                                                   int64_t from, int64_t to, int64_t bucket_ms)
+{
+    std::map<int64_t, mesh_store_bucket_t> buckets;
+    std::vector<mesh_store_bucket_t> result;
+    series_t *series = this->series(node, channel, false);
+
+    if (series == nullptr || bucket_ms <= 0) {
+        return result;
+    }
+
+    for (const auto &segment : series->segments) {
+        segment->range(from, to, bucket_ms, buckets);
+    }
+
+    result.reserve(buckets.size());
+
+    for (const auto &bucket : buckets) {
+        result.push_back(bucket.second);
+    }
+
+    return result;
+}
+
+std::vector<std::string> mesh_store::nodes() const
+{
+    std::vector<std::string> nodes;
+
+    for (const auto &series : m_series) {
+        nodes.push_back(series.first.substr(0, series.first.find('/')));
+    }
+
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+    return nodes;
+}
+
+std::vector<std::string> mesh_store::channels(const std::string &node) const
+{
+    std::vector<std::string> channels;
+    std::string prefix = node + "/";
+
+    for (const auto &series : m_series) {
+        if (series.first.compare(0, prefix.size(), prefix) == 0) {
+            channels.push_back(series.first.substr(prefix.size()));
+        }
+    }
+
+    std::sort(channels.begin(), channels.end());
+
+    return channels;
+}
+
+void mesh_store::sync(bool wait)
+{
+    for (const auto &series : m_series) {
+        for (const auto &segment : series.second.segments) {
+            segment->sync(wait);
+        }
+    }
+}
+
+} // namespace mesh_ingest
@@ -0,0 +1,151 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MESH_STORE_H__
+#define __MESH_STORE_H__
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define MESH_STORE_VERSION (1)
+
+namespace mesh_ingest {
+
+/**
+ * @brief One segment file: {dir}/{node}/{channel}/{index}.seg
+ *
+ *        header (one page)
+ *        capacity x int64_t timestamp in ms
+ *        capacity x float value
+ *
+ * @note  The file is created sparse with its full size and mapped once, an
+ *        append writes both columns and then bumps the count in the header.
+ *        A reader never sees a count that covers unwritten rows.
+ */
+struct mesh_store_segment_header_t {
+    char magic[4];      /**< "MSEG" */
+    uint32_t version;   /**< MESH_STORE_VERSION */
+    uint64_t capacity;
+    uint64_t count;
+    int64_t min_ts;
+    int64_t max_ts;
+    uint32_t sorted;    /**< Timestamps are non-decreasing, so range lookups can bisect */
+};
+
+struct mesh_store_point_t {
+    int64_t ts;
+    float value;
+};
+
+/**
+ * @brief Result of a downsampled range query, one per non-empty bucket
+ */
+struct mesh_store_bucket_t {
+    int64_t ts;     /**< Start of the bucket */
+    float min;
+    float max;
+    double sum;
+    uint64_t count;
+};
+
+class mesh_store_segment {
+public:
+    ~mesh_store_segment();
+
+    static std::unique_ptr<mesh_store_segment> create(const std::string &path, uint64_t capacity);
+    static std::unique_ptr<mesh_store_segment> open(const std::string &path);
+
+    bool full() const { return m_header->count == m_header->capacity; }
+    const mesh_store_segment_header_t &header() const { return *m_header; }
+
+    void append(int64_t ts, float value);
+
+    /**
+     * @brief Rows with from <= ts < to, in storage order
+     */
+    void range(int64_t from, int64_t to, std::vector<mesh_store_point_t> &points) const;
+    void range(int64_t from, int64_t to, int64_t bucket_ms, std::map<int64_t, mesh_store_bucket_t> &buckets) const;
+
+    void sync(bool wait) const;
+
+private:
+    mesh_store_segment() = default;
+    bool map(int fd, size_t size);
+    std::pair<uint64_t, uint64_t> bounds(int64_t from, int64_t to) const;
+
+    size_t m_size = 0;
+    uint8_t *m_base = nullptr;
+    mesh_store_segment_header_t *m_header = nullptr;
+    int64_t *m_ts = nullptr;
+    float *m_values = nullptr;
+};
+
+/**
+ * @brief Columnar store of per-node, per-channel series
+ */
+class mesh_store {
+public:
+    /**
+     * @param dir              root directory, created if missing
+     * @param segment_capacity rows per segment file
+     */
+    explicit mesh_store(const std::string &dir, uint64_t segment_capacity = 1 << 20);
+    ~mesh_store();
+
+    bool append(const std::string &node, const std::string &channel, int64_t ts, float value);
+
+    /**
+     * @brief Raw points with from <= ts < to
+     */
+    std::vector<mesh_store_point_t> query(const std::string &node, const std::string &channel,
+                                          int64_t from, int64_t to);
+
+    /**
+     * @brief min/max/sum/count per bucket_ms wide bucket, buckets are aligned to multiples of bucket_ms
+     */
+    std::vector<mesh_store_bucket_t> query(const std::string &node, const std::string &channel,
+                                           int64_t from, int64_t to, int64_t bucket_ms);
+
+    std::vector<std::string> nodes() const;
+    std::vector<std::string> channels(const std::string &node) const;
+
+    /**
+     * @brief Flush dirty pages, wait for the disk with wait set
+     */
+    void sync(bool wait = false);
+
+    uint64_t size() const { return m_rows; }
+
+private:
+    struct series_t {
+        std::vector<std::unique_ptr<mesh_store_segment>> segments;
+        uint64_t next_index = 0;    /**< Above the index of every segment file, opened or not */
+    };
+
+    series_t *series(const std::string &node, const std::string &channel, bool create);
+    void load();
+
+    std::string m_dir;
+    uint64_t m_segment_capacity;
+    uint64_t m_rows = 0;
+    std::unordered_map<std::string, series_t> m_series; /**< Keyed by "{node}/{channel}" */
+};
+
+} // namespace mesh_ingest
+
+#endif /**< __MESH_STORE_H__ */
@@ -0,0 +1,379 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/**
+ * Field simulator for the placement policy of components/mesh_shard.
+ *
+ *   mesh_shard_sim [-n NODES] [-r ROOTS] [-w WIDTH_M] [-R RANGE_M] [-c CAPACITY]
+ *                  [-k ROUNDS] [-s SEED] [-x]
+ *
+ * ROOTS roots stand evenly spaced across a square field, NODES nodes are
+ * placed at random and boot in random order. A node hears a mesh through
+ * the members in radio range and joins with the policy of the firmware,
+ * using the loads of the last report, as the beacons carry them. Every
+ * round is one report interval: roots compute their load, overloaded roots
+ * ask a share of their leaf nodes to choose again. -x places every node by
+ * the hash of its address instead, which is what nodes do when no mesh of
+ * the field is heard.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mesh_shard_policy.h"
+
+#define SIM_MESH_MAX_NUM  (16)
+#define SIM_MAX_LAYER     (6)
+#define SIM_HIGH_REPORTS  (2)
+#define SIM_SETTLE_ROUNDS (3)
+
+typedef struct {
+    double x;
+    double y;
+    int mesh;   /**< -1 until the node has joined */
+    int layer;  /**< 1 for the root */
+    int parent;
+    int joined; /**< Round the node chose its mesh */
+} sim_node_t;
+
+typedef struct {
+    uint8_t mesh_id[MESH_SHARD_ID_LEN];
+    uint8_t load; /**< Load of the last report, advertised in the beacons */
+    int high_num;
+} sim_mesh_t;
+
+static sim_node_t *g_nodes;
+static int g_node_num;
+static sim_mesh_t g_meshes[SIM_MESH_MAX_NUM];
+static int g_mesh_num;
+static double g_range = 60;
+static uint32_t g_seed = 1;
+
+static mesh_shard_policy_t g_policy = {
+    .node_capacity = 50,
+    .hop_cost = 10,
+    .hysteresis = 10,
+    .high_load = 90,
+    .target_load = 75,
+    .min_rssi = -85,
+};
+
+static uint32_t sim_random()
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+
+static double sim_distance(const sim_node_t *a, const sim_node_t *b)
+{
+    return hypot(a->x - b->x, a->y - b->y);
+}
+
+/**< Log-distance path loss, -85 dBm at about 60 m */
+static int sim_rssi(double distance)
+{
+    return -40 - (int)(25 * log10(distance < 1 ? 1 : distance));
+}
+
+static int sim_mesh_node_num(int mesh)
+{
+    int num = 0;
+
+    for (int i = 0; i < g_node_num; ++i) {
+        num += g_nodes[i].mesh == mesh;
+    }
+
+    return num;
+}
+
+static int sim_child_num(int node)
+{
+    int num = 0;
+
+    for (int i = 0; i < g_node_num; ++i) {
+        num += g_nodes[i].mesh >= 0 && g_nodes[i].parent == node;
+    }
+
+    return num;
+}
+
+/**
+ * @brief Scan of one node: every member in range is heard, the policy keeps
+ *        the best one per mesh. Returns the mesh chosen, -1 if none is heard.
+ */
+static int sim_select(int node, int current, bool shard, int *parent)
+{
+    mesh_shard_candidate_t candidates[SIM_MESH_MAX_NUM];
+    size_t num = 0;
+
+    for (int i = 0; i < g_node_num; ++i) {
+        const sim_node_t *member = g_nodes + i;
+        double distance = sim_distance(g_nodes + node, member);
+
+        if (i == node || member->mesh < 0 || member->layer >= SIM_MAX_LAYER || distance > g_range
+                || (!shard && member->mesh != current)) {
+            continue;
+        }
+
+        mesh_shard_candidate_t heard = {
+            .load = g_meshes[member->mesh].load,
+            .layer = member->layer,
+            .rssi = sim_rssi(distance),
+        };
+        memcpy(heard.mesh_id, g_meshes[member->mesh].mesh_id, MESH_SHARD_ID_LEN);
+        num = mesh_shard_policy_merge(&g_policy, candidates, num, SIM_MESH_MAX_NUM, &heard);
+    }
+
+    int index = mesh_shard_policy_select(&g_policy, candidates, num, g_meshes[current].mesh_id);
+
+    if (index < 0) {
+        return -1;
+    }
+
+    int mesh = 0;
+
+    while (memcmp(g_meshes[mesh].mesh_id, candidates[index].mesh_id, MESH_SHARD_ID_LEN)) {
+        mesh++;
+    }
+
+    /**< The parent is the closest member of the chosen mesh on the advertised layer */
+    for (int i = 0; i < g_node_num; ++i) {
+        const sim_node_t *member = g_nodes + i;
+
+        if (i != node && member->mesh == mesh && member->layer == candidates[index].layer
+                && sim_rssi(sim_distance(g_nodes + node, member)) >= g_policy.min_rssi
+                && sim_distance(g_nodes + node, member) <= g_range
+                && (*parent < 0 || sim_distance(g_nodes + node, member) < sim_distance(g_nodes + node, g_nodes + *parent))) {
+            *parent = i;
+        }
+    }
+
+    return mesh;
+}
+
+static void sim_join(int node, int mesh, int parent, int round)
+{
+    g_nodes[node].mesh = mesh;
+    g_nodes[node].parent = parent;
+    g_nodes[node].layer = g_nodes[parent].layer + 1;
+    g_nodes[node].joined = round;
+}
+
+/**
+ * @brief Nodes boot in random order, a node that hears nothing retries after
+ *        the others, until no node can join any more.
+ */
+static void sim_boot(const int *order, int num, bool shard, int round, int current)
+{
+    for (bool progress = true; progress;) {
+        progress = false;
+
+        for (int i = 0; i < num; ++i) {
+            int node = order[i];
+            int parent = -1;
+            int home = current >= 0 ? current : shard ? 0 : node % g_mesh_num;
+
+            if (g_nodes[node].mesh >= 0) {
+                continue;
+            }
+
+            int mesh = sim_select(node, home, shard, &parent);
+
+            if (mesh >= 0 && parent >= 0) {
+                sim_join(node, mesh, parent, round);
+                progress = true;
+            }
+        }
+    }
+}
+
+static void sim_report(int round, int moves)
+{
+    int orphans = 0;
+
+    for (int i = 0; i < g_node_num; ++i) {
+        orphans += g_nodes[i].mesh < 0;
+    }
+
+    printf("round %3d  moves %4d  orphans %4d  load", round, moves, orphans);
+
+    for (int i = 0; i < g_mesh_num; ++i) {
+        printf(" %3d%%", g_meshes[i].load);
+    }
+
+    printf("\n");
+}
+
+static void sim_summary()
+{
+    printf("\n%-8s %6s %6s %10s %10s\n", "mesh", "nodes", "load", "max layer", "mean layer");
+
+    for (int i = 0; i < g_mesh_num; ++i) {
+        int num = 0, max_layer = 0, layers = 0;
+
+        for (int j = 0; j < g_node_num; ++j) {
+            if (g_nodes[j].mesh == i && g_nodes[j].layer > 1) {
+                num++;
+                layers += g_nodes[j].layer;
+                max_layer = g_nodes[j].layer > max_layer ? g_nodes[j].layer : max_layer;
+            }
+        }
+
+        printf("%-8.6s %6d %5d%% %10d %10.2f\n", (char *)g_meshes[i].mesh_id, num,
+               g_meshes[i].load, max_layer, num ? (double)layers / num : 0);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n NODES] [-r ROOTS] [-w WIDTH_M] [-R RANGE_M] [-c CAPACITY] "
+            "[-k ROUNDS] [-s SEED] [-x]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    int sensor_num = 120;
+    double width = 300;
+    int rounds = 20;
+    bool shard = true;
+    int opt = 0;
+
+    g_mesh_num = 3;
+
+    while ((opt = getopt(argc, argv, "n:r:w:R:c:k:s:x")) != -1) {
+        switch (opt) {
+            case 'n':
+                sensor_num = atoi(optarg);
+                break;
+
+            case 'r':
+                g_mesh_num = atoi(optarg);
+                break;
+
+            case 'w':
+                width = atof(optarg);
+                break;
+
+            case 'R':
+                g_range = atof(optarg);
+                break;
+
+            case 'c':
+                g_policy.node_capacity = atoi(optarg);
+                break;
+
+            case 'k':
+                rounds = atoi(optarg);
+                break;
+
+            case 's':
+                g_seed = (uint32_t)strtoul(optarg, NULL, 0) * 2 + 1;
+                break;
+
+            case 'x':
+                shard = false;
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (sensor_num <= 0 || g_mesh_num <= 0 || g_mesh_num > SIM_MESH_MAX_NUM || width <= 0 || g_range <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /**< The roots come first, one per mesh, evenly spaced on a grid */
+    int grid = (int)ceil(sqrt(g_mesh_num));
+    g_node_num = g_mesh_num + sensor_num;
+    g_nodes = calloc(g_node_num, sizeof(sim_node_t));
+    int *order = calloc(sensor_num, sizeof(int));
+
+    for (int i = 0; i < g_mesh_num; ++i) {
+        char mesh_id[MESH_SHARD_ID_LEN + 1];
+        snprintf(mesh_id, sizeof(mesh_id), "field%x", i & 0xf);
+        memcpy(g_meshes[i].mesh_id, mesh_id, MESH_SHARD_ID_LEN);
+        g_nodes[i].x = width * (i % grid + 0.5) / grid;
+        g_nodes[i].y = width * (i / grid + 0.5) / grid;
+        g_nodes[i].mesh = i;
+        g_nodes[i].layer = 1;
+        g_nodes[i].parent = -1;
+    }
+
+    for (int i = g_mesh_num; i < g_node_num; ++i) {
+        g_nodes[i].x = width * (sim_random() % 10000) / 10000;
+        g_nodes[i].y = width * (sim_random() % 10000) / 10000;
+        g_nodes[i].mesh = -1;
+        order[i - g_mesh_num] = i;
+    }
+
+    for (int i = sensor_num - 1; i > 0; --i) {
+        int j = sim_random() % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    sim_boot(order, sensor_num, shard, 0, -1);
+
+    for (int round = 1; round <= rounds; ++round) {
+        int moves = 0;
+        uint16_t shed[SIM_MESH_MAX_NUM] = {0};
+
+        for (int i = 0; i < g_mesh_num; ++i) {
+            sim_mesh_t *mesh = g_meshes + i;
+            mesh->load = mesh_shard_policy_load(&g_policy, sim_mesh_node_num(i), 0, 0, true);
+            mesh->high_num = mesh->load >= g_policy.high_load ? mesh->high_num + 1 : 0;
+            shed[i] = shard && mesh->high_num >= SIM_HIGH_REPORTS ? mesh_shard_policy_shed(&g_policy, mesh->load) : 0;
+        }
+
+        /**< Leaf nodes decide on the same report, then choose with the loads it carried */
+        int *leaving = calloc(sensor_num, sizeof(int));
+        int leaving_num = 0;
+
+        for (int i = g_mesh_num; i < g_node_num; ++i) {
+            sim_node_t *node = g_nodes + i;
+
+            if (node->mesh >= 0 && shed[node->mesh] && !sim_child_num(i)
+                    && round - node->joined > SIM_SETTLE_ROUNDS && sim_random() % 1000 < shed[node->mesh]) {
+                leaving[leaving_num++] = i;
+            }
+        }
+
+        for (int i = 0; i < leaving_num; ++i) {
+            int node = leaving[i];
+            int from = g_nodes[node].mesh;
+            g_nodes[node].mesh = -1;
+            sim_boot(&node, 1, shard, round, from);
+            moves += g_nodes[node].mesh != from;
+        }
+
+        free(leaving);
+        sim_report(round, moves);
+    }
+
+    sim_summary();
+
+    free(order);
+    free(g_nodes);
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/**
+ * Local SNTP server for components/mesh_time, so that a bench runs without
+ * internet access.
+ *
+ *   mesh_sntp [-p PORT] [-o OFFSET_MS] [-n REQUESTS]
+ *   mesh_sntp -q HOST [-p PORT]
+ *
+ * Point CONFIG_MESH_TIME_SNTP_SERVER at the host running it. It answers with
+ * the clock of the host shifted by OFFSET_MS, which steps the root clock and
+ * exercises the step handling of the nodes. It exits after REQUESTS replies,
+ * or never if 0.
+ *
+ * -q sends one request to HOST instead and prints the offset of its clock
+ * from the local one, the exit status is non-zero without a valid reply.
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define SNTP_PACKET_LEN     (48)
+#define SNTP_UNIX_EPOCH     (2208988800ULL) /**< 1970-01-01 in seconds since 1900 */
+#define SNTP_VERSION        (4)
+#define SNTP_MODE_CLIENT    (3)
+#define SNTP_MODE_SERVER    (4)
+#define SNTP_QUERY_TIMEOUT  (2)             /**< s */
+
+/**< Offsets of the timestamps in the packet */
+#define SNTP_REFERENCE      (16)
+#define SNTP_ORIGINATE      (24)
+#define SNTP_RECEIVE        (32)
+#define SNTP_TRANSMIT       (40)
+
+static int64_t sntp_now_us()
+{
+    struct timeval tv = {0};
+
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void sntp_put_time(uint8_t *buf, int64_t time_us)
+{
+    uint32_t sec = (uint32_t)(time_us / 1000000 + SNTP_UNIX_EPOCH);
+    uint32_t frac = (uint32_t)(((uint64_t)(time_us % 1000000) << 32) / 1000000);
+
+    sec = htonl(sec);
+    frac = htonl(frac);
+    memcpy(buf, &sec, 4);
+    memcpy(buf + 4, &frac, 4);
+}
+
+static int64_t sntp_get_time(const uint8_t *buf)
+{
+    uint32_t sec = 0;
+    uint32_t frac = 0;
+
+    memcpy(&sec, buf, 4);
+    memcpy(&frac, buf + 4, 4);
+    sec = ntohl(sec);
+    frac = ntohl(frac);
+
+    return ((int64_t)sec - (int64_t)SNTP_UNIX_EPOCH) * 1000000 + (int64_t)(((uint64_t)frac * 1000000) >> 32);
+}
+
+static int sntp_serve(uint16_t port, int64_t offset_us, int requests)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int replies = 0;
+
+    if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("mesh_sntp: bind");
+        return 1;
+    }
+
+    printf("mesh_sntp: port %u, offset %lld ms\n", port, (long long)(offset_us / 1000));
+    fflush(stdout);
+
+    while (requests == 0 || replies < requests) {
+        uint8_t packet[SNTP_PACKET_LEN] = {0};
+        struct sockaddr_in peer = {0};
+        socklen_t peer_len = sizeof(peer);
+        ssize_t size = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&peer, &peer_len);
+        int64_t receive_us = sntp_now_us() + offset_us;
+
+        /**< Anything but a client request is dropped, as a real server would */
+        if (size < SNTP_PACKET_LEN || (packet[0] & 0x07) != SNTP_MODE_CLIENT) {
+            continue;
+        }
+
+        uint8_t version = (packet[0] >> 3) & 0x07;
+
+        /**< The transmit time of the request comes back as the originate time */
+        memcpy(packet + SNTP_ORIGINATE, packet + SNTP_TRANSMIT, 8);
+        packet[0] = (version << 3) | SNTP_MODE_SERVER;
+        packet[1] = 1;      /**< Stratum, a primary reference */
+        packet[2] = 4;      /**< Poll interval, log2 s */
+        packet[3] = 0xec;   /**< Precision, log2 s, about 60 ns */
+        memset(packet + 4, 0, 8);
+        memcpy(packet + 12, "LOCL", 4);
+        sntp_put_time(packet + SNTP_REFERENCE, receive_us);
+        sntp_put_time(packet + SNTP_RECEIVE, receive_us);
+        sntp_put_time(packet + SNTP_TRANSMIT, sntp_now_us() + offset_us);
+
+        if (sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *)&peer, peer_len) == sizeof(packet)) {
+            ++replies;
+        }
+    }
+
+    close(sock);
+    return 0;
+}
+
+static int sntp_query(const char *host, uint16_t port)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *info = NULL;
+    struct timeval timeout = {.tv_sec = SNTP_QUERY_TIMEOUT};
+    char service[8] = {0};
+    uint8_t packet[SNTP_PACKET_LEN] = {0};
+    uint8_t request_time[8] = {0};
+    int sock = -1;
+
+    snprintf(service, sizeof(service), "%u", port);
+
+    if (getaddrinfo(host, service, &hints, &info) != 0) {
+        fprintf(stderr, "mesh_sntp: unknown host %s\n", host);
+        return 1;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    int64_t originate_us = sntp_now_us();
+
+    packet[0] = (SNTP_VERSION << 3) | SNTP_MODE_CLIENT;
+    sntp_put_time(packet + SNTP_TRANSMIT, originate_us);
+    memcpy(request_time, packet + SNTP_TRANSMIT, sizeof(request_time));
+
+    if (sendto(sock, packet, sizeof(packet), 0, info->ai_addr, info->ai_addrlen) != sizeof(packet)
+            || recv(sock, packet, sizeof(packet), 0) != sizeof(packet)) {
+        fprintf(stderr, "mesh_sntp: no reply from %s:%u\n", host, port);
+        freeaddrinfo(info);
+        close(sock);
+        return 1;
+    }
+
+    int64_t destination_us = sntp_now_us();
+
+    freeaddrinfo(info);
+    close(sock);
+
+    /**< Checked the way lwIP does before it sets the clock */
+    if ((packet[0] & 0x07) != SNTP_MODE_SERVER || packet[1] == 0
+            || memcmp(packet + SNTP_ORIGINATE, request_time, sizeof(request_time))) {
+        fprintf(stderr, "mesh_sntp: invalid reply\n");
+        return 1;
+    }
+
+    int64_t receive_us = sntp_get_time(packet + SNTP_RECEIVE);
+    int64_t transmit_us = sntp_get_time(packet + SNTP_TRANSMIT);
+    int64_t offset_us = ((receive_us - originate_us) + (transmit_us - destination_us)) / 2;
+    int64_t delay_us = (destination_us - originate_us) - (transmit_us - receive_us);
+
+    printf("offset %lld ms, delay %lld us\n", (long long)(offset_us / 1000), (long long)delay_us);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-p PORT] [-o OFFSET_MS] [-n REQUESTS]\n"
+            "       %s -q HOST [-p PORT]\n", name, name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = NULL;
+    int port = 123;
+    int64_t offset_ms = 0;
+    int requests = 0;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "p:o:n:q:")) != -1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+
+            case 'o':
+                offset_ms = strtoll(optarg, NULL, 0);
+                break;
+
+            case 'n':
+                requests = atoi(optarg);
+                break;
+
+            case 'q':
+                host = optarg;
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (port <= 0 || port > UINT16_MAX || requests < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    return host ? sntp_query(host, port) : sntp_serve(port, offset_ms * 1000, requests);
+}
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Check the test material against what the root expects, without a broker:
+# openssl s_server stands in for the TLS listeners of mosquitto.conf and
+# s_client for the root. Run by `make test`, the exit status is non-zero on
+# a failure.
+
+OPENSSL=${OPENSSL:-openssl}
+BROKER_IP=${BROKER_IP:-127.0.0.1}
+PSK_ID=${PSK_ID:-mesh}
+PORT=${PORT:-18883}
+
+PSK_KEY=`cut -d: -f2 certs/psk.txt`
+PSK_CIPHERS=`sed -n 's/^ciphers //p' mosquitto.conf`
+FAILED=0
+
+check()
+{
+    if [ "$2" = 0 ]; then
+        echo "$1: ok"
+    else
+        echo "$1: FAILED"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# Run s_server with the arguments after $1 for one connection, then s_client
+# with $1, and print what both of them said
+handshake()
+{
+    client_args=$1
+    shift
+    $OPENSSL s_server -accept $PORT -naccept 1 -tls1_2 -quiet "$@" < /dev/null > /dev/null 2>&1 &
+    server=$!
+    sleep 1
+    $OPENSSL s_client -connect 127.0.0.1:$PORT -tls1_2 -brief $client_args < /dev/null 2>&1
+    kill $server 2> /dev/null
+    wait $server 2> /dev/null
+}
+
+$OPENSSL verify -CAfile certs/ca.pem certs/broker.crt certs/client.crt > /dev/null
+check "chain" $?
+
+$OPENSSL x509 -in certs/broker.crt -noout -text | grep -q "IP Address:$BROKER_IP"
+check "broker address" $?
+
+# The firmware takes CONFIG_MESH_MQTT_TLS_PSK_KEY as 16 to 32 bytes in hex
+echo "$PSK_KEY" | grep -Eq '^([0-9a-fA-F]{2}){16,32}$'
+check "psk key" $?
+
+handshake "-CAfile certs/ca.pem -verify_return_error -verify_ip $BROKER_IP -cert certs/client.crt -key certs/client.key" \
+    -cert certs/broker.crt -key certs/broker.key -CAfile certs/ca.pem -Verify 1 | grep -q "Verification: OK"
+check "certificate handshake" $?
+
+handshake "-psk_identity $PSK_ID -psk $PSK_KEY" \
+    -nocert -psk_hint $PSK_ID -psk $PSK_KEY -cipher "$PSK_CIPHERS" | grep -q "Ciphersuite: PSK-"
+check "psk handshake" $?
+
+# A root built with another key must not get through
+handshake "-psk_identity $PSK_ID -psk 00$PSK_KEY" \
+    -nocert -psk_hint $PSK_ID -psk $PSK_KEY -cipher "$PSK_CIPHERS" | grep -q "Ciphersuite: PSK-"
+[ $? != 0 ]
+check "psk mismatch" $?
+
+echo "$FAILED checks failed"
+exit $FAILED
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Time full handshakes against both TLS listeners of the running broker, the
+# way the root connects: a new session every time, esp-mqtt never resumes
+# one. s_time has no PSK options, so both listeners are timed the same way,
+# one s_client per handshake with its process start included. Run by
+# `make time`.
+
+OPENSSL=${OPENSSL:-openssl}
+BROKER_IP=${BROKER_IP:-127.0.0.1}
+PSK_ID=${PSK_ID:-mesh}
+CERT_PORT=${CERT_PORT:-8883}
+PSK_PORT=${PSK_PORT:-8884}
+COUNT=${COUNT:-50}
+
+PSK_KEY=`cut -d: -f2 certs/psk.txt`
+FAILED=0
+
+# Run s_client COUNT times with the arguments after $1 and print the mean
+# time of one connection
+handshakes()
+{
+    name=$1
+    shift
+    start=`date +%s%N`
+    i=0
+
+    while [ $i -lt $COUNT ]; do
+        if ! $OPENSSL s_client -tls1_2 "$@" < /dev/null > /dev/null 2>&1; then
+            echo "$name: handshake failed"
+            FAILED=$((FAILED + 1))
+            return
+        fi
+
+        i=$((i + 1))
+    done
+
+    end=`date +%s%N`
+    echo "$name: $(( (end - start) / COUNT / 1000 )) us per full handshake, mean of $COUNT"
+}
+
+# As CONFIG_MESH_MQTT_TLS_CERT, the root checks the broker against the CA
+handshakes "certificate $CERT_PORT" -connect $BROKER_IP:$CERT_PORT -CAfile certs/ca.pem -verify_return_error
+
+handshakes "psk $PSK_PORT" -connect $BROKER_IP:$PSK_PORT -psk_identity $PSK_ID -psk $PSK_KEY
+
+exit $FAILED
@@ -0,0 +1,491 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/**
+ * Failover simulator for components/root_standby.
+ *
+ *   root_standby_sim [-n NODES] [-p REPORT_S] [-e ELECTION_MS] [-l SYNC_LATENCY_MS]
+ *                    [-r COMMANDS_PER_MIN] [-d DELIVERY_MS] [-k RUNS] [-s SEED] [-x]
+ *   root_standby_sim -t
+ *
+ * The component is built as is, in virtual time. One root hears NODES nodes,
+ * each reporting every REPORT_S seconds, and handles downlink commands one
+ * after the other, each taking DELIVERY_MS until the cloud has its result,
+ * delivered or unreachable. Snapshots reach the standby roots
+ * SYNC_LATENCY_MS after they are sent. The root fails at a random time
+ * and a standby takes over ELECTION_MS later. -x starts the new root cold, without the snapshot.
+ *
+ * Resume time: from the failure until the new root knows every node the old
+ * one knew. Commands: in flight at the failure and replayed by the new root,
+ * lost, or replayed although the cloud already had their result.
+ *
+ * -t checks the snapshot round trip of the commands instead, the exit status
+ * is the number of failed checks.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**< The firmware is built with the warning set of ESP-IDF, which leaves out these two */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#include "root_standby.c"
+#pragma GCC diagnostic pop
+
+#define SIM_STEP_MS        (10)
+#define SIM_NODE_MAX_NUM   (CONFIG_ROOT_STANDBY_NODE_MAX_NUM)
+#define SIM_RUN_MAX_NUM    (10000)
+
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint8_t layer;
+    uint32_t next_report; /**< ms */
+} sim_node_t;
+
+static struct sim {
+    uint32_t now;               /**< Virtual time, ms */
+    int dummy;
+    bool notified;              /**< root_standby_notify() woke the sync task */
+    uint8_t snapshot[MWIFI_PAYLOAD_LEN];
+    size_t snapshot_size;
+    uint32_t snapshot_time;     /**< Reception by the standby roots */
+    uint8_t pending[MWIFI_PAYLOAD_LEN];
+    size_t pending_size;
+    uint32_t pending_time;      /**< Snapshot on the air, received at this time */
+} g_sim;
+
+static sim_node_t g_nodes[SIM_NODE_MAX_NUM];
+static int g_node_num = 24;
+static uint32_t g_seed = 1;
+
+static uint32_t sim_random()
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+
+static double sim_uniform()
+{
+    return (sim_random() % 1000000) / 1000000.0;
+}
+
+/**< Only what root_standby.c calls, the sync task itself is driven by sim_sync() */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return &g_sim.dummy;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait_ticks)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pdTRUE;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return g_sim.now;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_size, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    *handle = &g_sim.dummy;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    g_sim.notified = true;
+    return pdPASS;
+}
+
+bool mwifi_is_connected(void)
+{
+    return true;
+}
+
+mdf_err_t mwifi_root_write(const uint8_t *addrs_list, size_t addrs_num, const mwifi_data_type_t *data_type,
+                           const void *data, size_t size, bool block)
+{
+    return MDF_OK;
+}
+
+/**< The simulated mesh has no groups */
+size_t mesh_group_export(uint8_t *buffer, size_t size)
+{
+    return 0;
+}
+
+mdf_err_t mesh_group_import(const uint8_t *data, size_t size)
+{
+    return MDF_OK;
+}
+#pragma GCC diagnostic pop
+
+/**
+ * @brief Fresh device: empty tables, as after the boot of a standby root
+ */
+static void sim_device_reset()
+{
+    root_standby_commands_clear();
+    memset(&g_root_standby, 0, sizeof(g_root_standby));
+    root_standby_init();
+}
+
+/**
+ * @brief One pass of root_standby_sync_task(), the snapshot is on the air until pending_time
+ */
+static void sim_sync(uint32_t latency_ms)
+{
+    uint8_t candidates[CONFIG_ROOT_STANDBY_CANDIDATE_NUM][MWIFI_ADDR_LEN];
+    size_t candidate_num = 0;
+
+    g_sim.pending_size = root_standby_serialize(g_sim.pending, sizeof(g_sim.pending), candidates, &candidate_num);
+    g_sim.pending_time = g_sim.now + latency_ms;
+
+    if (candidate_num == 0) {
+        g_sim.pending_size = 0;
+    }
+}
+
+static void sim_receive()
+{
+    if (g_sim.pending_size && g_sim.now >= g_sim.pending_time) {
+        memcpy(g_sim.snapshot, g_sim.pending, g_sim.pending_size);
+        g_sim.snapshot_size = g_sim.pending_size;
+        g_sim.snapshot_time = g_sim.pending_time;
+        g_sim.pending_size = 0;
+    }
+}
+
+static void sim_report(sim_node_t *node, uint32_t period_ms)
+{
+    char heartbeat[32];
+    int size = snprintf(heartbeat, sizeof(heartbeat), "{\"layer\":%d}", node->layer);
+
+    root_standby_node_seen(node->addr, heartbeat, size);
+    node->next_report += period_ms;
+}
+
+static int sim_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+#define SIM_CHECK(con) do { \
+        if (!(con)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #con); \
+            failures++; \
+        } \
+    } while (0)
+
+/**
+ * @brief A command for more destinations than a byte counts, as a group of
+ *        CONFIG_MESH_GROUP_NODE_MAX_NUM nodes expands to, is handed over intact
+ */
+static int sim_test()
+{
+    static uint8_t addrs[300][MWIFI_ADDR_LEN];
+    static uint8_t snapshot[4096];
+    uint8_t candidates[CONFIG_ROOT_STANDBY_CANDIDATE_NUM][MWIFI_ADDR_LEN];
+    size_t candidate_num = 0;
+    char command[] = "{\"relay\":1}";
+    uint32_t handle = 0;
+    int failures = 0;
+
+    for (int i = 0; i < 300; ++i) {
+        addrs[i][0] = 0x30;
+        addrs[i][4] = i >> 8;
+        addrs[i][5] = i;
+    }
+
+    mesh_mqtt_data_t request = {
+        .addrs_num = 300,
+        .addrs_list = addrs[0],
+        .data = command,
+        .size = strlen(command),
+        .id = 7,
+        .type = MESH_MQTT_DATA_JSON,
+    };
+
+    sim_device_reset();
+    SIM_CHECK(root_standby_command_push(&request, &handle) == MDF_OK && handle);
+
+    /**< Too large for a mesh payload, the command is left out rather than cut */
+    size_t size = root_standby_serialize(snapshot, MWIFI_PAYLOAD_LEN, candidates, &candidate_num);
+    SIM_CHECK(size == sizeof(root_standby_state_header_t) && snapshot[3] == 0);
+
+    size = root_standby_serialize(snapshot, sizeof(snapshot), candidates, &candidate_num);
+    SIM_CHECK(size == sizeof(root_standby_state_header_t) + ROOT_STANDBY_COMMAND_HEADER_LEN
+              + sizeof(addrs) + strlen(command));
+
+    sim_device_reset();
+    SIM_CHECK(root_standby_handle_state(snapshot, size) == MDF_OK);
+    SIM_CHECK(root_standby_handle_state(snapshot, size - 1) == MDF_ERR_INVALID_ARG);
+
+    mesh_mqtt_data_t *item = NULL;
+    SIM_CHECK(root_standby_command_pop(&item) == MDF_OK);
+
+    if (item != NULL) {
+        SIM_CHECK(item->addrs_num == 300 && !memcmp(item->addrs_list, addrs, sizeof(addrs)));
+        SIM_CHECK(item->size == strlen(command) && !memcmp(item->data, command, item->size));
+        SIM_CHECK(item->id == 7 && item->type == MESH_MQTT_DATA_JSON);
+        MDF_FREE(item->addrs_list);
+        MDF_FREE(item->data);
+        MDF_FREE(item);
+    }
+
+    SIM_CHECK(root_standby_command_pop(&item) != MDF_OK);
+
+    /**< More than the wire format counts is refused when it is recorded */
+    request.addrs_num = UINT16_MAX + 1;
+    SIM_CHECK(root_standby_command_push(&request, &handle) == MDF_ERR_INVALID_ARG && handle == 0);
+
+    printf("%d checks failed\n", failures);
+    return failures;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n NODES] [-p REPORT_S] [-e ELECTION_MS] [-l SYNC_LATENCY_MS] "
+            "[-r COMMANDS_PER_MIN] [-d DELIVERY_MS] [-k RUNS] [-s SEED] [-x] [-t]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t report_ms = 60 * 1000;
+    uint32_t election_ms = 2000;
+    uint32_t latency_ms = 50;
+    double command_rate = 30;
+    uint32_t delivery_ms = 500;
+    int runs = 50;
+    bool standby = true;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "n:p:e:l:r:d:k:s:xt")) != -1) {
+        switch (opt) {
+            case 'n':
+                g_node_num = atoi(optarg);
+                break;
+
+            case 'p':
+                report_ms = atoi(optarg) * 1000;
+                break;
+
+            case 'e':
+                election_ms = atoi(optarg);
+                break;
+
+            case 'l':
+                latency_ms = atoi(optarg);
+                break;
+
+            case 'r':
+                command_rate = atof(optarg);
+                break;
+
+            case 'd':
+                delivery_ms = atoi(optarg);
+                break;
+
+            case 'k':
+                runs = atoi(optarg);
+                break;
+
+            case 's':
+                g_seed = (uint32_t)strtoul(optarg, NULL, 0) * 2 + 1;
+                break;
+
+            case 'x':
+                standby = false;
+                break;
+
+            case 't':
+                return sim_test();
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (g_node_num <= 0 || g_node_num > SIM_NODE_MAX_NUM || report_ms == 0 || delivery_ms == 0
+            || command_rate < 0 || runs <= 0 || runs > SIM_RUN_MAX_NUM) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static uint32_t resume_ms[SIM_RUN_MAX_NUM];
+    int in_flight = 0;
+    int replayed = 0;
+    int lost = 0;
+    int duplicates = 0;
+
+    for (int run = 0; run < runs; ++run) {
+        uint32_t fail_time = 2 * report_ms + sim_random() % (5 * 60 * 1000);
+        uint32_t next_sync = 0;
+        uint32_t next_command = 0;
+        uint32_t command_id = 0;
+        uint32_t busy_until = 0;  /**< End of the delivery in progress, 0 if idle */
+        uint32_t handle = 0;
+        char command[] = "{\"relay\":1}";
+
+        memset(&g_sim, 0, sizeof(g_sim));
+        sim_device_reset();
+        root_standby_start();
+
+        /**< A third of the nodes are below the root and candidates for the next election */
+        for (int i = 0; i < g_node_num; ++i) {
+            memset(g_nodes[i].addr, 0, MWIFI_ADDR_LEN);
+            g_nodes[i].addr[0] = 0x30;
+            g_nodes[i].addr[4] = i >> 8;
+            g_nodes[i].addr[5] = i;
+            g_nodes[i].layer = i % 3 == 0 ? ROOT_STANDBY_CANDIDATE_LAYER : 3 + sim_random() % 2;
+            g_nodes[i].next_report = sim_random() % report_ms;
+        }
+
+        /**< The old root, until it fails */
+        for (g_sim.now = 0; g_sim.now < fail_time; g_sim.now += SIM_STEP_MS) {
+            for (int i = 0; i < g_node_num; ++i) {
+                if (g_sim.now >= g_nodes[i].next_report) {
+                    sim_report(g_nodes + i, report_ms);
+                }
+            }
+
+            if (busy_until && g_sim.now >= busy_until) {
+                /**< Delivered or reported unreachable, the cloud has its result either way */
+                root_standby_command_done(handle);
+                busy_until = 0;
+            }
+
+            if (command_rate > 0 && g_sim.now >= next_command && !busy_until) {
+                mesh_mqtt_data_t request = {
+                    .addrs_num = 1,
+                    .addrs_list = g_nodes[sim_random() % g_node_num].addr,
+                    .data = command,
+                    .size = strlen(command),
+                    .id = ++command_id,
+                    .type = MESH_MQTT_DATA_JSON,
+                };
+
+                root_standby_command_push(&request, &handle);
+                busy_until = g_sim.now + delivery_ms;
+                next_command = g_sim.now + (uint32_t)(-log(1 - sim_uniform()) * 60000 / command_rate);
+            }
+
+            if (g_sim.notified || g_sim.now >= next_sync) {
+                g_sim.notified = false;
+                sim_sync(latency_ms);
+                next_sync = g_sim.now + CONFIG_ROOT_STANDBY_SYNC_INTERVAL * 1000;
+            }
+
+            sim_receive();
+        }
+
+        size_t known_num = root_standby_get_node_num();
+        uint32_t lost_id = busy_until ? command_id : 0;
+        in_flight += lost_id != 0;
+
+        /**< The snapshot on the air when the root failed still arrives */
+        for (; g_sim.now < fail_time + election_ms; g_sim.now += SIM_STEP_MS) {
+            sim_receive();
+        }
+
+        /**< The standby that wins the election, it booted long ago and only kept the snapshot */
+        sim_device_reset();
+
+        if (standby && g_sim.snapshot_size) {
+            uint32_t takeover = g_sim.now;
+            g_sim.now = g_sim.snapshot_time;
+            root_standby_handle_state(g_sim.snapshot, g_sim.snapshot_size);
+            g_sim.now = takeover;
+        }
+
+        root_standby_start();
+
+        /**< One command at a time, the cloud has the result of every other one */
+        mesh_mqtt_data_t *request = NULL;
+
+        while (root_standby_command_pop(&request) == MDF_OK) {
+            if (request->id == lost_id) {
+                replayed++;
+                lost_id = 0;
+            } else {
+                duplicates++;
+            }
+
+            MDF_FREE(request->addrs_list);
+            MDF_FREE(request->data);
+            MDF_FREE(request);
+        }
+
+        lost += lost_id != 0;
+
+        /**< The new root, until it knows every node again */
+        uint32_t deadline = g_sim.now + 2 * report_ms;
+
+        for (; g_sim.now < deadline && root_standby_get_node_num() < known_num; g_sim.now += SIM_STEP_MS) {
+            for (int i = 0; i < g_node_num; ++i) {
+                if (g_sim.now >= g_nodes[i].next_report) {
+                    sim_report(g_nodes + i, report_ms);
+                }
+            }
+        }
+
+        resume_ms[run] = g_sim.now - fail_time;
+        root_standby_stop();
+    }
+
+    qsort(resume_ms, runs, sizeof(resume_ms[0]), sim_compare);
+
+    double sum = 0;
+
+    for (int i = 0; i < runs; ++i) {
+        sum += resume_ms[i];
+    }
+
+    printf("%s, %d nodes, report %u s, election %u ms, sync every %d s, %d runs\n",
+           standby ? "standby" : "cold", g_node_num, report_ms / 1000, election_ms,
+           CONFIG_ROOT_STANDBY_SYNC_INTERVAL, runs);
+    printf("resume ms       mean %8.0f  p50 %8u  p95 %8u  max %8u\n", sum / runs,
+           resume_ms[runs / 2], resume_ms[runs * 95 / 100], resume_ms[runs - 1]);
+    printf("commands        in flight %d  replayed %d  lost %d  duplicates %d\n",
+           in_flight, replayed, lost, duplicates);
+
+    return 0;
+}